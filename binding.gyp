@@ -92,8 +92,36 @@
         'src/api/steam_api_stats.cc',
         'src/api/steam_api_workshop.cc',
         'src/greenworks_api.cc',
+        'src/greenworks_archive_index.cc',
+        'src/greenworks_archive_index.h',
+        'src/greenworks_archive_io.cc',
+        'src/greenworks_archive_io.h',
+        'src/greenworks_archive_job.cc',
+        'src/greenworks_archive_job.h',
         'src/greenworks_async_workers.cc',
         'src/greenworks_async_workers.h',
+        'src/greenworks_cloud_cache.cc',
+        'src/greenworks_cloud_cache.h',
+        'src/greenworks_cloud_compression.cc',
+        'src/greenworks_cloud_compression.h',
+        'src/greenworks_cloud_quota.cc',
+        'src/greenworks_cloud_quota.h',
+        'src/greenworks_cloud_requests.cc',
+        'src/greenworks_cloud_requests.h',
+        'src/greenworks_cloud_sync.cc',
+        'src/greenworks_cloud_sync.h',
+        'src/greenworks_crc32.cc',
+        'src/greenworks_crc32.h',
+        'src/greenworks_directory_hash.cc',
+        'src/greenworks_directory_hash.h',
+        'src/greenworks_directory_walker.cc',
+        'src/greenworks_directory_walker.h',
+        'src/greenworks_file_copy.cc',
+        'src/greenworks_file_copy.h',
+        'src/greenworks_hash.cc',
+        'src/greenworks_hash.h',
+        'src/greenworks_patch.cc',
+        'src/greenworks_patch.h',
         'src/greenworks_unzip.cc',
         'src/greenworks_unzip.h',
         'src/greenworks_utils.cc',
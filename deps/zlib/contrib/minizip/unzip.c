@@ -186,6 +186,8 @@ typedef struct
 
     int isZip64;
 
+    unz_crc32_func crc32_func; /* computes the crc32 of the data read */
+
 #    ifndef NOUNCRYPT
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
     const unsigned long* pcrc_32_tab;
@@ -610,6 +612,7 @@ local unzFile unzOpenInternal (const void *path,
     else
         us.z_filefunc = *pzlib_filefunc64_32_def;
     us.is64bitOpenFunction = is64bitOpenFunction;
+    us.crc32_func = crc32;
 
 
 
@@ -1040,19 +1043,21 @@ local int unz64local_GetCurrentFileInfoInternal (unzFile file,
             {
                                                         uLong uL;
 
-                                                                if(file_info.uncompressed_size == (ZPOS64_T)(unsigned long)-1)
+                                                                /* Greenworks: compared with 0xffffffff, which
+                                                                   (unsigned long)-1 isn't where long is 64-bit */
+                                                                if(file_info.uncompressed_size == (ZPOS64_T)0xffffffff)
                                                                 {
                                                                         if (unz64local_getLong64(&s->z_filefunc, s->filestream,&file_info.uncompressed_size) != UNZ_OK)
                                                                                         err=UNZ_ERRNO;
                                                                 }
 
-                                                                if(file_info.compressed_size == (ZPOS64_T)(unsigned long)-1)
+                                                                if(file_info.compressed_size == (ZPOS64_T)0xffffffff)
                                                                 {
                                                                         if (unz64local_getLong64(&s->z_filefunc, s->filestream,&file_info.compressed_size) != UNZ_OK)
                                                                                   err=UNZ_ERRNO;
                                                                 }
 
-                                                                if(file_info_internal.offset_curfile == (ZPOS64_T)(unsigned long)-1)
+                                                                if(file_info_internal.offset_curfile == (ZPOS64_T)0xffffffff)
                                                                 {
                                                                         /* Relative Header offset */
                                                                         if (unz64local_getLong64(&s->z_filefunc, s->filestream,&file_info_internal.offset_curfile) != UNZ_OK)
@@ -1241,18 +1246,26 @@ extern int ZEXPORT unzLocateFile (unzFile file, const char *szFileName, int iCas
     unz_file_info64_internal cur_file_info_internalSaved;
     ZPOS64_T num_fileSaved;
     ZPOS64_T pos_in_central_dirSaved;
+    size_t name_length;
+    char* szCurrentFileName;
 
 
     if (file==NULL)
         return UNZ_PARAMERROR;
 
-    if (strlen(szFileName)>=UNZ_MAXFILENAMEINZIP)
+    /* Greenworks: names of any length, up to the 64K of the zip format */
+    name_length = strlen(szFileName);
+    if (name_length>0xffff)
         return UNZ_PARAMERROR;
 
     s=(unz64_s*)file;
     if (!s->current_file_ok)
         return UNZ_END_OF_LIST_OF_FILE;
 
+    szCurrentFileName = (char*)ALLOC(name_length+1);
+    if (szCurrentFileName==NULL)
+        return UNZ_INTERNALERROR;
+
     /* Save the current state */
     num_fileSaved = s->num_file;
     pos_in_central_dirSaved = s->pos_in_central_dir;
@@ -1263,18 +1276,25 @@ extern int ZEXPORT unzLocateFile (unzFile file, const char *szFileName, int iCas
 
     while (err == UNZ_OK)
     {
-        char szCurrentFileName[UNZ_MAXFILENAMEINZIP+1];
-        err = unzGetCurrentFileInfo64(file,NULL,
-                                    szCurrentFileName,sizeof(szCurrentFileName)-1,
-                                    NULL,0,NULL,0);
-        if (err == UNZ_OK)
+        /* only a name of the same length can match, and it's then read
+           whole, terminated */
+        if (s->cur_file_info.size_filename == name_length)
         {
-            if (unzStringFileNameCompare(szCurrentFileName,
+            err = unzGetCurrentFileInfo64(file,NULL,
+                                        szCurrentFileName,(uLong)name_length+1,
+                                        NULL,0,NULL,0);
+            if (err == UNZ_OK &&
+                unzStringFileNameCompare(szCurrentFileName,
                                             szFileName,iCaseSensitivity)==0)
+            {
+                TRYFREE(szCurrentFileName);
                 return UNZ_OK;
-            err = unzGoToNextFile(file);
+            }
         }
+        if (err == UNZ_OK)
+            err = unzGoToNextFile(file);
     }
+    TRYFREE(szCurrentFileName);
 
     /* We failed, so restore the state of the 'current file' to where we
      * were.
@@ -1671,6 +1691,20 @@ extern ZPOS64_T ZEXPORT unzGetCurrentFileZStreamPos64( unzFile file)
 
 /** Addition for GDAL : END */
 
+/** Addition for greenworks : START */
+
+extern int ZEXPORT unzSetCrc32Function (unzFile file, unz_crc32_func crc32_func)
+{
+    unz64_s* s;
+    if (file==NULL || crc32_func==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    s->crc32_func = crc32_func;
+    return UNZ_OK;
+}
+
+/** Addition for greenworks : END */
+
 /*
   Read bytes from the current file.
   buf contain buffer where data must be copied
@@ -1781,7 +1815,10 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uDoCopy;
 
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
+            /* the crc32 of raw data is never checked */
+            if (!pfile_in_zip_read_info->raw)
+                pfile_in_zip_read_info->crc32 = s->crc32_func(
+                                pfile_in_zip_read_info->crc32,
                                 pfile_in_zip_read_info->stream.next_out,
                                 uDoCopy);
             pfile_in_zip_read_info->rest_read_uncompressed-=uDoCopy;
@@ -1818,7 +1855,7 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uOutThis;
 
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,bufBefore, (uInt)(uOutThis));
+            pfile_in_zip_read_info->crc32 = s->crc32_func(pfile_in_zip_read_info->crc32,bufBefore, (uInt)(uOutThis));
             pfile_in_zip_read_info->rest_read_uncompressed -= uOutThis;
             iRead += (uInt)(uTotalOutAfter - uTotalOutBefore);
 
@@ -1862,7 +1899,7 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uOutThis;
 
             pfile_in_zip_read_info->crc32 =
-                crc32(pfile_in_zip_read_info->crc32,bufBefore,
+                s->crc32_func(pfile_in_zip_read_info->crc32,bufBefore,
                         (uInt)(uOutThis));
 
             pfile_in_zip_read_info->rest_read_uncompressed -=
@@ -322,6 +322,17 @@ extern ZPOS64_T ZEXPORT unzGetCurrentFileZStreamPos64 OF((unzFile file));
 
 /** Addition for GDAL : END */
 
+/** Addition for greenworks : START */
+
+/* Replace the function unzReadCurrentFile computes the CRC of the data
+   read with (crc32 by default), e.g. with a hardware accelerated one.
+   Applies to the files opened afterwards through this handle. */
+typedef uLong (*unz_crc32_func) OF((uLong crc, const Bytef* buf, uInt len));
+extern int ZEXPORT unzSetCrc32Function OF((unzFile file,
+                                           unz_crc32_func crc32_func));
+
+/** Addition for greenworks : END */
+
 
 /***************************************************************************/
 /* for reading the content of the current zipfile, you can open it, read data
@@ -87,6 +87,15 @@ greenworks.ugcPublishUpdate = function(published_file_id, file_name, title,
 greenworks.Utils.move = function(source_dir, target_dir, success_callback,
     error_callback) {
   fs.rename(source_dir, target_dir, function(err) {
+    // A move to another drive needs a copy, done natively.
+    if (err && err.code == 'EXDEV') {
+      greenworks.Utils.moveDirectory(source_dir, target_dir, function() {
+        if (success_callback) success_callback();
+      }, function(err) {
+        if (error_callback) error_callback(err);
+      });
+      return;
+    }
     if (err) {
       if (error_callback) error_callback(err);
       return;
@@ -3,49 +3,482 @@
 // found in the LICENSE file.
 
 #include <string>
+#include <vector>
 
 #include "nan.h"
 #include "v8.h"
 
 #include "greenworks_async_workers.h"
+#include "greenworks_crc32.h"
 #include "steam_api_registry.h"
 
 namespace greenworks {
 namespace api {
 namespace {
 
-NAN_METHOD(CreateArchive) {
-  Nan::HandleScope scope;
-  if (info.Length() < 5 || !info[0]->IsString() || !info[1]->IsString() ||
-      !info[2]->IsString() || !info[3]->IsInt32() || !info[4]->IsFunction()) {
+// The default of the progressInterval option, in ms.
+const int kDefaultProgressInterval = 100;
+
+// Reads the progress and progressInterval options of the archive jobs;
+// returns false if they're invalid.
+bool ParseProgressOptions(v8::Local<v8::Object> options_object,
+                          v8::Local<v8::Function>* progress_function,
+                          int* progress_interval) {
+  v8::Local<v8::Value> progress =
+      options_object->Get(Nan::New("progress").ToLocalChecked());
+  if (progress->IsFunction())
+    *progress_function = progress.As<v8::Function>();
+  else if (!progress->IsUndefined())
+    return false;
+  v8::Local<v8::Value> interval =
+      options_object->Get(Nan::New("progressInterval").ToLocalChecked());
+  if (interval->IsInt32() && interval->Int32Value() >= 0)
+    *progress_interval = interval->Int32Value();
+  else if (!interval->IsUndefined())
+    return false;
+  return true;
+}
+
+// Reads the threads option of the parallel jobs; returns false if it's
+// invalid.
+bool ParseThreadsOption(v8::Local<v8::Object> options_object, int* threads) {
+  v8::Local<v8::Value> value =
+      options_object->Get(Nan::New("threads").ToLocalChecked());
+  if (value->IsInt32())
+    *threads = value->Int32Value();
+  else if (!value->IsUndefined())
+    return false;
+  return true;
+}
+
+// Reads an optional boolean option, such as mmap; returns false if it isn't
+// a boolean.
+bool ParseBooleanOption(v8::Local<v8::Object> options_object,
+                        const char* name, bool* result) {
+  v8::Local<v8::Value> value =
+      options_object->Get(Nan::New(name).ToLocalChecked());
+  if (value->IsBoolean())
+    *result = value->BooleanValue();
+  else if (!value->IsUndefined())
+    return false;
+  return true;
+}
+
+// Shared by createArchive and updateArchive, which take the same arguments.
+void QueueCreateArchive(const Nan::FunctionCallbackInfo<v8::Value>& info,
+                        bool update) {
+  // The options object is optional.
+  int callback_index = 4;
+  if (info.Length() > 4 && info[4]->IsObject() && !info[4]->IsFunction())
+    callback_index = 5;
+  if (info.Length() <= callback_index || !info[0]->IsString() ||
+      !info[1]->IsString() || !info[2]->IsString() || !info[3]->IsInt32() ||
+      !info[callback_index]->IsFunction()) {
     THROW_BAD_ARGS("bad arguments");
   }
   std::string zip_file_path = *(v8::String::Utf8Value(info[0]));
   std::string source_dir = *(v8::String::Utf8Value(info[1]));
   std::string password = *(v8::String::Utf8Value(info[2]));
   int compress_level = info[3]->Int32Value();
+  greenworks::ZipOptions options;
+  options.update = update;
+  v8::Local<v8::Function> progress_function;
+  int progress_interval = kDefaultProgressInterval;
+  if (callback_index == 5) {
+    v8::Local<v8::Object> options_object = info[4].As<v8::Object>();
+    if (!ParseProgressOptions(options_object, &progress_function,
+                              &progress_interval) ||
+        !ParseThreadsOption(options_object, &options.threads) ||
+        !ParseBooleanOption(options_object, "mmap", &options.use_mmap) ||
+        !ParseBooleanOption(options_object, "adaptive", &options.adaptive) ||
+        !ParseBooleanOption(options_object, "deterministic",
+                            &options.deterministic))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::Callback* progress_callback = progress_function.IsEmpty() ?
+      NULL : new Nan::Callback(progress_function);
+
+  greenworks::CreateArchiveWorker* worker =
+      new greenworks::CreateArchiveWorker(
+          success_callback, error_callback, progress_callback,
+          progress_interval, zip_file_path, source_dir, password,
+          compress_level, options);
+  int job_id = worker->job_id();
+  Nan::AsyncQueueWorker(worker);
+  info.GetReturnValue().Set(job_id);
+}
+
+NAN_METHOD(CreateArchive) {
+  Nan::HandleScope scope;
+  QueueCreateArchive(info, false);
+}
+
+NAN_METHOD(UpdateArchive) {
+  Nan::HandleScope scope;
+  QueueCreateArchive(info, true);
+}
+
+NAN_METHOD(CreateArchiveFromBuffers) {
+  Nan::HandleScope scope;
+  // The options object is optional.
+  int callback_index = 3;
+  if (info.Length() > 3 && info[3]->IsObject() && !info[3]->IsFunction())
+    callback_index = 4;
+  if (info.Length() <= callback_index || !info[0]->IsArray() ||
+      !info[1]->IsString() || !info[2]->IsInt32() ||
+      !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  v8::Local<v8::Array> entries_array = info[0].As<v8::Array>();
+  std::vector<greenworks::ZipBufferEntry> entries;
+  std::vector<v8::Local<v8::Value> > buffers;
+  for (uint32_t i = 0; i < entries_array->Length(); ++i) {
+    v8::Local<v8::Value> entry = entries_array->Get(i);
+    if (!entry->IsObject())
+      THROW_BAD_ARGS("bad arguments");
+    v8::Local<v8::Value> name =
+        entry.As<v8::Object>()->Get(Nan::New("name").ToLocalChecked());
+    v8::Local<v8::Value> content =
+        entry.As<v8::Object>()->Get(Nan::New("content").ToLocalChecked());
+    if (!name->IsString() || !node::Buffer::HasInstance(content))
+      THROW_BAD_ARGS("bad arguments");
+    greenworks::ZipBufferEntry buffer_entry;
+    buffer_entry.name = *(v8::String::Utf8Value(name));
+    buffer_entry.data = node::Buffer::Data(content);
+    buffer_entry.size = node::Buffer::Length(content);
+    entries.push_back(buffer_entry);
+    buffers.push_back(content);
+  }
+  std::string password = *(v8::String::Utf8Value(info[1]));
+  int compress_level = info[2]->Int32Value();
+  greenworks::ZipOptions options;
+  std::string cloud_file;
+  if (callback_index == 4) {
+    v8::Local<v8::Object> options_object = info[3].As<v8::Object>();
+    if (!ParseThreadsOption(options_object, &options.threads) ||
+        !ParseBooleanOption(options_object, "adaptive", &options.adaptive) ||
+        !ParseBooleanOption(options_object, "deterministic",
+                            &options.deterministic))
+      THROW_BAD_ARGS("bad arguments");
+    v8::Local<v8::Value> cloud_file_value =
+        options_object->Get(Nan::New("cloudFile").ToLocalChecked());
+    if (cloud_file_value->IsString())
+      cloud_file = *(v8::String::Utf8Value(cloud_file_value));
+    else if (!cloud_file_value->IsUndefined())
+      THROW_BAD_ARGS("bad arguments");
+  }
 
   Nan::Callback* success_callback =
-      new Nan::Callback(info[4].As<v8::Function>());
+      new Nan::Callback(info[callback_index].As<v8::Function>());
   Nan::Callback* error_callback = NULL;
 
-  if (info.Length() > 5 && info[5]->IsFunction())
-    error_callback = new Nan::Callback(info[5].As<v8::Function>());
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
 
-  Nan::AsyncQueueWorker(new greenworks::CreateArchiveWorker(
-      success_callback, error_callback, zip_file_path, source_dir, password,
-      compress_level));
+  greenworks::CreateArchiveFromBuffersWorker* worker =
+      new greenworks::CreateArchiveFromBuffersWorker(
+          success_callback, error_callback, entries, password,
+          compress_level, options, cloud_file);
+  // Keep the Buffers alive while the worker reads them off the main thread.
+  for (size_t i = 0; i < buffers.size(); ++i)
+    worker->SaveToPersistent(static_cast<uint32_t>(i), buffers[i]);
+  Nan::AsyncQueueWorker(worker);
   info.GetReturnValue().Set(Nan::Undefined());
 }
 
 NAN_METHOD(ExtractArchive) {
+  Nan::HandleScope scope;
+  // The options object is optional.
+  int callback_index = 3;
+  if (info.Length() > 3 && info[3]->IsObject() && !info[3]->IsFunction())
+    callback_index = 4;
+  if (info.Length() <= callback_index || !info[0]->IsString() ||
+      !info[1]->IsString() || !info[2]->IsString() ||
+      !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  std::string zip_file_path = *(v8::String::Utf8Value(info[0]));
+  std::string extract_dir = *(v8::String::Utf8Value(info[1]));
+  std::string password = *(v8::String::Utf8Value(info[2]));
+  greenworks::UnzipOptions options;
+  v8::Local<v8::Function> progress_function;
+  int progress_interval = kDefaultProgressInterval;
+  if (callback_index == 4) {
+    v8::Local<v8::Object> options_object = info[3].As<v8::Object>();
+    if (!ParseProgressOptions(options_object, &progress_function,
+                              &progress_interval) ||
+        !ParseThreadsOption(options_object, &options.threads) ||
+        !ParseBooleanOption(options_object, "mmap", &options.use_mmap))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::Callback* progress_callback = progress_function.IsEmpty() ?
+      NULL : new Nan::Callback(progress_function);
+
+  greenworks::ExtractArchiveWorker* worker =
+      new greenworks::ExtractArchiveWorker(
+          success_callback, error_callback, progress_callback,
+          progress_interval, zip_file_path, extract_dir, password, options);
+  int job_id = worker->job_id();
+  Nan::AsyncQueueWorker(worker);
+  info.GetReturnValue().Set(job_id);
+}
+
+NAN_METHOD(VerifyArchive) {
+  Nan::HandleScope scope;
+  // The options object is optional.
+  int callback_index = 2;
+  if (info.Length() > 2 && info[2]->IsObject() && !info[2]->IsFunction())
+    callback_index = 3;
+  if (info.Length() <= callback_index || !info[0]->IsString() ||
+      !info[1]->IsString() || !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  std::string zip_file_path = *(v8::String::Utf8Value(info[0]));
+  std::string password = *(v8::String::Utf8Value(info[1]));
+  greenworks::UnzipOptions options;
+  v8::Local<v8::Function> progress_function;
+  int progress_interval = kDefaultProgressInterval;
+  if (callback_index == 3) {
+    v8::Local<v8::Object> options_object = info[2].As<v8::Object>();
+    if (!ParseProgressOptions(options_object, &progress_function,
+                              &progress_interval) ||
+        !ParseThreadsOption(options_object, &options.threads) ||
+        !ParseBooleanOption(options_object, "mmap", &options.use_mmap))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::Callback* progress_callback = progress_function.IsEmpty() ?
+      NULL : new Nan::Callback(progress_function);
+
+  greenworks::VerifyArchiveWorker* worker =
+      new greenworks::VerifyArchiveWorker(
+          success_callback, error_callback, progress_callback,
+          progress_interval, zip_file_path, password, options);
+  int job_id = worker->job_id();
+  Nan::AsyncQueueWorker(worker);
+  info.GetReturnValue().Set(job_id);
+}
+
+// Shared by extractArchiveFromBuffer and readArchiveFromBuffer, which only
+// differ by the extract_dir argument.
+void QueueExtractArchiveFromBuffer(
+    const Nan::FunctionCallbackInfo<v8::Value>& info, bool to_memory) {
+  int password_index = to_memory ? 1 : 2;
+  // The options object is optional.
+  int callback_index = password_index + 1;
+  if (info.Length() > callback_index && info[callback_index]->IsObject() &&
+      !info[callback_index]->IsFunction())
+    ++callback_index;
+  if (info.Length() <= callback_index ||
+      !node::Buffer::HasInstance(info[0]) ||
+      (!to_memory && !info[1]->IsString()) ||
+      !info[password_index]->IsString() ||
+      !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  std::string extract_dir;
+  if (!to_memory)
+    extract_dir = *(v8::String::Utf8Value(info[1]));
+  // An empty directory would mean extracting in memory.
+  if (!to_memory && extract_dir.empty())
+    THROW_BAD_ARGS("bad arguments");
+  std::string password = *(v8::String::Utf8Value(info[password_index]));
+  greenworks::UnzipOptions options;
+  v8::Local<v8::Function> progress_function;
+  int progress_interval = kDefaultProgressInterval;
+  if (callback_index == password_index + 2) {
+    v8::Local<v8::Object> options_object =
+        info[password_index + 1].As<v8::Object>();
+    if (!ParseProgressOptions(options_object, &progress_function,
+                              &progress_interval) ||
+        !ParseThreadsOption(options_object, &options.threads))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::Callback* progress_callback = progress_function.IsEmpty() ?
+      NULL : new Nan::Callback(progress_function);
+
+  greenworks::ExtractArchiveFromBufferWorker* worker =
+      new greenworks::ExtractArchiveFromBufferWorker(
+          success_callback, error_callback, progress_callback,
+          progress_interval, node::Buffer::Data(info[0]),
+          node::Buffer::Length(info[0]), extract_dir, password, options);
+  // Keep the Buffer alive while the worker reads it off the main thread.
+  worker->SaveToPersistent(0u, info[0]);
+  int job_id = worker->job_id();
+  Nan::AsyncQueueWorker(worker);
+  info.GetReturnValue().Set(job_id);
+}
+
+NAN_METHOD(ExtractArchiveFromBuffer) {
+  Nan::HandleScope scope;
+  QueueExtractArchiveFromBuffer(info, false);
+}
+
+NAN_METHOD(ReadArchiveFromBuffer) {
+  Nan::HandleScope scope;
+  QueueExtractArchiveFromBuffer(info, true);
+}
+
+// Shared by moveDirectory and copyDirectory, which take the same arguments.
+void QueueCopyDirectory(const Nan::FunctionCallbackInfo<v8::Value>& info,
+                        bool move) {
+  // The options object is optional.
+  int callback_index = 2;
+  if (info.Length() > 2 && info[2]->IsObject() && !info[2]->IsFunction())
+    callback_index = 3;
+  if (info.Length() <= callback_index || !info[0]->IsString() ||
+      !info[1]->IsString() || !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  std::string source_path = *(v8::String::Utf8Value(info[0]));
+  std::string target_path = *(v8::String::Utf8Value(info[1]));
+  if (source_path.empty() || target_path.empty())
+    THROW_BAD_ARGS("bad arguments");
+  greenworks::CopyOptions options;
+  v8::Local<v8::Function> progress_function;
+  int progress_interval = kDefaultProgressInterval;
+  if (callback_index == 3) {
+    v8::Local<v8::Object> options_object = info[2].As<v8::Object>();
+    if (!ParseProgressOptions(options_object, &progress_function,
+                              &progress_interval) ||
+        !ParseThreadsOption(options_object, &options.threads))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::Callback* progress_callback = progress_function.IsEmpty() ?
+      NULL : new Nan::Callback(progress_function);
+
+  greenworks::CopyDirectoryWorker* worker =
+      new greenworks::CopyDirectoryWorker(
+          success_callback, error_callback, progress_callback,
+          progress_interval, source_path, target_path, move, options);
+  int job_id = worker->job_id();
+  Nan::AsyncQueueWorker(worker);
+  info.GetReturnValue().Set(job_id);
+}
+
+NAN_METHOD(MoveDirectory) {
+  Nan::HandleScope scope;
+  QueueCopyDirectory(info, true);
+}
+
+NAN_METHOD(CopyDirectory) {
+  Nan::HandleScope scope;
+  QueueCopyDirectory(info, false);
+}
+
+NAN_METHOD(CancelArchive) {
+  Nan::HandleScope scope;
+  if (info.Length() < 1 || !info[0]->IsInt32()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  info.GetReturnValue().Set(
+      greenworks::CancelArchiveJob(info[0]->Int32Value()));
+}
+
+NAN_METHOD(ExtractEntries) {
+  Nan::HandleScope scope;
+  // The options object is optional.
+  int callback_index = 4;
+  if (info.Length() > 4 && info[4]->IsObject() && !info[4]->IsFunction())
+    callback_index = 5;
+  if (info.Length() <= callback_index || !info[0]->IsString() ||
+      !info[1]->IsArray() || !info[2]->IsString() || !info[3]->IsString() ||
+      !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  std::string zip_file_path = *(v8::String::Utf8Value(info[0]));
+  v8::Local<v8::Array> patterns_array = info[1].As<v8::Array>();
+  std::vector<std::string> patterns;
+  for (uint32_t i = 0; i < patterns_array->Length(); ++i) {
+    v8::Local<v8::Value> pattern = patterns_array->Get(i);
+    if (!pattern->IsString())
+      THROW_BAD_ARGS("bad arguments");
+    patterns.push_back(*(v8::String::Utf8Value(pattern)));
+  }
+  std::string extract_dir = *(v8::String::Utf8Value(info[2]));
+  std::string password = *(v8::String::Utf8Value(info[3]));
+  greenworks::UnzipOptions options;
+  if (callback_index == 5) {
+    v8::Local<v8::Object> options_object = info[4].As<v8::Object>();
+    if (!ParseThreadsOption(options_object, &options.threads) ||
+        !ParseBooleanOption(options_object, "mmap", &options.use_mmap))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::AsyncQueueWorker(new greenworks::ExtractEntriesWorker(
+      success_callback, error_callback, zip_file_path, patterns, extract_dir,
+      password, options));
+  info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(ReadArchiveEntry) {
   Nan::HandleScope scope;
   if (info.Length() < 4 || !info[0]->IsString() || !info[1]->IsString() ||
       !info[2]->IsString() || !info[3]->IsFunction()) {
     THROW_BAD_ARGS("bad arguments");
   }
   std::string zip_file_path = *(v8::String::Utf8Value(info[0]));
-  std::string extract_dir = *(v8::String::Utf8Value(info[1]));
+  std::string entry_name = *(v8::String::Utf8Value(info[1]));
   std::string password = *(v8::String::Utf8Value(info[2]));
 
   Nan::Callback* success_callback =
@@ -55,16 +488,325 @@ NAN_METHOD(ExtractArchive) {
   if (info.Length() > 4 && info[4]->IsFunction())
     error_callback = new Nan::Callback(info[4].As<v8::Function>());
 
-  Nan::AsyncQueueWorker(new greenworks::ExtractArchiveWorker(
-      success_callback, error_callback, zip_file_path, extract_dir, password));
+  Nan::AsyncQueueWorker(new greenworks::ReadArchiveEntryWorker(
+      success_callback, error_callback, zip_file_path, entry_name, password));
+  info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(ListArchive) {
+  Nan::HandleScope scope;
+  // The options object is optional.
+  int callback_index = 1;
+  if (info.Length() > 1 && info[1]->IsObject() && !info[1]->IsFunction())
+    callback_index = 2;
+  if (info.Length() <= callback_index || !info[0]->IsString() ||
+      !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  std::string zip_file_path = *(v8::String::Utf8Value(info[0]));
+  std::string index_path;
+  bool use_mmap = true;
+  if (callback_index == 2) {
+    v8::Local<v8::Object> options_object = info[1].As<v8::Object>();
+    v8::Local<v8::Value> index =
+        options_object->Get(Nan::New("index").ToLocalChecked());
+    if (index->IsString())
+      index_path = *(v8::String::Utf8Value(index));
+    else if (!index->IsUndefined())
+      THROW_BAD_ARGS("bad arguments");
+    if (!ParseBooleanOption(options_object, "mmap", &use_mmap))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::AsyncQueueWorker(new greenworks::ListArchiveWorker(
+      success_callback, error_callback, zip_file_path, index_path, use_mmap));
   info.GetReturnValue().Set(Nan::Undefined());
 }
 
+NAN_METHOD(HashDirectory) {
+  Nan::HandleScope scope;
+  // The options object is optional.
+  int callback_index = 1;
+  if (info.Length() > 1 && info[1]->IsObject() && !info[1]->IsFunction())
+    callback_index = 2;
+  if (info.Length() <= callback_index || !info[0]->IsString() ||
+      !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  std::string dir = *(v8::String::Utf8Value(info[0]));
+  greenworks::HashDirectoryOptions options;
+  v8::Local<v8::Function> progress_function;
+  int progress_interval = kDefaultProgressInterval;
+  if (callback_index == 2) {
+    v8::Local<v8::Object> options_object = info[1].As<v8::Object>();
+    if (!ParseProgressOptions(options_object, &progress_function,
+                              &progress_interval))
+      THROW_BAD_ARGS("bad arguments");
+    v8::Local<v8::Value> algorithm =
+        options_object->Get(Nan::New("algorithm").ToLocalChecked());
+    if (!algorithm->IsUndefined() && (!algorithm->IsString() ||
+        !greenworks::ParseHashAlgorithm(
+            *(v8::String::Utf8Value(algorithm)), &options.algorithm)))
+      THROW_BAD_ARGS("bad arguments");
+    if (!ParseThreadsOption(options_object, &options.threads) ||
+        !ParseBooleanOption(options_object, "mmap", &options.use_mmap))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::Callback* progress_callback = progress_function.IsEmpty() ?
+      NULL : new Nan::Callback(progress_function);
+
+  greenworks::HashDirectoryWorker* worker =
+      new greenworks::HashDirectoryWorker(
+          success_callback, error_callback, progress_callback,
+          progress_interval, dir, options);
+  int job_id = worker->job_id();
+  Nan::AsyncQueueWorker(worker);
+  info.GetReturnValue().Set(job_id);
+}
+
+// Reads a manifest returned by hashDirectory.
+bool ParseManifest(v8::Local<v8::Value> value,
+                   greenworks::HashAlgorithm* algorithm,
+                   std::vector<greenworks::ManifestEntry>* manifest) {
+  if (!value->IsObject())
+    return false;
+  v8::Local<v8::Object> object = value.As<v8::Object>();
+  v8::Local<v8::Value> algorithm_value =
+      object->Get(Nan::New("algorithm").ToLocalChecked());
+  v8::Local<v8::Value> files_value =
+      object->Get(Nan::New("files").ToLocalChecked());
+  if (!algorithm_value->IsString() || !files_value->IsArray() ||
+      !greenworks::ParseHashAlgorithm(
+          *(v8::String::Utf8Value(algorithm_value)), algorithm))
+    return false;
+  v8::Local<v8::Array> files = files_value.As<v8::Array>();
+  manifest->resize(files->Length());
+  for (uint32_t i = 0; i < files->Length(); ++i) {
+    if (!files->Get(i)->IsObject())
+      return false;
+    v8::Local<v8::Object> file = files->Get(i).As<v8::Object>();
+    v8::Local<v8::Value> path = file->Get(Nan::New("path").ToLocalChecked());
+    v8::Local<v8::Value> size = file->Get(Nan::New("size").ToLocalChecked());
+    v8::Local<v8::Value> hash = file->Get(Nan::New("hash").ToLocalChecked());
+    if (!path->IsString() || !size->IsNumber() || !hash->IsString())
+      return false;
+    greenworks::ManifestEntry& entry = (*manifest)[i];
+    entry.path = *(v8::String::Utf8Value(path));
+    entry.size = static_cast<uint64_t>(size->NumberValue());
+    entry.time = 0;
+    entry.hash = *(v8::String::Utf8Value(hash));
+  }
+  return true;
+}
+
+v8::Local<v8::Array> NewStringArray(const std::vector<std::string>& strings) {
+  v8::Local<v8::Array> array = Nan::New<v8::Array>(
+      static_cast<int>(strings.size()));
+  for (size_t i = 0; i < strings.size(); ++i)
+    array->Set(static_cast<uint32_t>(i), Nan::New(strings[i]).ToLocalChecked());
+  return array;
+}
+
+NAN_METHOD(DiffManifests) {
+  Nan::HandleScope scope;
+  greenworks::HashAlgorithm from_algorithm;
+  greenworks::HashAlgorithm to_algorithm;
+  std::vector<greenworks::ManifestEntry> from;
+  std::vector<greenworks::ManifestEntry> to;
+  // Hashes of different algorithms can't be compared.
+  if (info.Length() < 2 ||
+      !ParseManifest(info[0], &from_algorithm, &from) ||
+      !ParseManifest(info[1], &to_algorithm, &to) ||
+      from_algorithm != to_algorithm) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  greenworks::ManifestDiff diff;
+  greenworks::DiffManifests(from, to, &diff);
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  result->Set(Nan::New("added").ToLocalChecked(), NewStringArray(diff.added));
+  result->Set(Nan::New("removed").ToLocalChecked(),
+              NewStringArray(diff.removed));
+  result->Set(Nan::New("modified").ToLocalChecked(),
+              NewStringArray(diff.modified));
+  info.GetReturnValue().Set(result);
+}
+
+// Shared by the patch methods, whose |path_count| paths are followed by an
+// optional options object, then the callbacks.
+void QueuePatchJob(const Nan::FunctionCallbackInfo<v8::Value>& info,
+                   int path_count, bool create, bool directory) {
+  int callback_index = path_count;
+  if (info.Length() > callback_index && info[callback_index]->IsObject() &&
+      !info[callback_index]->IsFunction())
+    ++callback_index;
+  if (info.Length() <= callback_index ||
+      !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  std::string paths[3];
+  for (int i = 0; i < path_count; ++i) {
+    if (!info[i]->IsString())
+      THROW_BAD_ARGS("bad arguments");
+    paths[i] = *(v8::String::Utf8Value(info[i]));
+    if (paths[i].empty())
+      THROW_BAD_ARGS("bad arguments");
+  }
+  greenworks::PatchOptions options;
+  v8::Local<v8::Function> progress_function;
+  int progress_interval = kDefaultProgressInterval;
+  if (callback_index > path_count) {
+    v8::Local<v8::Object> options_object =
+        info[path_count].As<v8::Object>();
+    if (!ParseProgressOptions(options_object, &progress_function,
+                              &progress_interval))
+      THROW_BAD_ARGS("bad arguments");
+    v8::Local<v8::Value> block_size =
+        options_object->Get(Nan::New("blockSize").ToLocalChecked());
+    if (block_size->IsInt32() && block_size->Int32Value() >= 64)
+      options.block_size = block_size->Int32Value();
+    else if (!block_size->IsUndefined())
+      THROW_BAD_ARGS("bad arguments");
+    v8::Local<v8::Value> level =
+        options_object->Get(Nan::New("level").ToLocalChecked());
+    if (level->IsInt32() && level->Int32Value() >= 0 &&
+        level->Int32Value() <= 9)
+      options.compress_level = level->Int32Value();
+    else if (!level->IsUndefined())
+      THROW_BAD_ARGS("bad arguments");
+    if (!ParseThreadsOption(options_object, &options.threads))
+      THROW_BAD_ARGS("bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+
+  Nan::Callback* progress_callback = progress_function.IsEmpty() ?
+      NULL : new Nan::Callback(progress_function);
+
+  greenworks::ArchiveProgressWorker* worker;
+  if (create) {
+    worker = new greenworks::CreatePatchWorker(
+        success_callback, error_callback, progress_callback,
+        progress_interval, paths[0], paths[1], paths[2], directory, options);
+  } else {
+    worker = new greenworks::ApplyPatchWorker(
+        success_callback, error_callback, progress_callback,
+        progress_interval, paths[0], paths[1], paths[2], directory, options);
+  }
+  int job_id = worker->job_id();
+  Nan::AsyncQueueWorker(worker);
+  info.GetReturnValue().Set(job_id);
+}
+
+NAN_METHOD(CreatePatch) {
+  Nan::HandleScope scope;
+  QueuePatchJob(info, 3, true, false);
+}
+
+NAN_METHOD(ApplyPatch) {
+  Nan::HandleScope scope;
+  QueuePatchJob(info, 3, false, false);
+}
+
+NAN_METHOD(CreateDirectoryPatch) {
+  Nan::HandleScope scope;
+  QueuePatchJob(info, 3, true, true);
+}
+
+NAN_METHOD(ApplyDirectoryPatch) {
+  Nan::HandleScope scope;
+  QueuePatchJob(info, 2, false, true);
+}
+
+NAN_METHOD(Crc32) {
+  Nan::HandleScope scope;
+  if (info.Length() < 1 || !node::Buffer::HasInstance(info[0])) {
+    THROW_BAD_ARGS("bad arguments");
+  }
+  uint32_t crc = 0;
+  bool portable = false;
+  if (info.Length() > 1 && !info[1]->IsUndefined()) {
+    if (!info[1]->IsObject()) {
+      THROW_BAD_ARGS("bad arguments");
+    }
+    v8::Local<v8::Object> options_object = info[1].As<v8::Object>();
+    v8::Local<v8::Value> initial_crc =
+        options_object->Get(Nan::New("crc").ToLocalChecked());
+    if (initial_crc->IsUint32()) {
+      crc = initial_crc->Uint32Value();
+    } else if (!initial_crc->IsUndefined()) {
+      THROW_BAD_ARGS("bad arguments");
+    }
+    v8::Local<v8::Value> portable_value =
+        options_object->Get(Nan::New("portable").ToLocalChecked());
+    if (portable_value->IsBoolean()) {
+      portable = portable_value->BooleanValue();
+    } else if (!portable_value->IsUndefined()) {
+      THROW_BAD_ARGS("bad arguments");
+    }
+  }
+  const char* data = node::Buffer::Data(info[0]);
+  size_t size = node::Buffer::Length(info[0]);
+  crc = portable ? greenworks::Crc32Portable(crc, data, size)
+                 : greenworks::Crc32(crc, data, size);
+  info.GetReturnValue().Set(Nan::New<v8::Uint32>(crc));
+}
+
+NAN_METHOD(GetCrc32Implementation) {
+  Nan::HandleScope scope;
+  info.GetReturnValue().Set(
+      Nan::New(greenworks::Crc32Implementation()).ToLocalChecked());
+}
+
 void RegisterAPIs(v8::Handle<v8::Object> exports) {
   // Prepare constructor template
   v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>();
   Nan::SetMethod(tpl, "createArchive", CreateArchive);
+  Nan::SetMethod(tpl, "updateArchive", UpdateArchive);
+  Nan::SetMethod(tpl, "createArchiveFromBuffers", CreateArchiveFromBuffers);
   Nan::SetMethod(tpl, "extractArchive", ExtractArchive);
+  Nan::SetMethod(tpl, "extractArchiveFromBuffer", ExtractArchiveFromBuffer);
+  Nan::SetMethod(tpl, "readArchiveFromBuffer", ReadArchiveFromBuffer);
+  Nan::SetMethod(tpl, "verifyArchive", VerifyArchive);
+  Nan::SetMethod(tpl, "extractEntries", ExtractEntries);
+  Nan::SetMethod(tpl, "readArchiveEntry", ReadArchiveEntry);
+  Nan::SetMethod(tpl, "listArchive", ListArchive);
+  Nan::SetMethod(tpl, "moveDirectory", MoveDirectory);
+  Nan::SetMethod(tpl, "copyDirectory", CopyDirectory);
+  Nan::SetMethod(tpl, "hashDirectory", HashDirectory);
+  Nan::SetMethod(tpl, "diffManifests", DiffManifests);
+  Nan::SetMethod(tpl, "createPatch", CreatePatch);
+  Nan::SetMethod(tpl, "applyPatch", ApplyPatch);
+  Nan::SetMethod(tpl, "createDirectoryPatch", CreateDirectoryPatch);
+  Nan::SetMethod(tpl, "applyDirectoryPatch", ApplyDirectoryPatch);
+  Nan::SetMethod(tpl, "cancelArchive", CancelArchive);
+  Nan::SetMethod(tpl, "crc32", Crc32);
+  Nan::SetMethod(tpl, "crc32Implementation", GetCrc32Implementation);
   Nan::Persistent<v8::Function> constructor;
   constructor.Reset(tpl->GetFunction());
   Nan::Set(exports, Nan::New("Utils").ToLocalChecked(), tpl->GetFunction());
@@ -8,6 +8,9 @@
 #include "v8.h"
 
 #include "greenworks_async_workers.h"
+#include "greenworks_cloud_cache.h"
+#include "greenworks_cloud_compression.h"
+#include "greenworks_cloud_requests.h"
 #include "steam/steam_api.h"
 #include "steam_api_registry.h"
 
@@ -15,6 +18,9 @@ namespace greenworks {
 namespace api {
 namespace {
 
+// Files smaller than this rarely shrink enough to pay for the header.
+const int kDefaultCompressionThreshold = 512;
+
 NAN_METHOD(SaveTextToFile) {
   Nan::HandleScope scope;
 
@@ -60,9 +66,59 @@ NAN_METHOD(DeleteFile) {
   info.GetReturnValue().Set(Nan::Undefined());
 }
 
+bool ParseCloudQuotaOptions(v8::Local<v8::Object> options,
+    greenworks::CloudQuotaOptions* quota_options) {
+  quota_options->enabled = true;
+  quota_options->policy = greenworks::kCloudEvictOldestFirst;
+  v8::Local<v8::Value> evict = options->Get(Nan::New("evict").ToLocalChecked());
+  if (evict->IsString()) {
+    std::string policy(*(v8::String::Utf8Value(evict)));
+    if (policy == "oldest")
+      quota_options->policy = greenworks::kCloudEvictOldestFirst;
+    else if (policy == "priority")
+      quota_options->policy = greenworks::kCloudEvictByPriorityPrefix;
+    else
+      return false;
+  } else if (!evict->IsUndefined()) {
+    return false;
+  }
+
+  v8::Local<v8::Value> prefixes =
+      options->Get(Nan::New("priorityPrefixes").ToLocalChecked());
+  if (prefixes->IsArray()) {
+    v8::Local<v8::Array> prefixes_array = prefixes.As<v8::Array>();
+    for (uint32_t i = 0; i < prefixes_array->Length(); ++i) {
+      if (!prefixes_array->Get(i)->IsString())
+        return false;
+      quota_options->priority_prefixes.push_back(
+          *(v8::String::Utf8Value(prefixes_array->Get(i))));
+    }
+  } else if (!prefixes->IsUndefined()) {
+    return false;
+  }
+
+  v8::Local<v8::Value> method =
+      options->Get(Nan::New("evictMethod").ToLocalChecked());
+  if (method->IsString()) {
+    std::string evict_method(*(v8::String::Utf8Value(method)));
+    if (evict_method == "delete")
+      quota_options->delete_files = true;
+    else if (evict_method != "forget")
+      return false;
+  }
+  quota_options->dry_run =
+      options->Get(Nan::New("dryRun").ToLocalChecked())->BooleanValue();
+  return true;
+}
+
 NAN_METHOD(SaveFilesToCloud) {
   Nan::HandleScope scope;
-  if (info.Length() < 2 || !info[0]->IsArray() || !info[1]->IsFunction()) {
+  // The options object is optional.
+  int callback_index = 1;
+  if (info.Length() > 1 && info[1]->IsObject() && !info[1]->IsFunction())
+    callback_index = 2;
+  if (info.Length() <= callback_index || !info[0]->IsArray() ||
+      !info[callback_index]->IsFunction()) {
     THROW_BAD_ARGS("Bad arguments");
   }
   v8::Local<v8::Array> files = info[0].As<v8::Array>();
@@ -75,16 +131,24 @@ NAN_METHOD(SaveFilesToCloud) {
     if (string_array.length() > 0)
       files_path.push_back(*string_array);
   }
+  greenworks::CloudQuotaOptions quota_options;
+  if (callback_index == 2 &&
+      !ParseCloudQuotaOptions(info[1].As<v8::Object>(), &quota_options)) {
+    THROW_BAD_ARGS("Bad arguments");
+  }
 
   Nan::Callback* success_callback =
-      new Nan::Callback(info[1].As<v8::Function>());
+      new Nan::Callback(info[callback_index].As<v8::Function>());
   Nan::Callback* error_callback = NULL;
 
-  if (info.Length() > 2 && info[2]->IsFunction())
-    error_callback = new Nan::Callback(info[2].As<v8::Function>());
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
   Nan::AsyncQueueWorker(new greenworks::FilesSaveWorker(success_callback,
                                                         error_callback,
-                                                        files_path));
+                                                        files_path,
+                                                        quota_options));
   info.GetReturnValue().Set(Nan::Undefined());
 }
 
@@ -103,9 +167,9 @@ NAN_METHOD(ReadTextFromFile) {
   if (info.Length() > 2 && info[2]->IsFunction())
     error_callback = new Nan::Callback(info[2].As<v8::Function>());
 
-  Nan::AsyncQueueWorker(new greenworks::FileReadWorker(success_callback,
-                                                       error_callback,
-                                                       file_name));
+  (new greenworks::FileReadAsyncRequest(success_callback,
+                                        error_callback,
+                                        file_name))->Start();
   info.GetReturnValue().Set(Nan::Undefined());
 }
 
@@ -152,6 +216,89 @@ NAN_METHOD(GetCloudQuota) {
   info.GetReturnValue().Set(Nan::Undefined());
 }
 
+NAN_METHOD(SetCloudWriteDelay) {
+  Nan::HandleScope scope;
+
+  if (info.Length() < 1 || !info[0]->IsInt32()) {
+    THROW_BAD_ARGS("Bad arguments");
+  }
+  greenworks::CloudWriteCache::GetInstance()->SetDelay(info[0]->Int32Value());
+  info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(FlushCloud) {
+  Nan::HandleScope scope;
+
+  if (info.Length() < 1 || !info[0]->IsFunction()) {
+    THROW_BAD_ARGS("Bad arguments");
+  }
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[0].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > 1 && info[1]->IsFunction())
+    error_callback = new Nan::Callback(info[1].As<v8::Function>());
+
+  Nan::AsyncQueueWorker(new greenworks::CloudFlushWorker(success_callback,
+                                                         error_callback,
+                                                         true));
+  info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(EnableCloudCompression) {
+  Nan::HandleScope scope;
+
+  if (info.Length() < 1) {
+    THROW_BAD_ARGS("Bad arguments");
+  }
+  int threshold = kDefaultCompressionThreshold;
+  if (info.Length() > 1 && info[1]->IsInt32())
+    threshold = info[1]->Int32Value();
+  bool enable_flag = info[0]->BooleanValue();
+  greenworks::SetCloudCompressionThreshold(enable_flag ? threshold : -1);
+  info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(SyncCloudDirectory) {
+  Nan::HandleScope scope;
+  // The options object is optional.
+  int callback_index = 1;
+  if (info.Length() > 1 && info[1]->IsObject() && !info[1]->IsFunction())
+    callback_index = 2;
+  if (info.Length() <= callback_index || !info[0]->IsString() ||
+      !info[callback_index]->IsFunction()) {
+    THROW_BAD_ARGS("Bad arguments");
+  }
+  std::string local_dir(*(v8::String::Utf8Value(info[0])));
+  greenworks::CloudSyncDirection direction = greenworks::kCloudSyncBoth;
+  if (callback_index == 2) {
+    v8::Local<v8::Value> direction_value = info[1].As<v8::Object>()->Get(
+        Nan::New("direction").ToLocalChecked());
+    std::string direction_name = direction_value->IsString() ?
+        *(v8::String::Utf8Value(direction_value)) : "both";
+    if (direction_name == "upload")
+      direction = greenworks::kCloudSyncUpload;
+    else if (direction_name == "download")
+      direction = greenworks::kCloudSyncDownload;
+    else if (direction_name != "both")
+      THROW_BAD_ARGS("Bad arguments");
+  }
+
+  Nan::Callback* success_callback =
+      new Nan::Callback(info[callback_index].As<v8::Function>());
+  Nan::Callback* error_callback = NULL;
+
+  if (info.Length() > callback_index + 1 &&
+      info[callback_index + 1]->IsFunction())
+    error_callback = new Nan::Callback(
+        info[callback_index + 1].As<v8::Function>());
+  Nan::AsyncQueueWorker(new greenworks::CloudSyncWorker(success_callback,
+                                                        error_callback,
+                                                        local_dir,
+                                                        direction));
+  info.GetReturnValue().Set(Nan::Undefined());
+}
+
 void RegisterAPIs(v8::Handle<v8::Object> target) {
   Nan::Set(target,
            Nan::New("saveTextToFile").ToLocalChecked(),
@@ -178,6 +325,19 @@ void RegisterAPIs(v8::Handle<v8::Object> target) {
   Nan::Set(target,
            Nan::New("getCloudQuota").ToLocalChecked(),
            Nan::New<v8::FunctionTemplate>(GetCloudQuota)->GetFunction());
+  Nan::Set(target,
+           Nan::New("setCloudWriteDelay").ToLocalChecked(),
+           Nan::New<v8::FunctionTemplate>(SetCloudWriteDelay)->GetFunction());
+  Nan::Set(target,
+           Nan::New("flushCloud").ToLocalChecked(),
+           Nan::New<v8::FunctionTemplate>(FlushCloud)->GetFunction());
+  Nan::Set(target,
+           Nan::New("enableCloudCompression").ToLocalChecked(),
+           Nan::New<v8::FunctionTemplate>(
+               EnableCloudCompression)->GetFunction());
+  Nan::Set(target,
+           Nan::New("syncCloudDirectory").ToLocalChecked(),
+           Nan::New<v8::FunctionTemplate>(SyncCloudDirectory)->GetFunction());
 }
 
 SteamAPIRegistry::Add X(RegisterAPIs);
@@ -0,0 +1,298 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_archive_index.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "greenworks_archive_io.h"
+#include "greenworks_crc32.h"
+#include "zlib/contrib/minizip/unzip.h"
+
+#if defined(_WIN32)
+#include "zlib/contrib/minizip/iowin32.h"
+#endif
+
+namespace greenworks {
+
+namespace {
+
+// "GWAI" read as a little-endian integer; also rejects indexes written on a
+// machine of the other endianness.
+const uint32_t kIndexMagic = 0x49415747;
+const uint32_t kIndexVersion = 2;
+const char kIndexTempSuffix[] = ".tmp";
+// The end of central directory record, with the offset and size of the
+// central directory, is within this many bytes of the end of an archive:
+// the record, its longest comment, and the zip64 record and locator.
+const uint64_t kArchiveTailSize = 22 + 0xffff + 56 + 20;
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  // Identifies the version of the archive the index was written for. The
+  // modification time alone may be in whole seconds, and an archive
+  // rewritten within the same second, at the same size, would pass.
+  uint64_t archive_size;
+  int64_t archive_time;
+  int64_t archive_time_nsec;
+  uint32_t archive_tail_crc;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t names_size;
+};
+
+bool StatFile(const char* path, uint64_t* size, int64_t* time,
+              int64_t* time_nsec) {
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_stat64(path, &st) != 0)
+    return false;
+  *time_nsec = 0;
+#else
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return false;
+#if defined(__APPLE__)
+  *time_nsec = st.st_mtimespec.tv_nsec;
+#else
+  *time_nsec = st.st_mtim.tv_nsec;
+#endif
+#endif
+  *size = st.st_size;
+  *time = st.st_mtime;
+  return true;
+}
+
+// Identifies the archive at |path| by its size, modification time, and the
+// CRC-32 of its tail, which holds where its central directory is.
+bool GetArchiveVersion(const char* path, IndexHeader* header) {
+  if (!StatFile(path, &header->archive_size, &header->archive_time,
+                &header->archive_time_nsec))
+    return false;
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+  uint64_t tail_size = std::min(header->archive_size, kArchiveTailSize);
+  std::vector<char> tail(static_cast<size_t>(tail_size));
+  bool succeeded = fseeko64(file, header->archive_size - tail_size,
+                            SEEK_SET) == 0 &&
+      (tail.empty() || fread(&tail[0], 1, tail.size(), file) == tail.size());
+  fclose(file);
+  if (succeeded)
+    header->archive_tail_crc = tail.empty() ? 0 : static_cast<uint32_t>(
+        Crc32(0, &tail[0], tail.size()));
+  return succeeded;
+}
+
+unzFile OpenArchive(const char* zip_file, bool use_mmap) {
+  zlib_filefunc64_def ffunc;
+  if (use_mmap) {
+    FillMmapFileFunc64(&ffunc);
+    unzFile uf = unzOpen2_64(zip_file, &ffunc);
+    if (uf != NULL)
+      return uf;
+  }
+#if defined(_WIN32)
+  fill_win32_filefunc64A(&ffunc);
+  return unzOpen2_64(zip_file, &ffunc);
+#else
+  return unzOpen64(zip_file);
+#endif
+}
+
+template <typename T>
+bool WriteArray(FILE* file, const std::vector<T>& values) {
+  return values.empty() ||
+      fwrite(&values[0], sizeof(T), values.size(), file) == values.size();
+}
+
+template <typename T>
+bool ReadArray(FILE* file, size_t count, std::vector<T>* values) {
+  values->resize(count);
+  return count == 0 ||
+      fread(&(*values)[0], sizeof(T), count, file) == count;
+}
+
+}  // namespace
+
+void ArchiveListing::Clear() {
+  names.clear();
+  compressed_sizes.clear();
+  uncompressed_sizes.clear();
+  crcs.clear();
+  offsets.clear();
+  times.clear();
+}
+
+int ListArchive(const char* zip_file, bool use_mmap, ArchiveListing* listing) {
+  listing->Clear();
+  unzFile uf = OpenArchive(zip_file, use_mmap);
+  if (uf == NULL)
+    return UNZ_ERRNO;
+
+  unz_global_info64 global_info;
+  int err = unzGetGlobalInfo64(uf, &global_info);
+  if (err == UNZ_OK) {
+    // Don't trust the count of a damaged archive for a large allocation.
+    size_t count = static_cast<size_t>(
+        std::min<ZPOS64_T>(global_info.number_entry, 1 << 20));
+    listing->names.reserve(count);
+    listing->compressed_sizes.reserve(count);
+    listing->uncompressed_sizes.reserve(count);
+    listing->crcs.reserve(count);
+    listing->offsets.reserve(count);
+    listing->times.reserve(count);
+    err = unzGoToFirstFile(uf);
+  }
+
+  // File names are at most 64K long in a zip archive.
+  std::vector<char> name(0xffff + 1);
+  // Entries are often written at the same time; mktime is relatively slow.
+  uLong last_dos_date = 0;
+  double last_time = 0;
+  while (err == UNZ_OK) {
+    unz_file_info64 info;
+    err = unzGetCurrentFileInfo64(uf, &info, &name[0], name.size(), NULL, 0,
+                                  NULL, 0);
+    if (err != UNZ_OK)
+      break;
+    if (listing->names.empty() || info.dosDate != last_dos_date) {
+      struct tm date;
+      memset(&date, 0, sizeof(date));
+      date.tm_sec = info.tmu_date.tm_sec;
+      date.tm_min = info.tmu_date.tm_min;
+      date.tm_hour = info.tmu_date.tm_hour;
+      date.tm_mday = info.tmu_date.tm_mday;
+      date.tm_mon = info.tmu_date.tm_mon;
+      date.tm_year = info.tmu_date.tm_year - 1900;
+      date.tm_isdst = -1;
+      last_dos_date = info.dosDate;
+      last_time = static_cast<double>(mktime(&date));
+    }
+    listing->names.push_back(std::string(&name[0], info.size_filename));
+    listing->compressed_sizes.push_back(
+        static_cast<double>(info.compressed_size));
+    listing->uncompressed_sizes.push_back(
+        static_cast<double>(info.uncompressed_size));
+    listing->crcs.push_back(static_cast<uint32_t>(info.crc));
+    listing->offsets.push_back(static_cast<double>(unzGetOffset64(uf)));
+    listing->times.push_back(last_time);
+    err = unzGoToNextFile(uf);
+  }
+  unzClose(uf);
+  return err == UNZ_END_OF_LIST_OF_FILE ? UNZ_OK : err;
+}
+
+bool ReadArchiveIndex(const std::string& index_file, const char* zip_file,
+                      ArchiveListing* listing) {
+  listing->Clear();
+  IndexHeader header;
+  IndexHeader archive;
+  if (!GetArchiveVersion(zip_file, &archive))
+    return false;
+  FILE* file = fopen(index_file.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  bool succeeded = fread(&header, sizeof(header), 1, file) == 1 &&
+      header.magic == kIndexMagic && header.version == kIndexVersion &&
+      header.archive_size == archive.archive_size &&
+      header.archive_time == archive.archive_time &&
+      header.archive_time_nsec == archive.archive_time_nsec &&
+      header.archive_tail_crc == archive.archive_tail_crc;
+
+  // Check the index size against the counts before allocating for them.
+  uint64_t entry_size = 4 * sizeof(double) + 2 * sizeof(uint32_t);
+  if (succeeded) {
+    uint64_t index_size = 0;
+    int64_t index_time;
+    int64_t index_time_nsec;
+    succeeded = StatFile(index_file.c_str(), &index_size, &index_time,
+                         &index_time_nsec) &&
+        header.count <= (index_size - sizeof(header)) / entry_size &&
+        index_size == sizeof(header) + header.count * entry_size +
+                      header.names_size;
+  }
+  size_t count = static_cast<size_t>(header.count);
+  std::vector<uint32_t> name_lengths;
+  std::string names;
+  succeeded = succeeded &&
+      ReadArray(file, count, &listing->compressed_sizes) &&
+      ReadArray(file, count, &listing->uncompressed_sizes) &&
+      ReadArray(file, count, &listing->crcs) &&
+      ReadArray(file, count, &listing->offsets) &&
+      ReadArray(file, count, &listing->times) &&
+      ReadArray(file, count, &name_lengths);
+  if (succeeded) {
+    names.resize(static_cast<size_t>(header.names_size));
+    succeeded = names.empty() ||
+        fread(&names[0], 1, names.size(), file) == names.size();
+  }
+  fclose(file);
+
+  size_t position = 0;
+  listing->names.reserve(count);
+  for (size_t i = 0; succeeded && i < count; ++i) {
+    succeeded = name_lengths[i] <= names.size() - position;
+    if (succeeded)
+      listing->names.push_back(names.substr(position, name_lengths[i]));
+    position += name_lengths[i];
+  }
+  if (!succeeded)
+    listing->Clear();
+  return succeeded;
+}
+
+bool WriteArchiveIndex(const std::string& index_file, const char* zip_file,
+                       const ArchiveListing& listing) {
+  IndexHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kIndexMagic;
+  header.version = kIndexVersion;
+  header.count = listing.size();
+  if (!GetArchiveVersion(zip_file, &header))
+    return false;
+  std::vector<uint32_t> name_lengths(listing.size());
+  for (size_t i = 0; i < listing.size(); ++i) {
+    name_lengths[i] = static_cast<uint32_t>(listing.names[i].size());
+    header.names_size += name_lengths[i];
+  }
+
+  // Written aside then renamed, so that readers never see a partial index.
+  std::string temp_file = index_file + kIndexTempSuffix;
+  FILE* file = fopen(temp_file.c_str(), "wb");
+  if (file == NULL)
+    return false;
+  bool succeeded = fwrite(&header, sizeof(header), 1, file) == 1 &&
+      WriteArray(file, listing.compressed_sizes) &&
+      WriteArray(file, listing.uncompressed_sizes) &&
+      WriteArray(file, listing.crcs) &&
+      WriteArray(file, listing.offsets) &&
+      WriteArray(file, listing.times) &&
+      WriteArray(file, name_lengths);
+  for (size_t i = 0; succeeded && i < listing.size(); ++i) {
+    const std::string& name = listing.names[i];
+    succeeded = name.empty() ||
+        fwrite(name.data(), 1, name.size(), file) == name.size();
+  }
+  if (fclose(file) != 0)
+    succeeded = false;
+#if defined(_WIN32)
+  if (succeeded)
+    remove(index_file.c_str());
+#endif
+  if (succeeded)
+    succeeded = rename(temp_file.c_str(), index_file.c_str()) == 0;
+  if (!succeeded)
+    remove(temp_file.c_str());
+  return succeeded;
+}
+
+}  // namespace greenworks
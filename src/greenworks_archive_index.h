@@ -0,0 +1,50 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_ARCHIVE_INDEX_H_
+#define SRC_GREENWORKS_ARCHIVE_INDEX_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace greenworks {
+
+// The entries of an archive as parallel arrays, one element per entry, in
+// central directory order.
+struct ArchiveListing {
+  size_t size() const { return names.size(); }
+  void Clear();
+
+  std::vector<std::string> names;
+  std::vector<double> compressed_sizes;
+  std::vector<double> uncompressed_sizes;
+  std::vector<uint32_t> crcs;
+  // The position of each entry's central directory record, which
+  // unzSetOffset64 seeks to directly.
+  std::vector<double> offsets;
+  // The modification times, in seconds since the epoch.
+  std::vector<double> times;
+};
+
+// Lists the entries of |zip_file| from its central directory only, without
+// reading any of the compressed data. Returns an UNZ_* error code.
+int ListArchive(const char* zip_file, bool use_mmap, ArchiveListing* listing);
+
+// Loads the listing of |zip_file| from the sidecar index at |index_file|.
+// Fails if the index is missing, unreadable, or was written for a different
+// version of the archive (by size, modification time to the nanosecond where
+// the filesystem has it, and the CRC-32 of the end of the archive, which
+// locates its central directory).
+bool ReadArchiveIndex(const std::string& index_file, const char* zip_file,
+                      ArchiveListing* listing);
+
+// Saves |listing| of |zip_file| as a sidecar index at |index_file|.
+bool WriteArchiveIndex(const std::string& index_file, const char* zip_file,
+                       const ArchiveListing& listing);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_ARCHIVE_INDEX_H_
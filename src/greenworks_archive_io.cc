@@ -0,0 +1,365 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_archive_io.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace greenworks {
+
+namespace {
+
+ZPOS64_T GetMappingGranularity() {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwAllocationGranularity;
+#else
+  return static_cast<ZPOS64_T>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// A read-only stream over a mapped file, or over memory owned by the caller.
+struct MappedStream {
+  MappedFile file;
+  const unsigned char* data;
+  ZPOS64_T size;
+  ZPOS64_T position;
+};
+
+voidpf ZCALLBACK mmap_open64_file_func(voidpf opaque, const void* filename,
+                                       int mode) {
+  if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ ||
+      filename == NULL)
+    return NULL;
+  MappedStream* stream = new MappedStream();
+  stream->position = 0;
+  if (!stream->file.Open(static_cast<const char*>(filename))) {
+    delete stream;
+    return NULL;
+  }
+  stream->data = stream->file.data();
+  stream->size = stream->file.size();
+  return stream;
+}
+
+voidpf ZCALLBACK read_memory_open64_file_func(voidpf opaque,
+                                              const void* filename, int mode) {
+  if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ)
+    return NULL;
+  const MemoryRange* range = static_cast<const MemoryRange*>(opaque);
+  MappedStream* stream = new MappedStream();
+  stream->data = reinterpret_cast<const unsigned char*>(range->data);
+  stream->size = range->size;
+  stream->position = 0;
+  return stream;
+}
+
+uLong ZCALLBACK mmap_read_file_func(voidpf opaque, voidpf stream, void* buf,
+                                    uLong size) {
+  MappedStream* mapped = static_cast<MappedStream*>(stream);
+  ZPOS64_T available = mapped->size - mapped->position;
+  if (size > available)
+    size = static_cast<uLong>(available);
+  if (size > 0)
+    memcpy(buf, mapped->data + mapped->position, size);
+  mapped->position += size;
+  return size;
+}
+
+uLong ZCALLBACK mmap_write_file_func(voidpf opaque, voidpf stream,
+                                     const void* buf, uLong size) {
+  return 0;
+}
+
+ZPOS64_T ZCALLBACK mmap_tell64_file_func(voidpf opaque, voidpf stream) {
+  return static_cast<MappedStream*>(stream)->position;
+}
+
+long ZCALLBACK mmap_seek64_file_func(voidpf opaque, voidpf stream,
+                                     ZPOS64_T offset, int origin) {
+  MappedStream* mapped = static_cast<MappedStream*>(stream);
+  ZPOS64_T position;
+  switch (origin) {
+    case ZLIB_FILEFUNC_SEEK_CUR:
+      position = mapped->position + offset;
+      break;
+    case ZLIB_FILEFUNC_SEEK_END:
+      position = mapped->size + offset;
+      break;
+    case ZLIB_FILEFUNC_SEEK_SET:
+      position = offset;
+      break;
+    default:
+      return -1;
+  }
+  if (position > mapped->size)
+    return -1;
+  mapped->position = position;
+  return 0;
+}
+
+int ZCALLBACK mmap_close_file_func(voidpf opaque, voidpf stream) {
+  delete static_cast<MappedStream*>(stream);
+  return 0;
+}
+
+int ZCALLBACK mmap_error_file_func(voidpf opaque, voidpf stream) {
+  return 0;
+}
+
+struct MemoryStream {
+  MemoryBuffer* buffer;
+  ZPOS64_T position;
+};
+
+voidpf ZCALLBACK memory_open64_file_func(voidpf opaque, const void* filename,
+                                         int mode) {
+  MemoryStream* stream = new MemoryStream();
+  stream->buffer = static_cast<MemoryBuffer*>(opaque);
+  stream->position = 0;
+  return stream;
+}
+
+uLong ZCALLBACK memory_read_file_func(voidpf opaque, voidpf stream, void* buf,
+                                      uLong size) {
+  MemoryStream* memory = static_cast<MemoryStream*>(stream);
+  ZPOS64_T available = memory->position < memory->buffer->size() ?
+      memory->buffer->size() - memory->position : 0;
+  if (size > available)
+    size = static_cast<uLong>(available);
+  if (size > 0)
+    memcpy(buf, memory->buffer->data() + memory->position, size);
+  memory->position += size;
+  return size;
+}
+
+uLong ZCALLBACK memory_write_file_func(voidpf opaque, voidpf stream,
+                                       const void* buf, uLong size) {
+  MemoryStream* memory = static_cast<MemoryStream*>(stream);
+  if (!memory->buffer->Write(memory->position, buf, size))
+    return 0;
+  memory->position += size;
+  return size;
+}
+
+ZPOS64_T ZCALLBACK memory_tell64_file_func(voidpf opaque, voidpf stream) {
+  return static_cast<MemoryStream*>(stream)->position;
+}
+
+long ZCALLBACK memory_seek64_file_func(voidpf opaque, voidpf stream,
+                                       ZPOS64_T offset, int origin) {
+  MemoryStream* memory = static_cast<MemoryStream*>(stream);
+  switch (origin) {
+    case ZLIB_FILEFUNC_SEEK_CUR:
+      memory->position += offset;
+      return 0;
+    case ZLIB_FILEFUNC_SEEK_END:
+      memory->position = memory->buffer->size() + offset;
+      return 0;
+    case ZLIB_FILEFUNC_SEEK_SET:
+      memory->position = offset;
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+int ZCALLBACK memory_close_file_func(voidpf opaque, voidpf stream) {
+  delete static_cast<MemoryStream*>(stream);
+  return 0;
+}
+
+int ZCALLBACK memory_error_file_func(voidpf opaque, voidpf stream) {
+  return 0;
+}
+
+}  // namespace
+
+MemoryBuffer::MemoryBuffer() : data_(NULL), size_(0), capacity_(0) {
+}
+
+MemoryBuffer::~MemoryBuffer() {
+  free(data_);
+}
+
+bool MemoryBuffer::Write(ZPOS64_T position, const void* data, size_t size) {
+  ZPOS64_T end = position + size;
+  if (static_cast<size_t>(end) != end || end < position)
+    return false;
+  if (end > capacity_) {
+    // Grow geometrically: archives are written in many small pieces.
+    size_t capacity = std::max<size_t>(capacity_ * 2, 64 * 1024);
+    capacity = std::max<size_t>(capacity, static_cast<size_t>(end));
+    char* grown = static_cast<char*>(realloc(data_, capacity));
+    if (grown == NULL)
+      return false;
+    data_ = grown;
+    capacity_ = capacity;
+  }
+  // Seeking past the end leaves a gap, zeroed like in a file.
+  if (position > size_)
+    memset(data_ + size_, 0, static_cast<size_t>(position) - size_);
+  memcpy(data_ + position, data, size);
+  size_ = std::max<size_t>(size_, static_cast<size_t>(end));
+  return true;
+}
+
+char* MemoryBuffer::Release() {
+  char* data = data_;
+  data_ = NULL;
+  size_ = capacity_ = 0;
+  return data;
+}
+
+MappedFile::MappedFile()
+    : view_(NULL), view_size_(0), data_(NULL), size_(0) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Open(const char* path) {
+  return Open(path, 0, static_cast<ZPOS64_T>(-1));
+}
+
+bool MappedFile::Open(const char* path, ZPOS64_T offset, ZPOS64_T length) {
+  Close();
+  ZPOS64_T file_size;
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER large_size;
+  if (!GetFileSizeEx(file, &large_size)) {
+    CloseHandle(file);
+    return false;
+  }
+  file_size = static_cast<ZPOS64_T>(large_size.QuadPart);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  file_size = static_cast<ZPOS64_T>(st.st_size);
+#endif
+
+  if (length == static_cast<ZPOS64_T>(-1))
+    length = file_size - offset;
+  bool succeeded = offset <= file_size && length <= file_size - offset;
+  ZPOS64_T view_offset = offset - offset % GetMappingGranularity();
+  ZPOS64_T view_size = offset - view_offset + length;
+  // Also fails when the view doesn't fit in the address space.
+  if (succeeded && static_cast<size_t>(view_size) != view_size)
+    succeeded = false;
+  // Empty ranges can't be mapped, but don't need to.
+  if (succeeded && length > 0) {
+#if defined(_WIN32)
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL) {
+      view_ = MapViewOfFile(mapping, FILE_MAP_READ,
+                            static_cast<DWORD>(view_offset >> 32),
+                            static_cast<DWORD>(view_offset),
+                            static_cast<SIZE_T>(view_size));
+      // The view keeps the mapping alive.
+      CloseHandle(mapping);
+    }
+    succeeded = view_ != NULL;
+#else
+    view_ = mmap(NULL, static_cast<size_t>(view_size), PROT_READ, MAP_PRIVATE,
+                 fd, static_cast<off_t>(view_offset));
+    if (view_ == MAP_FAILED)
+      view_ = NULL;
+    else
+      madvise(view_, static_cast<size_t>(view_size), MADV_SEQUENTIAL);
+    succeeded = view_ != NULL;
+#endif
+  }
+#if defined(_WIN32)
+  CloseHandle(file);
+#else
+  close(fd);
+#endif
+  if (!succeeded)
+    return false;
+
+  view_size_ = static_cast<size_t>(view_size);
+  data_ = view_ ?
+      static_cast<const unsigned char*>(view_) + (offset - view_offset) : NULL;
+  size_ = length;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (view_) {
+#if defined(_WIN32)
+    UnmapViewOfFile(view_);
+#else
+    munmap(view_, view_size_);
+#endif
+  }
+  view_ = NULL;
+  view_size_ = 0;
+  data_ = NULL;
+  size_ = 0;
+}
+
+void FillMemoryFileFunc64(zlib_filefunc64_def* pzlib_filefunc_def,
+                          MemoryBuffer* buffer) {
+  pzlib_filefunc_def->zopen64_file = memory_open64_file_func;
+  pzlib_filefunc_def->zread_file = memory_read_file_func;
+  pzlib_filefunc_def->zwrite_file = memory_write_file_func;
+  pzlib_filefunc_def->ztell64_file = memory_tell64_file_func;
+  pzlib_filefunc_def->zseek64_file = memory_seek64_file_func;
+  pzlib_filefunc_def->zclose_file = memory_close_file_func;
+  pzlib_filefunc_def->zerror_file = memory_error_file_func;
+  pzlib_filefunc_def->opaque = buffer;
+}
+
+void FillMmapFileFunc64(zlib_filefunc64_def* pzlib_filefunc_def) {
+  pzlib_filefunc_def->zopen64_file = mmap_open64_file_func;
+  pzlib_filefunc_def->zread_file = mmap_read_file_func;
+  pzlib_filefunc_def->zwrite_file = mmap_write_file_func;
+  pzlib_filefunc_def->ztell64_file = mmap_tell64_file_func;
+  pzlib_filefunc_def->zseek64_file = mmap_seek64_file_func;
+  pzlib_filefunc_def->zclose_file = mmap_close_file_func;
+  pzlib_filefunc_def->zerror_file = mmap_error_file_func;
+  pzlib_filefunc_def->opaque = NULL;
+}
+
+void FillReadMemoryFileFunc64(zlib_filefunc64_def* pzlib_filefunc_def,
+                              const MemoryRange* range) {
+  FillMmapFileFunc64(pzlib_filefunc_def);
+  pzlib_filefunc_def->zopen64_file = read_memory_open64_file_func;
+  pzlib_filefunc_def->opaque = const_cast<MemoryRange*>(range);
+}
+
+void PreallocateFile(FILE* file, ZPOS64_T size) {
+#if defined(__linux__)
+  // Unlike posix_fallocate, fallocate fails rather than writing zeros on the
+  // filesystems which don't support it.
+  if (size > 0)
+    fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size));
+#endif
+}
+
+}  // namespace greenworks
@@ -0,0 +1,95 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_ARCHIVE_IO_H_
+#define SRC_GREENWORKS_ARCHIVE_IO_H_
+
+#include <stdio.h>
+
+#include "zlib/zlib.h"
+#include "zlib/contrib/minizip/ioapi.h"
+
+namespace greenworks {
+
+// A read-only memory mapping of a file, or of a range of it.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Maps the whole file.
+  bool Open(const char* path);
+  // Maps |length| bytes from |offset|; fails if the file is shorter.
+  bool Open(const char* path, ZPOS64_T offset, ZPOS64_T length);
+  void Close();
+
+  const unsigned char* data() const { return data_; }
+  ZPOS64_T size() const { return size_; }
+
+ private:
+  // The mapping starts at the page boundary before the requested offset.
+  void* view_;
+  size_t view_size_;
+  const unsigned char* data_;
+  ZPOS64_T size_;
+
+  MappedFile(const MappedFile&);
+  void operator=(const MappedFile&);
+};
+
+// A growable malloc'ed block, which an archive is written to in memory.
+class MemoryBuffer {
+ public:
+  MemoryBuffer();
+  ~MemoryBuffer();
+
+  // Writes |size| bytes at |position|, growing the buffer as needed.
+  bool Write(ZPOS64_T position, const void* data, size_t size);
+  // Hands the data over to the caller, to be freed with free(), and empties
+  // the buffer.
+  char* Release();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  char* data_;
+  size_t size_;
+  size_t capacity_;
+
+  MemoryBuffer(const MemoryBuffer&);
+  void operator=(const MemoryBuffer&);
+};
+
+// Memory owned by the caller.
+struct MemoryRange {
+  const char* data;
+  size_t size;
+};
+
+// Fills |pzlib_filefunc_def| with file functions reading and writing
+// |buffer| instead of a file, for zipOpen2_64; the file name is ignored.
+void FillMemoryFileFunc64(zlib_filefunc64_def* pzlib_filefunc_def,
+                          MemoryBuffer* buffer);
+
+// Fills |pzlib_filefunc_def| with read-only file functions which map the
+// whole file in memory, for unzOpen2_64. Opening fails for other modes, and
+// if the file can't be mapped (e.g. larger than the address space).
+void FillMmapFileFunc64(zlib_filefunc64_def* pzlib_filefunc_def);
+
+// Fills |pzlib_filefunc_def| with read-only file functions reading |range|
+// instead of a file, for unzOpen2_64; the file name is ignored. Each handle
+// has its own position, so several threads can read the same |range|, which
+// must outlive the handles.
+void FillReadMemoryFileFunc64(zlib_filefunc64_def* pzlib_filefunc_def,
+                              const MemoryRange* range);
+
+// Reserves the disk space of a |size| bytes file ahead of writing it
+// sequentially, without changing its size. Best effort: it's a no-op where
+// the filesystem or the platform doesn't support it.
+void PreallocateFile(FILE* file, ZPOS64_T size);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_ARCHIVE_IO_H_
@@ -0,0 +1,102 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_archive_job.h"
+
+#include <chrono>
+#include <map>
+
+namespace greenworks {
+
+namespace {
+
+std::map<int, ArchiveJob*>& RunningJobs() {
+  static std::map<int, ArchiveJob*> jobs;
+  return jobs;
+}
+
+int64_t NowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+ArchiveJob::ArchiveJob()
+    : cancelled_(false), entries_(0), total_entries_(0), bytes_in_(0),
+      bytes_out_(0), total_bytes_(0), interval_ns_(0), next_report_ns_(0) {
+}
+
+void ArchiveJob::SetProgressCallback(const ProgressCallback& callback,
+                                     int interval_ms) {
+  callback_ = callback;
+  interval_ns_ = static_cast<int64_t>(interval_ms) * 1000000;
+}
+
+void ArchiveJob::Start(uint64_t total_entries, uint64_t total_bytes) {
+  total_entries_ = total_entries;
+  total_bytes_ = total_bytes;
+  Report(true);
+}
+
+void ArchiveJob::AddBytes(uint64_t bytes_in, uint64_t bytes_out) {
+  bytes_in_ += bytes_in;
+  bytes_out_ += bytes_out;
+  Report(false);
+}
+
+void ArchiveJob::AddEntry() {
+  ++entries_;
+  Report(false);
+}
+
+void ArchiveJob::Finish() {
+  Report(true);
+}
+
+ArchiveProgress ArchiveJob::progress() const {
+  ArchiveProgress progress;
+  progress.entries = entries_;
+  progress.total_entries = total_entries_;
+  progress.bytes_in = bytes_in_;
+  progress.bytes_out = bytes_out_;
+  progress.total_bytes = total_bytes_;
+  return progress;
+}
+
+void ArchiveJob::Report(bool force) {
+  if (!callback_)
+    return;
+  int64_t now = NowNanoseconds();
+  int64_t next_report = next_report_ns_;
+  // Only the thread which moves the deadline reports, so the others never
+  // wait on the lock.
+  if (!force && (now < next_report || !next_report_ns_.compare_exchange_strong(
+                     next_report, now + interval_ns_)))
+    return;
+  if (force)
+    next_report_ns_ = now + interval_ns_;
+  std::lock_guard<std::mutex> lock(report_mutex_);
+  callback_(progress());
+}
+
+int RegisterArchiveJob(ArchiveJob* job) {
+  static int next_id = 1;
+  RunningJobs()[next_id] = job;
+  return next_id++;
+}
+
+void UnregisterArchiveJob(int id) {
+  RunningJobs().erase(id);
+}
+
+bool CancelArchiveJob(int id) {
+  std::map<int, ArchiveJob*>::iterator it = RunningJobs().find(id);
+  if (it == RunningJobs().end())
+    return false;
+  it->second->Cancel();
+  return true;
+}
+
+}  // namespace greenworks
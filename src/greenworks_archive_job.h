@@ -0,0 +1,85 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_ARCHIVE_JOB_H_
+#define SRC_GREENWORKS_ARCHIVE_JOB_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+namespace greenworks {
+
+// Returned by zip() and unzip() when their job was cancelled.
+const int kArchiveCancelled = -200;
+
+struct ArchiveProgress {
+  uint64_t entries;
+  uint64_t total_entries;
+  // The bytes consumed: source data when archiving, compressed data when
+  // extracting.
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  // The bytes_in of the whole job.
+  uint64_t total_bytes;
+};
+
+// Follows the progress of a zip() or unzip() call, and lets another thread
+// cancel it. The archiving threads update the counters as they go, and
+// check for cancellation between chunks.
+class ArchiveJob {
+ public:
+  typedef std::function<void(const ArchiveProgress&)> ProgressCallback;
+
+  ArchiveJob();
+
+  // |callback| is called on the archiving threads, one at a time, at most
+  // once per |interval_ms| and once more when the job ends. Set it before
+  // the job starts.
+  void SetProgressCallback(const ProgressCallback& callback, int interval_ms);
+
+  void Cancel() { cancelled_ = true; }
+  bool cancelled() const { return cancelled_; }
+
+  // Called by the archiver once the amount of work is known.
+  void Start(uint64_t total_entries, uint64_t total_bytes);
+  void AddBytes(uint64_t bytes_in, uint64_t bytes_out);
+  void AddEntry();
+  // Reports the progress regardless of the interval.
+  void Finish();
+
+  ArchiveProgress progress() const;
+
+ private:
+  void Report(bool force);
+
+  std::atomic<bool> cancelled_;
+  std::atomic<uint64_t> entries_;
+  std::atomic<uint64_t> total_entries_;
+  std::atomic<uint64_t> bytes_in_;
+  std::atomic<uint64_t> bytes_out_;
+  std::atomic<uint64_t> total_bytes_;
+
+  ProgressCallback callback_;
+  int64_t interval_ns_;
+  // The steady clock time before which nothing is reported.
+  std::atomic<int64_t> next_report_ns_;
+  std::mutex report_mutex_;
+
+  ArchiveJob(const ArchiveJob&);
+  void operator=(const ArchiveJob&);
+};
+
+// The jobs running for JS, by the id Utils.cancelArchive takes. Only used
+// from the main thread.
+int RegisterArchiveJob(ArchiveJob* job);
+void UnregisterArchiveJob(int id);
+// Returns false if no job runs with |id| (e.g. it already finished).
+bool CancelArchiveJob(int id);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_ARCHIVE_JOB_H_
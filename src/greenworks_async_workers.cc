@@ -4,73 +4,247 @@
 
 #include "greenworks_async_workers.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
 #include <sstream>
 #include <iomanip>
 #include "nan.h"
 #include "steam/steam_api.h"
 #include "v8.h"
 
+#include "greenworks_cloud_cache.h"
+#include "greenworks_crc32.h"
 #include "greenworks_unzip.h"
 #include "greenworks_zip.h"
 
 
+
+namespace greenworks {
+
 namespace {
 
-struct FilesContentContainer {
-  std::vector<char*> files_content;
-  ~FilesContentContainer() {
-    for (size_t i = 0; i < files_content.size(); ++i) {
-      delete[] files_content[i];
-    }
-  }
-};
+template <typename ArrayType, typename T>
+v8::Local<ArrayType> NewTypedArray(const std::vector<T>& values) {
+  v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(
+      v8::Isolate::GetCurrent(), values.size() * sizeof(T));
+  if (!values.empty())
+    memcpy(buffer->GetContents().Data(), &values[0],
+           values.size() * sizeof(T));
+  return ArrayType::New(buffer, 0, values.size());
+}
 
-};  // namespace
+v8::Local<v8::Object> NewZipStats(const ZipStats& zip_stats) {
+  v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+  stats->Set(Nan::New("entries").ToLocalChecked(),
+             Nan::New<v8::Number>(static_cast<double>(zip_stats.entries)));
+  stats->Set(Nan::New("reusedEntries").ToLocalChecked(),
+             Nan::New<v8::Number>(
+                 static_cast<double>(zip_stats.reused_entries)));
+  stats->Set(Nan::New("compressedEntries").ToLocalChecked(),
+             Nan::New<v8::Number>(static_cast<double>(
+                 zip_stats.entries - zip_stats.reused_entries)));
+  stats->Set(Nan::New("bytesRead").ToLocalChecked(),
+             Nan::New<v8::Number>(static_cast<double>(zip_stats.bytes_read)));
+  stats->Set(Nan::New("bytesWritten").ToLocalChecked(),
+             Nan::New<v8::Number>(
+                 static_cast<double>(zip_stats.bytes_written)));
 
-namespace greenworks {
+  // Keyed by the reason each entry was written the way it was.
+  static const char* const kClassNames[kZipEntryClassCount] = {
+    "deflated", "stored", "incompressibleExtension", "incompressibleEntropy",
+    "incompressibleTrial", "reused",
+  };
+  v8::Local<v8::Object> classes = Nan::New<v8::Object>();
+  for (int i = 0; i < kZipEntryClassCount; ++i) {
+    const ZipClassStats& class_stats = zip_stats.classes[i];
+    v8::Local<v8::Object> class_object = Nan::New<v8::Object>();
+    class_object->Set(Nan::New("entries").ToLocalChecked(),
+                      Nan::New<v8::Number>(
+                          static_cast<double>(class_stats.entries)));
+    class_object->Set(Nan::New("bytesIn").ToLocalChecked(),
+                      Nan::New<v8::Number>(
+                          static_cast<double>(class_stats.bytes_in)));
+    class_object->Set(Nan::New("bytesOut").ToLocalChecked(),
+                      Nan::New<v8::Number>(
+                          static_cast<double>(class_stats.bytes_out)));
+    // Compressed size over uncompressed size; 1 for empty classes.
+    double ratio = class_stats.bytes_in > 0 ?
+        static_cast<double>(class_stats.bytes_out) / class_stats.bytes_in : 1;
+    class_object->Set(Nan::New("ratio").ToLocalChecked(),
+                      Nan::New<v8::Number>(ratio));
+    classes->Set(Nan::New(kClassNames[i]).ToLocalChecked(), class_object);
+  }
+  stats->Set(Nan::New("classes").ToLocalChecked(), classes);
+  stats->Set(Nan::New("deflateSeconds").ToLocalChecked(),
+             Nan::New<v8::Number>(zip_stats.deflate_seconds));
+  stats->Set(Nan::New("secondsSaved").ToLocalChecked(),
+             Nan::New<v8::Number>(zip_stats.seconds_saved));
+  if (!zip_stats.content_hash.empty()) {
+    stats->Set(Nan::New("contentHash").ToLocalChecked(),
+               Nan::New(zip_stats.content_hash).ToLocalChecked());
+  }
+  v8::Local<v8::Array> skipped = Nan::New<v8::Array>(
+      static_cast<int>(zip_stats.skipped.size()));
+  for (size_t i = 0; i < zip_stats.skipped.size(); ++i) {
+    skipped->Set(static_cast<uint32_t>(i),
+                 Nan::New(zip_stats.skipped[i]).ToLocalChecked());
+  }
+  stats->Set(Nan::New("skipped").ToLocalChecked(), skipped);
+  return stats;
+}
+
+}  // namespace
 
 FileContentSaveWorker::FileContentSaveWorker(Nan::Callback* success_callback,
     Nan::Callback* error_callback, std::string file_name, std::string content):
         SteamAsyncWorker(success_callback, error_callback),
         file_name_(file_name),
-        content_(content) {
+        content_(content),
+        is_cached_(false) {
 }
 
 void FileContentSaveWorker::Execute() {
-  if (!SteamRemoteStorage()->FileWrite(
-      file_name_.c_str(), content_.c_str(), content_.size()))
-    SetErrorMessage("Error on writing to file.");
+  CloudWriteCache* cloud_write_cache = CloudWriteCache::GetInstance();
+  if (cloud_write_cache->IsEnabled()) {
+    cloud_write_cache->Put(file_name_, content_);
+    is_cached_ = true;
+    return;
+  }
+
+  std::string encoded;
+  EncodeCloudFile(content_.data(), content_.size(), &encoded, &stats_);
+  if (!encoded.empty())
+    content_.swap(encoded);
+}
+
+void FileContentSaveWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  // The cached content hasn't been encoded yet, see greenworks.flushCloud.
+  if (is_cached_) {
+    callback->Call(0, NULL);
+    return;
+  }
+
+  std::vector<FileWriteAsyncRequest::File> files(1);
+  files[0].file_name.swap(file_name_);
+  files[0].data.swap(content_);
+  // The request takes over the callbacks.
+  FileWriteAsyncRequest* request = new FileWriteAsyncRequest(callback,
+      error_callback_, &files, stats_, "Error on writing to file.");
+  callback = NULL;
+  error_callback_ = NULL;
+  request->Start();
 }
 
 FilesSaveWorker::FilesSaveWorker(Nan::Callback* success_callback,
-    Nan::Callback* error_callback, const std::vector<std::string>& files_path):
+    Nan::Callback* error_callback, const std::vector<std::string>& files_path,
+    const CloudQuotaOptions& quota_options):
         SteamAsyncWorker(success_callback, error_callback),
-        files_path_(files_path) {
+        files_path_(files_path),
+        quota_options_(quota_options) {
 }
 
 void FilesSaveWorker::Execute() {
-  FilesContentContainer container;
-  std::vector<int> files_content_length;
+  files_.resize(files_path_.size());
+  std::string encoded;
   for (size_t i = 0; i < files_path_.size(); ++i) {
-    char* content = NULL;
-    int length = 0;
-    if (!utils::ReadFile(files_path_[i].c_str(), &content, &length))
-      break;
-    container.files_content.push_back(content);
-    files_content_length.push_back(length);
+    FileWriteAsyncRequest::File& file = files_[i];
+    if (!utils::ReadFile(files_path_[i].c_str(), &file.data)) {
+      SetErrorMessage("Error on reading files.");
+      return;
+    }
+    file.file_name = utils::GetFileNameFromPath(files_path_[i]);
+    CloudFileStats file_stats;
+    EncodeCloudFile(file.data.data(), file.data.size(), &encoded,
+                    &file_stats);
+    if (!encoded.empty())
+      file.data.swap(encoded);
+    stats_.Add(file_stats);
   }
-  if (container.files_content.size() != files_path_.size()) {
-    SetErrorMessage("Error on reading files.");
+
+  if (quota_options_.enabled && !ApplyQuotaPlan())
     return;
+  if (quota_options_.dry_run)
+    return;
+  // A pending cached write of the same file would be flushed over this one.
+  for (size_t i = 0; i < files_.size(); ++i)
+    CloudWriteCache::GetInstance()->Discard(files_[i].file_name);
+}
+
+bool FilesSaveWorker::ApplyQuotaPlan() {
+  ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  uint64 total_bytes = 0;
+  uint64 available_bytes = 0;
+  if (!steam_remote_storage->GetQuota(&total_bytes, &available_bytes)) {
+    SetErrorMessage("Error on getting cloud quota.");
+    return false;
   }
-  for (size_t i = 0; i < files_path_.size(); ++i) {
-    std::string file_name = utils::GetFileNameFromPath(files_path_[i]);
-    if (!SteamRemoteStorage()->FileWrite(file_name.c_str(),
-        container.files_content[i], files_content_length[i])) {
-      SetErrorMessage("Error on writing file on Steam Cloud.");
-      return;
+
+  // Only the persisted files count against the quota.
+  std::vector<CloudFileInfo> cloud_files;
+  int32 file_count = steam_remote_storage->GetFileCount();
+  for (int32 i = 0; i < file_count; ++i) {
+    int32 file_size = 0;
+    const char* file_name =
+        steam_remote_storage->GetFileNameAndSize(i, &file_size);
+    if (!file_name || !steam_remote_storage->FilePersisted(file_name))
+      continue;
+    CloudFileInfo cloud_file = { file_name, static_cast<uint64>(file_size),
+        steam_remote_storage->GetFileTimestamp(file_name) };
+    cloud_files.push_back(cloud_file);
+  }
+  std::vector<CloudFileInfo> written_files;
+  for (size_t i = 0; i < files_.size(); ++i) {
+    CloudFileInfo written_file = { files_[i].file_name, files_[i].data.size(),
+                                   0 };
+    written_files.push_back(written_file);
+  }
+
+  PlanCloudWrite(cloud_files, written_files, available_bytes, quota_options_,
+                 &quota_plan_);
+  if (quota_options_.dry_run)
+    return true;
+  if (!quota_plan_.fits) {
+    SetErrorMessage("Not enough Steam Cloud quota.");
+    return false;
+  }
+  // Forgetting frees the quota but keeps the local copies, which the request
+  // persists again if a write fails, or deletes once they all succeed.
+  for (size_t i = 0; i < quota_plan_.evictions.size(); ++i) {
+    const char* file_name = quota_plan_.evictions[i].c_str();
+    if (!steam_remote_storage->FileForget(file_name)) {
+      for (size_t j = 0; j < i; ++j)
+        PersistForgottenFile(quota_plan_.evictions[j].c_str());
+      SetErrorMessage("Error on evicting file from Steam Cloud.");
+      return false;
     }
   }
+  return true;
+}
+
+void FilesSaveWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+  if (quota_options_.dry_run) {
+    v8::Local<v8::Value> argv[] = { ConvertToJsObject(stats_),
+                                    ConvertToJsObject(quota_plan_) };
+    callback->Call(2, argv);
+    return;
+  }
+
+  // The request takes over the callbacks.
+  FileWriteAsyncRequest* request = new FileWriteAsyncRequest(callback,
+      error_callback_, &files_, stats_,
+      "Error on writing file on Steam Cloud.");
+  if (quota_options_.enabled)
+    request->set_quota_plan(quota_plan_, quota_options_.delete_files);
+  callback = NULL;
+  error_callback_ = NULL;
+  request->Start();
 }
 
 FileDeleteWorker::FileDeleteWorker(Nan::Callback* success_callback,
@@ -81,9 +255,12 @@ FileDeleteWorker::FileDeleteWorker(Nan::Callback* success_callback,
 
 void FileDeleteWorker::Execute() {
   ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  bool was_pending = CloudWriteCache::GetInstance()->Discard(file_name_);
 
   if (!steam_remote_storage->FileExists(file_name_.c_str())) {
-    SetErrorMessage("File doesn't exist.");
+    // A file which has only been written to the cache is gone already.
+    if (!was_pending)
+      SetErrorMessage("File doesn't exist.");
     return;
   }
 
@@ -94,40 +271,303 @@ void FileDeleteWorker::Execute() {
 }
 
 FileReadWorker::FileReadWorker(Nan::Callback* success_callback,
-    Nan::Callback* error_callback, std::string file_name):
+    Nan::Callback* error_callback, std::string* content, bool is_encoded,
+    const std::string& error_message):
         SteamAsyncWorker(success_callback, error_callback),
-        file_name_(file_name) {
+        is_encoded_(is_encoded),
+        error_message_(error_message) {
+  content_.swap(*content);
 }
 
 void FileReadWorker::Execute() {
+  if (!error_message_.empty()) {
+    SetErrorMessage(error_message_.c_str());
+    return;
+  }
+  if (is_encoded_ && !DecodeCloudFile(&content_))
+    SetErrorMessage("Error on decompressing file.");
+}
+
+void FileReadWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  v8::Local<v8::Value> argv[] = { Nan::New(content_).ToLocalChecked() };
+  callback->Call(1, argv);
+}
+
+CloudFlushWorker::CloudFlushWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, bool force):
+        SteamAsyncWorker(success_callback, error_callback),
+        force_(force),
+        files_written_(0) {
+}
+
+void CloudFlushWorker::Execute() {
+  if (!CloudWriteCache::GetInstance()->Flush(force_, &files_written_,
+                                             &stats_))
+    SetErrorMessage("Error on writing files to Steam Cloud.");
+}
+
+void CloudFlushWorker::HandleOKCallback() {
+  // Background flushes scheduled by the cache have no callback.
+  if (!callback)
+    return;
+  Nan::HandleScope scope;
+  v8::Local<v8::Value> argv[] = { Nan::New(files_written_),
+                                  ConvertToJsObject(stats_) };
+  callback->Call(2, argv);
+}
+
+CloudSyncWorker::CloudSyncWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, const std::string& local_dir,
+    CloudSyncDirection direction):
+        SteamAsyncWorker(success_callback, error_callback),
+        direction_(direction),
+        state_(new CloudSyncState()) {
+  state_->local_dir = local_dir;
+}
+
+CloudSyncWorker::~CloudSyncWorker() {
+  delete state_;
+}
+
+void CloudSyncWorker::Execute() {
+  const std::string& local_dir = state_->local_dir;
+  CloudSyncManifest manifest;
+  if (!ReadCloudSyncManifest(local_dir, &manifest)) {
+    SetErrorMessage("Error on reading the cloud sync manifest.");
+    return;
+  }
+  std::vector<LocalFileState> local_files;
+  if (!HashLocalFiles(local_dir, manifest, &local_files)) {
+    SetErrorMessage("Error on hashing local files.");
+    return;
+  }
+
   ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  std::vector<CloudFileInfo> cloud_files;
+  int32 file_count = steam_remote_storage->GetFileCount();
+  for (int32 i = 0; i < file_count; ++i) {
+    int32 file_size = 0;
+    const char* file_name =
+        steam_remote_storage->GetFileNameAndSize(i, &file_size);
+    // Names which would resolve outside |local_dir| are never downloaded.
+    if (!file_name || kCloudSyncManifestName == std::string(file_name) ||
+        !IsSafeCloudFileName(file_name))
+      continue;
+    CloudFileInfo cloud_file = { file_name, static_cast<uint64>(file_size),
+        steam_remote_storage->GetFileTimestamp(file_name) };
+    cloud_files.push_back(cloud_file);
+  }
+  CloudSyncPlan& plan = state_->plan;
+  PlanCloudSync(local_files, cloud_files, manifest, direction_, &plan);
 
-  if (!steam_remote_storage->FileExists(file_name_.c_str())) {
-    SetErrorMessage("File doesn't exist.");
+  // Files which fail to transfer keep their old record, if any, so that the
+  // next sync retries them.
+  std::map<std::string, const LocalFileState*> local;
+  for (size_t i = 0; i < local_files.size(); ++i)
+    local[local_files[i].file_name] = &local_files[i];
+  CloudSyncManifest& synced_manifest = state_->manifest;
+  for (size_t i = 0; i < plan.unchanged.size(); ++i) {
+    const LocalFileState* file = local[plan.unchanged[i]];
+    CloudSyncRecord& record = synced_manifest[file->file_name];
+    record = manifest[file->file_name];
+    record.local_timestamp = file->timestamp;
+  }
+  for (size_t i = 0; i < plan.downloads.size(); ++i) {
+    if (manifest.count(plan.downloads[i]))
+      synced_manifest[plan.downloads[i]] = manifest[plan.downloads[i]];
+  }
+  for (size_t i = 0; i < plan.cloud_deletions.size(); ++i) {
+    const std::string& file_name = plan.cloud_deletions[i];
+    synced_manifest[file_name] = manifest[file_name];
+  }
+  for (size_t i = 0; i < plan.local_deletions.size(); ++i) {
+    const std::string& file_name = plan.local_deletions[i];
+    synced_manifest[file_name] = manifest[file_name];
+  }
+
+  for (size_t i = 0; i < plan.uploads.size(); ++i) {
+    const LocalFileState* file = local[plan.uploads[i]];
+    if (manifest.count(file->file_name))
+      synced_manifest[file->file_name] = manifest[file->file_name];
+    uint64 cloud_size = 0;
+    if (!UploadFile(file->file_name, &cloud_size)) {
+      SetErrorMessage("Error on writing file on Steam Cloud.");
+      break;
+    }
+    // Align the local timestamp with Steam Cloud, like the workshop sync.
+    std::string file_path = local_dir + "/" + file->file_name;
+    int64 timestamp =
+        steam_remote_storage->GetFileTimestamp(file->file_name.c_str());
+    utils::UpdateFileLastUpdatedTime(file_path.c_str(),
+                                     static_cast<time_t>(timestamp));
+    CloudSyncRecord record = { file->crc, file->size, cloud_size,
+        utils::GetFileLastUpdatedTime(file_path.c_str()), timestamp };
+    synced_manifest[file->file_name] = record;
+  }
+
+  // Deleted files drop their record; those which fail to delete keep it, so
+  // that the next sync retries them.
+  for (size_t i = 0; ErrorMessage() == NULL &&
+       i < plan.cloud_deletions.size(); ++i) {
+    const std::string& file_name = plan.cloud_deletions[i];
+    if (!steam_remote_storage->FileDelete(file_name.c_str())) {
+      SetErrorMessage("Error on deleting file on Steam Cloud.");
+      break;
+    }
+    synced_manifest.erase(file_name);
+  }
+  for (size_t i = 0; ErrorMessage() == NULL &&
+       i < plan.local_deletions.size(); ++i) {
+    const std::string& file_name = plan.local_deletions[i];
+    std::string file_path = local_dir + "/" + file_name;
+    if (remove(file_path.c_str()) != 0 && errno != ENOENT) {
+      SetErrorMessage("Error on deleting local file.");
+      break;
+    }
+    synced_manifest.erase(file_name);
+  }
+
+  // The downloads are driven by the Steam loop, see CloudSyncDownloadRequest;
+  // the last one writes the manifest.
+  if ((ErrorMessage() != NULL || plan.downloads.empty()) &&
+      !WriteCloudSyncManifest(local_dir, synced_manifest) &&
+      ErrorMessage() == NULL)
+    SetErrorMessage("Error on writing the cloud sync manifest.");
+}
+
+bool CloudSyncWorker::UploadFile(const std::string& file_name,
+                                 uint64* cloud_size) {
+  // Compressing takes the whole file, as saveFilesToCloud does.
+  std::string content;
+  if (!utils::ReadFile((state_->local_dir + "/" + file_name).c_str(),
+                       &content))
+    return false;
+  std::string encoded;
+  CloudFileStats stats;
+  EncodeCloudFile(content.data(), content.size(), &encoded, &stats);
+  const std::string& data = encoded.empty() ? content : encoded;
+
+  ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  UGCFileWriteStreamHandle_t handle =
+      steam_remote_storage->FileWriteStreamOpen(file_name.c_str());
+  if (handle == k_UGCFileStreamHandleInvalid)
+    return false;
+  for (size_t offset = 0; offset < data.size();
+       offset += kCloudSyncChunkSize) {
+    int32 chunk_size = static_cast<int32>(std::min<size_t>(
+        kCloudSyncChunkSize, data.size() - offset));
+    if (!steam_remote_storage->FileWriteStreamWriteChunk(
+            handle, data.data() + offset, chunk_size)) {
+      steam_remote_storage->FileWriteStreamCancel(handle);
+      return false;
+    }
+  }
+  *cloud_size = data.size();
+  return steam_remote_storage->FileWriteStreamClose(handle);
+}
+
+void CloudSyncWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+  if (state_->plan.downloads.empty()) {
+    v8::Local<v8::Value> argv[] = { ConvertToJsObject(state_->plan) };
+    callback->Call(1, argv);
     return;
   }
 
-  int32 file_size = steam_remote_storage->GetFileSize(file_name_.c_str());
+  // The request takes over the callbacks and the state.
+  CloudSyncDownloadRequest* request = new CloudSyncDownloadRequest(callback,
+      error_callback_, state_);
+  callback = NULL;
+  error_callback_ = NULL;
+  state_ = NULL;
+  request->Start();
+}
 
-  char* content = new char[file_size+1];
-  int32 end_pos = steam_remote_storage->FileRead(
-      file_name_.c_str(), content, file_size);
-  content[end_pos] = '\0';
+CloudSyncWriteWorker::CloudSyncWriteWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, CloudSyncState* state,
+    std::string* content, const std::string& error_message):
+        SteamAsyncWorker(success_callback, error_callback),
+        state_(state),
+        error_message_(error_message) {
+  content_.swap(*content);
+}
 
-  if (end_pos == 0 && file_size > 0) {
-    SetErrorMessage("Error on reading file.");
-  } else {
-    content_ = std::string(content);
+CloudSyncWriteWorker::~CloudSyncWriteWorker() {
+  delete state_;
+}
+
+void CloudSyncWriteWorker::Execute() {
+  if (error_message_.empty()) {
+    const std::string& file_name =
+        state_->plan.downloads[state_->next_download];
+    CloudSyncRecord record;
+    record.cloud_size = content_.size();
+    if (!DecodeCloudFile(&content_)) {
+      error_message_ = "Error on decompressing file.";
+    } else if (WriteDownload(file_name, &record)) {
+      state_->manifest[file_name] = record;
+      ++state_->next_download;
+    } else {
+      error_message_ = "Error on writing file on local machine.";
+    }
+  }
+  // Record the files synced so far when the sync ends, however it ends.
+  bool is_last = !error_message_.empty() ||
+      state_->next_download == state_->plan.downloads.size();
+  if (is_last && !WriteCloudSyncManifest(state_->local_dir, state_->manifest) &&
+      error_message_.empty())
+    error_message_ = "Error on writing the cloud sync manifest.";
+  if (!error_message_.empty())
+    SetErrorMessage(error_message_.c_str());
+}
+
+bool CloudSyncWriteWorker::WriteDownload(const std::string& file_name,
+                                         CloudSyncRecord* record) {
+  std::string file_path = state_->local_dir + "/" + file_name;
+  std::string download_path = file_path + kCloudSyncDownloadSuffix;
+  if (!utils::CreateParentDirectories(file_path))
+    return false;
+  std::ofstream fout(download_path.c_str(), std::ios::out|std::ios::binary);
+  if (!fout.is_open())
+    return false;
+  fout.write(content_.data(), content_.size());
+  fout.close();
+  if (fout.fail()) {
+    std::remove(download_path.c_str());
+    return false;
   }
+  // rename() doesn't replace an existing file on Windows.
+  std::remove(file_path.c_str());
+  if (std::rename(download_path.c_str(), file_path.c_str()))
+    return false;
 
-  delete[] content;
+  record->crc = Crc32(0, content_.data(), content_.size());
+  record->size = content_.size();
+  record->cloud_timestamp =
+      SteamRemoteStorage()->GetFileTimestamp(file_name.c_str());
+  if (!utils::UpdateFileLastUpdatedTime(file_path.c_str(),
+          static_cast<time_t>(record->cloud_timestamp)))
+    return false;
+  record->local_timestamp = utils::GetFileLastUpdatedTime(file_path.c_str());
+  return true;
 }
 
-void FileReadWorker::HandleOKCallback() {
+void CloudSyncWriteWorker::HandleOKCallback() {
   Nan::HandleScope scope;
+  if (state_->next_download == state_->plan.downloads.size()) {
+    v8::Local<v8::Value> argv[] = { ConvertToJsObject(state_->plan) };
+    callback->Call(1, argv);
+    return;
+  }
 
-  v8::Local<v8::Value> argv[] = { Nan::New(content_).ToLocalChecked() };
-  callback->Call(1, argv);
+  CloudSyncDownloadRequest* request = new CloudSyncDownloadRequest(callback,
+      error_callback_, state_);
+  callback = NULL;
+  error_callback_ = NULL;
+  state_ = NULL;
+  request->Start();
 }
 
 CloudQuotaGetWorker::CloudQuotaGetWorker(Nan::Callback* success_callback,
@@ -251,40 +691,533 @@ void GetNumberOfPlayersWorker::HandleOKCallback() {
   callback->Call(1, argv);
 }
 
+ArchiveProgressWorker::ArchiveProgressWorker(
+    Nan::Callback* success_callback, Nan::Callback* error_callback,
+    Nan::Callback* progress_callback, int progress_interval)
+        : SteamAsyncProgressWorker(success_callback, error_callback),
+          job_id_(RegisterArchiveJob(&job_)),
+          progress_callback_(progress_callback),
+          progress_interval_(progress_interval) {
+}
+
+ArchiveProgressWorker::~ArchiveProgressWorker() {
+  UnregisterArchiveJob(job_id_);
+  delete progress_callback_;
+}
+
+void ArchiveProgressWorker::Execute(const ExecutionProgress& progress) {
+  if (progress_callback_) {
+    // Only the latest progress sent is delivered to the main thread.
+    job_.SetProgressCallback([&progress](const ArchiveProgress& current) {
+      progress.Send(reinterpret_cast<const char*>(&current), sizeof(current));
+    }, progress_interval_);
+  }
+  ExecuteJob();
+  job_.SetProgressCallback(ArchiveJob::ProgressCallback(), 0);
+}
+
+void ArchiveProgressWorker::HandleProgressCallback(const char* data,
+                                                   size_t size) {
+  if (!progress_callback_ || size != sizeof(ArchiveProgress))
+    return;
+  Nan::HandleScope scope;
+  ArchiveProgress current;
+  memcpy(&current, data, sizeof(current));
+  v8::Local<v8::Object> progress = Nan::New<v8::Object>();
+  progress->Set(Nan::New("entries").ToLocalChecked(),
+                Nan::New<v8::Number>(static_cast<double>(current.entries)));
+  progress->Set(Nan::New("totalEntries").ToLocalChecked(),
+                Nan::New<v8::Number>(
+                    static_cast<double>(current.total_entries)));
+  progress->Set(Nan::New("bytesIn").ToLocalChecked(),
+                Nan::New<v8::Number>(static_cast<double>(current.bytes_in)));
+  progress->Set(Nan::New("bytesOut").ToLocalChecked(),
+                Nan::New<v8::Number>(static_cast<double>(current.bytes_out)));
+  progress->Set(Nan::New("totalBytes").ToLocalChecked(),
+                Nan::New<v8::Number>(
+                    static_cast<double>(current.total_bytes)));
+  v8::Local<v8::Value> argv[] = { progress };
+  progress_callback_->Call(1, argv);
+}
+
 CreateArchiveWorker::CreateArchiveWorker(Nan::Callback* success_callback,
-    Nan::Callback* error_callback, const std::string& zip_file_path,
+    Nan::Callback* error_callback, Nan::Callback* progress_callback,
+    int progress_interval, const std::string& zip_file_path,
     const std::string& source_dir, const std::string& password,
-    int compress_level)
-        :SteamAsyncWorker(success_callback, error_callback),
-         zip_file_path_(zip_file_path),
-         source_dir_(source_dir),
-         password_(password),
-         compress_level_(compress_level) {
+    int compress_level, const ZipOptions& options)
+        : ArchiveProgressWorker(success_callback, error_callback,
+                                progress_callback, progress_interval),
+          zip_file_path_(zip_file_path),
+          source_dir_(source_dir),
+          password_(password),
+          compress_level_(compress_level),
+          options_(options) {
+  options_.job = job();
 }
 
-void CreateArchiveWorker::Execute() {
+void CreateArchiveWorker::ExecuteJob() {
   int result = zip(zip_file_path_.c_str(),
                    source_dir_.c_str(),
                    compress_level_,
-                   password_.empty()?NULL:password_.c_str());
-  if (result)
+                   password_.empty()?NULL:password_.c_str(),
+                   options_,
+                   &stats_);
+  if (result == kArchiveCancelled)
+    SetErrorMessage("Archive job cancelled.");
+  else if (result)
+    SetErrorMessage(options_.update ? "Error on updating zip file."
+                                    : "Error on creating zip file.");
+}
+
+void CreateArchiveWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+  v8::Local<v8::Value> argv[] = { NewZipStats(stats_) };
+  callback->Call(1, argv);
+}
+
+CreateArchiveFromBuffersWorker::CreateArchiveFromBuffersWorker(
+    Nan::Callback* success_callback, Nan::Callback* error_callback,
+    const std::vector<ZipBufferEntry>& entries, const std::string& password,
+    int compress_level, const ZipOptions& options,
+    const std::string& cloud_file)
+        : SteamAsyncWorker(success_callback, error_callback),
+          entries_(entries),
+          password_(password),
+          compress_level_(compress_level),
+          options_(options),
+          cloud_file_(cloud_file) {
+}
+
+void CreateArchiveFromBuffersWorker::Execute() {
+  int result = zip_buffers(entries_, compress_level_,
+                           password_.empty()?NULL:password_.c_str(),
+                           &archive_, options_, &stats_);
+  if (result) {
     SetErrorMessage("Error on creating zip file.");
+    return;
+  }
+  if (cloud_file_.empty()) {
+    if (archive_.size() > 0x7fffffff)
+      SetErrorMessage("The zip file is too large for a Buffer.");
+    return;
+  }
+
+  // Stream the archive to Steam Cloud straight from memory.
+  ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  UGCFileWriteStreamHandle_t handle =
+      steam_remote_storage->FileWriteStreamOpen(cloud_file_.c_str());
+  if (handle == k_UGCFileStreamHandleInvalid) {
+    SetErrorMessage("Error on opening the cloud file.");
+    return;
+  }
+  for (size_t offset = 0; offset < archive_.size();
+       offset += kCloudSyncChunkSize) {
+    int32 chunk_size = static_cast<int32>(std::min<size_t>(
+        kCloudSyncChunkSize, archive_.size() - offset));
+    if (!steam_remote_storage->FileWriteStreamWriteChunk(
+            handle, archive_.data() + offset, chunk_size)) {
+      steam_remote_storage->FileWriteStreamCancel(handle);
+      SetErrorMessage("Error on writing to the cloud file.");
+      return;
+    }
+  }
+  if (!steam_remote_storage->FileWriteStreamClose(handle))
+    SetErrorMessage("Error on writing to the cloud file.");
+}
+
+void CreateArchiveFromBuffersWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  v8::Local<v8::Value> archive = Nan::Undefined();
+  if (cloud_file_.empty()) {
+    // The Buffer takes ownership of the archive, without a copy.
+    uint32_t size = static_cast<uint32_t>(archive_.size());
+    archive = Nan::NewBuffer(archive_.Release(), size).ToLocalChecked();
+  }
+  v8::Local<v8::Value> argv[] = { archive, NewZipStats(stats_) };
+  callback->Call(2, argv);
 }
 
 ExtractArchiveWorker::ExtractArchiveWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, Nan::Callback* progress_callback,
+    int progress_interval, const std::string& zip_file_path,
+    const std::string& extract_path, const std::string& password,
+    const UnzipOptions& options)
+        : ArchiveProgressWorker(success_callback, error_callback,
+                                progress_callback, progress_interval),
+          zip_file_path_(zip_file_path),
+          extract_path_(extract_path),
+          password_(password),
+          options_(options) {
+  options_.job = job();
+}
+
+void ExtractArchiveWorker::ExecuteJob() {
+  int result = unzip(zip_file_path_.c_str(), extract_path_.c_str(),
+      password_.empty()?NULL:password_.c_str(), options_);
+  if (result == kArchiveCancelled)
+    SetErrorMessage("Archive job cancelled.");
+  else if (result)
+    SetErrorMessage("Error on extracting zip file.");
+}
+
+ExtractArchiveFromBufferWorker::ExtractArchiveFromBufferWorker(
+    Nan::Callback* success_callback, Nan::Callback* error_callback,
+    Nan::Callback* progress_callback, int progress_interval,
+    const char* data, size_t size, const std::string& extract_path,
+    const std::string& password, const UnzipOptions& options)
+        : ArchiveProgressWorker(success_callback, error_callback,
+                                progress_callback, progress_interval),
+          data_(data),
+          size_(size),
+          extract_path_(extract_path),
+          password_(password),
+          options_(options) {
+  options_.job = job();
+}
+
+ExtractArchiveFromBufferWorker::~ExtractArchiveFromBufferWorker() {
+  for (size_t i = 0; i < entries_.size(); ++i)
+    free(entries_[i].content);
+}
+
+void ExtractArchiveFromBufferWorker::ExecuteJob() {
+  const char* password = password_.empty()?NULL:password_.c_str();
+  int result = extract_path_.empty() ?
+      unzip_buffer_to_memory(data_, size_, password, &entries_, options_) :
+      unzip_buffer(data_, size_, extract_path_.c_str(), password, options_);
+  if (result == kArchiveCancelled)
+    SetErrorMessage("Archive job cancelled.");
+  else if (result)
+    SetErrorMessage("Error on extracting zip file.");
+}
+
+void ExtractArchiveFromBufferWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  if (!extract_path_.empty()) {
+    callback->Call(0, NULL);
+    return;
+  }
+  v8::Local<v8::Array> entries = Nan::New<v8::Array>(
+      static_cast<int>(entries_.size()));
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    v8::Local<v8::Object> entry = Nan::New<v8::Object>();
+    entry->Set(Nan::New("name").ToLocalChecked(),
+               Nan::New(entries_[i].name).ToLocalChecked());
+    // The Buffer takes ownership of the malloc'ed content, without a copy.
+    entry->Set(Nan::New("content").ToLocalChecked(),
+               Nan::NewBuffer(entries_[i].content,
+                              static_cast<uint32_t>(entries_[i].size))
+                   .ToLocalChecked());
+    entries_[i].content = NULL;
+    entries->Set(static_cast<uint32_t>(i), entry);
+  }
+  v8::Local<v8::Value> argv[] = { entries };
+  callback->Call(1, argv);
+}
+
+VerifyArchiveWorker::VerifyArchiveWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, Nan::Callback* progress_callback,
+    int progress_interval, const std::string& zip_file_path,
+    const std::string& password, const UnzipOptions& options)
+        : ArchiveProgressWorker(success_callback, error_callback,
+                                progress_callback, progress_interval),
+          zip_file_path_(zip_file_path),
+          password_(password),
+          options_(options) {
+  options_.job = job();
+}
+
+void VerifyArchiveWorker::ExecuteJob() {
+  int result = unzip_verify(zip_file_path_.c_str(),
+      password_.empty()?NULL:password_.c_str(), &corrupt_, options_);
+  if (result == kArchiveCancelled)
+    SetErrorMessage("Archive job cancelled.");
+  else if (result)
+    SetErrorMessage("Error on reading zip file.");
+}
+
+void VerifyArchiveWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  v8::Local<v8::Array> corrupt = Nan::New<v8::Array>(
+      static_cast<int>(corrupt_.size()));
+  for (size_t i = 0; i < corrupt_.size(); ++i) {
+    v8::Local<v8::Object> entry = Nan::New<v8::Object>();
+    entry->Set(Nan::New("name").ToLocalChecked(),
+               Nan::New(corrupt_[i].name).ToLocalChecked());
+    entry->Set(Nan::New("error").ToLocalChecked(),
+               Nan::New(unzip_error_description(corrupt_[i].error))
+                   .ToLocalChecked());
+    corrupt->Set(static_cast<uint32_t>(i), entry);
+  }
+  v8::Local<v8::Value> argv[] = { corrupt };
+  callback->Call(1, argv);
+}
+
+ExtractEntriesWorker::ExtractEntriesWorker(Nan::Callback* success_callback,
     Nan::Callback* error_callback, const std::string& zip_file_path,
-    const std::string& extract_path, const std::string& password)
+    const std::vector<std::string>& patterns,
+    const std::string& extract_path, const std::string& password,
+    const UnzipOptions& options)
         : SteamAsyncWorker(success_callback, error_callback),
           zip_file_path_(zip_file_path),
+          patterns_(patterns),
           extract_path_(extract_path),
-          password_(password) {
+          password_(password),
+          options_(options),
+          extracted_(0) {
 }
 
-void ExtractArchiveWorker::Execute() {
-  int result = unzip(zip_file_path_.c_str(), extract_path_.c_str(),
-      password_.empty()?NULL:password_.c_str());
+void ExtractEntriesWorker::Execute() {
+  int result = unzip_entries(zip_file_path_.c_str(), extract_path_.c_str(),
+      password_.empty()?NULL:password_.c_str(), patterns_, options_,
+      &extracted_);
   if (result)
-    SetErrorMessage("Error on extracting zip file.");
+    SetErrorMessage("Error on extracting zip file entries.");
+}
+
+void ExtractEntriesWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  v8::Local<v8::Value> argv[] = {
+      Nan::New<v8::Number>(static_cast<double>(extracted_)) };
+  callback->Call(1, argv);
+}
+
+ReadArchiveEntryWorker::ReadArchiveEntryWorker(
+    Nan::Callback* success_callback, Nan::Callback* error_callback,
+    const std::string& zip_file_path, const std::string& entry_name,
+    const std::string& password)
+        : SteamAsyncWorker(success_callback, error_callback),
+          zip_file_path_(zip_file_path),
+          entry_name_(entry_name),
+          password_(password),
+          content_(NULL),
+          size_(0) {
+}
+
+ReadArchiveEntryWorker::~ReadArchiveEntryWorker() {
+  free(content_);
+}
+
+void ReadArchiveEntryWorker::Execute() {
+  int result = unzip_entry(zip_file_path_.c_str(), entry_name_.c_str(),
+      password_.empty()?NULL:password_.c_str(), &content_, &size_);
+  if (result)
+    SetErrorMessage("Error on reading zip file entry.");
+}
+
+void ReadArchiveEntryWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  // The Buffer takes ownership of the malloc'ed content, without a copy.
+  v8::Local<v8::Value> argv[] = {
+      Nan::NewBuffer(content_, static_cast<uint32_t>(size_)).ToLocalChecked()
+  };
+  content_ = NULL;
+  callback->Call(1, argv);
+}
+
+ListArchiveWorker::ListArchiveWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, const std::string& zip_file_path,
+    const std::string& index_path, bool use_mmap)
+        : SteamAsyncWorker(success_callback, error_callback),
+          zip_file_path_(zip_file_path),
+          index_path_(index_path),
+          use_mmap_(use_mmap),
+          from_index_(false) {
+}
+
+void ListArchiveWorker::Execute() {
+  if (!index_path_.empty() &&
+      ReadArchiveIndex(index_path_, zip_file_path_.c_str(), &listing_)) {
+    from_index_ = true;
+    return;
+  }
+  if (ListArchive(zip_file_path_.c_str(), use_mmap_, &listing_) != 0) {
+    SetErrorMessage("Error on listing zip file.");
+    return;
+  }
+  // The index only saves a later scan; failing to write it isn't an error.
+  if (!index_path_.empty())
+    WriteArchiveIndex(index_path_, zip_file_path_.c_str(), listing_);
+}
+
+void ListArchiveWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  v8::Local<v8::Array> names = Nan::New<v8::Array>(
+      static_cast<int>(listing_.size()));
+  for (size_t i = 0; i < listing_.size(); ++i)
+    names->Set(i, Nan::New(listing_.names[i]).ToLocalChecked());
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  result->Set(Nan::New("count").ToLocalChecked(),
+              Nan::New<v8::Number>(static_cast<double>(listing_.size())));
+  result->Set(Nan::New("names").ToLocalChecked(), names);
+  result->Set(Nan::New("compressedSizes").ToLocalChecked(),
+              NewTypedArray<v8::Float64Array>(listing_.compressed_sizes));
+  result->Set(Nan::New("uncompressedSizes").ToLocalChecked(),
+              NewTypedArray<v8::Float64Array>(listing_.uncompressed_sizes));
+  result->Set(Nan::New("crcs").ToLocalChecked(),
+              NewTypedArray<v8::Uint32Array>(listing_.crcs));
+  result->Set(Nan::New("offsets").ToLocalChecked(),
+              NewTypedArray<v8::Float64Array>(listing_.offsets));
+  result->Set(Nan::New("times").ToLocalChecked(),
+              NewTypedArray<v8::Float64Array>(listing_.times));
+  result->Set(Nan::New("fromIndex").ToLocalChecked(),
+              Nan::New(from_index_));
+  v8::Local<v8::Value> argv[] = { result };
+  callback->Call(1, argv);
+}
+
+CopyDirectoryWorker::CopyDirectoryWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, Nan::Callback* progress_callback,
+    int progress_interval, const std::string& source_path,
+    const std::string& target_path, bool move, const CopyOptions& options)
+        : ArchiveProgressWorker(success_callback, error_callback,
+                                progress_callback, progress_interval),
+          source_path_(source_path),
+          target_path_(target_path),
+          move_(move),
+          options_(options) {
+  options_.job = job();
+}
+
+void CopyDirectoryWorker::ExecuteJob() {
+  std::string error;
+  bool succeeded = move_ ?
+      MoveDirectory(source_path_, target_path_, options_, &error) :
+      CopyDirectory(source_path_, target_path_, options_, &error);
+  if (succeeded)
+    return;
+  if (job()->cancelled())
+    SetErrorMessage("Archive job cancelled.");
+  else
+    SetErrorMessage(error.c_str());
+}
+
+HashDirectoryWorker::HashDirectoryWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, Nan::Callback* progress_callback,
+    int progress_interval, const std::string& dir,
+    const HashDirectoryOptions& options)
+        : ArchiveProgressWorker(success_callback, error_callback,
+                                progress_callback, progress_interval),
+          dir_(dir),
+          options_(options) {
+  options_.job = job();
+}
+
+void HashDirectoryWorker::ExecuteJob() {
+  std::string error;
+  if (HashDirectory(dir_, options_, &manifest_, &error))
+    return;
+  if (job()->cancelled())
+    SetErrorMessage("Archive job cancelled.");
+  else
+    SetErrorMessage(error.c_str());
+}
+
+void HashDirectoryWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  v8::Local<v8::Array> files = Nan::New<v8::Array>(
+      static_cast<int>(manifest_.size()));
+  for (size_t i = 0; i < manifest_.size(); ++i) {
+    v8::Local<v8::Object> file = Nan::New<v8::Object>();
+    file->Set(Nan::New("path").ToLocalChecked(),
+              Nan::New(manifest_[i].path).ToLocalChecked());
+    file->Set(Nan::New("size").ToLocalChecked(),
+              Nan::New<v8::Number>(static_cast<double>(manifest_[i].size)));
+    file->Set(Nan::New("mtime").ToLocalChecked(),
+              Nan::New<v8::Number>(static_cast<double>(manifest_[i].time)));
+    file->Set(Nan::New("hash").ToLocalChecked(),
+              Nan::New(manifest_[i].hash).ToLocalChecked());
+    files->Set(static_cast<uint32_t>(i), file);
+  }
+  v8::Local<v8::Object> manifest = Nan::New<v8::Object>();
+  manifest->Set(Nan::New("algorithm").ToLocalChecked(),
+                Nan::New(HashAlgorithmName(options_.algorithm))
+                    .ToLocalChecked());
+  manifest->Set(Nan::New("files").ToLocalChecked(), files);
+  v8::Local<v8::Value> argv[] = { manifest };
+  callback->Call(1, argv);
+}
+
+CreatePatchWorker::CreatePatchWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, Nan::Callback* progress_callback,
+    int progress_interval, const std::string& old_path,
+    const std::string& new_path, const std::string& patch_path,
+    bool directory, const PatchOptions& options)
+        : ArchiveProgressWorker(success_callback, error_callback,
+                                progress_callback, progress_interval),
+          old_path_(old_path),
+          new_path_(new_path),
+          patch_path_(patch_path),
+          directory_(directory),
+          options_(options) {
+  options_.job = job();
+}
+
+void CreatePatchWorker::ExecuteJob() {
+  std::string error;
+  bool succeeded = directory_ ?
+      CreateDirectoryPatch(old_path_, new_path_, patch_path_, options_,
+                           &stats_, &error) :
+      CreatePatch(old_path_, new_path_, patch_path_, options_, &stats_,
+                  &error);
+  if (succeeded)
+    return;
+  if (job()->cancelled())
+    SetErrorMessage("Archive job cancelled.");
+  else
+    SetErrorMessage(error.c_str());
+}
+
+void CreatePatchWorker::HandleOKCallback() {
+  Nan::HandleScope scope;
+
+  v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+  stats->Set(Nan::New("files").ToLocalChecked(),
+             Nan::New<v8::Number>(static_cast<double>(stats_.files)));
+  stats->Set(Nan::New("copiedBytes").ToLocalChecked(),
+             Nan::New<v8::Number>(static_cast<double>(stats_.copied_bytes)));
+  stats->Set(Nan::New("insertedBytes").ToLocalChecked(),
+             Nan::New<v8::Number>(
+                 static_cast<double>(stats_.inserted_bytes)));
+  stats->Set(Nan::New("patchSize").ToLocalChecked(),
+             Nan::New<v8::Number>(static_cast<double>(stats_.patch_size)));
+  v8::Local<v8::Value> argv[] = { stats };
+  callback->Call(1, argv);
+}
+
+ApplyPatchWorker::ApplyPatchWorker(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, Nan::Callback* progress_callback,
+    int progress_interval, const std::string& old_path,
+    const std::string& patch_path, const std::string& new_path,
+    bool directory, const PatchOptions& options)
+        : ArchiveProgressWorker(success_callback, error_callback,
+                                progress_callback, progress_interval),
+          old_path_(old_path),
+          patch_path_(patch_path),
+          new_path_(new_path),
+          directory_(directory),
+          options_(options) {
+  options_.job = job();
+}
+
+void ApplyPatchWorker::ExecuteJob() {
+  std::string error;
+  bool succeeded = directory_ ?
+      ApplyDirectoryPatch(old_path_, patch_path_, options_, &error) :
+      ApplyPatch(old_path_, patch_path_, new_path_, options_, &error);
+  if (succeeded)
+    return;
+  if (job()->cancelled())
+    SetErrorMessage("Archive job cancelled.");
+  else
+    SetErrorMessage(error.c_str());
 }
 
 GetAuthSessionTicketWorker::GetAuthSessionTicketWorker(
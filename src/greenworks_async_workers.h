@@ -11,7 +11,18 @@
 #include "steam/steam_api.h"
 
 #include "steam_async_worker.h"
+#include "greenworks_archive_index.h"
+#include "greenworks_archive_io.h"
+#include "greenworks_archive_job.h"
+#include "greenworks_cloud_compression.h"
+#include "greenworks_cloud_requests.h"
+#include "greenworks_cloud_sync.h"
+#include "greenworks_directory_hash.h"
+#include "greenworks_file_copy.h"
+#include "greenworks_patch.h"
+#include "greenworks_unzip.h"
 #include "greenworks_utils.h"
+#include "greenworks_zip.h"
 #include "greenworks_workshop_workers.h"
 #include "greenworks_matchmaking_workers.h"
 
@@ -26,37 +37,52 @@ class FileContentSaveWorker : public SteamAsyncWorker {
 
   // Override NanAsyncWorker methods.
   virtual void Execute();
+  virtual void HandleOKCallback();
 
  private:
   std::string file_name_;
   std::string content_;
+  bool is_cached_;
+  CloudFileStats stats_;
 };
 
 class FilesSaveWorker : public SteamAsyncWorker {
  public:
   FilesSaveWorker(Nan::Callback* success_callback,
                   Nan::Callback* error_callback,
-                  const std::vector<std::string>& files_path);
+                  const std::vector<std::string>& files_path,
+                  const CloudQuotaOptions& quota_options);
 
   // Override NanAsyncWorker methods.
   virtual void Execute();
+  virtual void HandleOKCallback();
 
  private:
+  // Makes room for |files_| on Steam Cloud according to |quota_options_|.
+  bool ApplyQuotaPlan();
+
   std::vector<std::string> files_path_;
+  std::vector<FileWriteAsyncRequest::File> files_;
+  CloudFileStats stats_;
+  CloudQuotaOptions quota_options_;
+  CloudQuotaPlan quota_plan_;
 };
 
+// Decodes the content read by a FileReadAsyncRequest on a worker thread.
 class FileReadWorker : public SteamAsyncWorker {
  public:
+  // Takes |content|. A non-empty |error_message| fails the read.
   FileReadWorker(Nan::Callback* success_callback, Nan::Callback* error_callback,
-      std::string file_name);
+      std::string* content, bool is_encoded, const std::string& error_message);
 
   // Override NanAsyncWorker methods.
   virtual void Execute();
   virtual void HandleOKCallback();
 
  private:
-  std::string file_name_;
   std::string content_;
+  bool is_encoded_;
+  std::string error_message_;
 };
 
 class FileDeleteWorker : public SteamAsyncWorker {
@@ -72,6 +98,72 @@ class FileDeleteWorker : public SteamAsyncWorker {
   std::string file_name_;
 };
 
+class CloudFlushWorker : public SteamAsyncWorker {
+ public:
+  CloudFlushWorker(Nan::Callback* success_callback,
+                   Nan::Callback* error_callback,
+                   bool force);
+
+  // Override NanAsyncWorker methods.
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+ private:
+  bool force_;
+  int files_written_;
+  CloudFileStats stats_;
+};
+
+// Plans a sync and uploads on a worker thread; the downloads are then read
+// by a CloudSyncDownloadRequest and written by a CloudSyncWriteWorker, one
+// file after the other.
+class CloudSyncWorker : public SteamAsyncWorker {
+ public:
+  CloudSyncWorker(Nan::Callback* success_callback,
+                  Nan::Callback* error_callback,
+                  const std::string& local_dir,
+                  CloudSyncDirection direction);
+  ~CloudSyncWorker();
+
+  // Override NanAsyncWorker methods.
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+ private:
+  // Uploads a local file, compressed if enabled, and sets |cloud_size| to
+  // the size stored.
+  bool UploadFile(const std::string& file_name, uint64* cloud_size);
+
+  CloudSyncDirection direction_;
+  // Handed over to the downloads, if any.
+  CloudSyncState* state_;
+};
+
+// Writes the file a CloudSyncDownloadRequest read on a worker thread, then
+// starts the next download, or calls the success callback after the last.
+class CloudSyncWriteWorker : public SteamAsyncWorker {
+ public:
+  // Takes |state| and |content|. A non-empty |error_message| fails the sync,
+  // once the files synced so far are recorded in the manifest.
+  CloudSyncWriteWorker(Nan::Callback* success_callback,
+                       Nan::Callback* error_callback,
+                       CloudSyncState* state,
+                       std::string* content,
+                       const std::string& error_message);
+  ~CloudSyncWriteWorker();
+
+  // Override NanAsyncWorker methods.
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+ private:
+  bool WriteDownload(const std::string& file_name, CloudSyncRecord* record);
+
+  CloudSyncState* state_;
+  std::string content_;
+  std::string error_message_;
+};
+
 class CloudQuotaGetWorker : public SteamAsyncWorker {
  public:
   CloudQuotaGetWorker(Nan::Callback* success_callback,
@@ -142,40 +234,318 @@ class GetNumberOfPlayersWorker : public SteamCallbackAsyncWorker {
   CCallResult<GetNumberOfPlayersWorker, NumberOfCurrentPlayers_t> call_result_;
 };
 
-class CreateArchiveWorker : public SteamAsyncWorker {
+// The base of the archive workers which report their progress to
+// |progress_callback| (if any) every |progress_interval| ms at most, and can
+// be cancelled through job_id().
+class ArchiveProgressWorker : public SteamAsyncProgressWorker {
+ public:
+  ArchiveProgressWorker(Nan::Callback* success_callback,
+                        Nan::Callback* error_callback,
+                        Nan::Callback* progress_callback,
+                        int progress_interval);
+  ~ArchiveProgressWorker();
+
+  int job_id() const { return job_id_; }
+
+  // Override NanAsyncProgressWorker methods.
+  virtual void Execute(const ExecutionProgress& progress);
+  virtual void HandleProgressCallback(const char* data, size_t size);
+
+ protected:
+  // Runs the archiving on the worker thread, with job() in its options.
+  virtual void ExecuteJob() = 0;
+
+  ArchiveJob* job() { return &job_; }
+
+ private:
+  ArchiveJob job_;
+  int job_id_;
+  Nan::Callback* progress_callback_;
+  int progress_interval_;
+};
+
+class CreateArchiveWorker : public ArchiveProgressWorker {
  public:
   CreateArchiveWorker(Nan::Callback* success_callback,
                       Nan::Callback* error_callback,
+                      Nan::Callback* progress_callback,
+                      int progress_interval,
                       const std::string& zip_file_path,
                       const std::string& source_dir,
                       const std::string& password,
-                      int compress_level);
+                      int compress_level,
+                      const ZipOptions& options);
 
-  // Override NanAsyncWorker methods.
-  virtual void Execute();
+  // Override ArchiveProgressWorker methods.
+  virtual void ExecuteJob();
+  virtual void HandleOKCallback();
 
  private:
   std::string zip_file_path_;
   std::string source_dir_;
   std::string password_;
   int compress_level_;
+  ZipOptions options_;
+  ZipStats stats_;
+};
+
+class CreateArchiveFromBuffersWorker : public SteamAsyncWorker {
+ public:
+  // The |entries| point into Buffers the caller keeps alive with
+  // SaveToPersistent. If |cloud_file| isn't empty, the archive is written
+  // to that Steam Cloud file instead of being passed back as a Buffer.
+  CreateArchiveFromBuffersWorker(Nan::Callback* success_callback,
+                                 Nan::Callback* error_callback,
+                                 const std::vector<ZipBufferEntry>& entries,
+                                 const std::string& password,
+                                 int compress_level,
+                                 const ZipOptions& options,
+                                 const std::string& cloud_file);
+
+  // Override NanAsyncWorker methods.
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+ private:
+  std::vector<ZipBufferEntry> entries_;
+  std::string password_;
+  int compress_level_;
+  ZipOptions options_;
+  std::string cloud_file_;
+  MemoryBuffer archive_;
+  ZipStats stats_;
 };
 
-class ExtractArchiveWorker : public SteamAsyncWorker {
+class ExtractArchiveWorker : public ArchiveProgressWorker {
  public:
   ExtractArchiveWorker(Nan::Callback* success_callback,
                        Nan::Callback* error_callback,
+                       Nan::Callback* progress_callback,
+                       int progress_interval,
                        const std::string& zip_file_path,
                        const std::string& extract_path,
-                       const std::string& password);
+                       const std::string& password,
+                       const UnzipOptions& options);
+
+  // Override ArchiveProgressWorker methods.
+  virtual void ExecuteJob();
+
+ private:
+  std::string zip_file_path_;
+  std::string extract_path_;
+  std::string password_;
+  UnzipOptions options_;
+};
+
+class ExtractArchiveFromBufferWorker : public ArchiveProgressWorker {
+ public:
+  // |data| points into a Buffer the caller keeps alive with
+  // SaveToPersistent. The archive is extracted to |extract_path|, or in
+  // memory and passed back as Buffers if it's empty.
+  ExtractArchiveFromBufferWorker(Nan::Callback* success_callback,
+                                 Nan::Callback* error_callback,
+                                 Nan::Callback* progress_callback,
+                                 int progress_interval,
+                                 const char* data,
+                                 size_t size,
+                                 const std::string& extract_path,
+                                 const std::string& password,
+                                 const UnzipOptions& options);
+  ~ExtractArchiveFromBufferWorker();
+
+  // Override ArchiveProgressWorker methods.
+  virtual void ExecuteJob();
+  virtual void HandleOKCallback();
+
+ private:
+  const char* data_;
+  size_t size_;
+  std::string extract_path_;
+  std::string password_;
+  UnzipOptions options_;
+  // The contents are handed over to the Buffers passed to the success
+  // callback.
+  std::vector<UnzipMemoryEntry> entries_;
+};
+
+class VerifyArchiveWorker : public ArchiveProgressWorker {
+ public:
+  VerifyArchiveWorker(Nan::Callback* success_callback,
+                      Nan::Callback* error_callback,
+                      Nan::Callback* progress_callback,
+                      int progress_interval,
+                      const std::string& zip_file_path,
+                      const std::string& password,
+                      const UnzipOptions& options);
+
+  // Override ArchiveProgressWorker methods.
+  virtual void ExecuteJob();
+  virtual void HandleOKCallback();
+
+ private:
+  std::string zip_file_path_;
+  std::string password_;
+  UnzipOptions options_;
+  std::vector<CorruptEntry> corrupt_;
+};
+
+class ExtractEntriesWorker : public SteamAsyncWorker {
+ public:
+  ExtractEntriesWorker(Nan::Callback* success_callback,
+                       Nan::Callback* error_callback,
+                       const std::string& zip_file_path,
+                       const std::vector<std::string>& patterns,
+                       const std::string& extract_path,
+                       const std::string& password,
+                       const UnzipOptions& options);
 
   // Override NanAsyncWorker methods.
   virtual void Execute();
+  virtual void HandleOKCallback();
 
  private:
   std::string zip_file_path_;
+  std::vector<std::string> patterns_;
   std::string extract_path_;
   std::string password_;
+  UnzipOptions options_;
+  size_t extracted_;
+};
+
+class ReadArchiveEntryWorker : public SteamAsyncWorker {
+ public:
+  ReadArchiveEntryWorker(Nan::Callback* success_callback,
+                         Nan::Callback* error_callback,
+                         const std::string& zip_file_path,
+                         const std::string& entry_name,
+                         const std::string& password);
+  ~ReadArchiveEntryWorker();
+
+  // Override NanAsyncWorker methods.
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+ private:
+  std::string zip_file_path_;
+  std::string entry_name_;
+  std::string password_;
+  // Handed over to the Buffer passed to the success callback.
+  char* content_;
+  size_t size_;
+};
+
+class ListArchiveWorker : public SteamAsyncWorker {
+ public:
+  // |index_path| is the sidecar index to read the listing from, or to save it
+  // to; empty to always read the central directory.
+  ListArchiveWorker(Nan::Callback* success_callback,
+                    Nan::Callback* error_callback,
+                    const std::string& zip_file_path,
+                    const std::string& index_path,
+                    bool use_mmap);
+
+  // Override NanAsyncWorker methods.
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+ private:
+  std::string zip_file_path_;
+  std::string index_path_;
+  bool use_mmap_;
+  bool from_index_;
+  ArchiveListing listing_;
+};
+
+class CopyDirectoryWorker : public ArchiveProgressWorker {
+ public:
+  // Moves rather than copies if |move|.
+  CopyDirectoryWorker(Nan::Callback* success_callback,
+                      Nan::Callback* error_callback,
+                      Nan::Callback* progress_callback,
+                      int progress_interval,
+                      const std::string& source_path,
+                      const std::string& target_path,
+                      bool move,
+                      const CopyOptions& options);
+
+  // Override ArchiveProgressWorker methods.
+  virtual void ExecuteJob();
+
+ private:
+  std::string source_path_;
+  std::string target_path_;
+  bool move_;
+  CopyOptions options_;
+};
+
+class HashDirectoryWorker : public ArchiveProgressWorker {
+ public:
+  HashDirectoryWorker(Nan::Callback* success_callback,
+                      Nan::Callback* error_callback,
+                      Nan::Callback* progress_callback,
+                      int progress_interval,
+                      const std::string& dir,
+                      const HashDirectoryOptions& options);
+
+  // Override ArchiveProgressWorker methods.
+  virtual void ExecuteJob();
+  virtual void HandleOKCallback();
+
+ private:
+  std::string dir_;
+  HashDirectoryOptions options_;
+  std::vector<ManifestEntry> manifest_;
+};
+
+class CreatePatchWorker : public ArchiveProgressWorker {
+ public:
+  // Patches directories rather than files if |directory|.
+  CreatePatchWorker(Nan::Callback* success_callback,
+                    Nan::Callback* error_callback,
+                    Nan::Callback* progress_callback,
+                    int progress_interval,
+                    const std::string& old_path,
+                    const std::string& new_path,
+                    const std::string& patch_path,
+                    bool directory,
+                    const PatchOptions& options);
+
+  // Override ArchiveProgressWorker methods.
+  virtual void ExecuteJob();
+  virtual void HandleOKCallback();
+
+ private:
+  std::string old_path_;
+  std::string new_path_;
+  std::string patch_path_;
+  bool directory_;
+  PatchOptions options_;
+  PatchStats stats_;
+};
+
+class ApplyPatchWorker : public ArchiveProgressWorker {
+ public:
+  // Patches the directory |old_path| in place if |directory|, in which case
+  // |new_path| is unused.
+  ApplyPatchWorker(Nan::Callback* success_callback,
+                   Nan::Callback* error_callback,
+                   Nan::Callback* progress_callback,
+                   int progress_interval,
+                   const std::string& old_path,
+                   const std::string& patch_path,
+                   const std::string& new_path,
+                   bool directory,
+                   const PatchOptions& options);
+
+  // Override ArchiveProgressWorker methods.
+  virtual void ExecuteJob();
+
+ private:
+  std::string old_path_;
+  std::string patch_path_;
+  std::string new_path_;
+  bool directory_;
+  PatchOptions options_;
 };
 
 class GetAuthSessionTicketWorker : public SteamCallbackAsyncWorker {
@@ -0,0 +1,188 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_cloud_cache.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "nan.h"
+#include "steam/steam_api.h"
+
+#include "greenworks_async_workers.h"
+
+namespace greenworks {
+
+namespace {
+
+// The timer checks for idle files this many times per window.
+const int kTimerTicksPerWindow = 4;
+const int kMinTimerInterval = 10;
+
+int64 NowInMilliseconds() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void on_timer_close_complete(uv_handle_t* handle) {
+  delete reinterpret_cast<uv_timer_t*>(handle);
+}
+
+#if NAUV_UVVERSION < 0x000b17
+void RunCloudWriteCacheTimer(uv_timer_t* handle, int status_code) {
+#else
+void RunCloudWriteCacheTimer(uv_timer_t* handle) {
+#endif
+  CloudWriteCache::GetInstance()->OnTimer();
+}
+
+}  // namespace
+
+CloudWriteCache::CloudWriteCache()
+    : delay_(0), next_version_(0), flush_queued_(false), timer_(NULL) {}
+
+CloudWriteCache* CloudWriteCache::GetInstance() {
+  static CloudWriteCache cloud_write_cache;
+  return &cloud_write_cache;
+}
+
+void CloudWriteCache::SetDelay(int milliseconds) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    delay_ = std::max(milliseconds, 0);
+  }
+  if (timer_) {
+    uv_timer_stop(timer_);
+    if (milliseconds <= 0) {
+      uv_close(reinterpret_cast<uv_handle_t*>(timer_),
+               on_timer_close_complete);
+      timer_ = NULL;
+      // Nothing collapses into the pending writes any more.
+      QueueFlush(true);
+      return;
+    }
+  } else if (milliseconds > 0) {
+    timer_ = new uv_timer_t();
+    uv_timer_init(uv_default_loop(), timer_);
+    // The cache timer alone shouldn't keep the process alive.
+    uv_unref(reinterpret_cast<uv_handle_t*>(timer_));
+  }
+  if (timer_) {
+    int interval = std::max(milliseconds / kTimerTicksPerWindow,
+                            kMinTimerInterval);
+    uv_timer_start(timer_, &RunCloudWriteCacheTimer, interval, interval);
+  }
+}
+
+bool CloudWriteCache::IsEnabled() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return delay_ > 0;
+}
+
+void CloudWriteCache::Put(const std::string& file_name,
+                          const std::string& content) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry& entry = entries_[file_name];
+  entry.content = content;
+  entry.version = ++next_version_;
+  entry.deadline = NowInMilliseconds() + delay_;
+}
+
+bool CloudWriteCache::Get(const std::string& file_name, std::string* content) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<std::string, Entry>::const_iterator it = entries_.find(file_name);
+  if (it == entries_.end())
+    return false;
+  *content = it->second.content;
+  return true;
+}
+
+bool CloudWriteCache::Discard(const std::string& file_name) {
+  std::lock_guard<std::mutex> write_lock(write_mutex_);
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.erase(file_name) > 0;
+}
+
+bool CloudWriteCache::Flush(bool force, int* files_written,
+                            CloudFileStats* stats) {
+  std::lock_guard<std::mutex> write_lock(write_mutex_);
+
+  std::vector<PendingWrite> writes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!force)
+      flush_queued_ = false;
+    int64 now = NowInMilliseconds();
+    for (std::map<std::string, Entry>::const_iterator it = entries_.begin();
+         it != entries_.end(); ++it) {
+      if (!force && it->second.deadline > now)
+        continue;
+      PendingWrite write = { it->first, it->second.content,
+                             it->second.version };
+      writes.push_back(write);
+    }
+  }
+
+  bool success = true;
+  *files_written = 0;
+  ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  std::string encoded;
+  for (size_t i = 0; i < writes.size(); ++i) {
+    const PendingWrite& write = writes[i];
+    CloudFileStats file_stats;
+    EncodeCloudFile(write.content.data(), write.content.size(), &encoded,
+                    &file_stats);
+    const std::string& data = encoded.empty() ? write.content : encoded;
+    bool written = steam_remote_storage->FileWrite(write.file_name.c_str(),
+        data.data(), static_cast<int32>(data.size()));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, Entry>::iterator it = entries_.find(write.file_name);
+    if (!written) {
+      success = false;
+      // Retry on a later flush unless a newer value has already rescheduled
+      // the file.
+      if (it != entries_.end() && it->second.version == write.version)
+        it->second.deadline = NowInMilliseconds() + delay_;
+      continue;
+    }
+    ++*files_written;
+    stats->Add(file_stats);
+    // Keep the entry if it has been overwritten while we were writing.
+    if (it != entries_.end() && it->second.version == write.version)
+      entries_.erase(it);
+  }
+  return success;
+}
+
+void CloudWriteCache::OnTimer() {
+  if (HasExpiredEntries())
+    QueueFlush(false);
+}
+
+bool CloudWriteCache::HasExpiredEntries() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (flush_queued_)
+    return false;
+  int64 now = NowInMilliseconds();
+  for (std::map<std::string, Entry>::const_iterator it = entries_.begin();
+       it != entries_.end(); ++it) {
+    if (it->second.deadline <= now)
+      return true;
+  }
+  return false;
+}
+
+void CloudWriteCache::QueueFlush(bool force) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.empty())
+      return;
+    if (!force)
+      flush_queued_ = true;
+  }
+  Nan::AsyncQueueWorker(new CloudFlushWorker(NULL, NULL, force));
+}
+
+}  // namespace greenworks
@@ -0,0 +1,89 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_CLOUD_CACHE_H_
+#define SRC_GREENWORKS_CLOUD_CACHE_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "steam/steamtypes.h"
+#include "uv.h"
+
+#include "greenworks_cloud_compression.h"
+
+namespace greenworks {
+
+// A write-back cache for Steam Cloud text files. Repeated writes to the same
+// file within the delay window collapse into the last value, which is written
+// to Steam Cloud once the file has been idle for the whole window.
+//
+// Put/Get/Discard/Flush are thread-safe; SetDelay must be called on the main
+// thread since it owns the uv timer that schedules the background flushes.
+class CloudWriteCache {
+ public:
+  static CloudWriteCache* GetInstance();
+
+  // Sets the debounce window. 0 disables the cache and flushes the pending
+  // writes in background.
+  void SetDelay(int milliseconds);
+  bool IsEnabled();
+
+  // Stores |content| as the pending value of |file_name|.
+  void Put(const std::string& file_name, const std::string& content);
+
+  // Returns true and fills |content| if |file_name| has not been written to
+  // Steam Cloud yet.
+  bool Get(const std::string& file_name, std::string* content);
+
+  // Drops the pending value of |file_name|, waiting for an in-progress flush
+  // to finish so that it can't be resurrected after a delete. Returns true if
+  // there was a pending value.
+  bool Discard(const std::string& file_name);
+
+  // Writes the pending files to Steam Cloud on the calling thread. Only the
+  // files idle for the whole window are written unless |force| is true.
+  // Returns false if any write failed; failed files stay pending.
+  bool Flush(bool force, int* files_written, CloudFileStats* stats);
+
+  // Called by the uv timer on the main thread; queues a background flush if
+  // any pending file has been idle for the whole window.
+  void OnTimer();
+
+ private:
+  CloudWriteCache();
+
+  struct Entry {
+    std::string content;
+    uint64 version;
+    int64 deadline;
+  };
+
+  struct PendingWrite {
+    std::string file_name;
+    std::string content;
+    uint64 version;
+  };
+
+  bool HasExpiredEntries();
+  void QueueFlush(bool force);
+
+  // Guards |entries_|, |delay_|, |next_version_| and |flush_queued_|.
+  std::mutex mutex_;
+  // Serializes the actual writes so that two flushes never reorder the
+  // versions of one file.
+  std::mutex write_mutex_;
+
+  std::map<std::string, Entry> entries_;
+  int delay_;
+  uint64 next_version_;
+  bool flush_queued_;
+  uv_timer_t* timer_;
+};
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_CLOUD_CACHE_H_
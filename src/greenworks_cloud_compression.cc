@@ -0,0 +1,98 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_cloud_compression.h"
+
+#include <atomic>
+#include <cstring>
+
+#include "zlib/zlib.h"
+
+namespace greenworks {
+
+namespace {
+
+const char kMagic[] = { '\0', 'G', 'W', 'Z' };
+// Deflate can't do better than about 1032:1, so a larger raw size in the
+// header means the file is corrupted.
+const uint64 kMaxDeflateRatio = 1032;
+
+std::atomic<int> g_compression_threshold(-1);
+
+bool HasCompressionHeader(const std::string& content) {
+  return content.size() >= kCloudCompressionHeaderSize &&
+         memcmp(content.data(), kMagic, sizeof(kMagic)) == 0;
+}
+
+}  // namespace
+
+void SetCloudCompressionThreshold(int threshold) {
+  g_compression_threshold = threshold;
+}
+
+int GetCloudCompressionThreshold() {
+  return g_compression_threshold;
+}
+
+void EncodeCloudFile(const char* data, size_t size, std::string* out,
+                     CloudFileStats* stats) {
+  out->clear();
+  stats->raw_bytes = size;
+  stats->stored_bytes = size;
+
+  int threshold = g_compression_threshold;
+  if (threshold < 0 || size < static_cast<size_t>(threshold))
+    return;
+
+  uLongf compressed_size = compressBound(size);
+  out->resize(kCloudCompressionHeaderSize + compressed_size);
+  char* header = &(*out)[0];
+  memcpy(header, kMagic, sizeof(kMagic));
+  header[sizeof(kMagic)] = static_cast<char>(kCloudCodecDeflate);
+  for (int i = 0; i < 8; ++i)
+    header[sizeof(kMagic) + 1 + i] = static_cast<char>(
+        (static_cast<uint64>(size) >> (8 * i)) & 0xff);
+
+  int err = compress2(
+      reinterpret_cast<Bytef*>(header + kCloudCompressionHeaderSize),
+      &compressed_size, reinterpret_cast<const Bytef*>(data), size,
+      Z_DEFAULT_COMPRESSION);
+  // Store incompressible data raw.
+  if (err != Z_OK ||
+      kCloudCompressionHeaderSize + compressed_size >= size) {
+    out->clear();
+    return;
+  }
+  out->resize(kCloudCompressionHeaderSize + compressed_size);
+  stats->stored_bytes = out->size();
+}
+
+bool DecodeCloudFile(std::string* content) {
+  if (!HasCompressionHeader(*content))
+    return true;
+  const unsigned char* header =
+      reinterpret_cast<const unsigned char*>(content->data());
+  if (header[sizeof(kMagic)] != kCloudCodecDeflate)
+    return false;
+  uint64 raw_size = 0;
+  for (int i = 0; i < 8; ++i)
+    raw_size |= static_cast<uint64>(header[sizeof(kMagic) + 1 + i]) << (8 * i);
+
+  if (raw_size > content->size() * kMaxDeflateRatio)
+    return false;
+
+  std::string raw(static_cast<size_t>(raw_size), '\0');
+  uLongf dest_size = static_cast<uLongf>(raw_size);
+  int err = uncompress(
+      reinterpret_cast<Bytef*>(raw_size ? &raw[0] : NULL), &dest_size,
+      reinterpret_cast<const Bytef*>(content->data() +
+                                     kCloudCompressionHeaderSize),
+      content->size() - kCloudCompressionHeaderSize);
+  if (err != Z_OK || dest_size != raw_size)
+    return false;
+  content->swap(raw);
+  return true;
+}
+
+}  // namespace greenworks
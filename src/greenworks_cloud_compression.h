@@ -0,0 +1,51 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_CLOUD_COMPRESSION_H_
+#define SRC_GREENWORKS_CLOUD_COMPRESSION_H_
+
+#include <string>
+
+#include "steam/steamtypes.h"
+
+namespace greenworks {
+
+// Compressed cloud files start with a 13 bytes header:
+//   magic     4 bytes  "\0GWZ"
+//   codec     1 byte   kCloudCodecDeflate
+//   raw size  8 bytes  little endian
+// Files without the header are stored raw, which keeps the files written by
+// older versions readable.
+const int kCloudCodecDeflate = 1;
+const size_t kCloudCompressionHeaderSize = 13;
+
+struct CloudFileStats {
+  CloudFileStats() : raw_bytes(0), stored_bytes(0) {}
+  void Add(const CloudFileStats& other) {
+    raw_bytes += other.raw_bytes;
+    stored_bytes += other.stored_bytes;
+  }
+
+  uint64 raw_bytes;
+  uint64 stored_bytes;
+};
+
+// Enables compressing the cloud files of at least |threshold| bytes. A
+// negative |threshold| disables it.
+void SetCloudCompressionThreshold(int threshold);
+int GetCloudCompressionThreshold();
+
+// Encodes |size| bytes of |data| into the cloud file format, compressing it if
+// enabled and worthwhile. |out| is left empty when the data should be stored
+// as is, so that the callers can avoid a copy.
+void EncodeCloudFile(const char* data, size_t size, std::string* out,
+                     CloudFileStats* stats);
+
+// Decodes a cloud file in place. Returns false if it has a compression header
+// but can't be decompressed.
+bool DecodeCloudFile(std::string* content);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_CLOUD_COMPRESSION_H_
@@ -0,0 +1,97 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_cloud_quota.h"
+
+#include <algorithm>
+#include <map>
+
+namespace greenworks {
+
+namespace {
+
+bool IsOlder(const CloudFileInfo* a, const CloudFileInfo* b) {
+  if (a->timestamp != b->timestamp)
+    return a->timestamp < b->timestamp;
+  return a->file_name < b->file_name;
+}
+
+// Returns the index of the first prefix matching |file_name|, or -1.
+int GetPrefixPriority(const std::string& file_name,
+                      const std::vector<std::string>& prefixes) {
+  for (size_t i = 0; i < prefixes.size(); ++i) {
+    if (file_name.compare(0, prefixes[i].size(), prefixes[i]) == 0)
+      return static_cast<int>(i);
+  }
+  return -1;
+}
+
+}  // namespace
+
+void PlanCloudWrite(const std::vector<CloudFileInfo>& cloud_files,
+                    const std::vector<CloudFileInfo>& files,
+                    uint64 available_bytes,
+                    const CloudQuotaOptions& options,
+                    CloudQuotaPlan* plan) {
+  std::map<std::string, uint64> written_sizes;
+  for (size_t i = 0; i < files.size(); ++i)
+    written_sizes[files[i].file_name] = files[i].size;
+
+  // Overwritten files give their old size back.
+  uint64 released_bytes = 0;
+  std::vector<const CloudFileInfo*> candidates;
+  for (size_t i = 0; i < cloud_files.size(); ++i) {
+    const CloudFileInfo& cloud_file = cloud_files[i];
+    if (written_sizes.count(cloud_file.file_name))
+      released_bytes += cloud_file.size;
+    else
+      candidates.push_back(&cloud_file);
+  }
+  uint64 written_bytes = 0;
+  for (std::map<std::string, uint64>::const_iterator it =
+           written_sizes.begin(); it != written_sizes.end(); ++it) {
+    written_bytes += it->second;
+  }
+
+  plan->needed_bytes =
+      written_bytes > released_bytes ? written_bytes - released_bytes : 0;
+  plan->available_bytes = available_bytes;
+  plan->freed_bytes = 0;
+  plan->evictions.clear();
+  plan->fits = plan->needed_bytes <= available_bytes;
+  if (plan->fits || options.policy == kCloudEvictNone)
+    return;
+
+  std::sort(candidates.begin(), candidates.end(), IsOlder);
+  if (options.policy == kCloudEvictByPriorityPrefix) {
+    std::vector<const CloudFileInfo*> prioritized;
+    for (size_t prefix = 0; prefix < options.priority_prefixes.size();
+         ++prefix) {
+      for (size_t i = 0; i < candidates.size(); ++i) {
+        if (GetPrefixPriority(candidates[i]->file_name,
+                              options.priority_prefixes) ==
+            static_cast<int>(prefix))
+          prioritized.push_back(candidates[i]);
+      }
+    }
+    candidates.swap(prioritized);
+  }
+
+  uint64 deficit = plan->needed_bytes - available_bytes;
+  for (size_t i = 0; i < candidates.size() && plan->freed_bytes < deficit;
+       ++i) {
+    // Empty files don't help.
+    if (candidates[i]->size == 0)
+      continue;
+    plan->evictions.push_back(candidates[i]->file_name);
+    plan->freed_bytes += candidates[i]->size;
+  }
+  plan->fits = plan->freed_bytes >= deficit;
+  if (!plan->fits) {
+    plan->evictions.clear();
+    plan->freed_bytes = 0;
+  }
+}
+
+}  // namespace greenworks
@@ -0,0 +1,67 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_CLOUD_QUOTA_H_
+#define SRC_GREENWORKS_CLOUD_QUOTA_H_
+
+#include <string>
+#include <vector>
+
+#include "steam/steamtypes.h"
+
+namespace greenworks {
+
+struct CloudFileInfo {
+  std::string file_name;
+  uint64 size;
+  int64 timestamp;
+};
+
+enum CloudEvictionPolicy {
+  // Never evicts, the write fails early if it doesn't fit.
+  kCloudEvictNone,
+  // Evicts the files with the oldest timestamp first.
+  kCloudEvictOldestFirst,
+  // Evicts the files matching the first prefix first, then the second one,
+  // etc.; the oldest first within a prefix. Other files are never evicted.
+  kCloudEvictByPriorityPrefix,
+};
+
+struct CloudQuotaOptions {
+  CloudQuotaOptions()
+      : enabled(false), policy(kCloudEvictNone), delete_files(false),
+        dry_run(false) {}
+
+  bool enabled;
+  CloudEvictionPolicy policy;
+  std::vector<std::string> priority_prefixes;
+  // Uses FileDelete instead of FileForget, which keeps the local copy.
+  bool delete_files;
+  // Only computes the plan.
+  bool dry_run;
+};
+
+struct CloudQuotaPlan {
+  CloudQuotaPlan()
+      : needed_bytes(0), available_bytes(0), freed_bytes(0), fits(false) {}
+
+  uint64 needed_bytes;
+  uint64 available_bytes;
+  uint64 freed_bytes;
+  std::vector<std::string> evictions;
+  bool fits;
+};
+
+// Plans writing |files| given the persisted |cloud_files| and the
+// |available_bytes| of the quota. Overwriting a file releases its old size,
+// and the files being written are never evicted.
+void PlanCloudWrite(const std::vector<CloudFileInfo>& cloud_files,
+                    const std::vector<CloudFileInfo>& files,
+                    uint64 available_bytes,
+                    const CloudQuotaOptions& options,
+                    CloudQuotaPlan* plan);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_CLOUD_QUOTA_H_
@@ -0,0 +1,302 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_cloud_requests.h"
+
+#include <algorithm>
+
+#include "greenworks_async_workers.h"
+#include "greenworks_cloud_cache.h"
+
+namespace greenworks {
+
+FileWriteAsyncRequest::Write::Write(FileWriteAsyncRequest* request,
+                                    File* file)
+    : request_(request) {
+  file_.file_name.swap(file->file_name);
+  file_.data.swap(file->data);
+}
+
+bool FileWriteAsyncRequest::Write::Start() {
+  // The data has to stay alive until the write completes.
+  SteamAPICall_t steam_api_call = SteamRemoteStorage()->FileWriteAsync(
+      file_.file_name.c_str(), file_.data.data(),
+      static_cast<uint32>(file_.data.size()));
+  if (steam_api_call == k_uAPICallInvalid)
+    return false;
+  call_result_.Set(steam_api_call, this, &Write::OnWriteCompleted);
+  return true;
+}
+
+void FileWriteAsyncRequest::Write::OnWriteCompleted(
+    RemoteStorageFileWriteAsyncComplete_t* result, bool io_failure) {
+  request_->OnWriteCompleted(!io_failure && result->m_eResult == k_EResultOK);
+}
+
+FileWriteAsyncRequest::FileWriteAsyncRequest(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, std::vector<File>* files,
+    const CloudFileStats& stats, const std::string& error_message)
+        : success_callback_(success_callback),
+          error_callback_(error_callback),
+          stats_(stats),
+          has_quota_plan_(false),
+          delete_evicted_(false),
+          error_message_(error_message),
+          pending_writes_(0),
+          failed_(false) {
+  for (size_t i = 0; i < files->size(); ++i)
+    writes_.push_back(new Write(this, &(*files)[i]));
+}
+
+FileWriteAsyncRequest::~FileWriteAsyncRequest() {
+  for (size_t i = 0; i < writes_.size(); ++i)
+    delete writes_[i];
+  delete success_callback_;
+  delete error_callback_;
+}
+
+void FileWriteAsyncRequest::Start() {
+  for (size_t i = 0; i < writes_.size(); ++i) {
+    if (!writes_[i]->Start()) {
+      failed_ = true;
+      break;
+    }
+    ++pending_writes_;
+  }
+  if (pending_writes_ == 0)
+    Complete();
+}
+
+void FileWriteAsyncRequest::OnWriteCompleted(bool success) {
+  if (!success)
+    failed_ = true;
+  if (--pending_writes_ == 0)
+    Complete();
+}
+
+void FileWriteAsyncRequest::SettleEvictions() {
+  ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  for (size_t i = 0; i < quota_plan_.evictions.size(); ++i) {
+    const char* file_name = quota_plan_.evictions[i].c_str();
+    if (!failed_) {
+      if (delete_evicted_)
+        steam_remote_storage->FileDelete(file_name);
+      continue;
+    }
+    PersistForgottenFile(file_name);
+  }
+}
+
+void FileWriteAsyncRequest::Complete() {
+  Nan::HandleScope scope;
+  if (has_quota_plan_)
+    SettleEvictions();
+  if (failed_) {
+    if (error_callback_) {
+      v8::Local<v8::Value> argv[] = {
+          Nan::New(error_message_).ToLocalChecked() };
+      error_callback_->Call(1, argv);
+    }
+  } else {
+    v8::Local<v8::Value> argv[] = { ConvertToJsObject(stats_),
+                                    Nan::Undefined() };
+    if (has_quota_plan_)
+      argv[1] = ConvertToJsObject(quota_plan_);
+    success_callback_->Call(2, argv);
+  }
+  delete this;
+}
+
+FileReadAsyncRequest::FileReadAsyncRequest(Nan::Callback* success_callback,
+    Nan::Callback* error_callback, const std::string& file_name)
+        : success_callback_(success_callback),
+          error_callback_(error_callback),
+          file_name_(file_name) {
+}
+
+void FileReadAsyncRequest::Start() {
+  // Serve the files which haven't been flushed to Steam Cloud yet.
+  if (CloudWriteCache::GetInstance()->Get(file_name_, &content_)) {
+    Complete(false, std::string());
+    return;
+  }
+
+  ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  if (!steam_remote_storage->FileExists(file_name_.c_str())) {
+    Complete(false, "File doesn't exist.");
+    return;
+  }
+
+  int32 file_size = steam_remote_storage->GetFileSize(file_name_.c_str());
+  SteamAPICall_t steam_api_call = steam_remote_storage->FileReadAsync(
+      file_name_.c_str(), 0, static_cast<uint32>(file_size));
+  if (steam_api_call == k_uAPICallInvalid) {
+    Complete(false, "Error on reading file.");
+    return;
+  }
+  call_result_.Set(steam_api_call, this,
+      &FileReadAsyncRequest::OnReadCompleted);
+}
+
+void FileReadAsyncRequest::OnReadCompleted(
+    RemoteStorageFileReadAsyncComplete_t* result, bool io_failure) {
+  if (io_failure || result->m_eResult != k_EResultOK) {
+    Complete(false, "Error on reading file.");
+    return;
+  }
+  content_.resize(result->m_cubRead);
+  if (result->m_cubRead > 0 && !SteamRemoteStorage()->FileReadAsyncComplete(
+          result->m_hFileReadAsync, &content_[0], result->m_cubRead)) {
+    Complete(false, "Error on reading file.");
+    return;
+  }
+  Complete(true, std::string());
+}
+
+void FileReadAsyncRequest::Complete(bool is_encoded,
+                                    const std::string& error_message) {
+  Nan::AsyncQueueWorker(new FileReadWorker(success_callback_,
+                                           error_callback_,
+                                           &content_,
+                                           is_encoded,
+                                           error_message));
+  delete this;
+}
+
+CloudSyncDownloadRequest::CloudSyncDownloadRequest(
+    Nan::Callback* success_callback, Nan::Callback* error_callback,
+    CloudSyncState* state)
+        : success_callback_(success_callback),
+          error_callback_(error_callback),
+          state_(state),
+          file_name_(state->plan.downloads[state->next_download]),
+          file_size_(0) {
+}
+
+void CloudSyncDownloadRequest::Start() {
+  int32 file_size = SteamRemoteStorage()->GetFileSize(file_name_.c_str());
+  if (file_size < 0) {
+    Complete("Error on reading file from Steam Cloud.");
+    return;
+  }
+  file_size_ = static_cast<uint32>(file_size);
+  content_.reserve(file_size_);
+  if (file_size_ == 0)
+    Complete(std::string());
+  else if (!ReadNextChunk())
+    Complete("Error on reading file from Steam Cloud.");
+}
+
+bool CloudSyncDownloadRequest::ReadNextChunk() {
+  uint32 offset = static_cast<uint32>(content_.size());
+  SteamAPICall_t steam_api_call = SteamRemoteStorage()->FileReadAsync(
+      file_name_.c_str(), offset,
+      std::min(kCloudSyncChunkSize, file_size_ - offset));
+  if (steam_api_call == k_uAPICallInvalid)
+    return false;
+  call_result_.Set(steam_api_call, this,
+      &CloudSyncDownloadRequest::OnReadCompleted);
+  return true;
+}
+
+void CloudSyncDownloadRequest::OnReadCompleted(
+    RemoteStorageFileReadAsyncComplete_t* result, bool io_failure) {
+  size_t offset = content_.size();
+  bool succeeded = !io_failure && result->m_eResult == k_EResultOK &&
+      result->m_cubRead > 0 && result->m_cubRead <= file_size_ - offset;
+  if (succeeded) {
+    content_.resize(offset + result->m_cubRead);
+    succeeded = SteamRemoteStorage()->FileReadAsyncComplete(
+        result->m_hFileReadAsync, &content_[offset], result->m_cubRead);
+  }
+  if (!succeeded)
+    Complete("Error on reading file from Steam Cloud.");
+  else if (content_.size() == file_size_)
+    Complete(std::string());
+  else if (!ReadNextChunk())
+    Complete("Error on reading file from Steam Cloud.");
+}
+
+void CloudSyncDownloadRequest::Complete(const std::string& error_message) {
+  Nan::AsyncQueueWorker(new CloudSyncWriteWorker(success_callback_,
+                                                 error_callback_,
+                                                 state_,
+                                                 &content_,
+                                                 error_message));
+  delete this;
+}
+
+bool PersistForgottenFile(const char* file_name) {
+  ISteamRemoteStorage* steam_remote_storage = SteamRemoteStorage();
+  // A forgotten file can still be read from the local disk.
+  int32 file_size = steam_remote_storage->GetFileSize(file_name);
+  if (file_size < 0)
+    return false;
+  std::string content(file_size, '\0');
+  if (file_size > 0 && steam_remote_storage->FileRead(file_name, &content[0],
+                                                      file_size) != file_size)
+    return false;
+  return steam_remote_storage->FileWrite(file_name, content.data(),
+                                         file_size);
+}
+
+v8::Local<v8::Object> ConvertToJsObject(const CloudFileStats& stats) {
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  result->Set(Nan::New("rawBytes").ToLocalChecked(),
+              Nan::New(static_cast<double>(stats.raw_bytes)));
+  result->Set(Nan::New("storedBytes").ToLocalChecked(),
+              Nan::New(static_cast<double>(stats.stored_bytes)));
+  result->Set(Nan::New("ratio").ToLocalChecked(),
+              Nan::New(stats.stored_bytes == 0 ? 1.0 :
+                  static_cast<double>(stats.raw_bytes) / stats.stored_bytes));
+  return result;
+}
+
+v8::Local<v8::Object> ConvertToJsObject(const CloudQuotaPlan& plan) {
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  result->Set(Nan::New("neededBytes").ToLocalChecked(),
+              Nan::New(static_cast<double>(plan.needed_bytes)));
+  result->Set(Nan::New("availableBytes").ToLocalChecked(),
+              Nan::New(static_cast<double>(plan.available_bytes)));
+  result->Set(Nan::New("freedBytes").ToLocalChecked(),
+              Nan::New(static_cast<double>(plan.freed_bytes)));
+  v8::Local<v8::Array> evictions = Nan::New<v8::Array>(
+      static_cast<int>(plan.evictions.size()));
+  for (size_t i = 0; i < plan.evictions.size(); ++i)
+    evictions->Set(i, Nan::New(plan.evictions[i]).ToLocalChecked());
+  result->Set(Nan::New("evictions").ToLocalChecked(), evictions);
+  result->Set(Nan::New("fits").ToLocalChecked(), Nan::New(plan.fits));
+  return result;
+}
+
+v8::Local<v8::Object> ConvertToJsObject(const CloudSyncPlan& plan) {
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  v8::Local<v8::Array> uploaded = Nan::New<v8::Array>(plan.uploads.size());
+  for (size_t i = 0; i < plan.uploads.size(); ++i)
+    uploaded->Set(i, Nan::New(plan.uploads[i]).ToLocalChecked());
+  v8::Local<v8::Array> downloaded = Nan::New<v8::Array>(plan.downloads.size());
+  for (size_t i = 0; i < plan.downloads.size(); ++i)
+    downloaded->Set(i, Nan::New(plan.downloads[i]).ToLocalChecked());
+  result->Set(Nan::New("uploaded").ToLocalChecked(), uploaded);
+  result->Set(Nan::New("downloaded").ToLocalChecked(), downloaded);
+  result->Set(Nan::New("unchanged").ToLocalChecked(),
+              Nan::New(static_cast<uint32>(plan.unchanged.size())));
+  result->Set(Nan::New("conflicts").ToLocalChecked(),
+              Nan::New(plan.conflicts));
+  v8::Local<v8::Array> deleted_from_cloud =
+      Nan::New<v8::Array>(plan.cloud_deletions.size());
+  for (size_t i = 0; i < plan.cloud_deletions.size(); ++i)
+    deleted_from_cloud->Set(
+        i, Nan::New(plan.cloud_deletions[i]).ToLocalChecked());
+  v8::Local<v8::Array> deleted_locally =
+      Nan::New<v8::Array>(plan.local_deletions.size());
+  for (size_t i = 0; i < plan.local_deletions.size(); ++i)
+    deleted_locally->Set(i, Nan::New(plan.local_deletions[i]).ToLocalChecked());
+  result->Set(Nan::New("deletedFromCloud").ToLocalChecked(),
+              deleted_from_cloud);
+  result->Set(Nan::New("deletedLocally").ToLocalChecked(), deleted_locally);
+  return result;
+}
+
+}  // namespace greenworks
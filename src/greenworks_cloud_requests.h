@@ -0,0 +1,144 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_CLOUD_REQUESTS_H_
+#define SRC_GREENWORKS_CLOUD_REQUESTS_H_
+
+#include <string>
+#include <vector>
+
+#include "nan.h"
+#include "steam/steam_api.h"
+#include "v8.h"
+
+#include "greenworks_cloud_compression.h"
+#include "greenworks_cloud_quota.h"
+#include "greenworks_cloud_sync.h"
+
+namespace greenworks {
+
+// Unlike the SteamCallbackAsyncWorker, the cloud requests don't park a worker
+// thread while waiting for Steam: they are started on the main thread and
+// completed by SteamAPI_RunCallbacks in the Steam loop. A request owns the
+// callbacks and deletes itself once it has called one of them.
+
+class FileWriteAsyncRequest {
+ public:
+  struct File {
+    std::string file_name;
+    std::string data;
+  };
+
+  // Takes the content of |files|.
+  FileWriteAsyncRequest(Nan::Callback* success_callback,
+                        Nan::Callback* error_callback,
+                        std::vector<File>* files,
+                        const CloudFileStats& stats,
+                        const std::string& error_message);
+  ~FileWriteAsyncRequest();
+
+  // Passes |plan| to the success callback along with the stats. Its
+  // evictions, which have been forgotten, are deleted once the writes
+  // succeed if |delete_evicted|, and persisted again if one fails.
+  void set_quota_plan(const CloudQuotaPlan& plan, bool delete_evicted) {
+    quota_plan_ = plan;
+    has_quota_plan_ = true;
+    delete_evicted_ = delete_evicted;
+  }
+
+  void Start();
+
+ private:
+  // A single FileWriteAsync call of the request.
+  class Write {
+   public:
+    Write(FileWriteAsyncRequest* request, File* file);
+    bool Start();
+    void OnWriteCompleted(RemoteStorageFileWriteAsyncComplete_t* result,
+                          bool io_failure);
+
+   private:
+    FileWriteAsyncRequest* request_;
+    File file_;
+    CCallResult<Write, RemoteStorageFileWriteAsyncComplete_t> call_result_;
+  };
+
+  void OnWriteCompleted(bool success);
+  // Deletes or restores the evicted files, depending on |failed_|.
+  void SettleEvictions();
+  void Complete();
+
+  Nan::Callback* success_callback_;
+  Nan::Callback* error_callback_;
+  std::vector<Write*> writes_;
+  CloudFileStats stats_;
+  CloudQuotaPlan quota_plan_;
+  bool has_quota_plan_;
+  bool delete_evicted_;
+  std::string error_message_;
+  size_t pending_writes_;
+  bool failed_;
+};
+
+class FileReadAsyncRequest {
+ public:
+  FileReadAsyncRequest(Nan::Callback* success_callback,
+                       Nan::Callback* error_callback,
+                       const std::string& file_name);
+
+  void Start();
+  void OnReadCompleted(RemoteStorageFileReadAsyncComplete_t* result,
+                       bool io_failure);
+
+ private:
+  // Hands the content over to a FileReadWorker, which decodes it on a worker
+  // thread and calls the callbacks.
+  void Complete(bool is_encoded, const std::string& error_message);
+
+  Nan::Callback* success_callback_;
+  Nan::Callback* error_callback_;
+  std::string file_name_;
+  std::string content_;
+  CCallResult<FileReadAsyncRequest, RemoteStorageFileReadAsyncComplete_t>
+      call_result_;
+};
+
+// Reads the next file a sync downloads, kCloudSyncChunkSize bytes per
+// FileReadAsync call, then hands it over to a CloudSyncWriteWorker.
+class CloudSyncDownloadRequest {
+ public:
+  // Takes |state|.
+  CloudSyncDownloadRequest(Nan::Callback* success_callback,
+                           Nan::Callback* error_callback,
+                           CloudSyncState* state);
+
+  void Start();
+  void OnReadCompleted(RemoteStorageFileReadAsyncComplete_t* result,
+                       bool io_failure);
+
+ private:
+  bool ReadNextChunk();
+  void Complete(const std::string& error_message);
+
+  Nan::Callback* success_callback_;
+  Nan::Callback* error_callback_;
+  CloudSyncState* state_;
+  std::string file_name_;
+  std::string content_;
+  uint32 file_size_;
+  CCallResult<CloudSyncDownloadRequest, RemoteStorageFileReadAsyncComplete_t>
+      call_result_;
+};
+
+// Writes the local copy of a file removed with FileForget back to Steam
+// Cloud.
+bool PersistForgottenFile(const char* file_name);
+
+v8::Local<v8::Object> ConvertToJsObject(const CloudFileStats& stats);
+v8::Local<v8::Object> ConvertToJsObject(const CloudQuotaPlan& plan);
+v8::Local<v8::Object> ConvertToJsObject(const CloudSyncPlan& plan);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_CLOUD_REQUESTS_H_
@@ -0,0 +1,241 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_cloud_sync.h"
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "greenworks_crc32.h"
+#include "greenworks_directory_walker.h"
+#include "greenworks_utils.h"
+
+namespace greenworks {
+
+const char kCloudSyncManifestName[] = ".greenworks_cloud_sync";
+const char kCloudSyncDownloadSuffix[] = ".greenworks_download";
+const uint32 kCloudSyncChunkSize = 4 * 1024 * 1024;
+
+namespace {
+
+const char kManifestHeader[] = "greenworks-cloud-sync 2";
+// Version 1 didn't record the cloud size, which was the local one.
+const char kManifestHeaderV1[] = "greenworks-cloud-sync 1";
+const size_t kHashBufferSize = 64 * 1024;
+
+bool EndsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+      str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}  // namespace
+
+bool ReadCloudSyncManifest(const std::string& dir,
+                           CloudSyncManifest* manifest) {
+  manifest->clear();
+  std::ifstream fin((dir + "/" + kCloudSyncManifestName).c_str());
+  if (!fin.is_open())
+    return true;
+  std::string line;
+  if (!std::getline(fin, line) ||
+      (line != kManifestHeader && line != kManifestHeaderV1))
+    return false;
+  bool has_cloud_size = line == kManifestHeader;
+  // Each line is "<crc> <size> <cloud size> <local timestamp>
+  // <cloud timestamp> <name>".
+  while (std::getline(fin, line)) {
+    std::istringstream sin(line);
+    CloudSyncRecord record;
+    if (!(sin >> record.crc >> record.size))
+      return false;
+    if (!has_cloud_size)
+      record.cloud_size = record.size;
+    else if (!(sin >> record.cloud_size))
+      return false;
+    if (!(sin >> record.local_timestamp >> record.cloud_timestamp) ||
+        sin.get() != ' ')
+      return false;
+    std::string file_name;
+    std::getline(sin, file_name);
+    if (file_name.empty())
+      return false;
+    (*manifest)[file_name] = record;
+  }
+  return true;
+}
+
+bool WriteCloudSyncManifest(const std::string& dir,
+                            const CloudSyncManifest& manifest) {
+  std::ofstream fout((dir + "/" + kCloudSyncManifestName).c_str());
+  fout << kManifestHeader << "\n";
+  for (CloudSyncManifest::const_iterator it = manifest.begin();
+       it != manifest.end(); ++it) {
+    fout << it->second.crc << " " << it->second.size << " "
+         << it->second.cloud_size << " " << it->second.local_timestamp << " "
+         << it->second.cloud_timestamp << " " << it->first << "\n";
+  }
+  return fout.good();
+}
+
+bool IsSafeCloudFileName(const std::string& file_name) {
+  std::string path = file_name;
+  std::replace(path.begin(), path.end(), '\\', '/');
+  if (path.empty() || path[0] == '/' || (path.size() > 1 && path[1] == ':'))
+    return false;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos)
+      end = path.size();
+    if (path.compare(start, end - start, "..") == 0)
+      return false;
+    start = end + 1;
+  }
+  return true;
+}
+
+bool GetFileCrc32(const std::string& file_path, uint32* crc) {
+  std::ifstream fin(file_path.c_str(), std::ios::in|std::ios::binary);
+  if (!fin.is_open())
+    return false;
+  std::vector<char> buffer(kHashBufferSize);
+  uint32_t result = 0;
+  while (fin) {
+    fin.read(&buffer[0], buffer.size());
+    result = greenworks::Crc32(result, &buffer[0],
+                               static_cast<size_t>(fin.gcount()));
+  }
+  if (!fin.eof())
+    return false;
+  *crc = static_cast<uint32>(result);
+  return true;
+}
+
+bool HashLocalFiles(const std::string& dir,
+                    const CloudSyncManifest& manifest,
+                    std::vector<LocalFileState>* files) {
+  // The walk collects the sizes and times the manifest is checked against.
+  greenworks::DirectoryWalker walker;
+  greenworks::DirectoryWalker::Options walk_options;
+  walk_options.threads = 0;
+  if (!walker.Walk(dir, walk_options))
+    return false;
+
+  files->clear();
+  for (size_t i = 0; i < walker.size(); ++i) {
+    std::string file_name = walker.relative_path(i);
+    if (file_name == kCloudSyncManifestName ||
+        EndsWith(file_name, kCloudSyncDownloadSuffix))
+      continue;
+    LocalFileState file = { file_name, 0, walker.file_size(i),
+                            walker.modification_time(i) };
+    files->push_back(file);
+  }
+
+  std::vector<char> hashed(files->size(), 0);
+  utils::ParallelFor(files->size(), [&](size_t i) {
+    LocalFileState& file = (*files)[i];
+    std::string file_path = dir + "/" + file.file_name;
+    CloudSyncManifest::const_iterator it = manifest.find(file.file_name);
+    if (it != manifest.end() && it->second.size == file.size &&
+        it->second.local_timestamp == file.timestamp) {
+      file.crc = it->second.crc;
+      hashed[i] = 1;
+      return;
+    }
+    hashed[i] = GetFileCrc32(file_path, &file.crc);
+  });
+  return std::find(hashed.begin(), hashed.end(), 0) == hashed.end();
+}
+
+void PlanCloudSync(const std::vector<LocalFileState>& local_files,
+                   const std::vector<CloudFileInfo>& cloud_files,
+                   const CloudSyncManifest& manifest,
+                   CloudSyncDirection direction,
+                   CloudSyncPlan* plan) {
+  plan->uploads.clear();
+  plan->downloads.clear();
+  plan->unchanged.clear();
+  plan->cloud_deletions.clear();
+  plan->local_deletions.clear();
+  plan->conflicts = 0;
+
+  std::map<std::string, const LocalFileState*> local;
+  for (size_t i = 0; i < local_files.size(); ++i)
+    local[local_files[i].file_name] = &local_files[i];
+  std::map<std::string, const CloudFileInfo*> cloud;
+  for (size_t i = 0; i < cloud_files.size(); ++i)
+    cloud[cloud_files[i].file_name] = &cloud_files[i];
+  std::set<std::string> file_names;
+  for (size_t i = 0; i < local_files.size(); ++i)
+    file_names.insert(local_files[i].file_name);
+  for (size_t i = 0; i < cloud_files.size(); ++i)
+    file_names.insert(cloud_files[i].file_name);
+
+  for (std::set<std::string>::const_iterator name = file_names.begin();
+       name != file_names.end(); ++name) {
+    const LocalFileState* local_file =
+        local.count(*name) ? local[*name] : NULL;
+    const CloudFileInfo* cloud_file = cloud.count(*name) ? cloud[*name] : NULL;
+    CloudSyncManifest::const_iterator record = manifest.find(*name);
+    bool has_record = record != manifest.end();
+    bool local_changed = !local_file || !has_record ||
+        local_file->crc != record->second.crc ||
+        local_file->size != record->second.size;
+    bool cloud_changed = !cloud_file || !has_record ||
+        cloud_file->timestamp != record->second.cloud_timestamp ||
+        cloud_file->size != record->second.cloud_size;
+    if (local_file && cloud_file && !local_changed && !cloud_changed) {
+      plan->unchanged.push_back(*name);
+      continue;
+    }
+
+    // A one-way sync makes the target match the source.
+    if (direction == kCloudSyncUpload) {
+      if (local_file)
+        plan->uploads.push_back(*name);
+      else if (has_record)
+        plan->cloud_deletions.push_back(*name);
+      continue;
+    }
+    if (direction == kCloudSyncDownload) {
+      if (cloud_file)
+        plan->downloads.push_back(*name);
+      else if (has_record)
+        plan->local_deletions.push_back(*name);
+      continue;
+    }
+
+    // A file deleted on one side is deleted on the other, unless it has
+    // changed there since, in which case it's restored.
+    if (has_record && !local_file && !cloud_changed) {
+      plan->cloud_deletions.push_back(*name);
+      continue;
+    }
+    if (has_record && !cloud_file && !local_changed) {
+      plan->local_deletions.push_back(*name);
+      continue;
+    }
+
+    bool upload;
+    if (!cloud_file) {
+      upload = true;
+    } else if (!local_file) {
+      upload = false;
+    } else if (local_changed != cloud_changed) {
+      upload = local_changed;
+    } else {
+      ++plan->conflicts;
+      upload = local_file->timestamp > cloud_file->timestamp;
+    }
+    if (upload)
+      plan->uploads.push_back(*name);
+    else
+      plan->downloads.push_back(*name);
+  }
+}
+
+}  // namespace greenworks
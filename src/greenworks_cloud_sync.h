@@ -0,0 +1,109 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_CLOUD_SYNC_H_
+#define SRC_GREENWORKS_CLOUD_SYNC_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "steam/steamtypes.h"
+
+#include "greenworks_cloud_quota.h"
+
+namespace greenworks {
+
+// The manifest file kept in the mirrored directory. It records the state of
+// each file at the last sync, so that the next sync can tell which side has
+// changed since, and skip hashing the local files which weren't touched.
+extern const char kCloudSyncManifestName[];
+
+// Downloads are written to "<file><suffix>" first, so that an interrupted
+// sync never leaves a truncated file looking like a local change.
+extern const char kCloudSyncDownloadSuffix[];
+
+// The size of the chunks uploaded and downloaded at once.
+extern const uint32 kCloudSyncChunkSize;
+
+enum CloudSyncDirection {
+  kCloudSyncBoth,
+  kCloudSyncUpload,
+  kCloudSyncDownload,
+};
+
+struct CloudSyncRecord {
+  // The CRC-32 and size of the local file.
+  uint32 crc;
+  uint64 size;
+  // The size stored on Steam Cloud, which differs if it's compressed.
+  uint64 cloud_size;
+  int64 local_timestamp;
+  int64 cloud_timestamp;
+};
+
+typedef std::map<std::string, CloudSyncRecord> CloudSyncManifest;
+
+struct LocalFileState {
+  std::string file_name;
+  uint32 crc;
+  uint64 size;
+  int64 timestamp;
+};
+
+struct CloudSyncPlan {
+  std::vector<std::string> uploads;
+  std::vector<std::string> downloads;
+  // Files in sync on both sides.
+  std::vector<std::string> unchanged;
+  // Files deleted on one side since the last sync, to delete on the other:
+  // |cloud_deletions| are deleted from Steam Cloud, |local_deletions| from
+  // the mirrored directory.
+  std::vector<std::string> cloud_deletions;
+  std::vector<std::string> local_deletions;
+  // Files changed on both sides since the last sync; the newer one wins.
+  int conflicts;
+};
+
+// What a sync carries from the worker which plans it, through each
+// download, to the one which writes the manifest.
+struct CloudSyncState {
+  CloudSyncState() : next_download(0) {}
+
+  std::string local_dir;
+  CloudSyncPlan plan;
+  // The records of the files synced so far.
+  CloudSyncManifest manifest;
+  // The index in |plan.downloads| of the file being downloaded.
+  size_t next_download;
+};
+
+// A missing manifest reads as an empty one.
+bool ReadCloudSyncManifest(const std::string& dir,
+                           CloudSyncManifest* manifest);
+bool WriteCloudSyncManifest(const std::string& dir,
+                            const CloudSyncManifest& manifest);
+
+// Whether the cloud file |file_name| maps to a path inside the mirrored
+// directory: no absolute path, drive letter or ".." component, with either
+// separator, as the archive entries are checked on extraction.
+bool IsSafeCloudFileName(const std::string& file_name);
+
+bool GetFileCrc32(const std::string& file_path, uint32* crc);
+
+// Walks |dir| and hashes its files in parallel. The files whose size and
+// timestamp match |manifest| reuse the recorded hash.
+bool HashLocalFiles(const std::string& dir,
+                    const CloudSyncManifest& manifest,
+                    std::vector<LocalFileState>* files);
+
+void PlanCloudSync(const std::vector<LocalFileState>& local_files,
+                   const std::vector<CloudFileInfo>& cloud_files,
+                   const CloudSyncManifest& manifest,
+                   CloudSyncDirection direction,
+                   CloudSyncPlan* plan);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_CLOUD_SYNC_H_
@@ -0,0 +1,237 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_crc32.h"
+
+#include <algorithm>
+
+#include "zlib/zlib.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define GREENWORKS_CRC32_PCLMUL
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__) && (defined(__linux__) || defined(__APPLE__))
+#define GREENWORKS_CRC32_ARMV8
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+// The SIMD functions are compiled for instructions the rest of the addon
+// can't assume, and only called once the CPU is known to have them.
+#if defined(_MSC_VER)
+#define GREENWORKS_TARGET(features)
+#else
+#define GREENWORKS_TARGET(features) __attribute__((target(features)))
+#endif
+
+namespace greenworks {
+
+namespace {
+
+typedef uint32_t (*Crc32Function)(uint32_t crc, const void* data,
+                                  size_t size);
+
+// zlib takes uInt lengths.
+const size_t kMaxZlibLength = 1u << 30;
+
+uint32_t ZlibCrc32(uint32_t crc, const void* data, size_t size) {
+  const Bytef* input = static_cast<const Bytef*>(data);
+  while (size > 0) {
+    uInt length = static_cast<uInt>(std::min(size, kMaxZlibLength));
+    crc = static_cast<uint32_t>(crc32(crc, input, length));
+    input += length;
+    size -= length;
+  }
+  return crc;
+}
+
+#if defined(GREENWORKS_CRC32_PCLMUL)
+
+bool HasPclmul() {
+  unsigned int ecx;
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  ecx = static_cast<unsigned int>(info[2]);
+#else
+  unsigned int eax, ebx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+#endif
+  return (ecx & (1u << 1)) != 0;
+}
+
+// Folds 64 bytes at a time with carry-less multiplications, then reduces
+// the remainder to 32 bits with Barrett's method, after "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel,
+// 2009). |size| is a multiple of 16, at least 64; |crc| is the
+// pre-inverted state.
+GREENWORKS_TARGET("pclmul")
+uint32_t PclmulCrc32Blocks(uint32_t crc, const uint8_t* input, size_t size) {
+  // The constants of the bit-reflected CRC-32 polynomial, as x^n mod P(x).
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+  const __m128i* blocks = reinterpret_cast<const __m128i*>(input);
+
+  __m128i x1 = _mm_loadu_si128(blocks);
+  __m128i x2 = _mm_loadu_si128(blocks + 1);
+  __m128i x3 = _mm_loadu_si128(blocks + 2);
+  __m128i x4 = _mm_loadu_si128(blocks + 3);
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+  blocks += 4;
+  size -= 64;
+
+  // Four independent folds, to keep the multiplier busy.
+  for (; size >= 64; size -= 64, blocks += 4) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(blocks));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(blocks + 1));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(blocks + 2));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(blocks + 3));
+  }
+
+  // Fold the four lanes into one, then the remaining 16 byte blocks.
+  __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+  for (; size >= 16; size -= 16, ++blocks) {
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(blocks)), x5);
+  }
+
+  // Fold 128 bits to 64, then 64 to 32.
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to the 32 bits of the CRC.
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+
+uint32_t PclmulCrc32(uint32_t crc, const void* data, size_t size) {
+  const uint8_t* input = static_cast<const uint8_t*>(data);
+  // Short inputs aren't worth the setup.
+  if (size >= 64) {
+    size_t blocks_size = size & ~static_cast<size_t>(15);
+    crc = ~PclmulCrc32Blocks(~crc, input, blocks_size);
+    input += blocks_size;
+    size -= blocks_size;
+  }
+  return size > 0 ? ZlibCrc32(crc, input, size) : crc;
+}
+
+#endif  // defined(GREENWORKS_CRC32_PCLMUL)
+
+#if defined(GREENWORKS_CRC32_ARMV8)
+
+bool HasArmv8Crc() {
+#if defined(__APPLE__)
+  // All the 64-bit Apple CPUs have it.
+  return true;
+#else
+  return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+
+#if defined(__clang__)
+#define GREENWORKS_ARMV8_CRC_TARGET GREENWORKS_TARGET("crc")
+#else
+#define GREENWORKS_ARMV8_CRC_TARGET GREENWORKS_TARGET("+crc")
+#endif
+
+GREENWORKS_ARMV8_CRC_TARGET
+uint32_t Armv8Crc32(uint32_t crc, const void* data, size_t size) {
+  const uint8_t* input = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  // Byte by byte up to 8 bytes alignment, then 32 bytes per iteration.
+  for (; size > 0 && (reinterpret_cast<uintptr_t>(input) & 7) != 0; --size)
+    crc = __crc32b(crc, *input++);
+  const uint64_t* words = reinterpret_cast<const uint64_t*>(input);
+  for (; size >= 32; size -= 32, words += 4) {
+    crc = __crc32d(crc, words[0]);
+    crc = __crc32d(crc, words[1]);
+    crc = __crc32d(crc, words[2]);
+    crc = __crc32d(crc, words[3]);
+  }
+  for (; size >= 8; size -= 8)
+    crc = __crc32d(crc, *words++);
+  input = reinterpret_cast<const uint8_t*>(words);
+  for (; size > 0; --size)
+    crc = __crc32b(crc, *input++);
+  return ~crc;
+}
+
+#endif  // defined(GREENWORKS_CRC32_ARMV8)
+
+struct Crc32Dispatch {
+  Crc32Dispatch() : function(ZlibCrc32), name("zlib") {
+#if defined(GREENWORKS_CRC32_PCLMUL)
+    if (HasPclmul()) {
+      function = PclmulCrc32;
+      name = "pclmul";
+    }
+#elif defined(GREENWORKS_CRC32_ARMV8)
+    if (HasArmv8Crc()) {
+      function = Armv8Crc32;
+      name = "armv8-crc";
+    }
+#endif
+  }
+
+  Crc32Function function;
+  const char* name;
+};
+
+// Checks the CPU once, on first use.
+const Crc32Dispatch& GetDispatch() {
+  static const Crc32Dispatch dispatch;
+  return dispatch;
+}
+
+}  // namespace
+
+uint32_t Crc32(uint32_t crc, const void* data, size_t size) {
+  return GetDispatch().function(crc, data, size);
+}
+
+const char* Crc32Implementation() {
+  return GetDispatch().name;
+}
+
+uint32_t Crc32Portable(uint32_t crc, const void* data, size_t size) {
+  return ZlibCrc32(crc, data, size);
+}
+
+}  // namespace greenworks
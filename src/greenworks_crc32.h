@@ -0,0 +1,28 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_CRC32_H_
+#define SRC_GREENWORKS_CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace greenworks {
+
+// Continues |crc| (0 to start) over |size| bytes at |data|: the CRC-32 of
+// zip and gzip, as zlib's crc32 computes it. Uses PCLMULQDQ on x86-64 or the
+// CRC32 instructions of ARMv8 when the CPU has them, else zlib's tables.
+uint32_t Crc32(uint32_t crc, const void* data, size_t size);
+
+// The implementation Crc32 picked for this CPU: "pclmul", "armv8-crc" or
+// "zlib".
+const char* Crc32Implementation();
+
+// Crc32 with zlib's table-driven implementation only, e.g. to benchmark
+// against.
+uint32_t Crc32Portable(uint32_t crc, const void* data, size_t size);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_CRC32_H_
@@ -0,0 +1,148 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_directory_hash.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "greenworks_archive_job.h"
+#include "greenworks_directory_walker.h"
+
+namespace greenworks {
+
+namespace {
+
+bool EntryPathLess(const ManifestEntry* a, const ManifestEntry* b) {
+  return a->path < b->path;
+}
+
+std::vector<const ManifestEntry*> SortByPath(
+    const std::vector<ManifestEntry>& manifest) {
+  std::vector<const ManifestEntry*> sorted(manifest.size());
+  for (size_t i = 0; i < manifest.size(); ++i)
+    sorted[i] = &manifest[i];
+  std::sort(sorted.begin(), sorted.end(), EntryPathLess);
+  return sorted;
+}
+
+}  // namespace
+
+bool HashDirectory(const std::string& dir,
+                   const HashDirectoryOptions& options,
+                   std::vector<ManifestEntry>* manifest,
+                   std::string* error) {
+  DirectoryWalker walker;
+  DirectoryWalker::Options walk_options;
+  walk_options.threads = options.threads;
+  if (!walker.Walk(dir, walk_options)) {
+    *error = walker.error();
+    return false;
+  }
+
+  // Largest first, so that a few big files don't end up hashed one after
+  // the other at the end.
+  std::vector<size_t> order(walker.size());
+  uint64_t total_bytes = 0;
+  for (size_t i = 0; i < walker.size(); ++i) {
+    order[i] = i;
+    total_bytes += walker.file_size(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return walker.file_size(a) > walker.file_size(b);
+  });
+  ArchiveJob* job = options.job;
+  if (job != NULL)
+    job->Start(walker.size(), total_bytes);
+
+  manifest->assign(walker.size(), ManifestEntry());
+  std::atomic<size_t> next_file(0);
+  std::atomic<bool> failed(false);
+  std::mutex error_mutex;
+  auto work = [&]() {
+    for (size_t n = next_file++; n < order.size() && !failed &&
+             !(job != NULL && job->cancelled()); n = next_file++) {
+      size_t i = order[n];
+      ManifestEntry& entry = (*manifest)[i];
+      entry.path = walker.relative_path(i);
+      entry.size = walker.file_size(i);
+      entry.time = walker.modification_time(i);
+      if (HashFile(walker.path(i).c_str(), options.algorithm,
+                   options.use_mmap, job, &entry.hash)) {
+        if (job != NULL)
+          job->AddEntry();
+        continue;
+      }
+      if (job != NULL && job->cancelled())
+        break;
+      int read_error = errno;
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!failed.exchange(true)) {
+        *error = "Cannot read '" + walker.path(i) + "': " +
+            strerror(read_error);
+      }
+    }
+  };
+
+  size_t threads = options.threads > 0 ?
+      options.threads : std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, order.size());
+  // The calling thread takes a share of the work too.
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; ++i)
+    workers.push_back(std::thread(work));
+  work();
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  if (job != NULL)
+    job->Finish();
+
+  if (job != NULL && job->cancelled()) {
+    *error = "Hashing cancelled.";
+    failed = true;
+  }
+  if (failed) {
+    manifest->clear();
+    return false;
+  }
+  std::sort(manifest->begin(), manifest->end(),
+            [](const ManifestEntry& a, const ManifestEntry& b) {
+    return a.path < b.path;
+  });
+  return true;
+}
+
+void DiffManifests(const std::vector<ManifestEntry>& from,
+                   const std::vector<ManifestEntry>& to,
+                   ManifestDiff* diff) {
+  diff->added.clear();
+  diff->removed.clear();
+  diff->modified.clear();
+  std::vector<const ManifestEntry*> old_files = SortByPath(from);
+  std::vector<const ManifestEntry*> new_files = SortByPath(to);
+  size_t i = 0;
+  size_t j = 0;
+  while (i < old_files.size() || j < new_files.size()) {
+    if (j == new_files.size() ||
+        (i < old_files.size() && old_files[i]->path < new_files[j]->path)) {
+      diff->removed.push_back(old_files[i++]->path);
+    } else if (i == old_files.size() ||
+               new_files[j]->path < old_files[i]->path) {
+      diff->added.push_back(new_files[j++]->path);
+    } else {
+      if (old_files[i]->size != new_files[j]->size ||
+          old_files[i]->hash != new_files[j]->hash)
+        diff->modified.push_back(new_files[j]->path);
+      ++i;
+      ++j;
+    }
+  }
+}
+
+}  // namespace greenworks
@@ -0,0 +1,68 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_DIRECTORY_HASH_H_
+#define SRC_GREENWORKS_DIRECTORY_HASH_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "greenworks_hash.h"
+
+namespace greenworks {
+
+class ArchiveJob;
+
+struct ManifestEntry {
+  // Relative to the hashed directory, joined with '/'.
+  std::string path;
+  uint64_t size;
+  // In seconds since the epoch.
+  int64_t time;
+  // Lowercase hexadecimal.
+  std::string hash;
+};
+
+struct HashDirectoryOptions {
+  HashDirectoryOptions()
+      : algorithm(kHashSha256), threads(0), use_mmap(false), job(NULL) {}
+
+  HashAlgorithm algorithm;
+  // The number of files hashed at once; 0 uses one per core.
+  int threads;
+  // Whether the files are read through memory mappings rather than reads,
+  // which only pays off for large files. See HashFile for the risk.
+  bool use_mmap;
+  // Receives the progress and may cancel the hashing. Not owned.
+  ArchiveJob* job;
+};
+
+// Hashes every file under |dir|, several at a time, largest first. Sets
+// |manifest| to the files sorted by path. Returns false with |error| set on
+// failure or cancellation.
+bool HashDirectory(const std::string& dir,
+                   const HashDirectoryOptions& options,
+                   std::vector<ManifestEntry>* manifest,
+                   std::string* error);
+
+// The paths which differ between two manifests, each sorted.
+struct ManifestDiff {
+  std::vector<std::string> added;
+  std::vector<std::string> removed;
+  // The files whose size or hash changed; modification times are ignored.
+  std::vector<std::string> modified;
+};
+
+// Compares the manifest of a directory before (|from|) and after (|to|) a
+// change. The manifests don't need to be sorted, but their hashes must have
+// been computed with the same algorithm.
+void DiffManifests(const std::vector<ManifestEntry>& from,
+                   const std::vector<ManifestEntry>& to,
+                   ManifestDiff* diff);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_DIRECTORY_HASH_H_
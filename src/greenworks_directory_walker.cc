@@ -0,0 +1,209 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_directory_walker.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#if defined(_WIN32)
+#include "misc/dirent.h"
+#else
+#include <dirent.h>
+#endif
+
+namespace greenworks {
+
+namespace {
+
+struct StatResult {
+  // 0, or the errno of the failed stat.
+  int error;
+  bool is_link;
+  bool is_directory;
+  bool is_file;
+  uint64_t size;
+  int64_t time;
+};
+
+void StatPath(const std::string& path, StatResult* result) {
+  bool is_link = false;
+#if defined(_WIN32)
+  struct _stat64 st;
+  int failed = _stat64(path.c_str(), &st);
+#else
+  struct stat st;
+  int failed = lstat(path.c_str(), &st);
+  if (!failed && S_ISLNK(st.st_mode)) {
+    is_link = true;
+    failed = stat(path.c_str(), &st);
+  }
+#endif
+  result->error = failed ? errno : 0;
+  result->is_link = is_link;
+  // Links to directories aren't followed: they could make a cycle.
+  result->is_directory = !failed && !is_link && S_ISDIR(st.st_mode);
+  result->is_file = !failed && S_ISREG(st.st_mode);
+  result->size = failed ? 0 : static_cast<uint64_t>(st.st_size);
+  result->time = failed ? 0 : static_cast<int64_t>(st.st_mtime);
+}
+
+}  // namespace
+
+DirectoryWalker::DirectoryWalker() {
+}
+
+bool DirectoryWalker::Walk(const std::string& root, const Options& options) {
+  root_ = root;
+  paths_.clear();
+  files_.clear();
+  directories_.clear();
+  skipped_.clear();
+  error_.clear();
+
+  // The root is the empty relative path.
+  PathRange root_range = { 0, 0 };
+  std::vector<PathRange> pending(1, root_range);
+  std::vector<PathRange> unknown;
+  std::vector<StatResult> results;
+  while (!pending.empty()) {
+    // Read all the directories known so far, then stat what they hold in one
+    // batch; directories of an unknown type found by the batch start another
+    // round.
+    unknown.clear();
+    while (!pending.empty()) {
+      PathRange directory = pending.back();
+      pending.pop_back();
+      if (directory.length > 0)
+        directories_.push_back(directory);
+      if (!ReadDirectory(directory, options.recursive ? &pending : NULL,
+                         &unknown))
+        return false;
+    }
+
+    results.resize(unknown.size());
+    size_t threads = options.threads > 0 ?
+        options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, unknown.size());
+    std::atomic<size_t> next_path(0);
+    auto work = [&]() {
+      for (size_t i = next_path++; i < unknown.size(); i = next_path++)
+        StatPath(FullPath(unknown[i]), &results[i]);
+    };
+    // The calling thread takes a share of the work too.
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i)
+      workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); ++i)
+      workers[i].join();
+
+    for (size_t i = 0; i < unknown.size(); ++i) {
+      const StatResult& result = results[i];
+      if (result.error == ENOENT) {
+        // A dangling link, rather than a file which vanished.
+        if (result.is_link)
+          skipped_.push_back(unknown[i]);
+        continue;
+      }
+      if (result.error != 0) {
+        error_ = "Cannot stat '" + FullPath(unknown[i]) + "': " +
+            strerror(result.error);
+        return false;
+      }
+      if (result.is_directory && options.recursive) {
+        pending.push_back(unknown[i]);
+      } else if (result.is_file) {
+        File file = { unknown[i], result.size, result.time };
+        files_.push_back(file);
+      } else if (!result.is_directory) {
+        skipped_.push_back(unknown[i]);
+      }
+    }
+  }
+  return true;
+}
+
+std::string DirectoryWalker::relative_path(size_t index) const {
+  return paths_.substr(files_[index].path.offset, files_[index].path.length);
+}
+
+std::string DirectoryWalker::relative_directory(size_t index) const {
+  return paths_.substr(directories_[index].offset,
+                       directories_[index].length);
+}
+
+std::string DirectoryWalker::relative_skipped_path(size_t index) const {
+  return paths_.substr(skipped_[index].offset, skipped_[index].length);
+}
+
+std::string DirectoryWalker::path(size_t index) const {
+  return FullPath(files_[index].path);
+}
+
+bool DirectoryWalker::ReadDirectory(const PathRange& directory,
+                                    std::vector<PathRange>* pending,
+                                    std::vector<PathRange>* unknown) {
+  std::string directory_path = FullPath(directory);
+  DIR* dir = opendir(directory_path.c_str());
+  if (!dir) {
+    error_ = "Cannot open directory '" + directory_path + "': " +
+        strerror(errno);
+    return false;
+  }
+  // readdir returns NULL both at the end and on errors, which only errno
+  // tells apart.
+  for (errno = 0; dirent* entry = readdir(dir); errno = 0) {
+    const char* name = entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+      continue;
+    bool is_directory = entry->d_type == DT_DIR;
+    if (is_directory && !pending)
+      continue;
+    PathRange range = { paths_.size(), 0 };
+    if (directory.length > 0) {
+      paths_.append(paths_, directory.offset, directory.length);
+      paths_ += '/';
+    }
+    paths_ += name;
+    range.length = paths_.size() - range.offset;
+    // Regular files are stat'ed anyway for their size and time; entries of
+    // an unknown type and links, to find out what they are.
+    if (is_directory)
+      pending->push_back(range);
+    else
+      unknown->push_back(range);
+  }
+  if (errno != 0) {
+    error_ = "Cannot read directory '" + directory_path + "': " +
+        strerror(errno);
+    closedir(dir);
+    return false;
+  }
+  if (closedir(dir)) {
+    error_ = "Cannot close directory '" + directory_path + "': " +
+        strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+std::string DirectoryWalker::FullPath(const PathRange& range) const {
+  if (range.length == 0)
+    return root_;
+  std::string path;
+  path.reserve(root_.size() + 1 + range.length);
+  path += root_;
+  path += '/';
+  path.append(paths_, range.offset, range.length);
+  return path;
+}
+
+}  // namespace greenworks
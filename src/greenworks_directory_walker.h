@@ -0,0 +1,96 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_DIRECTORY_WALKER_H_
+#define SRC_GREENWORKS_DIRECTORY_WALKER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace greenworks {
+
+// Lists the regular files under a directory with their size and modification
+// time. Walks iteratively, so deep trees can't overflow the stack. Symbolic
+// links to files are followed, links to directories aren't.
+class DirectoryWalker {
+ public:
+  struct Options {
+    Options() : recursive(true), threads(1) {}
+
+    // Whether the subdirectories are walked too.
+    bool recursive;
+    // The number of threads the files are stat'ed on; 0 uses one per core.
+    // Worth it on network drives, where each stat is a round trip.
+    int threads;
+  };
+
+  DirectoryWalker();
+
+  // Walks |root|, replacing the previous results. Returns false, with
+  // error() set, if a directory or a file can't be read; files which vanish
+  // during the walk are ignored.
+  bool Walk(const std::string& root, const Options& options = Options());
+
+  const std::string& root() const { return root_; }
+
+  size_t size() const { return files_.size(); }
+  // The path of a file relative to the root, joined with '/'.
+  std::string relative_path(size_t index) const;
+  // The root and the relative path of a file joined with '/'.
+  std::string path(size_t index) const;
+  uint64_t file_size(size_t index) const { return files_[index].size; }
+  // In seconds since the epoch.
+  int64_t modification_time(size_t index) const {
+    return files_[index].time;
+  }
+  // The subdirectories walked, parents before their children; empty ones
+  // included.
+  size_t directory_count() const { return directories_.size(); }
+  // The path of a subdirectory relative to the root, joined with '/'.
+  std::string relative_directory(size_t index) const;
+  // The entries which are neither files nor walked directories: links to
+  // directories, dangling links, pipes, sockets and devices.
+  size_t skipped_count() const { return skipped_.size(); }
+  // The path of a skipped entry relative to the root, joined with '/'.
+  std::string relative_skipped_path(size_t index) const;
+  const std::string& error() const { return error_; }
+
+ private:
+  // A range of |paths_|.
+  struct PathRange {
+    size_t offset;
+    size_t length;
+  };
+
+  struct File {
+    PathRange path;
+    uint64_t size;
+    int64_t time;
+  };
+
+  // Reads the directory at |directory|, pushing its subdirectories on
+  // |pending| and the entries to stat on |unknown|.
+  bool ReadDirectory(const PathRange& directory,
+                     std::vector<PathRange>* pending,
+                     std::vector<PathRange>* unknown);
+  std::string FullPath(const PathRange& range) const;
+
+  std::string root_;
+  // All the relative paths, back to back: one allocation for the whole walk
+  // rather than one per path.
+  std::string paths_;
+  std::vector<File> files_;
+  std::vector<PathRange> directories_;
+  std::vector<PathRange> skipped_;
+  std::string error_;
+
+  DirectoryWalker(const DirectoryWalker&);
+  void operator=(const DirectoryWalker&);
+};
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_DIRECTORY_WALKER_H_
@@ -0,0 +1,516 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_file_copy.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#include "greenworks_archive_job.h"
+#include "greenworks_directory_walker.h"
+#include "greenworks_utils.h"
+
+namespace greenworks {
+
+namespace {
+
+// The most copied at once, as for the archive jobs: cancellation is checked
+// and the progress reported in between.
+const size_t kCopyChunkSize = 1024 * 1024;
+
+struct CopyTask {
+  std::string source;
+  std::string target;
+  uint64_t size;
+  int64_t time;
+};
+
+std::string ErrorMessage(const char* action, const std::string& path,
+                         int error) {
+  return std::string("Cannot ") + action + " '" + path + "': " +
+      strerror(error);
+}
+
+// Appends |path| to |created| if it didn't exist yet.
+bool MakeDirectory(const std::string& path,
+                   std::vector<std::string>* created) {
+#if defined(_WIN32)
+  if (_mkdir(path.c_str()) == 0) {
+#else
+  if (mkdir(path.c_str(), 0775) == 0) {
+#endif
+    created->push_back(path);
+    return true;
+  }
+  return errno == EEXIST;
+}
+
+// Creates |path| and its missing parents, which are appended to |created|,
+// parents first.
+bool MakeDirectories(const std::string& path,
+                     std::vector<std::string>* created) {
+  for (size_t pos = path.find_first_of("/\\", 1);;
+       pos = path.find_first_of("/\\", pos + 1)) {
+    std::string directory = path.substr(0, pos);
+#if defined(_WIN32)
+    struct _stat64 st;
+    bool exists = _stat64(directory.c_str(), &st) == 0;
+#else
+    struct stat st;
+    bool exists = stat(directory.c_str(), &st) == 0;
+#endif
+    if (exists && (st.st_mode & S_IFMT) != S_IFDIR) {
+      errno = ENOTDIR;
+      return false;
+    }
+    if (!exists && !MakeDirectory(directory, created))
+      return false;
+    if (pos == std::string::npos)
+      return true;
+  }
+}
+
+bool RemoveEmptyDirectory(const std::string& path) {
+#if defined(_WIN32)
+  return _rmdir(path.c_str()) == 0;
+#else
+  return rmdir(path.c_str()) == 0;
+#endif
+}
+
+// Gives |target| the modification time of the directory |source|. Only
+// worth doing once the files are in, since adding them changes it.
+void CopyDirectoryTime(const std::string& source, const std::string& target) {
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_stat64(source.c_str(), &st) == 0)
+    utils::UpdateFileLastUpdatedTime(target.c_str(), st.st_mtime);
+#else
+  struct stat st;
+  if (stat(source.c_str(), &st) != 0)
+    return;
+#if defined(__APPLE__)
+  struct timespec times[2] = { st.st_atimespec, st.st_mtimespec };
+#else
+  struct timespec times[2] = { st.st_atim, st.st_mtim };
+#endif
+  utimensat(AT_FDCWD, target.c_str(), times, 0);
+#endif
+}
+
+#if defined(_WIN32)
+
+struct CopyProgress {
+  ArchiveJob* job;
+  uint64_t reported;
+  // Set once CopyFileEx has opened the target, which is then overwritten.
+  bool created;
+};
+
+DWORD CALLBACK OnCopyProgress(LARGE_INTEGER total_size,
+                              LARGE_INTEGER transferred,
+                              LARGE_INTEGER stream_size,
+                              LARGE_INTEGER stream_transferred,
+                              DWORD stream, DWORD reason, HANDLE source,
+                              HANDLE target, LPVOID data) {
+  CopyProgress* progress = static_cast<CopyProgress*>(data);
+  progress->created = true;
+  if (progress->job == NULL)
+    return PROGRESS_CONTINUE;
+  uint64_t bytes = static_cast<uint64_t>(transferred.QuadPart);
+  progress->job->AddBytes(bytes - progress->reported,
+                          bytes - progress->reported);
+  progress->reported = bytes;
+  return progress->job->cancelled() ? PROGRESS_CANCEL : PROGRESS_CONTINUE;
+}
+
+// CopyFileEx copies in the kernel (or on the server, for network shares),
+// keeps the times and attributes, and removes the target if cancelled.
+bool CopyOneFile(const CopyTask& task, ArchiveJob* job, bool* created,
+                 std::string* error) {
+  CopyProgress progress = { job, 0, false };
+  // The callback runs once the target is open, before any data is copied:
+  // a target which existed is only removed on failure if it was touched.
+  if (!CopyFileExA(task.source.c_str(), task.target.c_str(), OnCopyProgress,
+                   &progress, NULL, 0)) {
+    *created = progress.created;
+    *error = "Cannot copy '" + task.source + "': error " +
+        std::to_string(static_cast<unsigned long>(GetLastError()));
+    return false;
+  }
+  *created = true;
+  return true;
+}
+
+#else  // defined(_WIN32)
+
+ssize_t CopyFileRange(int in, int out, size_t length) {
+#if defined(__linux__) && defined(__NR_copy_file_range)
+  // Through syscall, since older C libraries don't wrap it.
+  return syscall(__NR_copy_file_range, in, NULL, out, NULL, length, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+ssize_t SendFile(int in, int out, size_t length) {
+#if defined(__linux__)
+  return sendfile(out, in, NULL, length);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+bool WriteAll(int out, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(out, data, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+enum CopyMethod {
+  kCopyFileRange,
+  kSendFile,
+  kReadWrite,
+};
+
+// Copies the |size| bytes of |in| to |out| with copy_file_range, which can
+// share extents or copy on the server, falling back to sendfile, then to
+// read and write, where the kernel or the file systems don't support them.
+// Sets errno on failure, to ECANCELED if |job| was cancelled.
+bool CopyContent(int in, int out, uint64_t size, ArchiveJob* job) {
+  CopyMethod method = kCopyFileRange;
+  std::vector<char> buffer;
+  uint64_t done = 0;
+  while (true) {
+    if (job != NULL && job->cancelled()) {
+      errno = ECANCELED;
+      return false;
+    }
+    ssize_t copied;
+    if (method == kCopyFileRange) {
+      copied = CopyFileRange(in, out, kCopyChunkSize);
+      if (copied < 0 && (errno == ENOSYS || errno == EXDEV ||
+                         errno == EINVAL || errno == EOPNOTSUPP)) {
+        method = kSendFile;
+        continue;
+      }
+    } else if (method == kSendFile) {
+      copied = SendFile(in, out, kCopyChunkSize);
+      if (copied < 0 && (errno == ENOSYS || errno == EINVAL)) {
+        method = kReadWrite;
+        continue;
+      }
+    } else {
+      buffer.resize(kCopyChunkSize);
+      copied = read(in, &buffer[0], buffer.size());
+      if (copied > 0 && !WriteAll(out, &buffer[0], copied))
+        return false;
+    }
+    if (copied < 0 && errno == EINTR)
+      continue;
+    if (copied < 0)
+      return false;
+    if (copied == 0) {
+      // Some file systems report nothing to copy rather than an error.
+      if (method != kReadWrite && done < size) {
+        method = kReadWrite;
+        continue;
+      }
+      return true;
+    }
+    done += copied;
+    if (job != NULL)
+      job->AddBytes(copied, copied);
+  }
+}
+
+bool CopyOneFile(const CopyTask& task, ArchiveJob* job, bool* created,
+                 std::string* error) {
+  int in = open(task.source.c_str(), O_RDONLY);
+  if (in == -1) {
+    *error = ErrorMessage("open", task.source, errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(in, &st) != 0) {
+    *error = ErrorMessage("stat", task.source, errno);
+    close(in);
+    return false;
+  }
+  int out = open(task.target.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                 st.st_mode & 0777);
+  if (out == -1) {
+    *error = ErrorMessage("create", task.target, errno);
+    close(in);
+    return false;
+  }
+  *created = true;
+  // An existing target keeps its own permissions through open.
+  bool succeeded = fchmod(out, st.st_mode & 07777) == 0 &&
+      CopyContent(in, out, static_cast<uint64_t>(st.st_size), job);
+  // With the nanoseconds, which utime would truncate to seconds.
+#if defined(__APPLE__)
+  struct timespec times[2] = { st.st_atimespec, st.st_mtimespec };
+#else
+  struct timespec times[2] = { st.st_atim, st.st_mtim };
+#endif
+  if (succeeded)
+    succeeded = futimens(out, times) == 0;
+  int copy_error = errno;
+  close(in);
+  if (close(out) != 0 && succeeded) {
+    succeeded = false;
+    copy_error = errno;
+  }
+  if (!succeeded)
+    *error = ErrorMessage("copy", task.source, copy_error);
+  return succeeded;
+}
+
+#endif  // defined(_WIN32)
+
+// Copies the files of |tasks| on up to options.threads threads, largest
+// first. A failed or cancelled copy removes the files it created.
+bool CopyFiles(std::vector<CopyTask>* tasks, const CopyOptions& options,
+               std::string* error) {
+  // So that a few big files don't end up serialized behind the small ones.
+  std::stable_sort(tasks->begin(), tasks->end(),
+      [](const CopyTask& a, const CopyTask& b) { return a.size > b.size; });
+  uint64_t total_bytes = 0;
+  for (size_t i = 0; i < tasks->size(); ++i)
+    total_bytes += (*tasks)[i].size;
+  ArchiveJob* job = options.job;
+  if (job != NULL)
+    job->Start(tasks->size(), total_bytes);
+
+  // One flag per file, set by the thread copying it.
+  std::vector<char> created(tasks->size(), 0);
+  std::atomic<size_t> next_task(0);
+  std::atomic<bool> failed(false);
+  std::mutex error_mutex;
+  auto work = [&]() {
+    for (size_t i = next_task++; i < tasks->size() && !failed &&
+             !(job != NULL && job->cancelled()); i = next_task++) {
+      bool file_created = false;
+      std::string file_error;
+      bool succeeded = CopyOneFile((*tasks)[i], job, &file_created,
+                                   &file_error);
+      created[i] = file_created;
+      if (succeeded) {
+        if (job != NULL)
+          job->AddEntry();
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!failed.exchange(true))
+        *error = file_error;
+    }
+  };
+
+  size_t threads = options.threads > 0 ?
+      options.threads : std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, tasks->size());
+  // The calling thread takes a share of the work too.
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; ++i)
+    workers.push_back(std::thread(work));
+  work();
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  if (job != NULL)
+    job->Finish();
+
+  bool cancelled = job != NULL && job->cancelled();
+  if (!failed && !cancelled)
+    return true;
+  for (size_t i = 0; i < tasks->size(); ++i) {
+    if (created[i])
+      remove((*tasks)[i].target.c_str());
+  }
+  if (cancelled)
+    *error = "Copy cancelled.";
+  return false;
+}
+
+bool WalkTree(const std::string& source_dir, const CopyOptions& options,
+              DirectoryWalker* walker, std::string* error) {
+  DirectoryWalker::Options walk_options;
+  walk_options.threads = options.threads;
+  if (!walker->Walk(source_dir, walk_options)) {
+    *error = walker->error();
+    return false;
+  }
+  return true;
+}
+
+// Copies the tree |walker| walked into |target_dir|, with the modification
+// times of its directories. A failed or cancelled copy removes the
+// directories it created, unless they hold other files.
+bool CopyTree(const DirectoryWalker& walker, const std::string& target_dir,
+              const CopyOptions& options, std::string* error) {
+  // The directories first, parents before their children.
+  std::vector<std::string> created;
+  bool succeeded = MakeDirectories(target_dir, &created);
+  if (!succeeded)
+    *error = ErrorMessage("create", target_dir, errno);
+  for (size_t i = 0; succeeded && i < walker.directory_count(); ++i) {
+    std::string directory = target_dir + "/" + walker.relative_directory(i);
+    succeeded = MakeDirectory(directory, &created);
+    if (!succeeded)
+      *error = ErrorMessage("create", directory, errno);
+  }
+
+  if (succeeded) {
+    std::vector<CopyTask> tasks(walker.size());
+    for (size_t i = 0; i < walker.size(); ++i) {
+      tasks[i].source = walker.path(i);
+      tasks[i].target = target_dir + "/" + walker.relative_path(i);
+      tasks[i].size = walker.file_size(i);
+      tasks[i].time = walker.modification_time(i);
+    }
+    succeeded = CopyFiles(&tasks, options, error);
+  }
+  if (!succeeded) {
+    for (size_t i = created.size(); i > 0; --i)
+      RemoveEmptyDirectory(created[i - 1]);
+    return false;
+  }
+
+  for (size_t i = walker.directory_count(); i > 0; --i) {
+    const std::string& directory = walker.relative_directory(i - 1);
+    CopyDirectoryTime(walker.root() + "/" + directory,
+                      target_dir + "/" + directory);
+  }
+  CopyDirectoryTime(walker.root(), target_dir);
+  return true;
+}
+
+// Removes the tree |walker| walked at |root|, deepest directories first.
+bool RemoveTree(const DirectoryWalker& walker, const std::string& root,
+                std::string* error) {
+  for (size_t i = 0; i < walker.size(); ++i) {
+    std::string file = walker.path(i);
+    if (remove(file.c_str()) != 0 && errno != ENOENT) {
+      *error = ErrorMessage("remove", file, errno);
+      return false;
+    }
+  }
+  for (size_t i = walker.directory_count(); i > 0; --i) {
+    std::string directory = root + "/" + walker.relative_directory(i - 1);
+    if (!RemoveEmptyDirectory(directory)) {
+      *error = ErrorMessage("remove", directory, errno);
+      return false;
+    }
+  }
+  if (!RemoveEmptyDirectory(root)) {
+    *error = ErrorMessage("remove", root, errno);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool CopyDirectory(const std::string& source_dir,
+                   const std::string& target_dir,
+                   const CopyOptions& options,
+                   std::string* error) {
+  DirectoryWalker walker;
+  return WalkTree(source_dir, options, &walker, error) &&
+      CopyTree(walker, target_dir, options, error);
+}
+
+bool MoveDirectory(const std::string& source,
+                   const std::string& target,
+                   const CopyOptions& options,
+                   std::string* error) {
+  if (!utils::CreateParentDirectories(target)) {
+    *error = ErrorMessage("create the parents of", target, errno);
+    return false;
+  }
+  if (rename(source.c_str(), target.c_str()) == 0) {
+    if (options.job != NULL) {
+      options.job->Start(0, 0);
+      options.job->Finish();
+    }
+    return true;
+  }
+  // Only a move to another device needs a copy.
+  if (errno != EXDEV) {
+    *error = ErrorMessage("move", source, errno);
+    return false;
+  }
+
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_stat64(source.c_str(), &st) != 0) {
+#else
+  struct stat st;
+  if (stat(source.c_str(), &st) != 0) {
+#endif
+    *error = ErrorMessage("stat", source, errno);
+    return false;
+  }
+  if ((st.st_mode & S_IFMT) == S_IFDIR) {
+    DirectoryWalker walker;
+    if (!WalkTree(source, options, &walker, error))
+      return false;
+    // The copy would leave them behind, and the source couldn't be removed
+    // but in part: fail before anything is copied instead.
+    if (walker.skipped_count() > 0) {
+      *error = "Cannot move '" + source + "/" +
+          walker.relative_skipped_path(0) +
+          "': not a regular file or directory";
+      return false;
+    }
+    return CopyTree(walker, target, options, error) &&
+        RemoveTree(walker, source, error);
+  }
+
+  std::vector<CopyTask> tasks(1);
+  tasks[0].source = source;
+  tasks[0].target = target;
+  tasks[0].size = static_cast<uint64_t>(st.st_size);
+  tasks[0].time = static_cast<int64_t>(st.st_mtime);
+  if (!CopyFiles(&tasks, options, error))
+    return false;
+  if (remove(source.c_str()) != 0) {
+    *error = ErrorMessage("remove", source, errno);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace greenworks
@@ -0,0 +1,49 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_FILE_COPY_H_
+#define SRC_GREENWORKS_FILE_COPY_H_
+
+#include <string>
+
+namespace greenworks {
+
+class ArchiveJob;
+
+struct CopyOptions {
+  CopyOptions() : threads(0), job(NULL) {}
+
+  // The number of files copied at once; 0 uses one per core.
+  int threads;
+  // Receives the progress and may cancel the copy, which then removes the
+  // files it copied. Not owned.
+  ArchiveJob* job;
+};
+
+// Copies the files and subdirectories under |source_dir| into |target_dir|,
+// which is created with its parents if missing; existing files are
+// overwritten. The file contents are copied in the kernel where possible
+// (copy_file_range or sendfile on Linux, CopyFileEx on Windows), several
+// files at a time, and keep their modification times and permissions.
+// Symbolic links to files are copied as files; links to directories,
+// dangling links and special files are skipped. Returns false with |error|
+// set on failure or cancellation.
+bool CopyDirectory(const std::string& source_dir,
+                   const std::string& target_dir,
+                   const CopyOptions& options,
+                   std::string* error);
+
+// Moves |source| (a directory or a file) to |target| by renaming it, or if
+// they're on different devices, by copying it as CopyDirectory does then
+// removing it. A failed or cancelled copy leaves |source| untouched, and so
+// does a source holding entries the copy would skip: the move fails before
+// copying anything.
+bool MoveDirectory(const std::string& source,
+                   const std::string& target,
+                   const CopyOptions& options,
+                   std::string* error);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_FILE_COPY_H_
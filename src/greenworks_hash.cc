@@ -0,0 +1,242 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "greenworks_archive_io.h"
+#include "greenworks_archive_job.h"
+#include "greenworks_crc32.h"
+
+namespace greenworks {
+
+namespace {
+
+const uint32_t kRoundConstants[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// The size of the reads of files which aren't mapped, and of the chunks
+// between which the job is checked.
+const size_t kReadBufferSize = 1024 * 1024;
+const size_t kFirstReadSize = 64 * 1024;
+
+// Hashes with either algorithm, through the same kernels as the archives.
+class FileHasher {
+ public:
+  explicit FileHasher(HashAlgorithm algorithm)
+      : algorithm_(algorithm), crc_(0) {}
+
+  void Update(const void* data, size_t size) {
+    if (algorithm_ == kHashCrc32)
+      crc_ = Crc32(crc_, data, size);
+    else
+      sha256_.Update(data, size);
+  }
+
+  std::string HexDigest() {
+    if (algorithm_ != kHashCrc32)
+      return sha256_.HexDigest();
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08x", crc_);
+    return hex;
+  }
+
+ private:
+  HashAlgorithm algorithm_;
+  Sha256 sha256_;
+  uint32_t crc_;
+};
+
+inline uint32_t RotateRight(uint32_t value, int bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+}  // namespace
+
+Sha256::Sha256() : length_(0), buffered_(0) {
+  static const uint32_t kInitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(state_, kInitialState, sizeof(state_));
+}
+
+void Sha256::Update(const void* data, size_t size) {
+  const uint8_t* input = static_cast<const uint8_t*>(data);
+  length_ += size;
+  if (buffered_ > 0) {
+    size_t copied = std::min(size, sizeof(buffer_) - buffered_);
+    memcpy(buffer_ + buffered_, input, copied);
+    buffered_ += copied;
+    input += copied;
+    size -= copied;
+    if (buffered_ < sizeof(buffer_))
+      return;
+    Transform(buffer_);
+    buffered_ = 0;
+  }
+  // Whole blocks are hashed in place, without going through the buffer.
+  for (; size >= sizeof(buffer_); size -= sizeof(buffer_)) {
+    Transform(input);
+    input += sizeof(buffer_);
+  }
+  memcpy(buffer_, input, size);
+  buffered_ = size;
+}
+
+void Sha256::Final(uint8_t digest[kDigestSize]) {
+  uint64_t bit_length = length_ * 8;
+  // A 1 bit, zeros up to 56 mod 64 bytes, then the length in bits.
+  static const uint8_t kPadding[64] = { 0x80 };
+  size_t padding = buffered_ < 56 ? 56 - buffered_ : 120 - buffered_;
+  Update(kPadding, padding);
+  uint8_t length_bytes[8];
+  for (int i = 0; i < 8; ++i)
+    length_bytes[i] = static_cast<uint8_t>(bit_length >> (56 - i * 8));
+  Update(length_bytes, sizeof(length_bytes));
+  for (int i = 0; i < 8; ++i) {
+    digest[i * 4] = static_cast<uint8_t>(state_[i] >> 24);
+    digest[i * 4 + 1] = static_cast<uint8_t>(state_[i] >> 16);
+    digest[i * 4 + 2] = static_cast<uint8_t>(state_[i] >> 8);
+    digest[i * 4 + 3] = static_cast<uint8_t>(state_[i]);
+  }
+}
+
+std::string Sha256::HexDigest() {
+  static const char kHexDigits[] = "0123456789abcdef";
+  uint8_t digest[kDigestSize];
+  Final(digest);
+  std::string hex(kDigestSize * 2, '0');
+  for (size_t i = 0; i < kDigestSize; ++i) {
+    hex[i * 2] = kHexDigits[digest[i] >> 4];
+    hex[i * 2 + 1] = kHexDigits[digest[i] & 0xf];
+  }
+  return hex;
+}
+
+void Sha256::Transform(const uint8_t block[64]) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) |
+           (static_cast<uint32_t>(block[i * 4 + 1]) << 16) |
+           (static_cast<uint32_t>(block[i * 4 + 2]) << 8) |
+           static_cast<uint32_t>(block[i * 4 + 3]);
+  }
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+    uint32_t choice = (e & f) ^ (~e & g);
+    uint32_t temp1 = h + s1 + choice + kRoundConstants[i] + w[i];
+    uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+    uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t temp2 = s0 + majority;
+    h = g;
+    g = f;
+    f = e;
+    e = d + temp1;
+    d = c;
+    c = b;
+    b = a;
+    a = temp1 + temp2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+
+bool ParseHashAlgorithm(const std::string& name, HashAlgorithm* algorithm) {
+  if (name == "sha256")
+    *algorithm = kHashSha256;
+  else if (name == "crc32")
+    *algorithm = kHashCrc32;
+  else
+    return false;
+  return true;
+}
+
+const char* HashAlgorithmName(HashAlgorithm algorithm) {
+  return algorithm == kHashCrc32 ? "crc32" : "sha256";
+}
+
+bool HashFile(const char* path, HashAlgorithm algorithm, bool use_mmap,
+              ArchiveJob* job, std::string* hex_digest) {
+  FileHasher hash(algorithm);
+  MappedFile mapping;
+  if (use_mmap && mapping.Open(path)) {
+    const unsigned char* data = mapping.data();
+    ZPOS64_T remaining = mapping.size();
+    while (remaining > 0) {
+      if (job != NULL && job->cancelled())
+        return false;
+      size_t size = static_cast<size_t>(
+          std::min<ZPOS64_T>(remaining, kReadBufferSize));
+      hash.Update(data, size);
+      if (job != NULL)
+        job->AddBytes(size, size);
+      data += size;
+      remaining -= size;
+    }
+    *hex_digest = hash.HexDigest();
+    return true;
+  }
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+  // Most files are small: the buffer only grows to kReadBufferSize once the
+  // first read fills it.
+  std::vector<char> buffer(kFirstReadSize);
+  size_t size_read;
+  bool cancelled = false;
+  while ((size_read = fread(&buffer[0], 1, buffer.size(), file)) > 0) {
+    hash.Update(&buffer[0], size_read);
+    if (size_read == buffer.size())
+      buffer.resize(kReadBufferSize);
+    if (job != NULL) {
+      job->AddBytes(size_read, size_read);
+      if ((cancelled = job->cancelled()))
+        break;
+    }
+  }
+  bool succeeded = !cancelled && !ferror(file);
+  fclose(file);
+  if (succeeded)
+    *hex_digest = hash.HexDigest();
+  return succeeded;
+}
+
+bool Sha256File(const char* path, bool use_mmap, std::string* hex_digest) {
+  return HashFile(path, kHashSha256, use_mmap, NULL, hex_digest);
+}
+
+}  // namespace greenworks
@@ -0,0 +1,62 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_HASH_H_
+#define SRC_GREENWORKS_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace greenworks {
+
+class ArchiveJob;
+
+// Incremental SHA-256 (FIPS 180-4).
+class Sha256 {
+ public:
+  static const size_t kDigestSize = 32;
+
+  Sha256();
+
+  void Update(const void* data, size_t size);
+  // Finishes the hash; Update can't be called afterwards.
+  void Final(uint8_t digest[kDigestSize]);
+  // Finishes the hash, as lowercase hexadecimal.
+  std::string HexDigest();
+
+ private:
+  void Transform(const uint8_t block[64]);
+
+  uint32_t state_[8];
+  uint64_t length_;
+  uint8_t buffer_[64];
+  size_t buffered_;
+};
+
+enum HashAlgorithm {
+  kHashSha256,
+  kHashCrc32,
+};
+
+// Parses "sha256" or "crc32".
+bool ParseHashAlgorithm(const std::string& name, HashAlgorithm* algorithm);
+const char* HashAlgorithmName(HashAlgorithm algorithm);
+
+// Hashes the content of the file at |path| with |algorithm|, read through a
+// memory mapping if |use_mmap| and possible, else in large sequential reads.
+// A mapped file truncated meanwhile raises SIGBUS, so only map files which
+// nothing else writes.
+// Reports the bytes hashed to |job| if not NULL, and fails if it's cancelled.
+// Sets |hex_digest| to the lowercase hexadecimal digest.
+bool HashFile(const char* path, HashAlgorithm algorithm, bool use_mmap,
+              ArchiveJob* job, std::string* hex_digest);
+
+// HashFile with SHA-256 and no job.
+bool Sha256File(const char* path, bool use_mmap, std::string* hex_digest);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_HASH_H_
@@ -0,0 +1,1293 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#include "greenworks_patch.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "zlib/zlib.h"
+#include "zlib/contrib/minizip/ioapi.h"
+#include "greenworks_archive_job.h"
+#include "greenworks_crc32.h"
+#include "greenworks_directory_hash.h"
+#include "greenworks_utils.h"
+
+// A file patch is kFilePatchMagic then a deflate stream of:
+//   varint old size, uint32 old CRC-32, varint new size,
+//   instructions: kOpCopy varint offset, varint length (from the old file)
+//                 kOpInsert varint length, bytes
+//                 kOpEnd,
+//   uint32 new CRC-32.
+// A directory patch is kDirectoryPatchMagic, varint count of added and
+// modified files, varint total size of these files, then records:
+//   kFileRemoved varint path length, path
+//   kFileAdded or kFileModified varint path length, path, varint mode,
+//     uint64 length, file patch (from an empty file for kFileAdded)
+//   kFileEnd.
+// The mode holds the permission bits of the new file.
+// Integers are little-endian; varints take 7 bits a byte, low bits first.
+
+namespace greenworks {
+
+namespace {
+
+const char kFilePatchMagic[] = "GWDELTA1";
+const char kDirectoryPatchMagic[] = "GWDPATCH";
+const size_t kMagicSize = 8;
+
+enum PatchOp {
+  kOpEnd = 0,
+  kOpCopy = 1,
+  kOpInsert = 2,
+};
+
+enum FileOp {
+  kFileEnd = 0,
+  kFileAdded = 'A',
+  kFileModified = 'M',
+  kFileRemoved = 'R',
+};
+
+// The size of the reads and writes, and of the chunks between which the job
+// is checked.
+const size_t kChunkSize = 1024 * 1024;
+// The most new bytes buffered before they're written as an insertion.
+const size_t kMaxInsertSize = 1024 * 1024;
+const size_t kMinBlockSize = 1024;
+const size_t kMaxBlockSize = 64 * 1024;
+// Bounds the size of the block index.
+const uint64_t kMaxBlockCount = 1 << 24;
+// The most blocks of a hash bucket compared at one position.
+const int kMaxCandidates = 64;
+const uint32_t kNoBlock = 0xffffffff;
+// New files are written aside, with this suffix, until they're checked.
+const char kTempSuffix[] = ".gwpatch";
+// The files a directory patch replaces or removes are kept aside, numbered
+// in this directory of the patched one, until all of it is applied.
+const char kBackupDirectory[] = ".gwpatch-old";
+
+std::string ErrorMessage(const char* action, const std::string& path) {
+  return std::string("Cannot ") + action + " '" + path + "': " +
+      strerror(errno);
+}
+
+std::string InvalidPatchMessage(const std::string& patch_path) {
+  return "Invalid or damaged patch '" + patch_path + "'";
+}
+
+// Closes its file when it goes out of scope.
+class ScopedFile {
+ public:
+  explicit ScopedFile(FILE* file) : file_(file) {}
+  ~ScopedFile() { Close(); }
+
+  FILE* get() const { return file_; }
+  // Returns false if the file couldn't be flushed.
+  bool Close() {
+    bool succeeded = file_ == NULL || fclose(file_) == 0;
+    file_ = NULL;
+    return succeeded;
+  }
+
+ private:
+  FILE* file_;
+
+  ScopedFile(const ScopedFile&);
+  void operator=(const ScopedFile&);
+};
+
+bool GetSize(FILE* file, uint64_t* size) {
+  if (fseeko64(file, 0, SEEK_END) != 0)
+    return false;
+  int64_t end = ftello64(file);
+  if (end < 0 || fseeko64(file, 0, SEEK_SET) != 0)
+    return false;
+  *size = static_cast<uint64_t>(end);
+  return true;
+}
+
+bool WriteRawVarint(FILE* file, uint64_t value) {
+  do {
+    int byte = value & 0x7f;
+    value >>= 7;
+    if (fputc(value != 0 ? byte | 0x80 : byte, file) == EOF)
+      return false;
+  } while (value != 0);
+  return true;
+}
+
+bool ReadRawVarint(FILE* file, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = fgetc(file);
+    if (byte == EOF)
+      return false;
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool WriteRawUint64(FILE* file, uint64_t value) {
+  unsigned char bytes[8];
+  for (int i = 0; i < 8; ++i)
+    bytes[i] = static_cast<unsigned char>(value >> (i * 8));
+  return fwrite(bytes, 1, 8, file) == 8;
+}
+
+bool ReadRawUint64(FILE* file, uint64_t* value) {
+  unsigned char bytes[8];
+  if (fread(bytes, 1, 8, file) != 8)
+    return false;
+  *value = 0;
+  for (int i = 0; i < 8; ++i)
+    *value |= static_cast<uint64_t>(bytes[i]) << (i * 8);
+  return true;
+}
+
+// Deflates the content of a file patch into a file.
+class PatchWriter {
+ public:
+  explicit PatchWriter(FILE* file)
+      : file_(file), initialized_(false), output_(kChunkSize) {
+    memset(&stream_, 0, sizeof(stream_));
+  }
+  ~PatchWriter() {
+    if (initialized_)
+      deflateEnd(&stream_);
+  }
+
+  bool Init(int level) {
+    initialized_ = deflateInit(&stream_, level) == Z_OK;
+    return initialized_;
+  }
+  bool Write(const void* data, size_t size) {
+    stream_.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+    stream_.avail_in = static_cast<uInt>(size);
+    return Deflate(Z_NO_FLUSH);
+  }
+  bool WriteByte(uint8_t value) { return Write(&value, 1); }
+  bool WriteVarint(uint64_t value) {
+    uint8_t bytes[10];
+    size_t size = 0;
+    do {
+      bytes[size] = value & 0x7f;
+      value >>= 7;
+      if (value != 0)
+        bytes[size] |= 0x80;
+      ++size;
+    } while (value != 0);
+    return Write(bytes, size);
+  }
+  bool WriteUint32(uint32_t value) {
+    uint8_t bytes[4] = {
+      static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8),
+      static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24),
+    };
+    return Write(bytes, 4);
+  }
+  bool Finish() { return Deflate(Z_FINISH); }
+
+ private:
+  bool Deflate(int flush) {
+    while (true) {
+      stream_.next_out = &output_[0];
+      stream_.avail_out = static_cast<uInt>(output_.size());
+      int result = deflate(&stream_, flush);
+      if (result == Z_STREAM_ERROR)
+        return false;
+      size_t size = output_.size() - stream_.avail_out;
+      if (size > 0 && fwrite(&output_[0], 1, size, file_) != size)
+        return false;
+      if (flush == Z_FINISH ? result == Z_STREAM_END :
+          stream_.avail_in == 0 && stream_.avail_out != 0)
+        return true;
+    }
+  }
+
+  FILE* file_;
+  z_stream stream_;
+  bool initialized_;
+  std::vector<Bytef> output_;
+};
+
+// Inflates the content of a file patch, reading at most |limit| bytes of
+// the file.
+class PatchReader {
+ public:
+  PatchReader(FILE* file, uint64_t limit)
+      : file_(file), remaining_(limit), initialized_(false), ended_(false),
+        input_(kChunkSize) {
+    memset(&stream_, 0, sizeof(stream_));
+  }
+  ~PatchReader() {
+    if (initialized_)
+      inflateEnd(&stream_);
+  }
+
+  bool Init() {
+    initialized_ = inflateInit(&stream_) == Z_OK;
+    return initialized_;
+  }
+  // Fails if the stream ends, or is damaged, before |size| bytes.
+  bool Read(void* data, size_t size) {
+    stream_.next_out = static_cast<Bytef*>(data);
+    stream_.avail_out = static_cast<uInt>(size);
+    while (stream_.avail_out > 0) {
+      if (ended_ || !Inflate())
+        return false;
+    }
+    return true;
+  }
+  bool ReadByte(uint8_t* value) { return Read(value, 1); }
+  bool ReadVarint(uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte;
+      if (!ReadByte(&byte))
+        return false;
+      *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+        return true;
+    }
+    return false;
+  }
+  bool ReadUint32(uint32_t* value) {
+    uint8_t bytes[4];
+    if (!Read(bytes, 4))
+      return false;
+    *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+        (static_cast<uint32_t>(bytes[3]) << 24);
+    return true;
+  }
+  // Whether the stream ends here, without any more content.
+  bool End() {
+    uint8_t extra;
+    stream_.next_out = &extra;
+    stream_.avail_out = 1;
+    while (!ended_) {
+      if (!Inflate() || stream_.avail_out == 0)
+        return false;
+    }
+    return true;
+  }
+
+ private:
+  bool Inflate() {
+    if (stream_.avail_in == 0 && remaining_ > 0) {
+      size_t size = static_cast<size_t>(
+          std::min<uint64_t>(remaining_, input_.size()));
+      size_t size_read = fread(&input_[0], 1, size, file_);
+      if (size_read == 0)
+        return false;
+      // A short read is the end of the file.
+      remaining_ = size_read < size ? 0 : remaining_ - size_read;
+      stream_.next_in = &input_[0];
+      stream_.avail_in = static_cast<uInt>(size_read);
+    }
+    int result = inflate(&stream_, Z_NO_FLUSH);
+    if (result == Z_STREAM_END)
+      ended_ = true;
+    return result == Z_OK || result == Z_STREAM_END;
+  }
+
+  FILE* file_;
+  uint64_t remaining_;
+  z_stream stream_;
+  bool initialized_;
+  bool ended_;
+  std::vector<Bytef> input_;
+};
+
+// The weak checksum of rsync, which rolls along a file one byte at a time.
+class RollingChecksum {
+ public:
+  RollingChecksum() : a_(0), b_(0), size_(0) {}
+
+  void Init(const unsigned char* data, size_t size) {
+    a_ = 0;
+    b_ = 0;
+    size_ = static_cast<uint32_t>(size);
+    for (size_t i = 0; i < size; ++i) {
+      a_ += data[i];
+      b_ += a_;
+    }
+  }
+  // Drops |out|, the first byte of the window, and appends |in|.
+  void Roll(unsigned char out, unsigned char in) {
+    a_ += in - out;
+    b_ += a_ - size_ * out;
+  }
+  uint32_t value() const { return (a_ & 0xffff) | (b_ << 16); }
+
+ private:
+  uint32_t a_;
+  uint32_t b_;
+  uint32_t size_;
+};
+
+// The whole blocks of an old file, by weak checksum.
+struct BlockIndex {
+  BlockIndex() : block_size(0), shift(31) {}
+
+  size_t Bucket(uint32_t weak) const {
+    return (weak * 0x9e3779b1u) >> shift;
+  }
+
+  size_t block_size;
+  std::vector<uint32_t> weak;
+  std::vector<uint32_t> crc;
+  // The next block of the same bucket.
+  std::vector<uint32_t> next;
+  // The first block of each bucket.
+  std::vector<uint32_t> buckets;
+  int shift;
+};
+
+size_t ChooseBlockSize(uint64_t old_size, int requested) {
+  size_t block_size = requested > 0 ? static_cast<size_t>(requested) :
+      std::min(kMaxBlockSize, std::max(kMinBlockSize,
+          static_cast<size_t>(sqrt(static_cast<double>(old_size)))));
+  return static_cast<size_t>(std::max<uint64_t>(
+      block_size, (old_size + kMaxBlockCount - 1) / kMaxBlockCount));
+}
+
+// Indexes the |size| bytes of |file| in blocks of |block_size|, and sets
+// |crc| to the CRC-32 of the whole file.
+bool BuildIndex(FILE* file, uint64_t size, size_t block_size,
+                ArchiveJob* job, BlockIndex* index, uint32_t* crc) {
+  size_t count = static_cast<size_t>(size / block_size);
+  index->block_size = block_size;
+  index->weak.resize(count);
+  index->crc.resize(count);
+  index->next.resize(count);
+  size_t bucket_count = 2;
+  index->shift = 31;
+  while (bucket_count < count * 2) {
+    bucket_count *= 2;
+    --index->shift;
+  }
+  index->buckets.assign(bucket_count, kNoBlock);
+
+  std::vector<unsigned char> buffer(
+      std::max<size_t>(1, kChunkSize / block_size) * block_size);
+  uint32_t block = 0;
+  uint64_t done = 0;
+  *crc = 0;
+  while (done < size) {
+    if (job != NULL && job->cancelled())
+      return false;
+    size_t length = static_cast<size_t>(
+        std::min<uint64_t>(buffer.size(), size - done));
+    if (fread(&buffer[0], 1, length, file) != length)
+      return false;
+    *crc = Crc32(*crc, &buffer[0], length);
+    for (size_t offset = 0; offset + block_size <= length;
+         offset += block_size, ++block) {
+      RollingChecksum checksum;
+      checksum.Init(&buffer[offset], block_size);
+      index->weak[block] = checksum.value();
+      index->crc[block] = Crc32(0, &buffer[offset], block_size);
+      size_t bucket = index->Bucket(index->weak[block]);
+      index->next[block] = index->buckets[bucket];
+      index->buckets[bucket] = block;
+    }
+    done += length;
+    if (job != NULL)
+      job->AddBytes(length, 0);
+  }
+  return true;
+}
+
+// Writes the instructions rebuilding a new file from an indexed old one.
+class DeltaEncoder {
+ public:
+  DeltaEncoder(const BlockIndex& index, FILE* old_file, PatchWriter* writer,
+               ArchiveJob* job, PatchStats* stats)
+      : index_(index), old_file_(old_file), writer_(writer), job_(job),
+        stats_(stats), copy_offset_(0), copy_length_(0),
+        last_block_(kNoBlock), cached_block_(kNoBlock),
+        old_read_failed_(false), write_failed_(false),
+        old_block_(index.block_size) {}
+
+  // Encodes the |size| bytes of |file| and sets |crc| to their CRC-32.
+  bool Encode(FILE* file, uint64_t size, uint32_t* crc);
+
+  bool old_read_failed() const { return old_read_failed_; }
+  bool write_failed() const { return write_failed_; }
+
+ private:
+  uint32_t FindBlock(const unsigned char* window, uint32_t weak);
+  bool Matches(uint32_t block, const unsigned char* window, uint32_t weak,
+               bool* has_crc, uint32_t* crc);
+  bool Copy(uint32_t block);
+  bool FlushCopy();
+  bool Insert(const unsigned char* data, size_t size);
+
+  const BlockIndex& index_;
+  FILE* old_file_;
+  PatchWriter* writer_;
+  ArchiveJob* job_;
+  PatchStats* stats_;
+  // The pending copy, extended while the blocks follow each other.
+  uint64_t copy_offset_;
+  uint64_t copy_length_;
+  uint32_t last_block_;
+  uint32_t cached_block_;
+  bool old_read_failed_;
+  bool write_failed_;
+  std::vector<unsigned char> old_block_;
+};
+
+bool DeltaEncoder::Encode(FILE* file, uint64_t size, uint32_t* crc) {
+  const size_t block_size = index_.block_size;
+  // The bytes not written yet, from |literal|, then the window at |position|
+  // and what's been read ahead.
+  std::vector<unsigned char> buffer(kMaxInsertSize + block_size + kChunkSize);
+  size_t literal = 0;
+  size_t position = 0;
+  size_t end = 0;
+  uint64_t read = 0;
+  bool eof = false;
+  bool summed = false;
+  RollingChecksum checksum;
+  *crc = 0;
+  while (true) {
+    if (end - position <= block_size && !eof) {
+      if (job_ != NULL && job_->cancelled())
+        return false;
+      memmove(&buffer[0], &buffer[literal], end - literal);
+      position -= literal;
+      end -= literal;
+      literal = 0;
+      size_t length = buffer.size() - end;
+      size_t size_read = fread(&buffer[end], 1, length, file);
+      if (ferror(file))
+        return false;
+      eof = size_read < length;
+      *crc = Crc32(*crc, &buffer[end], size_read);
+      end += size_read;
+      read += size_read;
+      if (job_ != NULL)
+        job_->AddBytes(size_read, 0);
+    }
+    // Without old blocks, everything is inserted as it's read.
+    if (index_.weak.empty()) {
+      position = end;
+      if (end > literal && !Insert(&buffer[literal], end - literal))
+        return false;
+      literal = end;
+      if (eof)
+        break;
+      continue;
+    }
+    if (end - position < block_size)
+      break;
+
+    if (!summed) {
+      checksum.Init(&buffer[position], block_size);
+      summed = true;
+    }
+    uint32_t block = FindBlock(&buffer[position], checksum.value());
+    if (old_read_failed_)
+      return false;
+    if (block != kNoBlock) {
+      if (position > literal &&
+          !Insert(&buffer[literal], position - literal))
+        return false;
+      if (!Copy(block))
+        return false;
+      position += block_size;
+      literal = position;
+      summed = false;
+      continue;
+    }
+    if (end - position > block_size)
+      checksum.Roll(buffer[position], buffer[position + block_size]);
+    else
+      summed = false;
+    ++position;
+    if (position - literal >= kMaxInsertSize) {
+      if (!Insert(&buffer[literal], position - literal))
+        return false;
+      literal = position;
+    }
+  }
+  if (end > literal && !Insert(&buffer[literal], end - literal))
+    return false;
+  if (!FlushCopy())
+    return false;
+  // The file changed while it was read.
+  return read == size;
+}
+
+uint32_t DeltaEncoder::FindBlock(const unsigned char* window, uint32_t weak) {
+  bool has_crc = false;
+  uint32_t crc = 0;
+  // The block following the last match is the likeliest.
+  uint32_t expected = last_block_ + 1;
+  if (expected < index_.weak.size() &&
+      Matches(expected, window, weak, &has_crc, &crc))
+    return expected;
+  int candidates = 0;
+  for (uint32_t block = index_.buckets[index_.Bucket(weak)];
+       block != kNoBlock && candidates < kMaxCandidates;
+       block = index_.next[block], ++candidates) {
+    if (block != expected && Matches(block, window, weak, &has_crc, &crc))
+      return block;
+  }
+  return kNoBlock;
+}
+
+// Compares the checksums first, then the bytes, so that a collision can't
+// corrupt the new file.
+bool DeltaEncoder::Matches(uint32_t block, const unsigned char* window,
+                           uint32_t weak, bool* has_crc, uint32_t* crc) {
+  const size_t block_size = index_.block_size;
+  if (index_.weak[block] != weak)
+    return false;
+  if (!*has_crc) {
+    *crc = Crc32(0, window, block_size);
+    *has_crc = true;
+  }
+  if (index_.crc[block] != *crc)
+    return false;
+  if (cached_block_ != block) {
+    cached_block_ = kNoBlock;
+    if (fseeko64(old_file_, static_cast<uint64_t>(block) * block_size,
+                 SEEK_SET) != 0 ||
+        fread(&old_block_[0], 1, block_size, old_file_) != block_size) {
+      old_read_failed_ = true;
+      return false;
+    }
+    cached_block_ = block;
+  }
+  return memcmp(&old_block_[0], window, block_size) == 0;
+}
+
+bool DeltaEncoder::Copy(uint32_t block) {
+  uint64_t offset = static_cast<uint64_t>(block) * index_.block_size;
+  last_block_ = block;
+  if (copy_length_ > 0 && copy_offset_ + copy_length_ == offset) {
+    copy_length_ += index_.block_size;
+    return true;
+  }
+  if (!FlushCopy())
+    return false;
+  copy_offset_ = offset;
+  copy_length_ = index_.block_size;
+  return true;
+}
+
+bool DeltaEncoder::FlushCopy() {
+  if (copy_length_ == 0)
+    return true;
+  if (!writer_->WriteByte(kOpCopy) || !writer_->WriteVarint(copy_offset_) ||
+      !writer_->WriteVarint(copy_length_)) {
+    write_failed_ = true;
+    return false;
+  }
+  stats_->copied_bytes += copy_length_;
+  copy_length_ = 0;
+  return true;
+}
+
+bool DeltaEncoder::Insert(const unsigned char* data, size_t size) {
+  if (!FlushCopy())
+    return false;
+  if (!writer_->WriteByte(kOpInsert) || !writer_->WriteVarint(size) ||
+      !writer_->Write(data, size)) {
+    write_failed_ = true;
+    return false;
+  }
+  stats_->inserted_bytes += size;
+  return true;
+}
+
+// Writes to |patch| the file patch from |old_path| (an empty file if NULL)
+// to |new_path|.
+bool EncodeFile(const std::string* old_path, const std::string& new_path,
+                FILE* patch, const std::string& patch_path,
+                const PatchOptions& options, PatchStats* stats,
+                std::string* error) {
+  ScopedFile old_file(old_path != NULL ?
+      fopen64(old_path->c_str(), "rb") : NULL);
+  uint64_t old_size = 0;
+  if (old_path != NULL &&
+      (old_file.get() == NULL || !GetSize(old_file.get(), &old_size))) {
+    *error = ErrorMessage("read", *old_path);
+    return false;
+  }
+  ScopedFile new_file(fopen64(new_path.c_str(), "rb"));
+  uint64_t new_size = 0;
+  if (new_file.get() == NULL || !GetSize(new_file.get(), &new_size)) {
+    *error = ErrorMessage("read", new_path);
+    return false;
+  }
+
+  BlockIndex index;
+  index.block_size = ChooseBlockSize(old_size, options.block_size);
+  uint32_t old_crc = 0;
+  if (old_path != NULL && !BuildIndex(old_file.get(), old_size,
+          index.block_size, options.job, &index, &old_crc)) {
+    *error = ErrorMessage("read", *old_path);
+    return false;
+  }
+
+  PatchWriter writer(patch);
+  uint32_t new_crc = 0;
+  DeltaEncoder encoder(index, old_file.get(), &writer, options.job, stats);
+  bool succeeded =
+      fwrite(kFilePatchMagic, 1, kMagicSize, patch) == kMagicSize &&
+      writer.Init(options.compress_level) && writer.WriteVarint(old_size) &&
+      writer.WriteUint32(old_crc) && writer.WriteVarint(new_size);
+  if (!succeeded) {
+    *error = ErrorMessage("write", patch_path);
+    return false;
+  }
+  if (!encoder.Encode(new_file.get(), new_size, &new_crc)) {
+    if (encoder.old_read_failed())
+      *error = ErrorMessage("read", *old_path);
+    else if (encoder.write_failed())
+      *error = ErrorMessage("write", patch_path);
+    else
+      *error = ErrorMessage("read", new_path);
+    return false;
+  }
+  if (!writer.WriteByte(kOpEnd) || !writer.WriteUint32(new_crc) ||
+      !writer.Finish()) {
+    *error = ErrorMessage("write", patch_path);
+    return false;
+  }
+  return true;
+}
+
+// Rebuilds a new file into |output| from the file patch |reader| inflates
+// (past the magic) and |old_file|, NULL for an empty file. Starts |job| with
+// the size of the new file if |start_job|.
+bool DecodeFile(PatchReader* reader, FILE* old_file,
+                const std::string& old_path, FILE* output,
+                const std::string& patch_path, ArchiveJob* job,
+                bool start_job, std::string* error) {
+  uint64_t old_size;
+  uint32_t old_crc;
+  uint64_t new_size;
+  if (!reader->ReadVarint(&old_size) || !reader->ReadUint32(&old_crc) ||
+      !reader->ReadVarint(&new_size)) {
+    *error = InvalidPatchMessage(patch_path);
+    return false;
+  }
+  if (start_job && job != NULL)
+    job->Start(1, new_size);
+
+  // The patch only applies to the file it was created from.
+  std::vector<unsigned char> buffer(kChunkSize);
+  uint64_t actual_size = 0;
+  uint32_t actual_crc = 0;
+  if (old_file != NULL) {
+    size_t size_read;
+    while ((size_read = fread(&buffer[0], 1, buffer.size(), old_file)) > 0) {
+      actual_crc = Crc32(actual_crc, &buffer[0], size_read);
+      actual_size += size_read;
+    }
+    if (ferror(old_file)) {
+      *error = ErrorMessage("read", old_path);
+      return false;
+    }
+  }
+  if (actual_size != old_size || actual_crc != old_crc) {
+    *error = "'" + old_path + "' isn't the file the patch was created from";
+    return false;
+  }
+
+  uint64_t written = 0;
+  uint32_t crc = 0;
+  while (true) {
+    if (job != NULL && job->cancelled())
+      return false;
+    uint8_t op;
+    uint64_t offset = 0;
+    uint64_t length;
+    if (!reader->ReadByte(&op) || op > kOpInsert ||
+        (op == kOpCopy && !reader->ReadVarint(&offset)) ||
+        (op != kOpEnd && !reader->ReadVarint(&length)) ||
+        (op != kOpEnd && length > new_size - written) ||
+        (op == kOpCopy && (old_file == NULL || offset > old_size ||
+                           length > old_size - offset))) {
+      *error = InvalidPatchMessage(patch_path);
+      return false;
+    }
+    if (op == kOpEnd)
+      break;
+    if (op == kOpCopy && fseeko64(old_file, offset, SEEK_SET) != 0) {
+      *error = ErrorMessage("read", old_path);
+      return false;
+    }
+    while (length > 0) {
+      size_t size = static_cast<size_t>(
+          std::min<uint64_t>(length, buffer.size()));
+      if (op == kOpCopy &&
+          fread(&buffer[0], 1, size, old_file) != size) {
+        *error = ErrorMessage("read", old_path);
+        return false;
+      }
+      if (op == kOpInsert && !reader->Read(&buffer[0], size)) {
+        *error = InvalidPatchMessage(patch_path);
+        return false;
+      }
+      if (fwrite(&buffer[0], 1, size, output) != size) {
+        *error = "Cannot write the patched file: " +
+            std::string(strerror(errno));
+        return false;
+      }
+      crc = Crc32(crc, &buffer[0], size);
+      written += size;
+      length -= size;
+      if (job != NULL)
+        job->AddBytes(size, size);
+    }
+  }
+  uint32_t new_crc;
+  if (!reader->ReadUint32(&new_crc) || !reader->End() ||
+      written != new_size || crc != new_crc) {
+    *error = InvalidPatchMessage(patch_path);
+    return false;
+  }
+  return true;
+}
+
+bool ReadMagic(FILE* file, const char* magic) {
+  char bytes[kMagicSize];
+  return fread(bytes, 1, kMagicSize, file) == kMagicSize &&
+      memcmp(bytes, magic, kMagicSize) == 0;
+}
+
+// Replaces |target| with |source|.
+bool MoveOver(const std::string& source, const std::string& target) {
+#if defined(_WIN32)
+  // rename() doesn't replace an existing file on Windows.
+  remove(target.c_str());
+#endif
+  return rename(source.c_str(), target.c_str()) == 0;
+}
+
+// Whether |a| and |b| name the same file: the same path, or on POSIX, the
+// same inode through another path or a hard link.
+bool IsSameFile(const std::string& a, const std::string& b) {
+  if (a == b)
+    return true;
+#if defined(_WIN32)
+  return false;
+#else
+  struct stat a_stat;
+  struct stat b_stat;
+  return stat(a.c_str(), &a_stat) == 0 && stat(b.c_str(), &b_stat) == 0 &&
+      a_stat.st_dev == b_stat.st_dev && a_stat.st_ino == b_stat.st_ino;
+#endif
+}
+
+// The permission bits of |path|, 0644 if it can't be read.
+uint32_t GetFileMode(const std::string& path) {
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_stat64(path.c_str(), &st) != 0)
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+#endif
+    return 0644;
+  return st.st_mode & 0777;
+}
+
+// Gives |file| the permission bits |mode|. Windows only knows of read-only
+// files, which the patches don't touch.
+bool SetFileMode(FILE* file, uint32_t mode) {
+#if defined(_WIN32)
+  return true;
+#else
+  return fchmod(fileno(file), mode & 0777) == 0;
+#endif
+}
+
+bool MakeDirectory(const std::string& path) {
+#if defined(_WIN32)
+  return _mkdir(path.c_str()) == 0;
+#else
+  return mkdir(path.c_str(), 0775) == 0;
+#endif
+}
+
+bool RemoveEmptyDirectory(const std::string& path) {
+#if defined(_WIN32)
+  return _rmdir(path.c_str()) == 0;
+#else
+  return rmdir(path.c_str()) == 0;
+#endif
+}
+
+// Creates the missing parents of |path| under |dir|, and appends them to
+// |created|, parents before their children.
+bool CreateParents(const std::string& dir, const std::string& path,
+                   std::vector<std::string>* created) {
+  for (size_t end = path.find('/'); end != std::string::npos;
+       end = path.find('/', end + 1)) {
+    std::string parent = dir + "/" + path.substr(0, end);
+    if (MakeDirectory(parent))
+      created->push_back(parent);
+    else if (errno != EEXIST)
+      return false;
+  }
+  return true;
+}
+
+// Removes the parents of |path| under |dir| which are left empty, and
+// appends them to |removed|, children before their parents. This makes room
+// for a new file where a directory was.
+void RemoveEmptyParents(const std::string& dir, const std::string& path,
+                        std::vector<std::string>* removed) {
+  for (size_t end = path.rfind('/'); end != std::string::npos;
+       end = path.rfind('/', end - 1)) {
+    std::string parent = dir + "/" + path.substr(0, end);
+    if (!RemoveEmptyDirectory(parent))
+      return;
+    removed->push_back(parent);
+  }
+}
+
+std::string BackupPath(const std::string& backup_dir, size_t index) {
+  return backup_dir + "/" + std::to_string(index);
+}
+
+// Moves the file |target| into |backup_dir|, created if needed, and appends
+// it to |backed_up|, whose index names it there. Succeeds if |target|
+// doesn't exist. Directories aren't moved aside: they may hold files which
+// the patch doesn't know of.
+bool MoveAside(const std::string& target, const std::string& backup_dir,
+               std::vector<std::string>* backed_up) {
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_stat64(target.c_str(), &st) != 0)
+#else
+  struct stat st;
+  if (stat(target.c_str(), &st) != 0)
+#endif
+    return errno == ENOENT;
+  if ((st.st_mode & S_IFMT) == S_IFDIR) {
+    errno = EISDIR;
+    return false;
+  }
+  if (backed_up->empty() && !MakeDirectory(backup_dir) && errno != EEXIST)
+    return false;
+  if (!MoveOver(target, BackupPath(backup_dir, backed_up->size())))
+    return false;
+  backed_up->push_back(target);
+  return true;
+}
+
+// Whether a path of a directory patch stays within the directory, and out
+// of its backups.
+bool IsSafePath(const std::string& path) {
+  if (path.empty() || path[0] == '/' || path.find('\\') != std::string::npos ||
+      (path.size() > 1 && path[1] == ':'))
+    return false;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos)
+      end = path.size();
+    std::string component = path.substr(start, end - start);
+    if (component.empty() || component == "." || component == ".." ||
+        (start == 0 && component == kBackupDirectory))
+      return false;
+    start = end + 1;
+  }
+  return true;
+}
+
+const ManifestEntry* FindEntry(const std::vector<ManifestEntry>& manifest,
+                               const std::string& path) {
+  std::vector<ManifestEntry>::const_iterator it = std::lower_bound(
+      manifest.begin(), manifest.end(), path,
+      [](const ManifestEntry& entry, const std::string& path) {
+        return entry.path < path;
+      });
+  return it != manifest.end() && it->path == path ? &*it : NULL;
+}
+
+bool WriteFileRecord(FILE* patch, FileOp op, const std::string& path) {
+  return fputc(op, patch) != EOF && WriteRawVarint(patch, path.size()) &&
+      fwrite(path.data(), 1, path.size(), patch) == path.size();
+}
+
+}  // namespace
+
+bool CreatePatch(const std::string& old_path,
+                 const std::string& new_path,
+                 const std::string& patch_path,
+                 const PatchOptions& options,
+                 PatchStats* stats,
+                 std::string* error) {
+  *stats = PatchStats();
+  // Creating the patch would truncate the file before it's read.
+  if (IsSameFile(patch_path, old_path) || IsSameFile(patch_path, new_path)) {
+    *error = "Cannot write the patch over '" + patch_path +
+        "', which is one of the files compared";
+    return false;
+  }
+  if (options.job != NULL) {
+    int64_t old_size = utils::GetFileSize(old_path.c_str());
+    int64_t new_size = utils::GetFileSize(new_path.c_str());
+    options.job->Start(1, std::max<int64_t>(0, old_size) +
+                          std::max<int64_t>(0, new_size));
+  }
+  ScopedFile patch(fopen64(patch_path.c_str(), "wb"));
+  if (patch.get() == NULL) {
+    *error = ErrorMessage("create", patch_path);
+    return false;
+  }
+  bool succeeded = EncodeFile(&old_path, new_path, patch.get(), patch_path,
+                              options, stats, error);
+  if (succeeded) {
+    int64_t size = ftello64(patch.get());
+    succeeded = patch.Close();
+    if (!succeeded)
+      *error = ErrorMessage("write", patch_path);
+    stats->files = 1;
+    stats->patch_size = static_cast<uint64_t>(size);
+  }
+  if (options.job != NULL) {
+    options.job->AddEntry();
+    options.job->Finish();
+  }
+  if (!succeeded) {
+    patch.Close();
+    remove(patch_path.c_str());
+  }
+  return succeeded;
+}
+
+bool ApplyPatch(const std::string& old_path,
+                const std::string& patch_path,
+                const std::string& new_path,
+                const PatchOptions& options,
+                std::string* error) {
+  ScopedFile patch(fopen64(patch_path.c_str(), "rb"));
+  if (patch.get() == NULL) {
+    *error = ErrorMessage("open", patch_path);
+    return false;
+  }
+  if (!ReadMagic(patch.get(), kFilePatchMagic)) {
+    *error = InvalidPatchMessage(patch_path);
+    return false;
+  }
+  ScopedFile old_file(fopen64(old_path.c_str(), "rb"));
+  if (old_file.get() == NULL) {
+    *error = ErrorMessage("open", old_path);
+    return false;
+  }
+  std::string temp_path = new_path + kTempSuffix;
+  if (!utils::CreateParentDirectories(new_path)) {
+    *error = ErrorMessage("create the parents of", new_path);
+    return false;
+  }
+  ScopedFile output(fopen64(temp_path.c_str(), "wb"));
+  if (output.get() == NULL) {
+    *error = ErrorMessage("create", temp_path);
+    return false;
+  }
+  // The new file keeps the permissions of the old one.
+  if (!SetFileMode(output.get(), GetFileMode(old_path))) {
+    *error = ErrorMessage("set the permissions of", temp_path);
+    output.Close();
+    remove(temp_path.c_str());
+    return false;
+  }
+
+  PatchReader reader(patch.get(), UINT64_MAX);
+  bool succeeded = reader.Init() &&
+      DecodeFile(&reader, old_file.get(), old_path, output.get(), patch_path,
+                 options.job, true, error);
+  if (!output.Close() && succeeded) {
+    *error = ErrorMessage("write", temp_path);
+    succeeded = false;
+  }
+  // The old file may be the one replaced.
+  old_file.Close();
+  if (succeeded && !MoveOver(temp_path, new_path)) {
+    *error = ErrorMessage("replace", new_path);
+    succeeded = false;
+  }
+  if (!succeeded)
+    remove(temp_path.c_str());
+  if (options.job != NULL) {
+    if (succeeded)
+      options.job->AddEntry();
+    options.job->Finish();
+  }
+  return succeeded;
+}
+
+bool CreateDirectoryPatch(const std::string& old_dir,
+                          const std::string& new_dir,
+                          const std::string& patch_path,
+                          const PatchOptions& options,
+                          PatchStats* stats,
+                          std::string* error) {
+  *stats = PatchStats();
+  HashDirectoryOptions hash_options;
+  hash_options.threads = options.threads;
+  std::vector<ManifestEntry> old_manifest;
+  std::vector<ManifestEntry> new_manifest;
+  if (!HashDirectory(old_dir, hash_options, &old_manifest, error) ||
+      !HashDirectory(new_dir, hash_options, &new_manifest, error))
+    return false;
+  ManifestDiff diff;
+  DiffManifests(old_manifest, new_manifest, &diff);
+
+  uint64_t new_bytes = 0;
+  uint64_t total_bytes = 0;
+  for (size_t i = 0; i < diff.added.size(); ++i)
+    new_bytes += FindEntry(new_manifest, diff.added[i])->size;
+  for (size_t i = 0; i < diff.modified.size(); ++i) {
+    new_bytes += FindEntry(new_manifest, diff.modified[i])->size;
+    total_bytes += FindEntry(old_manifest, diff.modified[i])->size;
+  }
+  total_bytes += new_bytes;
+  uint64_t file_count = diff.added.size() + diff.modified.size();
+  ArchiveJob* job = options.job;
+  if (job != NULL)
+    job->Start(file_count, total_bytes);
+
+  ScopedFile patch(fopen64(patch_path.c_str(), "wb"));
+  if (patch.get() == NULL) {
+    *error = ErrorMessage("create", patch_path);
+    return false;
+  }
+  bool succeeded =
+      fwrite(kDirectoryPatchMagic, 1, kMagicSize, patch.get()) == kMagicSize &&
+      WriteRawVarint(patch.get(), file_count) &&
+      WriteRawVarint(patch.get(), new_bytes);
+  for (size_t i = 0; succeeded && i < diff.removed.size(); ++i)
+    succeeded = WriteFileRecord(patch.get(), kFileRemoved, diff.removed[i]);
+  if (!succeeded)
+    *error = ErrorMessage("write", patch_path);
+
+  for (size_t i = 0; succeeded && i < file_count; ++i) {
+    bool added = i < diff.added.size();
+    const std::string& path =
+        added ? diff.added[i] : diff.modified[i - diff.added.size()];
+    std::string old_path = old_dir + "/" + path;
+    // The length of the file patch is written once it's known.
+    int64_t length_offset = -1;
+    succeeded = WriteFileRecord(patch.get(),
+                                added ? kFileAdded : kFileModified, path) &&
+        WriteRawVarint(patch.get(), GetFileMode(new_dir + "/" + path)) &&
+        (length_offset = ftello64(patch.get())) >= 0 &&
+        WriteRawUint64(patch.get(), 0);
+    if (!succeeded) {
+      *error = ErrorMessage("write", patch_path);
+      break;
+    }
+    succeeded = EncodeFile(added ? NULL : &old_path, new_dir + "/" + path,
+                           patch.get(), patch_path, options, stats, error);
+    if (!succeeded)
+      break;
+    int64_t end_offset = ftello64(patch.get());
+    succeeded = end_offset >= 0 &&
+        fseeko64(patch.get(), length_offset, SEEK_SET) == 0 &&
+        WriteRawUint64(patch.get(), end_offset - length_offset - 8) &&
+        fseeko64(patch.get(), end_offset, SEEK_SET) == 0;
+    if (!succeeded)
+      *error = ErrorMessage("write", patch_path);
+    if (job != NULL)
+      job->AddEntry();
+  }
+
+  if (succeeded) {
+    succeeded = fputc(kFileEnd, patch.get()) != EOF;
+    int64_t size = ftello64(patch.get());
+    succeeded = patch.Close() && succeeded;
+    if (!succeeded)
+      *error = ErrorMessage("write", patch_path);
+    stats->files = file_count + diff.removed.size();
+    stats->patch_size = static_cast<uint64_t>(size);
+  }
+  if (job != NULL)
+    job->Finish();
+  if (!succeeded) {
+    patch.Close();
+    remove(patch_path.c_str());
+  }
+  return succeeded;
+}
+
+bool ApplyDirectoryPatch(const std::string& dir,
+                         const std::string& patch_path,
+                         const PatchOptions& options,
+                         std::string* error) {
+  ScopedFile patch(fopen64(patch_path.c_str(), "rb"));
+  if (patch.get() == NULL) {
+    *error = ErrorMessage("open", patch_path);
+    return false;
+  }
+  uint64_t file_count;
+  uint64_t new_bytes;
+  if (!ReadMagic(patch.get(), kDirectoryPatchMagic) ||
+      !ReadRawVarint(patch.get(), &file_count) ||
+      !ReadRawVarint(patch.get(), &new_bytes)) {
+    *error = InvalidPatchMessage(patch_path);
+    return false;
+  }
+  ArchiveJob* job = options.job;
+  if (job != NULL)
+    job->Start(file_count, new_bytes);
+
+  // The removed files are moved aside first, which empties the directories
+  // that new files may replace. The new files are then written aside, and
+  // only replace the old ones once they're all checked.
+  std::string backup_dir = dir + "/" + kBackupDirectory;
+  std::vector<std::string> patched;
+  std::vector<std::string> backed_up;
+  std::vector<std::string> created_directories;
+  std::vector<std::string> removed_directories;
+  bool succeeded = true;
+  while (succeeded) {
+    int op = fgetc(patch.get());
+    if (op == kFileEnd)
+      break;
+    uint64_t path_length;
+    std::string path;
+    succeeded = (op == kFileAdded || op == kFileModified ||
+                 op == kFileRemoved) &&
+        ReadRawVarint(patch.get(), &path_length) && path_length < 0x10000;
+    if (succeeded) {
+      path.resize(static_cast<size_t>(path_length));
+      succeeded = path_length == 0 ||
+          fread(&path[0], 1, path.size(), patch.get()) == path.size();
+    }
+    if (!succeeded || !IsSafePath(path)) {
+      *error = InvalidPatchMessage(patch_path);
+      succeeded = false;
+      break;
+    }
+    if (op == kFileRemoved) {
+      std::string target = dir + "/" + path;
+      succeeded = MoveAside(target, backup_dir, &backed_up);
+      if (!succeeded) {
+        *error = ErrorMessage("remove", target);
+        break;
+      }
+      RemoveEmptyParents(dir, path, &removed_directories);
+      continue;
+    }
+
+    std::string target = dir + "/" + path;
+    std::string temp_path = target + kTempSuffix;
+    uint64_t mode;
+    uint64_t length;
+    int64_t start = -1;
+    if (!ReadRawVarint(patch.get(), &mode) || mode > 0777 ||
+        !ReadRawUint64(patch.get(), &length) ||
+        (start = ftello64(patch.get())) < 0 || length < kMagicSize ||
+        !ReadMagic(patch.get(), kFilePatchMagic)) {
+      *error = InvalidPatchMessage(patch_path);
+      succeeded = false;
+      break;
+    }
+    ScopedFile old_file(op == kFileModified ?
+        fopen64(target.c_str(), "rb") : NULL);
+    if (op == kFileModified && old_file.get() == NULL) {
+      *error = ErrorMessage("open", target);
+      succeeded = false;
+      break;
+    }
+    if (!CreateParents(dir, path, &created_directories)) {
+      *error = ErrorMessage("create the parents of", target);
+      succeeded = false;
+      break;
+    }
+    ScopedFile output(fopen64(temp_path.c_str(), "wb"));
+    if (output.get() == NULL) {
+      *error = ErrorMessage("create", temp_path);
+      succeeded = false;
+      break;
+    }
+    patched.push_back(path);
+    if (!SetFileMode(output.get(), static_cast<uint32_t>(mode))) {
+      *error = ErrorMessage("set the permissions of", temp_path);
+      succeeded = false;
+      break;
+    }
+    PatchReader reader(patch.get(), length - kMagicSize);
+    succeeded = reader.Init() &&
+        DecodeFile(&reader, old_file.get(), target, output.get(),
+                   patch_path, job, false, error);
+    if (!output.Close() && succeeded) {
+      *error = ErrorMessage("write", temp_path);
+      succeeded = false;
+    }
+    // The reader may have read ahead.
+    if (succeeded &&
+        fseeko64(patch.get(), start + length, SEEK_SET) != 0) {
+      *error = InvalidPatchMessage(patch_path);
+      succeeded = false;
+    }
+    if (succeeded && job != NULL)
+      job->AddEntry();
+  }
+
+  // The files replaced are moved aside rather than deleted too, so that a
+  // rename failing halfway can be rolled back.
+  std::vector<std::string> replaced;
+  for (size_t i = 0; succeeded && i < patched.size(); ++i) {
+    std::string target = dir + "/" + patched[i];
+    if (!MoveAside(target, backup_dir, &backed_up) ||
+        rename((target + kTempSuffix).c_str(), target.c_str()) != 0) {
+      *error = ErrorMessage("replace", target);
+      succeeded = false;
+      break;
+    }
+    replaced.push_back(target);
+  }
+
+  if (succeeded) {
+    for (size_t i = 0; i < backed_up.size(); ++i)
+      remove(BackupPath(backup_dir, i).c_str());
+  } else {
+    // The new files and directories go first, as the old ones may have been
+    // where they are.
+    for (size_t i = replaced.size(); i > 0; --i)
+      remove(replaced[i - 1].c_str());
+    for (size_t i = 0; i < patched.size(); ++i)
+      remove((dir + "/" + patched[i] + kTempSuffix).c_str());
+    for (size_t i = created_directories.size(); i > 0; --i)
+      RemoveEmptyDirectory(created_directories[i - 1]);
+    for (size_t i = removed_directories.size(); i > 0; --i)
+      MakeDirectory(removed_directories[i - 1]);
+    for (size_t i = backed_up.size(); i > 0; --i)
+      MoveOver(BackupPath(backup_dir, i - 1), backed_up[i - 1]);
+  }
+  if (!backed_up.empty())
+    RemoveEmptyDirectory(backup_dir);
+  if (job != NULL)
+    job->Finish();
+  return succeeded;
+}
+
+}  // namespace greenworks
@@ -0,0 +1,96 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_GREENWORKS_PATCH_H_
+#define SRC_GREENWORKS_PATCH_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace greenworks {
+
+class ArchiveJob;
+
+struct PatchOptions {
+  PatchOptions() : block_size(0), compress_level(6), threads(0), job(NULL) {}
+
+  // The size of the blocks of the old file which the new one is matched
+  // against; 0 picks about the square root of the old file's size, between
+  // 1 KiB and 64 KiB. Smaller blocks find more matches, but cost more memory
+  // and time.
+  int block_size;
+  // The zlib level the patch is deflated at.
+  int compress_level;
+  // The number of files the directory variants hash at once; 0 uses one per
+  // core.
+  int threads;
+  // Receives the progress and may cancel the job. Not owned.
+  ArchiveJob* job;
+};
+
+struct PatchStats {
+  PatchStats()
+      : files(0), copied_bytes(0), inserted_bytes(0), patch_size(0) {}
+
+  // The files added, modified or removed by the patch.
+  uint64_t files;
+  // The bytes of the new files which the patch copies from the old ones.
+  uint64_t copied_bytes;
+  // The bytes of the new files which the patch carries, before deflation.
+  uint64_t inserted_bytes;
+  uint64_t patch_size;
+};
+
+// Writes to |patch_path| the difference between |old_path| and |new_path|:
+// the new file as ranges copied from the old one and new bytes, deflated.
+// |patch_path| can't be either of the files compared.
+// Matches are found with a rolling checksum over the blocks of the old file
+// (as rsync does), then checked byte for byte, so only the block index is
+// kept in memory: about 20 bytes per block, its hash buckets included.
+// Returns false with |error| set on failure or cancellation.
+bool CreatePatch(const std::string& old_path,
+                 const std::string& new_path,
+                 const std::string& patch_path,
+                 const PatchOptions& options,
+                 PatchStats* stats,
+                 std::string* error);
+
+// Rebuilds the new file of a CreatePatch at |new_path| from |old_path|,
+// which may be the same path, with the permissions of |old_path|. Fails,
+// leaving |new_path| untouched, if the old file isn't the one the patch was
+// created from, or if the result doesn't match the new file's size and
+// CRC-32.
+bool ApplyPatch(const std::string& old_path,
+                const std::string& patch_path,
+                const std::string& new_path,
+                const PatchOptions& options,
+                std::string* error);
+
+// Writes to |patch_path| the changes from |old_dir| to |new_dir|, which are
+// compared by the SHA-256 manifests of HashDirectory: a CreatePatch for each
+// modified file, the added files (deflated) and the removed paths. The
+// added and modified files keep their permission bits. Empty directories
+// aren't part of the patch.
+bool CreateDirectoryPatch(const std::string& old_dir,
+                          const std::string& new_dir,
+                          const std::string& patch_path,
+                          const PatchOptions& options,
+                          PatchStats* stats,
+                          std::string* error);
+
+// Applies a CreateDirectoryPatch to |dir| in place. The removed files are
+// moved aside first, with the directories they leave empty, which a new file
+// may replace. Every new file is then rebuilt aside and checked; they then
+// replace the old files, which are kept aside too until every rename
+// succeeded. A patch which doesn't apply, or fails halfway, leaves |dir| as
+// it was, without the directories it created.
+bool ApplyDirectoryPatch(const std::string& dir,
+                         const std::string& patch_path,
+                         const PatchOptions& options,
+                         std::string* error);
+
+}  // namespace greenworks
+
+#endif  // SRC_GREENWORKS_PATCH_H_
@@ -18,8 +18,19 @@
 
 #include "greenworks_unzip.h"
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "zlib/contrib/minizip/unzip.h"
 #include "zlib/zlib.h"
+#include "greenworks_archive_io.h"
+#include "greenworks_archive_job.h"
+#include "greenworks_crc32.h"
 
 #ifndef _WIN32
   #ifndef __USE_FILE_OFFSET64
@@ -46,16 +57,21 @@
 #ifdef _WIN32
   #include <direct.h>
   #include <io.h>
+  #include <sys/stat.h>
+  #include <sys/types.h>
 #else
   #include <unistd.h>
-  #include <utime.h>
   #include <sys/stat.h>
   #include <sys/types.h>
 #endif
 
 #define CASESENSITIVITY (0)
 #define WRITEBUFFERSIZE (8192)
-#define MAXFILENAME (256)
+#define MAXWRITEBUFFERSIZE (1024 * 1024)
+/* verified data is thrown away, into a buffer which stays in the cache */
+#define VERIFYBUFFERSIZE (64 * 1024)
+/* the largest entry unzip_entry inflates in memory */
+#define MAXENTRYSIZE (0x7fffffffU)
 
 #ifdef _WIN32
 #define USEWIN32IOAPI
@@ -64,23 +80,62 @@
 
 namespace {
 
+/* the directory extracted to; all output paths are resolved against it, so
+   that extraction never depends on (or changes) the working directory */
+struct OutputDir {
+#ifdef _WIN32
+  std::string path;
+#else
+  int fd;
+#endif
+};
+
+#ifdef _WIN32
+std::string output_path(const OutputDir& dir, const std::string& name) {
+  std::string path = dir.path + "\\" + name;
+  std::replace(path.begin(), path.end(), '/', '\\');
+  return path;
+}
+#else
+/* open the directory holding name, relative to dir, one component at a
+   time and without following symlinks, so that a link planted anywhere in
+   the target directory can't redirect the output; *leaf is set to the last
+   component; returns -1 on failure, or an fd to close */
+int open_parent_dir(const OutputDir& dir, const std::string& name,
+    std::string* leaf) {
+  int fd = dup(dir.fd);
+  size_t start = 0;
+  for (size_t end = name.find('/'); fd != -1 && end != std::string::npos;
+       end = name.find('/', start)) {
+    int parent = fd;
+    fd = openat(parent, name.substr(start, end - start).c_str(),
+                O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    close(parent);
+    start = end + 1;
+  }
+  *leaf = name.substr(start);
+  return fd;
+}
+#endif
+
 /* change_file_date : change the date/time of a file
-filename : the filename of the file where date/time must be modified
+name : the path of the file relative to dir
 dosdate : the new date at the MSDos format (4 bytes)
 tmu_date : the SAME new date at the tm_unz format */
-void change_file_date(const char *filename, uLong dosdate, tm_unz tmu_date) {
+void change_file_date(const OutputDir& dir, const std::string& name,
+    uLong dosdate, tm_unz tmu_date) {
 #ifdef _WIN32
   HANDLE hFile;
   FILETIME ftm, ftLocal, ftCreate, ftLastAcc, ftLastWrite;
-  hFile = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE,
-    0, NULL, OPEN_EXISTING, 0, NULL);
+  hFile = CreateFileA(output_path(dir, name).c_str(),
+    GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
   GetFileTime(hFile, &ftCreate, &ftLastAcc, &ftLastWrite);
   DosDateTimeToFileTime((WORD)(dosdate >> 16), (WORD)dosdate, &ftLocal);
   LocalFileTimeToFileTime(&ftLocal, &ftm);
   SetFileTime(hFile, &ftm, &ftLastAcc, &ftm);
   CloseHandle(hFile);
 #else
-  struct utimbuf ut;
+  struct timespec times[2];
   struct tm newdate;
   newdate.tm_sec = tmu_date.tm_sec;
   newdate.tm_min = tmu_date.tm_min;
@@ -93,223 +148,874 @@ void change_file_date(const char *filename, uLong dosdate, tm_unz tmu_date) {
     newdate.tm_year = tmu_date.tm_year;
   newdate.tm_isdst = -1;
 
-  ut.actime = ut.modtime = mktime(&newdate);
-  utime(filename, &ut);
+  times[0].tv_sec = times[1].tv_sec = mktime(&newdate);
+  times[0].tv_nsec = times[1].tv_nsec = 0;
+  std::string leaf;
+  int parent = open_parent_dir(dir, name, &leaf);
+  if (parent != -1) {
+    utimensat(parent, leaf.c_str(), times, AT_SYMLINK_NOFOLLOW);
+    close(parent);
+  }
 #endif
 }
 
-int mymkdir(const char* dirname) {
+/* *created is set if the directory didn't exist yet */
+int mymkdir(const OutputDir& dir, const std::string& name, bool* created) {
   int ret = 0;
 #ifdef _WIN32
-  ret = _mkdir(dirname);
+  ret = _mkdir(output_path(dir, name).c_str());
 #else
-  ret = mkdir(dirname, 0775);
+  std::string leaf;
+  int parent = open_parent_dir(dir, name, &leaf);
+  if (parent == -1)
+    return -1;
+  ret = mkdirat(parent, leaf.c_str(), 0775);
+  int saved_errno = errno;
+  close(parent);
+  errno = saved_errno;
 #endif
+  *created = ret == 0;
+  if (ret != 0 && errno == EEXIST)
+    ret = 0;
   return ret;
 }
 
-int makedir(const char *newdir) {
-  char *buffer;
-  char *p;
-  int len = (int)strlen(newdir);
-
-  if (len <= 0)
-    return 0;
-
-  buffer = (char*)malloc(len + 1);
-  if (buffer == NULL)
-    return UNZ_INTERNALERROR;
-  strcpy(buffer, newdir);
+/* remove a directory created in dir, if it's empty */
+void remove_output_dir(const OutputDir& dir, const std::string& name) {
+#ifdef _WIN32
+  _rmdir(output_path(dir, name).c_str());
+#else
+  std::string leaf;
+  int parent = open_parent_dir(dir, name, &leaf);
+  if (parent != -1) {
+    unlinkat(parent, leaf.c_str(), AT_REMOVEDIR);
+    close(parent);
+  }
+#endif
+}
 
-  if (buffer[len - 1] == '/')
-    buffer[len - 1] = '\0';
+/* remove the directories created, deepest first; those which still hold
+   files are left */
+void remove_output_dirs(const OutputDir& dir,
+    const std::vector<std::string>& created_dirs) {
+  for (size_t i = created_dirs.size(); i > 0; --i)
+    remove_output_dir(dir, created_dirs[i - 1]);
+}
 
-  if (mymkdir(buffer) == 0) {
-    free(buffer);
-    return 1;
+/* remove a file extracted (maybe partly) to dir */
+void remove_output_file(const OutputDir& dir, const std::string& name) {
+#ifdef _WIN32
+  remove(output_path(dir, name).c_str());
+#else
+  std::string leaf;
+  int parent = open_parent_dir(dir, name, &leaf);
+  if (parent != -1) {
+    unlinkat(parent, leaf.c_str(), 0);
+    close(parent);
   }
+#endif
+}
 
-  p = buffer + 1;
-  while (1) {
-    char hold;
+FILE* open_output_file(const OutputDir& dir, const std::string& name) {
+#ifdef _WIN32
+  return fopen64(output_path(dir, name).c_str(), "wb");
+#else
+  /* don't write through a symlink planted in the target directory, be it
+     the file itself or one of its parents */
+  std::string leaf;
+  int parent = open_parent_dir(dir, name, &leaf);
+  if (parent == -1)
+    return NULL;
+  int fd = openat(parent, leaf.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0666);
+  close(parent);
+  if (fd == -1)
+    return NULL;
+  FILE* file = fdopen(fd, "wb");
+  if (file == NULL)
+    close(fd);
+  return file;
+#endif
+}
 
-    while (*p && *p != '\\' && *p != '/')
-      p++;
-    hold = *p;
-    *p = 0;
-    if ((mymkdir(buffer) == -1) && (errno == ENOENT)) {
-      free(buffer);
-      return 0;
+/* normalize the name of an entry to a relative path with '/' separators;
+   fails on absolute paths and on ".." components, which would escape the
+   target directory */
+bool sanitize_entry_name(const char* filename_inzip, std::string* name) {
+  std::string path = filename_inzip;
+  std::replace(path.begin(), path.end(), '\\', '/');
+  if (path.empty() || path[0] == '/' ||
+      (path.size() > 1 && path[1] == ':'))
+    return false;
+
+  name->clear();
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos)
+      end = path.size();
+    std::string component = path.substr(start, end - start);
+    if (component == "..")
+      return false;
+    if (!component.empty() && component != ".") {
+      if (!name->empty())
+        name->push_back('/');
+      name->append(component);
     }
-    if (hold == 0)
-      break;
-    *p++ = hold;
+    start = end + 1;
   }
-  free(buffer);
-  return 1;
+  /* keep the trailing slash of directory entries */
+  if (!name->empty() && path[path.size() - 1] == '/')
+    name->push_back('/');
+  return !name->empty();
 }
 
-int do_extract_currentfile(unzFile uf, const int* popt_extract_without_path,
-    int* popt_overwrite, const char* password) {
-  char filename_inzip[256];
-  char* filename_withoutpath;
-  char* p;
+struct ExtractEntry {
+  unz64_file_pos pos;
+  std::string name;
+  ZPOS64_T compressed_size;
+};
+
+/* extract the current entry; *created is set once its file exists, even if
+   the extraction then fails */
+int do_extract_currentfile(unzFile uf, const OutputDir& dir,
+    const ExtractEntry& entry, const char* password,
+    greenworks::ArchiveJob* job, bool* created) {
   FILE *fout = NULL;
   void* buf;
 
   unz_file_info64 file_info;
-  int err = unzGetCurrentFileInfo64(uf, &file_info, filename_inzip,
-      sizeof(filename_inzip), NULL, 0, NULL, 0);
+  int err = unzGetCurrentFileInfo64(uf, &file_info, NULL, 0, NULL, 0, NULL, 0);
 
   if (err != UNZ_OK)
     return err;
 
-  uInt size_buf = WRITEBUFFERSIZE;
+  /* directories have all been created upfront */
+  if (entry.name[entry.name.size() - 1] == '/') {
+    if (job != NULL)
+      job->AddEntry();
+    return UNZ_OK;
+  }
+
+  /* large entries are written in fewer, bigger writes */
+  uInt size_buf = (uInt)std::min<ZPOS64_T>(
+      std::max<ZPOS64_T>(file_info.uncompressed_size, WRITEBUFFERSIZE),
+      MAXWRITEBUFFERSIZE);
   buf = (void*)malloc(size_buf);
   if (buf == NULL)
     return UNZ_INTERNALERROR;
 
-  p = filename_withoutpath = filename_inzip;
-  while ((*p) != '\0') {
-    if (((*p) == '/') || ((*p) == '\\')) {
-#ifndef _WIN32
-      (*p) = '/';
-#endif
-      filename_withoutpath = p + 1;
-    }
-    p++;
-  }
-
-  if ((*filename_withoutpath) == '\0') {
-    if ((*popt_extract_without_path) == 0)
-      mymkdir(filename_inzip);
-  }
-  else {
-    const char* write_filename;
-    if ((*popt_extract_without_path) == 0)
-      write_filename = filename_inzip;
+  err = unzOpenCurrentFilePassword(uf, password);
+  if (err == UNZ_OK) {
+    fout = open_output_file(dir, entry.name);
+    if (fout == NULL)
+      err = UNZ_ERRNO;
     else
-      write_filename = filename_withoutpath;
+      greenworks::PreallocateFile(fout, file_info.uncompressed_size);
+  }
 
-    err = unzOpenCurrentFilePassword(uf, password);
-    if (err == UNZ_OK) {
-      fout = fopen64(write_filename, "wb");
-
-      /* some zipfile don't contain directory alone before file */
-      if ((fout == NULL) && ((*popt_extract_without_path) == 0) &&
-        (filename_withoutpath != (char*)filename_inzip))
-      {
-        char c = *(filename_withoutpath - 1);
-        *(filename_withoutpath - 1) = '\0';
-        makedir(write_filename);
-        *(filename_withoutpath - 1) = c;
-        fout = fopen64(write_filename, "wb");
+  if (fout != NULL) {
+    *created = true;
+    /* the compressed bytes consumed, from the position of the stream */
+    ZPOS64_T stream_pos = unzGetCurrentFileZStreamPos64(uf);
+    do {
+      if (job != NULL && job->cancelled()) {
+        err = greenworks::kArchiveCancelled;
+        break;
       }
-    }
-
-    if (fout != NULL) {
-      do {
-        err = unzReadCurrentFile(uf, buf, size_buf);
-        if (err<0)
+      err = unzReadCurrentFile(uf, buf, size_buf);
+      if (err<0)
+        break;
+      if (err>0)
+        if (fwrite(buf, err, 1, fout) != 1) {
+          err = UNZ_ERRNO;
           break;
-        if (err>0)
-          if (fwrite(buf, err, 1, fout) != 1) {
-            err = UNZ_ERRNO;
-            break;
-          }
-      } while (err>0);
-      if (fout)
-        fclose(fout);
-
-      if (err == 0)
-        change_file_date(write_filename, file_info.dosDate,
-        file_info.tmu_date);
-    }
+        }
+      if (job != NULL) {
+        ZPOS64_T pos = unzGetCurrentFileZStreamPos64(uf);
+        job->AddBytes(pos - stream_pos, err);
+        stream_pos = pos;
+      }
+    } while (err>0);
+    if (fclose(fout) != 0 && err == 0)
+      err = UNZ_ERRNO;
+  }
 
+  /* also checks the CRC, now that all of the entry was read */
+  if (err == UNZ_OK)
+    err = unzCloseCurrentFile(uf);
+  else
+    unzCloseCurrentFile(uf); /* don't lose the error */
+
+  if (fout != NULL) {
     if (err == UNZ_OK)
-      err = unzCloseCurrentFile(uf);
+      change_file_date(dir, entry.name, file_info.dosDate,
+          file_info.tmu_date);
     else
-      unzCloseCurrentFile(uf); /* don't lose the error */
+      remove_output_file(dir, entry.name); /* partly written, or corrupt */
   }
+  if (err == UNZ_OK && job != NULL)
+    job->AddEntry();
 
   free(buf);
   return err;
 }
 
-int do_extract(unzFile uf, int opt_extract_without_path,
-    int opt_overwrite, const char* password) {
-  uLong i;
-  unz_global_info64 gi;
+/* where an archive is read from: the file zipfilename (memory-mapped if
+   use_mmap), or through ffunc when set */
+struct ArchiveSource {
+  const char* zipfilename;
+  bool use_mmap;
+  zlib_filefunc64_def* ffunc;
+};
+
+/* the CRC unzReadCurrentFile checks the extracted data against */
+uLong check_crc32(uLong crc, const Bytef* buf, uInt len) {
+  return greenworks::Crc32((uint32_t)crc, buf, len);
+}
+
+/* a handle which checks CRCs with the fastest implementation for the CPU */
+unzFile set_crc32_function(unzFile uf) {
+  if (uf != NULL)
+    unzSetCrc32Function(uf, check_crc32);
+  return uf;
+}
+
+unzFile open_zip(const char* zipfilename, bool use_mmap) {
+  if (use_mmap) {
+    zlib_filefunc64_def mmap_ffunc;
+    greenworks::FillMmapFileFunc64(&mmap_ffunc);
+    unzFile uf = unzOpen2_64(zipfilename, &mmap_ffunc);
+    if (uf != NULL)
+      return set_crc32_function(uf);
+  }
+#ifdef USEWIN32IOAPI
+  zlib_filefunc64_def ffunc;
+  fill_win32_filefunc64A(&ffunc);
+  return set_crc32_function(unzOpen2_64(zipfilename, &ffunc));
+#else
+  return set_crc32_function(unzOpen64(zipfilename));
+#endif
+}
+
+/* one more handle on the archive, for a worker thread */
+unzFile open_source(const ArchiveSource& source) {
+  if (source.ffunc != NULL)
+    return set_crc32_function(unzOpen2_64(source.zipfilename, source.ffunc));
+  return open_zip(source.zipfilename, source.use_mmap);
+}
 
-  int err = unzGetGlobalInfo64(uf, &gi);
+int get_current_entry(unzFile uf, ExtractEntry* entry) {
+  unz_file_info64 file_info;
+  int err = unzGetCurrentFileInfo64(uf, &file_info, NULL, 0, NULL, 0, NULL, 0);
   if (err != UNZ_OK)
     return err;
+  /* names of any length (up to 64K), read whole with their terminator */
+  std::vector<char> filename_inzip(file_info.size_filename + 1);
+  err = unzGetCurrentFileInfo64(uf, NULL, &filename_inzip[0],
+      (uLong)filename_inzip.size(), NULL, 0, NULL, 0);
+  if (err == UNZ_OK)
+    err = unzGetFilePos64(uf, &entry->pos);
+  if (err != UNZ_OK)
+    return err;
+  entry->compressed_size = file_info.compressed_size;
+  /* an unsafe entry keeps its name as is, for reporting it */
+  if (!sanitize_entry_name(&filename_inzip[0], &entry->name)) {
+    entry->name = &filename_inzip[0];
+    return greenworks::kUnsafeEntryName;
+  }
+  return UNZ_OK;
+}
 
-  for (i = 0; i < gi.number_entry; i++) {
-    err = do_extract_currentfile(uf, &opt_extract_without_path, &opt_overwrite,
-        password);
-    if (err != UNZ_OK)
+/* list the entries of the archive; those with an unsafe name are appended
+   to unsafe if not NULL, else fail the listing */
+int list_entries(unzFile uf, std::vector<ExtractEntry>* entries,
+    std::vector<ExtractEntry>* unsafe = NULL) {
+  int err = unzGoToFirstFile(uf);
+  while (err == UNZ_OK) {
+    ExtractEntry entry;
+    err = get_current_entry(uf, &entry);
+    if (err == greenworks::kUnsafeEntryName && unsafe != NULL)
+      unsafe->push_back(entry);
+    else if (err == greenworks::kUnsafeEntryName)
+      return UNZ_BADZIPFILE;
+    else if (err != UNZ_OK)
       return err;
+    else
+      entries->push_back(entry);
+    err = unzGoToNextFile(uf);
+  }
+  return err == UNZ_END_OF_LIST_OF_FILE ? UNZ_OK : err;
+}
+
+bool is_glob(const std::string& pattern) {
+  return pattern.find_first_of("*?") != std::string::npos;
+}
 
-    if (i + 1 < gi.number_entry) {
-      err = unzGoToNextFile(uf);
-      if (err != UNZ_OK)
-        return err;
+/* match name against a glob pattern: '*' and '?' match within a path
+   component, a double star matches across components, and also matches no
+   component at all when followed by a slash */
+bool match_glob(const char* pattern, const char* name) {
+  while (*pattern) {
+    if (pattern[0] == '*' && pattern[1] == '*') {
+      pattern += 2;
+      if (*pattern == '/' && match_glob(pattern + 1, name))
+        return true;
+      for (;; ++name) {
+        if (match_glob(pattern, name))
+          return true;
+        if (!*name)
+          return false;
+      }
+    }
+    if (*pattern == '*') {
+      ++pattern;
+      for (;; ++name) {
+        if (match_glob(pattern, name))
+          return true;
+        if (!*name || *name == '/')
+          return false;
+      }
     }
+    if (!*name || (*pattern == '?' ? *name == '/' : *pattern != *name))
+      return false;
+    ++pattern;
+    ++name;
   }
+  return !*name;
+}
 
-  return 0;
+/* the entries named in patterns, located directly with unzLocateFile, plus
+   those matching the glob patterns, each once; a missing name is an error */
+int select_entries(unzFile uf, const std::vector<std::string>& patterns,
+    std::vector<ExtractEntry>* entries) {
+  std::vector<std::string> globs;
+  std::set<ZPOS64_T> selected;
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    if (is_glob(patterns[i])) {
+      globs.push_back(patterns[i]);
+      continue;
+    }
+    ExtractEntry entry;
+    int err = unzLocateFile(uf, patterns[i].c_str(), CASESENSITIVITY);
+    if (err == UNZ_OK)
+      err = get_current_entry(uf, &entry);
+    if (err == greenworks::kUnsafeEntryName)
+      err = UNZ_BADZIPFILE;
+    if (err != UNZ_OK)
+      return err;
+    if (selected.insert(entry.pos.pos_in_zip_directory).second)
+      entries->push_back(entry);
+  }
+  if (globs.empty())
+    return UNZ_OK;
+
+  std::vector<ExtractEntry> all_entries;
+  int err = list_entries(uf, &all_entries);
+  for (size_t i = 0; i < all_entries.size() && err == UNZ_OK; ++i) {
+    const ExtractEntry& entry = all_entries[i];
+    for (size_t j = 0; j < globs.size(); ++j) {
+      if (match_glob(globs[j].c_str(), entry.name.c_str())) {
+        if (selected.insert(entry.pos.pos_in_zip_directory).second)
+          entries->push_back(entry);
+        break;
+      }
+    }
+  }
+  return err;
 }
 
+/* entries which sanitize to the same name (say "a.bin" and "./a.bin") would
+   be written concurrently to one file; keep only the last one in the
+   archive, which is the one a sequential extraction leaves behind */
+void remove_duplicate_entries(std::vector<ExtractEntry>* entries) {
+  std::map<std::string, size_t> last;
+  for (size_t i = 0; i < entries->size(); ++i) {
+    const ExtractEntry& entry = (*entries)[i];
+    std::pair<std::map<std::string, size_t>::iterator, bool> inserted =
+        last.insert(std::make_pair(entry.name, i));
+    if (!inserted.second &&
+        (*entries)[inserted.first->second].pos.pos_in_zip_directory <
+            entry.pos.pos_in_zip_directory)
+      inserted.first->second = i;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < entries->size(); ++i) {
+    if (last[(*entries)[i].name] == i)
+      (*entries)[kept++] = (*entries)[i];
+  }
+  entries->resize(kept);
 }
 
-namespace greenworks {
+/* create the directory tree of all the entries once, ahead of the workers;
+   the directories which didn't exist are added to created_dirs, parents
+   first */
+int make_entry_dirs(const OutputDir& dir,
+    const std::vector<ExtractEntry>& entries,
+    std::vector<std::string>* created_dirs) {
+  std::set<std::string> dirs;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const std::string& name = entries[i].name;
+    for (size_t pos = name.find('/'); pos != std::string::npos;
+         pos = name.find('/', pos + 1))
+      dirs.insert(name.substr(0, pos));
+  }
+  /* the parents sort before their children */
+  for (std::set<std::string>::const_iterator it = dirs.begin();
+       it != dirs.end(); ++it) {
+    bool created = false;
+    if (mymkdir(dir, *it, &created) != 0)
+      return UNZ_ERRNO;
+    if (created)
+      created_dirs->push_back(*it);
+  }
+  return UNZ_OK;
+}
 
-int unzip(const char *zipfilename, const char *dirname, const char *password) {
-  char filename_try[MAXFILENAME + 16] = "";
-  unzFile uf = NULL;
-  int ret_value = 0;
+/* the number of threads options.threads asks for; 0 is one per core */
+int resolve_threads(int threads) {
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  return threads;
+}
 
+/* run fn(worker_uf, entry, i) over the entries on up to threads threads,
+   each inflating through its own handle positioned on the entries it takes
+   from the shared list; stops handing out entries at the first error */
+template <typename EntryFunction>
+int for_each_entry(const ArchiveSource& source, unzFile uf,
+    const std::vector<ExtractEntry>& entries, int threads,
+    EntryFunction fn) {
+  std::atomic<size_t> next_entry(0);
+  std::atomic<int> first_error(UNZ_OK);
+  auto work = [&](unzFile worker_uf) {
+    for (size_t i = next_entry++; i < entries.size() &&
+             first_error == UNZ_OK; i = next_entry++) {
+      int entry_err = unzGoToFilePos64(worker_uf, &entries[i].pos);
+      if (entry_err == UNZ_OK)
+        entry_err = fn(worker_uf, entries[i], i);
+      if (entry_err != UNZ_OK) {
+        int expected = UNZ_OK;
+        first_error.compare_exchange_strong(expected, entry_err);
+      }
+    }
+  };
+
+  threads = (int)std::min<size_t>(std::max(threads, 1), entries.size());
+  std::vector<unzFile> worker_ufs;
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i) {
+    unzFile worker_uf = open_source(source);
+    if (worker_uf == NULL)
+      break;
+    worker_ufs.push_back(worker_uf);
+    workers.push_back(std::thread(work, worker_uf));
+  }
+  work(uf);
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i].join();
+    unzClose(worker_ufs[i]);
+  }
+  return first_error;
+}
+
+/* hand out the largest entries first, so that a few big files don't end up
+   serialized behind the small ones; returns their total compressed size */
+ZPOS64_T sort_entries_by_size(std::vector<ExtractEntry>* entries) {
+  std::stable_sort(entries->begin(), entries->end(),
+      [](const ExtractEntry& a, const ExtractEntry& b) {
+        return a.compressed_size > b.compressed_size;
+      });
+  ZPOS64_T total_bytes = 0;
+  for (size_t i = 0; i < entries->size(); ++i)
+    total_bytes += (*entries)[i].compressed_size;
+  return total_bytes;
+}
+
+/* extract the entries selected by patterns, or all of them if NULL; a
+   cancelled job removes the files it extracted, and a cancelled or failed
+   one the directories it created, unless they still hold files */
+int do_extract(const ArchiveSource& source, unzFile uf, const OutputDir& dir,
+    const char* password, int threads, greenworks::ArchiveJob* job,
+    const std::vector<std::string>* patterns, size_t* extracted) {
+  std::vector<ExtractEntry> entries;
+  int err = patterns ? select_entries(uf, *patterns, &entries)
+                     : list_entries(uf, &entries);
+  remove_duplicate_entries(&entries);
+  if (extracted != NULL)
+    *extracted = entries.size();
+  std::vector<std::string> created_dirs;
+  if (err == UNZ_OK)
+    err = make_entry_dirs(dir, entries, &created_dirs);
+  if (err != UNZ_OK) {
+    remove_output_dirs(dir, created_dirs);
+    return err;
+  }
+
+  ZPOS64_T total_bytes = sort_entries_by_size(&entries);
+  if (job != NULL)
+    job->Start(entries.size(), total_bytes);
+
+  /* one flag per entry, set by the worker extracting it */
+  std::vector<char> created(entries.size(), 0);
+  err = for_each_entry(source, uf, entries, threads,
+      [&](unzFile worker_uf, const ExtractEntry& entry, size_t i) {
+        bool entry_created = false;
+        int entry_err = do_extract_currentfile(worker_uf, dir, entry,
+                                               password, job, &entry_created);
+        created[i] = entry_created;
+        return entry_err;
+      });
+  if (job != NULL) {
+    job->Finish();
+    if (job->cancelled()) {
+      for (size_t i = 0; i < entries.size(); ++i) {
+        if (created[i])
+          remove_output_file(dir, entries[i].name);
+      }
+      err = greenworks::kArchiveCancelled;
+    }
+  }
+  if (err != UNZ_OK)
+    remove_output_dirs(dir, created_dirs);
+  return err;
+}
+
+/* open zipfilename, trying with a .zip extension too */
+unzFile open_zip_try(const char* zipfilename, bool use_mmap,
+    std::string* filename_try) {
+  unzFile uf = NULL;
   if (zipfilename != NULL) {
-#ifdef USEWIN32IOAPI
-    zlib_filefunc64_def ffunc;
-#endif
+    *filename_try = zipfilename;
+    uf = open_zip(filename_try->c_str(), use_mmap);
+    if (uf == NULL) {
+      *filename_try += ".zip";
+      uf = open_zip(filename_try->c_str(), use_mmap);
+    }
+  }
+  return uf;
+}
 
-    strncpy(filename_try, zipfilename, MAXFILENAME - 1);
-    //strncpy doesnt append the trailing NULL, of the string is too long.
-    filename_try[MAXFILENAME] = '\0';
+/* extract the archive opened as uf, which is closed, to dirname */
+int extract(const ArchiveSource& source, unzFile uf, const char *dirname,
+    const char *password, const greenworks::UnzipOptions& options,
+    const std::vector<std::string>* patterns, size_t* extracted) {
+  int ret_value = 0;
 
-#ifdef USEWIN32IOAPI
-    fill_win32_filefunc64A(&ffunc);
-    uf = unzOpen2_64(zipfilename, &ffunc);
+  OutputDir dir;
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(dirname, &st) != 0 || !(st.st_mode & _S_IFDIR)) {
+    unzClose(uf);
+    return 1;
+  }
+  dir.path = dirname;
 #else
-    uf = unzOpen64(zipfilename);
+  dir.fd = open(dirname, O_RDONLY | O_DIRECTORY);
+  if (dir.fd == -1) {
+    unzClose(uf);
+    return 1;
+  }
 #endif
-    if (uf == NULL) {
-      strcat(filename_try, ".zip");
-#ifdef USEWIN32IOAPI
-      uf = unzOpen2_64(filename_try, &ffunc);
-#else
-      uf = unzOpen64(filename_try);
+
+  ret_value = do_extract(source, uf, dir, password,
+                         resolve_threads(options.threads), options.job,
+                         patterns, extracted);
+  unzClose(uf);
+#ifndef _WIN32
+  close(dir.fd);
 #endif
+
+  return ret_value;
+}
+
+int extract_file(const char *zipfilename, const char *dirname,
+    const char *password, const greenworks::UnzipOptions& options,
+    const std::vector<std::string>* patterns, size_t* extracted) {
+  std::string filename_try;
+  unzFile uf = open_zip_try(zipfilename, options.use_mmap, &filename_try);
+  if (uf == NULL)
+    return 1;
+  ArchiveSource source = { filename_try.c_str(), options.use_mmap, NULL };
+  return extract(source, uf, dirname, password, options, patterns, extracted);
+}
+
+/* inflate the current entry into a malloc'ed block of its size */
+int read_currentfile(unzFile uf, const char* password, char** content,
+    size_t* size) {
+  unz_file_info64 file_info;
+  int err = unzGetCurrentFileInfo64(uf, &file_info, NULL, 0, NULL, 0, NULL, 0);
+  /* the content is returned in a single allocation */
+  if (err == UNZ_OK && file_info.uncompressed_size > MAXENTRYSIZE)
+    err = UNZ_PARAMERROR;
+  if (err == UNZ_OK)
+    err = unzOpenCurrentFilePassword(uf, password);
+  if (err != UNZ_OK)
+    return err;
+
+  size_t length = (size_t)file_info.uncompressed_size;
+  /* malloc(0) may return NULL */
+  char* buf = (char*)malloc(length > 0 ? length : 1);
+  if (buf == NULL)
+    err = UNZ_INTERNALERROR;
+  size_t position = 0;
+  while (err == UNZ_OK && position < length) {
+    int read = unzReadCurrentFile(uf, buf + position,
+        (unsigned)std::min<size_t>(length - position, MAXWRITEBUFFERSIZE));
+    if (read < 0)
+      err = read;
+    else if (read == 0)
+      err = UNZ_BADZIPFILE; /* shorter than its declared size */
+    else
+      position += read;
+  }
+  /* also checks the CRC, now that all of the entry was read */
+  if (err == UNZ_OK)
+    err = unzCloseCurrentFile(uf);
+  else
+    unzCloseCurrentFile(uf);
+
+  if (err != UNZ_OK) {
+    free(buf);
+    return err;
+  }
+  *content = buf;
+  *size = length;
+  return UNZ_OK;
+}
+
+/* inflate the current entry to nowhere, checking its size and CRC */
+int verify_currentfile(unzFile uf, const char* password,
+    greenworks::ArchiveJob* job) {
+  unz_file_info64 file_info;
+  int err = unzGetCurrentFileInfo64(uf, &file_info, NULL, 0, NULL, 0, NULL, 0);
+  if (err == UNZ_OK)
+    err = unzOpenCurrentFilePassword(uf, password);
+  if (err != UNZ_OK)
+    return err;
+
+  void* buf = malloc(VERIFYBUFFERSIZE);
+  if (buf == NULL)
+    err = UNZ_INTERNALERROR;
+  ZPOS64_T length = 0;
+  ZPOS64_T stream_pos = unzGetCurrentFileZStreamPos64(uf);
+  while (err == UNZ_OK) {
+    if (job != NULL && job->cancelled()) {
+      err = greenworks::kArchiveCancelled;
+      break;
+    }
+    int read = unzReadCurrentFile(uf, buf, VERIFYBUFFERSIZE);
+    if (read < 0)
+      err = read;
+    if (read <= 0)
+      break;
+    length += read;
+    if (job != NULL) {
+      ZPOS64_T pos = unzGetCurrentFileZStreamPos64(uf);
+      job->AddBytes(pos - stream_pos, read);
+      stream_pos = pos;
     }
   }
+  /* a truncated stream ends without the CRC being checked */
+  if (err == UNZ_OK && length != file_info.uncompressed_size)
+    err = UNZ_BADZIPFILE;
+  if (err == UNZ_OK)
+    err = unzCloseCurrentFile(uf);
+  else
+    unzCloseCurrentFile(uf);
+  free(buf);
+  return err;
+}
+
+}
 
+namespace greenworks {
+
+int unzip(const char *zipfilename, const char *dirname, const char *password,
+          const UnzipOptions& options) {
+  return extract_file(zipfilename, dirname, password, options, NULL, NULL);
+}
+
+int unzip_entries(const char *zipfilename, const char *dirname,
+                  const char *password,
+                  const std::vector<std::string>& patterns,
+                  const UnzipOptions& options, size_t* extracted) {
+  return extract_file(zipfilename, dirname, password, options, &patterns,
+                      extracted);
+}
+
+int unzip_entry(const char *zipfilename, const char *entryname,
+                const char *password, char** content, size_t* size,
+                const UnzipOptions& options) {
+  std::string filename_try;
+  *content = NULL;
+  *size = 0;
+
+  unzFile uf = open_zip_try(zipfilename, options.use_mmap, &filename_try);
   if (uf == NULL)
     return 1;
+  int err = unzLocateFile(uf, entryname, CASESENSITIVITY);
+  if (err == UNZ_OK)
+    err = read_currentfile(uf, password, content, size);
+  unzClose(uf);
+  return err;
+}
 
-#ifdef _WIN32
-  if (_chdir(dirname)) {
-#else
-  if (chdir(dirname)) {
-#endif
+int unzip_buffer(const char* data, size_t size, const char *dirname,
+                 const char *password, const UnzipOptions& options) {
+  MemoryRange range = { data, size };
+  zlib_filefunc64_def ffunc;
+  FillReadMemoryFileFunc64(&ffunc, &range);
+  ArchiveSource source = { "memory.zip", false, &ffunc };
+  unzFile uf = open_source(source);
+  if (uf == NULL)
     return 1;
+  return extract(source, uf, dirname, password, options, NULL, NULL);
+}
+
+int unzip_buffer_to_memory(const char* data, size_t size,
+                           const char *password,
+                           std::vector<UnzipMemoryEntry>* entries,
+                           const UnzipOptions& options) {
+  MemoryRange range = { data, size };
+  zlib_filefunc64_def ffunc;
+  FillReadMemoryFileFunc64(&ffunc, &range);
+  ArchiveSource source = { "memory.zip", false, &ffunc };
+  unzFile uf = open_source(source);
+  if (uf == NULL)
+    return 1;
+
+  std::vector<ExtractEntry> files;
+  int err = list_entries(uf, &files);
+  if (err != UNZ_OK) {
+    unzClose(uf);
+    return err;
   }
+  /* directory entries have no content */
+  files.erase(std::remove_if(files.begin(), files.end(),
+      [](const ExtractEntry& entry) {
+        return entry.name[entry.name.size() - 1] == '/';
+      }), files.end());
+  ZPOS64_T total_bytes = sort_entries_by_size(&files);
+  ArchiveJob* job = options.job;
+  if (job != NULL)
+    job->Start(files.size(), total_bytes);
+
+  std::vector<UnzipMemoryEntry> results(files.size());
+  err = for_each_entry(source, uf, files, resolve_threads(options.threads),
+      [&](unzFile worker_uf, const ExtractEntry& entry, size_t i) {
+        if (job != NULL && job->cancelled())
+          return kArchiveCancelled;
+        int entry_err = read_currentfile(worker_uf, password,
+                                         &results[i].content,
+                                         &results[i].size);
+        if (entry_err == UNZ_OK && job != NULL) {
+          job->AddBytes(entry.compressed_size, results[i].size);
+          job->AddEntry();
+        }
+        return entry_err;
+      });
+  unzClose(uf);
+  if (job != NULL)
+    job->Finish();
+
+  /* back to the order of the archive, which the sort by size lost */
+  std::vector<size_t> order(files.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&files](size_t a, size_t b) {
+    return files[a].pos.pos_in_zip_directory <
+        files[b].pos.pos_in_zip_directory;
+  });
+  for (size_t i = 0; i < order.size(); ++i) {
+    UnzipMemoryEntry& result = results[order[i]];
+    if (err == UNZ_OK) {
+      result.name = files[order[i]].name;
+      entries->push_back(result);
+    } else {
+      free(result.content);
+    }
+  }
+  return err;
+}
 
-  ret_value = do_extract(uf, 0, 1, password);
+int unzip_verify(const char *zipfilename, const char *password,
+                 std::vector<CorruptEntry>* corrupt,
+                 const UnzipOptions& options) {
+  std::string filename_try;
+  unzFile uf = open_zip_try(zipfilename, options.use_mmap, &filename_try);
+  if (uf == NULL)
+    return 1;
+  ArchiveSource source = { filename_try.c_str(), options.use_mmap, NULL };
+
+  /* an entry which extraction would refuse is reported along with the
+     corrupt ones, without being inflated */
+  std::vector<ExtractEntry> entries;
+  std::vector<ExtractEntry> unsafe;
+  int err = list_entries(uf, &entries, &unsafe);
+  if (err != UNZ_OK) {
+    unzClose(uf);
+    return err;
+  }
+  ZPOS64_T total_bytes = sort_entries_by_size(&entries);
+  ArchiveJob* job = options.job;
+  if (job != NULL)
+    job->Start(entries.size(), total_bytes);
+
+  /* a corrupt entry is recorded, and the others are still checked */
+  std::vector<int> errors(entries.size(), UNZ_OK);
+  err = for_each_entry(source, uf, entries, resolve_threads(options.threads),
+      [&](unzFile worker_uf, const ExtractEntry& entry, size_t i) {
+        int entry_err = verify_currentfile(worker_uf, password, job);
+        if (entry_err == kArchiveCancelled)
+          return entry_err;
+        errors[i] = entry_err;
+        if (job != NULL)
+          job->AddEntry();
+        return UNZ_OK;
+      });
   unzClose(uf);
+  if (job != NULL)
+    job->Finish();
+  if (err != UNZ_OK)
+    return err;
 
-  return ret_value;
+  /* reported in the order of the archive, which the sort by size lost */
+  for (size_t i = 0; i < unsafe.size(); ++i) {
+    entries.push_back(unsafe[i]);
+    errors.push_back(kUnsafeEntryName);
+  }
+  std::vector<size_t> order;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (errors[i] != UNZ_OK)
+      order.push_back(i);
+  }
+  std::sort(order.begin(), order.end(), [&entries](size_t a, size_t b) {
+    return entries[a].pos.pos_in_zip_directory <
+        entries[b].pos.pos_in_zip_directory;
+  });
+  for (size_t i = 0; i < order.size(); ++i) {
+    CorruptEntry entry;
+    entry.name = entries[order[i]].name;
+    entry.error = errors[order[i]];
+    corrupt->push_back(entry);
+  }
+  return UNZ_OK;
+}
+
+const char* unzip_error_description(int error) {
+  switch (error) {
+    case UNZ_CRCERROR:
+      return "CRC mismatch";
+    case UNZ_BADZIPFILE:
+      return "Bad entry header or size";
+    case Z_DATA_ERROR:
+      return "Invalid compressed data";
+    case kUnsafeEntryName:
+      return "Unsafe entry name";
+    default:
+      return "Unreadable entry";
+  }
 }
 
 }  // namespace greenworks
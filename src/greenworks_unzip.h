@@ -19,9 +19,97 @@
 #ifndef GREENWORKS_UNZIP_H_
 #define GREENWORKS_UNZIP_H_
 
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
 namespace greenworks {
 
-int unzip(const char *zipfilename, const char *dirname, const char *password);
+class ArchiveJob;
+
+struct UnzipOptions {
+  UnzipOptions() : threads(0), use_mmap(true), job(NULL) {}
+
+  // The number of inflate threads; 0 uses one per core, 1 extracts on the
+  // calling thread only.
+  int threads;
+  // Whether the archive is memory-mapped rather than read with fread; it's
+  // read anyway if it can't be mapped.
+  bool use_mmap;
+  // Receives the progress and may cancel the extraction, which then fails
+  // with kArchiveCancelled and removes the files it extracted. Not owned.
+  ArchiveJob* job;
+};
+
+// A file entry inflated in memory by unzip_buffer_to_memory.
+struct UnzipMemoryEntry {
+  UnzipMemoryEntry() : content(NULL), size(0) {}
+
+  std::string name;
+  // Allocated with malloc and owned by the caller.
+  char* content;
+  size_t size;
+};
+
+// The CorruptEntry error of an entry whose name is absolute or has a ".."
+// component, which extraction refuses.
+const int kUnsafeEntryName = -201;
+
+// An entry of the archive which unzip_verify found corrupt.
+struct CorruptEntry {
+  std::string name;
+  // The minizip or zlib error it failed with, e.g. UNZ_CRCERROR for a CRC
+  // mismatch or Z_DATA_ERROR for invalid deflate data.
+  int error;
+};
+
+int unzip(const char *zipfilename, const char *dirname, const char *password,
+          const UnzipOptions& options = UnzipOptions());
+
+// Extracts only the entries named in |patterns|, or matching them as globs
+// ('*', '?', and '**' across directories), to |dirname|. Named entries which
+// aren't in the archive are an error. |extracted| receives the count of
+// selected entries.
+int unzip_entries(const char *zipfilename, const char *dirname,
+                  const char *password,
+                  const std::vector<std::string>& patterns,
+                  const UnzipOptions& options = UnzipOptions(),
+                  size_t* extracted = NULL);
+
+// Inflates the entry |entryname| in memory, without writing any file. On
+// success |content| is allocated with malloc and owned by the caller.
+int unzip_entry(const char *zipfilename, const char *entryname,
+                const char *password, char** content, size_t* size,
+                const UnzipOptions& options = UnzipOptions());
+
+// Extracts the archive held in the |size| bytes at |data| to |dirname|, as
+// unzip does with a file, without writing the archive anywhere. |data| must
+// not change until it returns. options.use_mmap is ignored.
+int unzip_buffer(const char* data, size_t size, const char *dirname,
+                 const char *password,
+                 const UnzipOptions& options = UnzipOptions());
+
+// Inflates all the files of the archive held in the |size| bytes at |data|
+// in memory, appended to |entries| in the order of the archive. Directory
+// entries are skipped. options.use_mmap is ignored.
+int unzip_buffer_to_memory(const char* data, size_t size,
+                           const char *password,
+                           std::vector<UnzipMemoryEntry>* entries,
+                           const UnzipOptions& options = UnzipOptions());
+
+// Inflates every entry of |zipfilename| to nowhere, on options.threads
+// threads, checking its CRC and size without writing anything. The entries
+// which fail are appended to |corrupt| in the order of the archive, and the
+// others are still checked; so are the entries with an unsafe name, with
+// kUnsafeEntryName. An unreadable archive or central directory is returned
+// as an error instead.
+int unzip_verify(const char *zipfilename, const char *password,
+                 std::vector<CorruptEntry>* corrupt,
+                 const UnzipOptions& options = UnzipOptions());
+
+// A short English description of the CorruptEntry |error|.
+const char* unzip_error_description(int error);
 
 }  // namespace greenworks
 
@@ -4,14 +4,20 @@
 
 #include "greenworks_utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <thread>
 #include <sys/stat.h>
 
 #if defined(_WIN32)
+#include <direct.h>
 #include <sys/utime.h>
 #include <windows.h>
+#include "misc/dirent.h"
 #else
 #include <unistd.h>
 #include <utime.h>
@@ -27,19 +33,37 @@ void sleep(int milliseconds) {
 #endif
 }
 
-bool ReadFile(const char* path, char** content, int* length) {
+bool ReadFile(const char* path, char** content, size_t* length) {
   std::ifstream fin(path, std::ios::in|std::ios::binary|std::ios::ate);
   if (!fin.is_open()) {
     return false;
   }
-  *length = static_cast<int>(fin.tellg());
+  *length = static_cast<size_t>(fin.tellg());
   *content = new char[*length];
   fin.seekg(0, std::ios::beg);
   fin.read(*content, *length);
+  if (!fin.good()) {
+    delete[] *content;
+    *content = NULL;
+    return false;
+  }
   return true;
 }
 
-bool WriteFile(const std::string& target_path, char* content, int length) {
+bool ReadFile(const char* path, std::string* content) {
+  std::ifstream fin(path, std::ios::in|std::ios::binary|std::ios::ate);
+  if (!fin.is_open()) {
+    return false;
+  }
+  content->resize(static_cast<size_t>(fin.tellg()));
+  fin.seekg(0, std::ios::beg);
+  if (!content->empty())
+    fin.read(&(*content)[0], content->size());
+  return fin.good();
+}
+
+bool WriteFile(const std::string& target_path, char* content,
+               size_t length) {
   std::ofstream fout(target_path.c_str(), std::ios::binary);
   fout.write(content, length);
   return fout.good();
@@ -60,12 +84,72 @@ bool UpdateFileLastUpdatedTime(const char* file_path, time_t time) {
 }
 
 int64 GetFileLastUpdatedTime(const char* file_path) {
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_stat64(file_path, &st))
+#else
   struct stat st;
   if (stat(file_path, &st))
+#endif
     return -1;
   return st.st_mtime;
 }
 
+int64 GetFileSize(const char* file_path) {
+  // The 32-bit stat of Windows fails on files of 2 GB or more.
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_stat64(file_path, &st))
+#else
+  struct stat st;
+  if (stat(file_path, &st))
+#endif
+    return -1;
+  return st.st_size;
+}
+
+bool CreateParentDirectories(const std::string& file_path) {
+  size_t pos = file_path.find_first_of("/\\", 1);
+  while (pos != std::string::npos) {
+    std::string dir = file_path.substr(0, pos);
+    struct stat st;
+    if (stat(dir.c_str(), &st)) {
+#if defined(_WIN32)
+      if (_mkdir(dir.c_str()) && errno != EEXIST)
+#else
+      if (mkdir(dir.c_str(), 0775) && errno != EEXIST)
+#endif
+        return false;
+    } else if (!S_ISDIR(st.st_mode)) {
+      return false;
+    }
+    pos = file_path.find_first_of("/\\", pos + 1);
+  }
+  return true;
+}
+
+void ParallelFor(size_t count, const std::function<void(size_t)>& task) {
+  size_t threads_count = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), count);
+  if (threads_count <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      task(i);
+    return;
+  }
+  std::atomic<size_t> next_index(0);
+  auto run = [&]() {
+    for (size_t i = next_index++; i < count; i = next_index++)
+      task(i);
+  };
+  // The calling thread takes a share of the work too.
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threads_count; ++i)
+    threads.push_back(std::thread(run));
+  run();
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+}
+
 std::string uint64ToString(uint64 value) {
   std::ostringstream sout;
   sout << value;
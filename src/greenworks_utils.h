@@ -5,7 +5,9 @@
 #ifndef SRC_GREENWORKS_UTILS_H_
 #define SRC_GREENWORKS_UTILS_H_
 
+#include <functional>
 #include <string>
+#include <vector>
 
 #include "steam/steamtypes.h"
 
@@ -13,9 +15,12 @@ namespace utils {
 
 void sleep(int milliseconds);
 
-bool ReadFile(const char* path, char** content, int* length);
+bool ReadFile(const char* path, char** content, size_t* length);
 
-bool WriteFile(const std::string& target_path, char* content, int length);
+bool ReadFile(const char* path, std::string* content);
+
+bool WriteFile(const std::string& target_path, char* content,
+               size_t length);
 
 std::string GetFileNameFromPath(const std::string& file_path);
 
@@ -23,6 +28,15 @@ bool UpdateFileLastUpdatedTime(const char* file_path, time_t time);
 
 int64 GetFileLastUpdatedTime(const char* file_path);
 
+int64 GetFileSize(const char* file_path);
+
+// Creates the missing parent directories of |file_path|.
+bool CreateParentDirectories(const std::string& file_path);
+
+// Runs |task| for each index in [0, count) on up to one thread per core, and
+// returns once all of them have finished.
+void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
 std::string uint64ToString(uint64 value);
 
 uint64 strToUint64(std::string);
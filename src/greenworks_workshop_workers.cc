@@ -5,11 +5,13 @@
 #include "greenworks_workshop_workers.h"
 
 #include <algorithm>
+#include <map>
 
 #include "nan.h"
 #include "steam/steam_api.h"
 #include "v8.h"
 
+#include "greenworks_directory_walker.h"
 #include "greenworks_utils.h"
 
 namespace {
@@ -390,13 +392,26 @@ void SynchronizeItemsWorker::OnUGCQueryCompleted(
   if (io_failure) {
     SetErrorMessage("Error on querying all ugc: Steam API IO Failure");
   } else if (result->m_eResult == k_EResultOK) {
+    // Items are downloaded flat in |download_dir_|: list it once rather than
+    // stat'ing a path per item. A missing directory has nothing downloaded.
+    std::map<std::string, int64> file_update_times;
+    greenworks::DirectoryWalker walker;
+    greenworks::DirectoryWalker::Options walk_options;
+    walk_options.recursive = false;
+    if (walker.Walk(download_dir_, walk_options)) {
+      for (size_t i = 0; i < walker.size(); ++i)
+        file_update_times[walker.relative_path(i)] =
+            walker.modification_time(i);
+    }
     SteamUGCDetails_t item;
     for (uint32 i = 0; i < result->m_unNumResultsReturned; ++i) {
       SteamUGC()->GetQueryUGCResult(result->m_handle, i, &item);
       std::string target_path = GetAbsoluteFilePath(item.m_pchFileName,
           download_dir_);
-      int64 file_update_time = utils::GetFileLastUpdatedTime(
-          target_path.c_str());
+      std::map<std::string, int64>::const_iterator it =
+          file_update_times.find(utils::GetFileNameFromPath(target_path));
+      int64 file_update_time =
+          it != file_update_times.end() ? it->second : -1;
       ugc_items_.push_back(item);
       // If the file is not existed or last update time is not equal to Steam,
       // download it.
@@ -18,12 +18,26 @@
 
 #include "greenworks_zip.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <cstring>
 
 #include "zlib/zlib.h"
+#include "zlib/contrib/minizip/unzip.h"
 #include "zlib/contrib/minizip/zip.h"
+#include "greenworks_archive_io.h"
+#include "greenworks_archive_job.h"
+#include "greenworks_crc32.h"
+#include "greenworks_directory_walker.h"
+#include "greenworks_hash.h"
 
 #ifndef _WIN32
   #ifndef __USE_FILE_OFFSET64
@@ -50,9 +64,9 @@
 #ifdef _WIN32
   #include <direct.h>
   #include <io.h>
-  #include "misc/dirent.h"
+  #include <sys/types.h>
+  #include <sys/stat.h>
 #else
-  #include <dirent.h>
   #include <sys/types.h>
   #include <sys/stat.h>
   #include <unistd.h>
@@ -64,62 +78,34 @@
 #endif
 
 #define WRITEBUFFERSIZE (16384)
-#define MAXFILENAME (256)
+// The compressed data of an encrypted entry held in memory at most.
+#define SPILLMEMORYSIZE (16 * 1024 * 1024)
+// Large files are deflated in chunks of this size, in parallel.
+#define DEFLATECHUNKSIZE (1024 * 1024)
+// The size of the deflate window, primed from the preceding chunk.
+#define DICTIONARYSIZE (32768)
+// The number of chunks deflated ahead of the writer, per thread.
+#define CHUNKSPERTHREAD (4)
+// The archive is updated in this file, then renamed over the original.
+#define UPDATESUFFIX ".greenworks_update"
+// The head of a file sampled to tell whether it's worth deflating.
+#define SAMPLESIZE (64 * 1024)
+// The part of the sample whose byte entropy is measured.
+#define ENTROPYSAMPLESIZE (4096)
+// Files smaller than this are always deflated: too small to sample.
+#define MINSAMPLEDSIZE (512)
+// Above this entropy (in bits per byte, 8 at most) data is already
+// compressed; random data measures about 7.95 on 4K.
+#define INCOMPRESSIBLEENTROPY (7.9)
+// Stored if deflating the sample doesn't save at least 3%.
+#define INCOMPRESSIBLERATIO (0.97)
 
 namespace {
 
-#ifdef _WIN32
-/* char *f: name of file to get info on */
-/* tm_zip *tmzip: return value: access, modific. and creation times */
-/* uLong *dt: dostime */
-uLong filetime(const char *f, tm_zip *tmzip, uLong *dt)
+/* convert a modification time to the local time zip.c stores */
+void set_tmzip(time_t tm_t, tm_zip* tmzip)
 {
-  int ret = 0;
-  {
-    FILETIME ftLocal;
-    HANDLE hFind;
-    WIN32_FIND_DATAA ff32;
-
-    hFind = FindFirstFileA(f, &ff32);
-    if (hFind != INVALID_HANDLE_VALUE)
-    {
-      FileTimeToLocalFileTime(&(ff32.ftLastWriteTime), &ftLocal);
-      FileTimeToDosDateTime(&ftLocal, ((LPWORD)dt) + 1, ((LPWORD)dt) + 0);
-      FindClose(hFind);
-      ret = 1;
-    }
-  }
-  return ret;
-}
-#else
-uLong filetime(const char *f, tm_zip *tmzip, uLong *dt)
-{
-  int ret = 0;
-  struct stat s;        /* results of stat() */
-  struct tm* filedate;
-  time_t tm_t = 0;
-
-  if (strcmp(f, "-") != 0)
-  {
-    char name[MAXFILENAME + 1];
-    int len = strlen(f);
-    if (len > MAXFILENAME)
-      len = MAXFILENAME;
-
-    strncpy(name, f, MAXFILENAME - 1);
-    /* strncpy doesnt append the trailing NULL, of the string is too long. */
-    name[MAXFILENAME] = '\0';
-
-    if (name[len - 1] == '/')
-      name[len - 1] = '\0';
-    /* not all systems allow stat'ing a file with / appended */
-    if (stat(name, &s) == 0)
-    {
-      tm_t = s.st_mtime;
-      ret = 1;
-    }
-  }
-  filedate = localtime(&tm_t);
+  struct tm* filedate = localtime(&tm_t);
 
   tmzip->tm_sec = filedate->tm_sec;
   tmzip->tm_min = filedate->tm_min;
@@ -127,273 +113,983 @@ uLong filetime(const char *f, tm_zip *tmzip, uLong *dt)
   tmzip->tm_mday = filedate->tm_mday;
   tmzip->tm_mon = filedate->tm_mon;
   tmzip->tm_year = filedate->tm_year;
+}
+
+/* stat a file once for everything the writer needs: its size, and its
+   modification time as local time */
+int stat_entry(const char* f, ZPOS64_T* size, tm_zip* tmzip)
+{
+#ifdef _WIN32
+  struct _stat64 s;
+  if (_stat64(f, &s) != 0)
+    return 0;
+#else
+  struct stat s;
+  if (stat(f, &s) != 0)
+    return 0;
+#endif
+  *size = (ZPOS64_T)s.st_size;
+  set_tmzip(s.st_mtime, tmzip);
+  return 1;
+}
 
-  return ret;
+/* whether an entry of size bytes is written with zip64 sizes: deflate can
+   expand incompressible data a little, so the compressed size may pass 4GB
+   before the uncompressed one, and the local header is written first */
+int needs_zip64(ZPOS64_T size)
+{
+  return size + (size >> 10) + 1024 >= 0xffffffff;
 }
+
+// The path name saved, should not include a leading slash.
+// if it did, windows/xp and dynazip couldn't read the zip file.
+std::string GetNameInZip(const char* sourceDir, const std::string& path) {
+#ifdef WIN32
+  std::string baseDir = path.substr(std::string(sourceDir).rfind('\\') + 1);
+#else
+  std::string baseDir = path.substr(std::string(sourceDir).rfind('/') + 1);
 #endif
+  size_t start = baseDir.find_first_not_of("\\/");
+  return start == std::string::npos ? "" : baseDir.substr(start);
+}
 
-/* calculate the CRC32 of a file, because to encrypt a file, we need known the CRC32 of the file before */
-int getFileCrc(const char* filenameinzip, void* buf, unsigned long size_buf, unsigned long* result_crc)
+struct ZipEntry {
+  std::string path;
+  std::string name_in_zip;
+  ZPOS64_T size;
+  zip_fileinfo info;
+  // The content of an entry built from memory; NULL to read |path|.
+  const char* data;
+  // The level the entry is compressed with (0 stores it), and why.
+  int level;
+  greenworks::ZipEntryClass entry_class;
+  // Set when the entry is copied as is from the archive being updated.
+  bool reuse;
+  unz64_file_pos source_pos;
+};
+
+/* whether the DOS date of an archived entry (2 seconds resolution, years
+   from 1980) is the one zip.c stores for tmzip */
+int same_dos_date(const tm_unz& tmu, const tm_zip& tmzip)
 {
-  unsigned long calculate_crc = 0;
-  int err = ZIP_OK;
-  FILE * fin = fopen(filenameinzip, "rb");
-  unsigned long size_read = 0;
-  unsigned long total_read = 0;
-  if (fin == NULL)
-  {
-    err = ZIP_ERRNO;
+  uInt year = tmzip.tm_year;
+  if (year >= 1980)
+    year -= 1980;
+  else if (year >= 80)
+    year -= 80;
+  return tmu.tm_year == year + 1980 && tmu.tm_mon == tmzip.tm_mon &&
+      tmu.tm_mday == tmzip.tm_mday && tmu.tm_hour == tmzip.tm_hour &&
+      tmu.tm_min == tmzip.tm_min && tmu.tm_sec == tmzip.tm_sec / 2 * 2;
+}
+
+/* the crc32 of a whole file, read through a mapping if possible */
+int file_crc(const char* path, bool use_mmap, uLong* crc)
+{
+  greenworks::MappedFile mapping;
+  *crc = 0;
+  if (use_mmap && mapping.Open(path)) {
+    *crc = greenworks::Crc32(0, mapping.data(), (size_t)mapping.size());
+    return 1;
   }
+  FILE* fin = fopen64(path, "rb");
+  if (fin == NULL)
+    return 0;
+  std::vector<char> buf(WRITEBUFFERSIZE);
+  size_t size_read;
+  while ((size_read = fread(&buf[0], 1, buf.size(), fin)) > 0)
+    *crc = greenworks::Crc32((uint32_t)*crc, &buf[0], size_read);
+  int ok = !ferror(fin);
+  fclose(fin);
+  return ok;
+}
 
-  if (err == ZIP_OK)
-    do
-    {
-      err = ZIP_OK;
-      size_read = (int)fread(buf, 1, size_buf, fin);
-      if (size_read < size_buf)
-        if (feof(fin) == 0)
-        {
-          err = ZIP_ERRNO;
-        }
+// Marks the entries which can be copied from |uf| without recompressing
+// them: same name, size, modification time and CRC, and stored the way
+// they'd be written now (same method, not encrypted; either method when
+// |adaptive|). Only the files whose size and time match are read, to compare
+// their CRC.
+int MatchPreviousEntries(unzFile uf, std::vector<ZipEntry>* entries,
+                         int level, bool adaptive, int threads, bool use_mmap,
+                         ZPOS64_T* bytes_read) {
+  struct PreviousEntry {
+    unz64_file_pos pos;
+    unz_file_info64 info;
+  };
+  std::map<std::string, PreviousEntry> previous;
+  std::vector<char> name;
+  int err = unzGoToFirstFile(uf);
+  while (err == UNZ_OK) {
+    PreviousEntry entry;
+    err = unzGetCurrentFileInfo64(uf, &entry.info, NULL, 0, NULL, 0, NULL, 0);
+    if (err == UNZ_OK) {
+      name.resize(entry.info.size_filename + 1);
+      err = unzGetCurrentFileInfo64(uf, &entry.info, &name[0], name.size(),
+                                    NULL, 0, NULL, 0);
+    }
+    if (err == UNZ_OK)
+      err = unzGetFilePos64(uf, &entry.pos);
+    if (err != UNZ_OK)
+      return err;
+    previous[&name[0]] = entry;
+    err = unzGoToNextFile(uf);
+  }
+  if (err != UNZ_END_OF_LIST_OF_FILE)
+    return err;
 
-      if (size_read>0)
-        calculate_crc = crc32(calculate_crc, (const Bytef*)buf, size_read);
-      total_read += size_read;
+  std::vector<std::pair<size_t, uLong> > candidates;
+  for (size_t i = 0; i < entries->size(); ++i) {
+    ZipEntry& entry = (*entries)[i];
+    std::map<std::string, PreviousEntry>::const_iterator it =
+        previous.find(entry.name_in_zip);
+    if (it == previous.end())
+      continue;
+    const unz_file_info64& info = it->second.info;
+    bool method_ok = level == 0 ? info.compression_method == 0
+                                : info.compression_method == Z_DEFLATED ||
+                                  (adaptive && info.compression_method == 0);
+    if (method_ok && !(info.flag & 1) &&
+        info.uncompressed_size == entry.size &&
+        same_dos_date(info.tmu_date, entry.info.tmz_date)) {
+      entry.source_pos = it->second.pos;
+      candidates.push_back(std::make_pair(i, (uLong)info.crc));
+    }
+  }
 
-    } while ((err == ZIP_OK) && (size_read>0));
+  std::atomic<size_t> next_candidate(0);
+  std::atomic<ZPOS64_T> read(0);
+  auto work = [&]() {
+    for (size_t i = next_candidate++; i < candidates.size();
+         i = next_candidate++) {
+      ZipEntry& entry = (*entries)[candidates[i].first];
+      uLong crc;
+      entry.reuse = file_crc(entry.path.c_str(), use_mmap, &crc) &&
+          crc == candidates[i].second;
+      read += entry.size;
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads && (size_t)i < candidates.size(); ++i)
+    workers.push_back(std::thread(work));
+  work();
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  *bytes_read = read;
+  return UNZ_OK;
+}
 
-    if (fin)
-      fclose(fin);
+// A slice of an entry, deflated independently like pigz does: the slice is
+// primed with the 32K preceding it as dictionary, and ends with a sync flush
+// (or the final block for the last slice), so that the slices of an entry
+// concatenate into a single valid deflate stream.
+struct DeflateChunk {
+  size_t entry;
+  ZPOS64_T offset;
+  uLong length;
+  bool first;
+  bool last;
+
+  bool done;
+  bool failed;
+  uLong crc;
+  std::string data;
+};
+
+// The compressed data of an encrypted entry, held until its CRC is known:
+// the encryption header, written first, depends on it. Spills to a
+// temporary file past SPILLMEMORYSIZE to bound the memory.
+class EntrySpill {
+ public:
+  EntrySpill() : file_(NULL) {}
+  ~EntrySpill() { Reset(); }
+
+  bool Append(const std::string& data) {
+    if (file_ == NULL && memory_.size() + data.size() <= SPILLMEMORYSIZE) {
+      memory_.append(data);
+      return true;
+    }
+    if (file_ == NULL) {
+      file_ = tmpfile();
+      if (file_ == NULL ||
+          fwrite(memory_.data(), 1, memory_.size(), file_) != memory_.size())
+        return false;
+      std::string().swap(memory_);
+    }
+    return fwrite(data.data(), 1, data.size(), file_) == data.size();
+  }
 
-    *result_crc = calculate_crc;
+  int WriteTo(zipFile zf) {
+    if (file_ == NULL) {
+      return memory_.empty() ? ZIP_OK :
+          zipWriteInFileInZip(zf, memory_.data(), (unsigned)memory_.size());
+    }
+    std::vector<char> buf(WRITEBUFFERSIZE);
+    rewind(file_);
+    int err = ZIP_OK;
+    size_t size_read;
+    while (err == ZIP_OK &&
+           (size_read = fread(&buf[0], 1, buf.size(), file_)) > 0)
+      err = zipWriteInFileInZip(zf, &buf[0], (unsigned)size_read);
+    if (err == ZIP_OK && ferror(file_))
+      err = ZIP_ERRNO;
     return err;
+  }
+
+  void Reset() {
+    if (file_ != NULL)
+      fclose(file_);
+    file_ = NULL;
+    std::string().swap(memory_);
+  }
+
+ private:
+  std::string memory_;
+  FILE* file_;
+};
+
+// The time spent deflating, to estimate the time saved by storing data.
+struct DeflateTiming {
+  DeflateTiming()
+      : nanoseconds(0), bytes(0), incompressible_nanoseconds(0),
+        incompressible_bytes(0) {}
+
+  std::atomic<unsigned long long> nanoseconds;
+  std::atomic<unsigned long long> bytes;
+  // The part of it spent on samples which didn't compress: deflate speed
+  // depends a lot on the data.
+  std::atomic<unsigned long long> incompressible_nanoseconds;
+  std::atomic<unsigned long long> incompressible_bytes;
+};
+
+/* whether the extension of path is one of a format which is already
+   compressed: images, audio, video and archives */
+int has_incompressible_extension(const std::string& path)
+{
+  static const char* const kExtensions[] = {
+    "7z", "bz2", "gz", "jpeg", "jpg", "m4a", "mkv", "mov", "mp3", "mp4",
+    "ogg", "ogv", "opus", "png", "rar", "webm", "webp", "xz", "zip", "zst",
+  };
+  size_t dot = path.rfind('.');
+  if (dot == std::string::npos ||
+      path.find_first_of("/\\", dot) != std::string::npos)
+    return 0;
+  std::string extension = path.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 ::tolower);
+  for (size_t i = 0; i < sizeof(kExtensions) / sizeof(kExtensions[0]); ++i) {
+    if (extension == kExtensions[i])
+      return 1;
+  }
+  return 0;
 }
 
-int isLargeFile(const char* filename) {
-  int largeFile = 0;
-  ZPOS64_T pos = 0;
-  FILE* pFile = fopen64(filename, "rb");
+/* the Shannon entropy of data, in bits per byte */
+double byte_entropy(const unsigned char* data, size_t size)
+{
+  size_t counts[256] = { 0 };
+  for (size_t i = 0; i < size; ++i)
+    ++counts[data[i]];
+  double entropy = 0;
+  for (int i = 0; i < 256; ++i) {
+    if (counts[i] == 0)
+      continue;
+    double p = (double)counts[i] / size;
+    entropy -= p * std::log2(p);
+  }
+  return entropy;
+}
 
-  if (pFile != NULL) {
-    fseeko64(pFile, 0, SEEK_END);
-    pos = ftello64(pFile);
+/* the compressed size of data at level, as a fraction of its size */
+double trial_ratio(const unsigned char* data, size_t size, int level,
+                   DeflateTiming* timing)
+{
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  uLongf compressed_size = compressBound((uLong)size);
+  std::vector<Bytef> compressed(compressed_size);
+  if (compress2(&compressed[0], &compressed_size, data, (uLong)size,
+                level) != Z_OK)
+    return 0;  /* deflate it for real then */
+  unsigned long long nanoseconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count();
+  double ratio = (double)compressed_size / size;
+  timing->nanoseconds += nanoseconds;
+  timing->bytes += size;
+  if (ratio >= INCOMPRESSIBLERATIO) {
+    timing->incompressible_nanoseconds += nanoseconds;
+    timing->incompressible_bytes += size;
+  }
+  return ratio;
+}
 
-    if (pos >= 0xffffffff)
-      largeFile = 1;
+/* pick between deflating the entry and storing it: by extension, then by
+   the entropy of its head, then by deflating a sample of it; returns the
+   bytes read from the file */
+ZPOS64_T classify_entry(ZipEntry* entry, bool use_mmap, DeflateTiming* timing)
+{
+  if (has_incompressible_extension(entry->name_in_zip)) {
+    entry->level = 0;
+    entry->entry_class = greenworks::kZipEntryIncompressibleExtension;
+    return 0;
+  }
+  if (entry->size < MINSAMPLEDSIZE)
+    return 0;
+
+  size_t sample_size = (size_t)std::min<ZPOS64_T>(entry->size, SAMPLESIZE);
+  std::vector<unsigned char> buffer;
+  greenworks::MappedFile mapping;
+  const unsigned char* sample;
+  if (entry->data != NULL) {
+    sample = (const unsigned char*)entry->data;
+  } else if (use_mmap && mapping.Open(entry->path.c_str(), 0, sample_size)) {
+    sample = mapping.data();
+  } else {
+    buffer.resize(sample_size);
+    FILE* fin = fopen64(entry->path.c_str(), "rb");
+    if (fin == NULL)
+      return 0;  /* the deflater reports the error */
+    size_t size_read = fread(&buffer[0], 1, sample_size, fin);
+    fclose(fin);
+    if (size_read != sample_size)
+      return size_read;
+    sample = &buffer[0];
+  }
 
-    fclose(pFile);
+  if (byte_entropy(sample, std::min<size_t>(sample_size, ENTROPYSAMPLESIZE))
+      >= INCOMPRESSIBLEENTROPY) {
+    entry->level = 0;
+    entry->entry_class = greenworks::kZipEntryIncompressibleEntropy;
+  } else if (trial_ratio(sample, sample_size, entry->level, timing) >=
+             INCOMPRESSIBLERATIO) {
+    entry->level = 0;
+    entry->entry_class = greenworks::kZipEntryIncompressibleTrial;
   }
+  return entry->data != NULL ? 0 : sample_size;
+}
 
-  return largeFile;
+// Classifies the entries which will be deflated, in parallel.
+void ClassifyEntries(std::vector<ZipEntry>* entries, int threads,
+                     bool use_mmap, DeflateTiming* timing,
+                     ZPOS64_T* bytes_read) {
+  std::atomic<size_t> next_entry(0);
+  std::atomic<ZPOS64_T> read(0);
+  auto work = [&]() {
+    for (size_t i = next_entry++; i < entries->size(); i = next_entry++) {
+      ZipEntry& entry = (*entries)[i];
+      if (!entry.reuse && entry.level != 0)
+        read += classify_entry(&entry, use_mmap, timing);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads && (size_t)i < entries->size(); ++i)
+    workers.push_back(std::thread(work));
+  work();
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  *bytes_read = read;
 }
 
-std::string PathCombine(std::string path1, std::string path2) {
-  char path[PATH_MAX];
+// Reads and compresses each entry once: the CRC is computed from the same
+// read as the deflated data, so even encrypted entries don't need a separate
+// pass over the file.
+class ParallelDeflater {
+ public:
+  ParallelDeflater(const std::vector<ZipEntry>& entries, int level,
+                   const char* password, int threads, bool use_mmap,
+                   unzFile source, DeflateTiming* timing,
+                   greenworks::ArchiveJob* job)
+      : entries_(entries), level_(level), password_(password),
+        threads_(threads), use_mmap_(use_mmap), source_(source),
+        timing_(timing), job_(job), copied_entries_(0),
+        compressed_sizes_(entries.size(), 0), bytes_read_(0), next_chunk_(0),
+        written_chunks_(0), aborted_(false) {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      if (entries_[i].reuse)
+        continue;
+      ZPOS64_T offset = 0;
+      do {
+        DeflateChunk chunk;
+        chunk.entry = i;
+        chunk.offset = offset;
+        chunk.length = (uLong)std::min<ZPOS64_T>(entries_[i].size - offset,
+                                                 DEFLATECHUNKSIZE);
+        chunk.first = offset == 0;
+        offset += chunk.length;
+        chunk.last = offset >= entries_[i].size;
+        chunk.done = chunk.failed = false;
+        chunk.crc = 0;
+        chunks_.push_back(chunk);
+      } while (offset < entries_[i].size);
+    }
+  }
 
-  strcpy(path, path1.c_str());
-#ifdef _WIN32
-  strcat(path, "\\\\");
-#else
-  strcat(path, "/");
-#endif
-  strcat(path, path2.c_str());
+  // Deflates the entries on the worker threads (or inline with a single
+  // thread), and appends them in order to |zf| as raw streams on the calling
+  // thread, along with the reused entries copied from |source|. Stops
+  // between chunks once the job is cancelled.
+  int Run(zipFile zf) {
+    std::vector<std::thread> workers;
+    if (threads_ > 1) {
+      for (int i = 0; i < threads_; ++i)
+        workers.push_back(std::thread(&ParallelDeflater::Work, this));
+    }
+    z_stream stream;
+    bool stream_ready = workers.empty() && InitStream(&stream);
+    std::vector<char> buffer;
+
+    int err = ZIP_OK;
+    uLong crc = 0;
+    EntrySpill spill;
+    for (size_t i = 0; i < chunks_.size() && err == ZIP_OK; ++i) {
+      DeflateChunk& chunk = chunks_[i];
+      if (workers.empty()) {
+        chunk.failed = !stream_ready || !Deflate(&stream, &buffer, &chunk);
+      } else {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&chunk] { return chunk.done; });
+      }
+      if (chunk.failed) {
+        err = ZIP_ERRNO;
+        break;
+      }
+      if (job_ != NULL && job_->cancelled()) {
+        err = greenworks::kArchiveCancelled;
+        break;
+      }
+      compressed_sizes_[chunk.entry] += chunk.data.size();
+      size_t compressed_length = chunk.data.size();
+      const ZipEntry& entry = entries_[chunk.entry];
+      if (chunk.first)
+        err = CopyReusedEntries(zf, chunk.entry);
+      if (err != ZIP_OK)
+        break;
+      crc = chunk.first ? chunk.crc :
+          crc32_combine(crc, chunk.crc, chunk.length);
+      if (password_ == NULL) {
+        if (chunk.first)
+          err = OpenEntry(zf, entry, 0);
+        if (err == ZIP_OK && !chunk.data.empty())
+          err = zipWriteInFileInZip(zf, chunk.data.data(),
+                                    (unsigned int)chunk.data.size());
+      } else {
+        if (!spill.Append(chunk.data))
+          err = ZIP_ERRNO;
+        if (err == ZIP_OK && chunk.last) {
+          err = OpenEntry(zf, entry, crc);
+          if (err == ZIP_OK)
+            err = spill.WriteTo(zf);
+          spill.Reset();
+        }
+      }
+      std::string().swap(chunk.data);
+      if (err == ZIP_OK && chunk.last)
+        err = zipCloseFileInZipRaw64(zf, entry.size, crc);
+      if (err == ZIP_OK && job_ != NULL) {
+        job_->AddBytes(chunk.length, compressed_length);
+        if (chunk.last)
+          job_->AddEntry();
+      }
 
-  //puts(path);
+      if (!workers.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++written_chunks_;
+        cond_.notify_all();
+      }
+    }
 
-  return path;
-}
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      aborted_ = true;
+      cond_.notify_all();
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+      workers[i].join();
+    if (stream_ready && level_ != 0)
+      deflateEnd(&stream);
+    if (err == ZIP_OK)
+      err = CopyReusedEntries(zf, entries_.size());
+    return err;
+  }
 
-std::vector<std::string> GetDirectoryList(const std::string& dir)
-{
-  DIR * d;
-  std::vector<std::string> ret;
+  ZPOS64_T bytes_read() const { return bytes_read_; }
+  // The size of an entry's data in the archive, without its headers.
+  ZPOS64_T compressed_size(size_t entry) const {
+    return compressed_sizes_[entry];
+  }
 
-  /* Open the directory specified by "dir_name". */
-  d = opendir(dir.c_str());
+ private:
+  // Copies the reused entries before |end| which haven't been yet, as raw
+  // (still compressed) data.
+  int CopyReusedEntries(zipFile zf, size_t end) {
+    int err = ZIP_OK;
+    for (; copied_entries_ < end && err == ZIP_OK; ++copied_entries_) {
+      if (!entries_[copied_entries_].reuse)
+        continue;
+      if (job_ != NULL && job_->cancelled())
+        return greenworks::kArchiveCancelled;
+      err = CopyEntry(zf, entries_[copied_entries_]);
+    }
+    return err;
+  }
+
+  int CopyEntry(zipFile zf, const ZipEntry& entry) {
+    unz_file_info64 info;
+    int method;
+    int level;
+    if (unzGoToFilePos64(source_, &entry.source_pos) != UNZ_OK ||
+        unzGetCurrentFileInfo64(source_, &info, NULL, 0, NULL, 0, NULL,
+                                0) != UNZ_OK ||
+        unzOpenCurrentFile2(source_, &method, &level, 1) != UNZ_OK)
+      return ZIP_ERRNO;
+    int zip64 = needs_zip64(std::max(entry.size, info.compressed_size));
+    int err = zipOpenNewFileInZip4_64(zf, entry.name_in_zip.c_str(),
+        &entry.info, NULL, 0, NULL, 0, NULL, method, level, 1, -MAX_WBITS,
+        DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY, NULL, 0, 36, 1 << 11, zip64);
+    copy_buffer_.resize(DEFLATECHUNKSIZE);
+    int size_read = 0;
+    while (err == ZIP_OK &&
+           (size_read = unzReadCurrentFile(source_, &copy_buffer_[0],
+                                           (unsigned)copy_buffer_.size())) > 0)
+      err = zipWriteInFileInZip(zf, &copy_buffer_[0], (unsigned)size_read);
+    if (size_read < 0)
+      err = ZIP_ERRNO;
+    unzCloseCurrentFile(source_);
+    if (err == ZIP_OK)
+      err = zipCloseFileInZipRaw64(zf, info.uncompressed_size, info.crc);
+    compressed_sizes_[copied_entries_] = info.compressed_size;
+    if (err == ZIP_OK && job_ != NULL) {
+      job_->AddBytes(info.uncompressed_size, info.compressed_size);
+      job_->AddEntry();
+    }
+    return err;
+  }
 
-  /* Check it was opened. */
-  if (!d) {
-    // fprintf(stderr, "Cannot open directory '%s': %s\n", dir, strerror(errno));
-    exit(EXIT_FAILURE);
+  int OpenEntry(zipFile zf, const ZipEntry& entry, uLong crc) {
+    int zip64 = needs_zip64(entry.size);
+    // Using 4 for unicode compatibility (UTF8) -- tested with chinese, does not work as expected
+    return zipOpenNewFileInZip4_64(zf, entry.name_in_zip.c_str(),
+        &entry.info, NULL, 0, NULL, 0, NULL,
+        (entry.level != 0) ? Z_DEFLATED : 0, entry.level, 1, -MAX_WBITS,
+        DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY, password_,
+        crc, 36, 1 << 11, zip64);
   }
 
-  while (1) {
-    struct dirent * entry;
-    const char * d_name;
+  bool InitStream(z_stream* stream) {
+    memset(stream, 0, sizeof(*stream));
+    return level_ == 0 ||
+        deflateInit2(stream, level_, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL,
+                     Z_DEFAULT_STRATEGY) == Z_OK;
+  }
 
-    /* "Readdir" gets subsequent entries from "d". */
-    entry = readdir(d);
+  void Work() {
+    z_stream stream;
+    bool stream_ready = InitStream(&stream);
+    std::vector<char> buffer;
+    while (true) {
+      size_t index;
+      {
+        // Bound the memory by staying within a window ahead of the writer.
+        size_t window = (size_t)threads_ * CHUNKSPERTHREAD;
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this, window] {
+          return aborted_ || next_chunk_ >= chunks_.size() ||
+              next_chunk_ < written_chunks_ + window;
+        });
+        if (aborted_ || next_chunk_ >= chunks_.size())
+          break;
+        index = next_chunk_++;
+      }
+      DeflateChunk& chunk = chunks_[index];
+      bool succeeded = stream_ready && Deflate(&stream, &buffer, &chunk);
+      std::lock_guard<std::mutex> lock(mutex_);
+      chunk.failed = !succeeded;
+      chunk.done = true;
+      cond_.notify_all();
+    }
+    if (level_ != 0 && stream_ready)
+      deflateEnd(&stream);
+  }
 
-    if (!entry) {
-      /* There are no more entries in this directory, so break out of the while loop. */
-      break;
+  bool Deflate(z_stream* stream, std::vector<char>* buffer,
+               DeflateChunk* chunk) {
+    int level = entries_[chunk->entry].level;
+    uLong dictionary_length =
+        (uLong)std::min<ZPOS64_T>(chunk->offset, DICTIONARYSIZE);
+    if (level == 0)
+      dictionary_length = 0;
+    const char* path = entries_[chunk->entry].path.c_str();
+    ZPOS64_T read_offset = chunk->offset - dictionary_length;
+    ZPOS64_T read_length = dictionary_length + chunk->length;
+
+    // The mapping is read in place, instead of being copied to |buffer|.
+    greenworks::MappedFile mapping;
+    const Bytef* source;
+    if (entries_[chunk->entry].data != NULL) {
+      source = (const Bytef*)entries_[chunk->entry].data + read_offset;
+    } else if (use_mmap_ && mapping.Open(path, read_offset, read_length)) {
+      source = mapping.data();
+    } else {
+      buffer->resize(read_length + 1);
+      FILE* fin = fopen64(path, "rb");
+      if (fin == NULL)
+        return false;
+      bool read_ok = fseeko64(fin, read_offset, SEEK_SET) == 0 &&
+          fread(&(*buffer)[0], 1, read_length, fin) == read_length;
+      fclose(fin);
+      if (!read_ok)
+        return false;
+      source = (const Bytef*)&(*buffer)[0];
     }
+    bytes_read_ += read_length;
 
-    d_name = entry->d_name;
+    const Bytef* input = source + dictionary_length;
+    chunk->crc = greenworks::Crc32(0, input, chunk->length);
+    if (level == 0) {
+      chunk->data.assign((const char*)input, chunk->length);
+      return true;
+    }
 
-    /* See if "entry" is a subdirectory of "d". */
-    if (entry->d_type & DT_DIR) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    if (deflateReset(stream) != Z_OK)
+      return false;
+    if (dictionary_length > 0 &&
+        deflateSetDictionary(stream, source, dictionary_length) != Z_OK)
+      return false;
+    // Leave room for the flush markers on top of the worst-case expansion.
+    chunk->data.resize(deflateBound(stream, chunk->length) + 16);
+    stream->next_in = (Bytef*)input;
+    stream->avail_in = chunk->length;
+    stream->next_out = (Bytef*)&chunk->data[0];
+    stream->avail_out = (uInt)chunk->data.size();
+    int ret = deflate(stream, chunk->last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (chunk->last ? ret != Z_STREAM_END
+                    : (ret != Z_OK || stream->avail_out == 0))
+      return false;
+    chunk->data.resize(chunk->data.size() - stream->avail_out);
+    timing_->nanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    timing_->bytes += chunk->length;
+    return true;
+  }
 
-      /* Check that the directory is not "d" or d's parent. */
-      if (strcmp(d_name, "..") != 0 && strcmp(d_name, ".") != 0) {
-        int path_length;
-        char path[PATH_MAX];
+  const std::vector<ZipEntry>& entries_;
+  int level_;
+  const char* password_;
+  int threads_;
+  bool use_mmap_;
+  unzFile source_;
+  DeflateTiming* timing_;
+  greenworks::ArchiveJob* job_;
+  size_t copied_entries_;
+  // Only accessed by the writer thread.
+  std::vector<ZPOS64_T> compressed_sizes_;
+  std::vector<char> copy_buffer_;
+  std::vector<DeflateChunk> chunks_;
+  std::atomic<ZPOS64_T> bytes_read_;
+
+  // Guards the chunks' |done|/|failed| and the counters below.
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  size_t next_chunk_;
+  size_t written_chunks_;
+  bool aborted_;
+};
+
+/* whether name is a relative path without "..", as extraction requires */
+int valid_name_in_zip(const std::string& name)
+{
+  if (name.empty() || name[0] == '/' || name[0] == '\\' ||
+      (name.size() > 1 && name[1] == ':'))
+    return 0;
+  size_t start = 0;
+  while (start <= name.size()) {
+    size_t end = name.find_first_of("/\\", start);
+    if (end == std::string::npos)
+      end = name.size();
+    if (name.compare(start, end - start, "..") == 0)
+      return 0;
+    start = end + 1;
+  }
+  return 1;
+}
 
-        strcpy(path, dir.c_str());
-#ifdef WIN32
-        strcat(path, "\\\\");
+// Opens the archive being updated; NULL if there's none yet.
+unzFile OpenPrevious(const char* zipfilename, bool use_mmap) {
+  if (use_mmap) {
+    zlib_filefunc64_def mmap_ffunc;
+    greenworks::FillMmapFileFunc64(&mmap_ffunc);
+    unzFile uf = unzOpen2_64(zipfilename, &mmap_ffunc);
+    if (uf != NULL)
+      return uf;
+  }
+#ifdef USEWIN32IOAPI
+  zlib_filefunc64_def ffunc;
+  fill_win32_filefunc64A(&ffunc);
+  return unzOpen2_64(zipfilename, &ffunc);
 #else
-        strcat(path, "/");
+  return unzOpen64(zipfilename);
 #endif
-        strcat(path, d_name);
+}
 
-        //puts(path);
+bool CompareNamesInZip(const ZipEntry& a, const ZipEntry& b) {
+  return a.name_in_zip < b.name_in_zip;
+}
 
-        path_length = strlen(path);
+// Makes the archive of |entries| independent of the directory order and of
+// the file dates: the rest of the headers only depends on the content.
+void NormalizeEntries(std::vector<ZipEntry>* entries) {
+  std::stable_sort(entries->begin(), entries->end(), CompareNamesInZip);
+  for (size_t i = 0; i < entries->size(); ++i) {
+    // The DOS epoch, the earliest date zip.c can store.
+    tm_zip& date = (*entries)[i].info.tmz_date;
+    date.tm_sec = date.tm_min = date.tm_hour = date.tm_mon = 0;
+    date.tm_mday = 1;
+    date.tm_year = 80;
+  }
+}
 
-        if (path_length >= PATH_MAX) {
-          fprintf(stderr, "Path length has got too long.\n");
-          exit(EXIT_FAILURE);
-        }
-        std::vector<std::string> rret = GetDirectoryList(path);
-        ret.insert(ret.end(), rret.begin(), rret.end());
-      }
+// Writes |entries| in |zf|: copied from |previous| when they didn't change,
+// else deflated or stored depending on how well they compress.
+int CompressEntries(zipFile zf, std::vector<ZipEntry>* entries,
+                    int compressionLevel, const char* password, int threads,
+                    const greenworks::ZipOptions& options, unzFile previous,
+                    greenworks::ZipStats* stats) {
+  greenworks::ArchiveJob* job = options.job;
+  if (options.deterministic)
+    NormalizeEntries(entries);
+  ZPOS64_T total_bytes = 0;
+  for (size_t i = 0; i < entries->size(); ++i) {
+    ZipEntry& entry = (*entries)[i];
+    entry.level = compressionLevel;
+    entry.entry_class = compressionLevel != 0 ? greenworks::kZipEntryDeflated
+                                              : greenworks::kZipEntryStored;
+    total_bytes += entry.size;
+  }
+  if (job != NULL)
+    job->Start(entries->size(), total_bytes);
+  // Encrypted entries are always rewritten: the password they were
+  // encrypted with can't be checked.
+  ZPOS64_T crc_bytes_read = 0;
+  if (previous != NULL && password == NULL &&
+      MatchPreviousEntries(previous, entries, compressionLevel,
+                           options.adaptive, threads, options.use_mmap,
+                           &crc_bytes_read) != UNZ_OK)
+    return ZIP_BADZIPFILE;
+  DeflateTiming timing;
+  ZPOS64_T sample_bytes_read = 0;
+  if (options.adaptive && compressionLevel != 0)
+    ClassifyEntries(entries, threads, options.use_mmap, &timing,
+                    &sample_bytes_read);
+  for (size_t i = 0; i < entries->size(); ++i) {
+    if ((*entries)[i].reuse)
+      (*entries)[i].entry_class = greenworks::kZipEntryReused;
+  }
+  if (job != NULL && job->cancelled())
+    return greenworks::kArchiveCancelled;
+
+  ParallelDeflater deflater(*entries, compressionLevel, password, threads,
+                            options.use_mmap, previous, &timing, job);
+  int err = deflater.Run(zf);
+  if (job != NULL)
+    job->Finish();
+  if (stats != NULL) {
+    stats->entries = entries->size();
+    stats->bytes_read =
+        crc_bytes_read + sample_bytes_read + deflater.bytes_read();
+    unsigned long long incompressible_bytes = 0;
+    for (size_t i = 0; i < entries->size(); ++i) {
+      const ZipEntry& entry = (*entries)[i];
+      greenworks::ZipClassStats& class_stats =
+          stats->classes[entry.entry_class];
+      ++class_stats.entries;
+      class_stats.bytes_in += entry.size;
+      class_stats.bytes_out += deflater.compressed_size(i);
+      if (entry.reuse)
+        ++stats->reused_entries;
+      else if (entry.entry_class != greenworks::kZipEntryDeflated &&
+               entry.entry_class != greenworks::kZipEntryStored)
+        incompressible_bytes += entry.size;
     }
-    else {
-      ret.push_back(PathCombine(dir, entry->d_name));
+    stats->deflate_seconds = timing.nanoseconds / 1e9;
+    if (timing.incompressible_bytes > 0) {
+      stats->seconds_saved = timing.incompressible_nanoseconds / 1e9 /
+          timing.incompressible_bytes * incompressible_bytes;
+    } else if (timing.bytes > 0) {
+      stats->seconds_saved =
+          stats->deflate_seconds / timing.bytes * incompressible_bytes;
     }
   }
-  /* After going through all the entries, close the directory. */
-  if (closedir(d)) {
-    // fprintf(stderr, "Could not close '%s': %s\n", dir, strerror(errno));
-    exit(EXIT_FAILURE);
-  }
+  return err;
+}
 
-  return ret;
+int WriteEntries(zipFile zf, const char* sourceDir,
+                 const greenworks::DirectoryWalker& files,
+                 int compressionLevel, const char* password, int threads,
+                 const greenworks::ZipOptions& options, unzFile previous,
+                 greenworks::ZipStats* stats) {
+  std::vector<ZipEntry> entries(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    ZipEntry& entry = entries[i];
+    entry.path = files.path(i);
+    entry.name_in_zip = GetNameInZip(sourceDir, entry.path);
+    entry.size = files.file_size(i);
+    entry.data = NULL;
+    entry.reuse = false;
+    memset(&entry.info, 0, sizeof(entry.info));
+    set_tmzip((time_t)files.modification_time(i), &entry.info.tmz_date);
+  }
+  return CompressEntries(zf, &entries, compressionLevel, password, threads,
+                         options, previous, stats);
 }
 
 }
 
 namespace greenworks {
 
-int zip(const char* targetFile, const char* sourceDir, int compressionLevel, const char* password) {
+int zip(const char* targetFile, const char* sourceDir, int compressionLevel, const char* password, const ZipOptions& options, ZipStats* stats) {
   // compressionLevel 0-9 (store only - best)
   int opt_overwrite = 1;// Overwrite existing zip file
   int opt_compress_level = compressionLevel;
-  char filename_try[MAXFILENAME + 16];
+  // Paths of any length, which used to be truncated to 256 bytes.
+  std::string filename_try = targetFile;
   int err = 0;
-  int size_buf = 0;
-  void* buf = NULL;
-  int i, len;
-  int dot_found = 0;
 
-  size_buf = WRITEBUFFERSIZE;
-  buf = (void*)malloc(size_buf);
-  if (buf == NULL)
-    return ZIP_INTERNALERROR;
-
-  strncpy(filename_try, targetFile, MAXFILENAME - 1);
-  // strncpy doesnt append the trailing NULL, of the string is too long.
-  filename_try[MAXFILENAME] = '\0';
-
-  len = (int)strlen(filename_try);
-  for (i = 0; i < len; i++) {
-    if (filename_try[i] == '.')
-      dot_found = 1;
-  }
-
-  if (dot_found == 0) {
-    strcat(filename_try, ".zip");
+  if (filename_try.find('.') == std::string::npos)
+    filename_try += ".zip";
+
+  int threads = options.threads;
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  if (password != NULL && strlen(password) == 0)
+    password = NULL;
+  if (options.deterministic && password != NULL)
+    return ZIP_PARAMERROR;
+
+  // Walked before the archive is opened, so that an unreadable directory
+  // leaves no empty archive behind. The directory is stat'ed on as many
+  // threads as it's compressed with, which pays off on network drives.
+  greenworks::DirectoryWalker files;
+  greenworks::DirectoryWalker::Options walk_options;
+  walk_options.threads = threads;
+  if (!files.Walk(sourceDir, walk_options))
+    return ZIP_ERRNO;
+  if (files.size() <= 0)
+    return ZIP_PARAMERROR;
+  if (stats != NULL) {
+    for (size_t i = 0; i < files.skipped_count(); ++i)
+      stats->skipped.push_back(files.relative_skipped_path(i));
   }
 
   zipFile zf;
+  // An update is written next to the archive it reads from, then replaces it.
+  // A deterministic one reuses nothing from it, but still only replaces it
+  // once complete.
+  unzFile previous = options.update && !options.deterministic ?
+      OpenPrevious(filename_try.c_str(), options.use_mmap) : NULL;
+  std::string output_file = filename_try;
+  if (options.update)
+    output_file += UPDATESUFFIX;
 
 #ifdef USEWIN32IOAPI
   zlib_filefunc64_def ffunc;
   fill_win32_filefunc64A(&ffunc);
-  zf = zipOpen2_64(filename_try, (opt_overwrite == 2) ? 2 : 0, NULL, &ffunc);
+  zf = zipOpen2_64(output_file.c_str(), (opt_overwrite == 2) ? 2 : 0, NULL,
+                   &ffunc);
 #else
-  zf = zipOpen64(filename_try, (opt_overwrite == 2) ? 2 : 0);
+  zf = zipOpen64(output_file.c_str(), (opt_overwrite == 2) ? 2 : 0);
 #endif
 
-  if (zf == NULL)
-    err = ZIP_ERRNO;
-
-  std::vector<std::string> files = GetDirectoryList(sourceDir);
-  if (files.size() <= 0) {
-    err = ZIP_PARAMERROR;
-  } else {
-    std::vector<std::string>::iterator itr;
-    for (itr = files.begin(); itr < files.end(); ++itr) {
-      const char* filenameinzip = itr->c_str();
-      const char *savefilenameinzip;
-
-      FILE * fin;
-      int size_read;
-      zip_fileinfo zi;
-      unsigned long crcFile = 0;
-      int zip64 = 0;
-
-      zi.tmz_date.tm_sec = zi.tmz_date.tm_min = zi.tmz_date.tm_hour = zi.tmz_date.tm_mday = zi.tmz_date.tm_mon = zi.tmz_date.tm_year = 0;
-      zi.dosDate = 0;
-      zi.internal_fa = 0;
-      zi.external_fa = 0;
-
-      filetime(filenameinzip, &zi.tmz_date, &zi.dosDate);
-
-      if ((password != NULL && strlen(password) > 0) && (err == ZIP_OK))
-        err = getFileCrc(filenameinzip, buf, size_buf, &crcFile);
-
-      zip64 = isLargeFile(filenameinzip);
+  if (zf == NULL) {
+    if (previous != NULL)
+      unzClose(previous);
+    return ZIP_ERRNO;
+  }
 
-      // The path name saved, should not include a leading slash.
-      // if it did, windows/xp and dynazip couldn't read the zip file.
-#ifdef WIN32
-      std::string baseDir = itr->substr(std::string(sourceDir).rfind('\\') + 1);
-#else
-      std::string baseDir = itr->substr(std::string(sourceDir).rfind('/') + 1);
+  err = WriteEntries(zf, sourceDir, files, opt_compress_level, password,
+                     threads, options, previous, stats);
+  int close_err = zipClose(zf, NULL);
+  if (err == ZIP_OK)
+    err = close_err;
+  if (previous != NULL)
+    unzClose(previous);
+  if (options.update && err == ZIP_OK) {
+#ifdef _WIN32
+    remove(filename_try.c_str());
 #endif
+    if (rename(output_file.c_str(), filename_try.c_str()) != 0)
+      err = ZIP_ERRNO;
+  }
+  // Don't leave a partial archive behind, e.g. when cancelled.
+  if (err != ZIP_OK)
+    remove(output_file.c_str());
+
+  if (stats != NULL) {
+    ZPOS64_T size = 0;
+    tm_zip unused;
+    stat_entry(filename_try.c_str(), &size, &unused);
+    stats->bytes_written = size;
+    if (options.deterministic && err == ZIP_OK &&
+        !greenworks::Sha256File(filename_try.c_str(), options.use_mmap,
+                                &stats->content_hash))
+      err = ZIP_ERRNO;
+  }
+  return err;
+}
 
-      savefilenameinzip = baseDir.c_str();
-
-      while (savefilenameinzip[0] == '\\' || savefilenameinzip[0] == '/')
-        savefilenameinzip++;
-
-      // Using 4 for unicode compatibility (UTF8) -- tested with chinese, does not work as expected
-      err = zipOpenNewFileInZip4_64(zf, savefilenameinzip, &zi, NULL, 0, NULL, 0, NULL, (opt_compress_level != 0) ? Z_DEFLATED : 0, opt_compress_level, 0, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY, password, crcFile, 36, 1 << 11, zip64);
-
-      if (err != ZIP_OK)
-        break;
+int zip_buffers(const std::vector<ZipBufferEntry>& buffers, int compressionLevel, const char* password, MemoryBuffer* archive, const ZipOptions& options, ZipStats* stats) {
+  // Entries built from memory are all dated now.
+  time_t now = time(NULL);
+  struct tm* date = localtime(&now);
+  std::vector<ZipEntry> entries(buffers.size());
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    ZipEntry& entry = entries[i];
+    if (!valid_name_in_zip(buffers[i].name))
+      return ZIP_PARAMERROR;
+    entry.name_in_zip = buffers[i].name;
+    std::replace(entry.name_in_zip.begin(), entry.name_in_zip.end(), '\\',
+                 '/');
+    entry.size = buffers[i].size;
+    // Empty Buffers may have no data at all.
+    entry.data = buffers[i].data != NULL ? buffers[i].data : "";
+    entry.reuse = false;
+    memset(&entry.info, 0, sizeof(entry.info));
+    entry.info.tmz_date.tm_sec = date->tm_sec;
+    entry.info.tmz_date.tm_min = date->tm_min;
+    entry.info.tmz_date.tm_hour = date->tm_hour;
+    entry.info.tmz_date.tm_mday = date->tm_mday;
+    entry.info.tmz_date.tm_mon = date->tm_mon;
+    entry.info.tmz_date.tm_year = date->tm_year;
+  }
 
-      fin = fopen64(filenameinzip, "rb");
-      if (fin == NULL)
-        err = ZIP_ERRNO;
+  int threads = options.threads;
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  if (password != NULL && strlen(password) == 0)
+    password = NULL;
+  if (options.deterministic && password != NULL)
+    return ZIP_PARAMERROR;
 
-      if (err == ZIP_OK) {
-        do {
-          err = ZIP_OK;
-          size_read = (int)fread(buf, 1, size_buf, fin);
-          if (size_read < size_buf)
-            if (feof(fin) == 0)
-              err = ZIP_ERRNO;
-
-          if (size_read>0) {
-            err = zipWriteInFileInZip(zf, buf, size_read);
-          }
-        } while ((err == ZIP_OK) && (size_read>0));
-      }
-      if (fin)
-        fclose(fin);
-      if (err < 0)
-        err = ZIP_ERRNO;
-      else
-        err = zipCloseFileInZip(zf);
+  zlib_filefunc64_def ffunc;
+  FillMemoryFileFunc64(&ffunc, archive);
+  zipFile zf = zipOpen2_64("memory.zip", APPEND_STATUS_CREATE, NULL, &ffunc);
+  if (zf == NULL)
+    return ZIP_ERRNO;
+  int err = CompressEntries(zf, &entries, compressionLevel, password, threads,
+                            options, NULL, stats);
+  int close_err = zipClose(zf, NULL);
+  if (err == ZIP_OK)
+    err = close_err;
+  if (stats != NULL) {
+    stats->bytes_written = archive->size();
+    if (options.deterministic && err == ZIP_OK) {
+      Sha256 hash;
+      hash.Update(archive->data(), archive->size());
+      stats->content_hash = hash.HexDigest();
     }
   }
-  zipClose(zf, NULL);
-  free(buf);
   return err;
 }
 
 }  // namespace greenworks
-
@@ -19,9 +19,111 @@
 #ifndef GREENWORKS_ZIP_H_
 #define GREENWORKS_ZIP_H_
 
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
 namespace greenworks {
 
-int zip(const char* targetFile, const char* sourceDir, int compressionLevel, const char* password);
+class ArchiveJob;
+class MemoryBuffer;
+
+struct ZipOptions {
+  ZipOptions()
+      : threads(0), use_mmap(false), update(false), adaptive(true),
+        deterministic(false), job(NULL) {}
+
+  // The number of deflate threads; 0 uses one per core, 1 compresses on the
+  // calling thread only.
+  int threads;
+  // Whether the source files are memory-mapped rather than read with fread;
+  // files which can't be mapped are read anyway. Off by default: a file
+  // truncated by another process while it's mapped raises SIGBUS, which
+  // kills the whole process rather than failing the archiving.
+  bool use_mmap;
+  // Whether to update the archive at the target path instead of creating it
+  // anew: the entries whose file didn't change are copied without being
+  // recompressed.
+  bool update;
+  // Whether the entries which don't compress (by extension, by the entropy of
+  // their head, or by deflating a sample of them) are stored rather than
+  // deflated. Ignored at level 0.
+  bool adaptive;
+  // Whether the archive only depends on the content and names of the files:
+  // the entries are sorted by name and all dated 1980-01-01 00:00, and no
+  // entry is reused from the updated archive, whose compression parameters
+  // are unknown. Can't be combined with a password, since encryption
+  // headers are random. ZipStats::content_hash is set.
+  bool deterministic;
+  // Receives the progress and may cancel the archiving, which then fails
+  // with kArchiveCancelled and removes the partial archive. Not owned.
+  ArchiveJob* job;
+};
+
+// How an entry was written in the archive.
+enum ZipEntryClass {
+  kZipEntryDeflated,
+  // Stored because the compression level is 0.
+  kZipEntryStored,
+  // Stored because of a file extension of an already compressed format.
+  kZipEntryIncompressibleExtension,
+  // Stored because its head looks random.
+  kZipEntryIncompressibleEntropy,
+  // Stored because deflating a sample of it saved almost nothing.
+  kZipEntryIncompressibleTrial,
+  // Copied from the updated archive.
+  kZipEntryReused,
+  kZipEntryClassCount
+};
+
+struct ZipClassStats {
+  ZipClassStats() : entries(0), bytes_in(0), bytes_out(0) {}
+
+  unsigned long long entries;
+  // The uncompressed and compressed sizes of the entries, without headers.
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+};
+
+struct ZipStats {
+  ZipStats() : entries(0), reused_entries(0), bytes_read(0), bytes_written(0),
+               deflate_seconds(0), seconds_saved(0) {}
+
+  unsigned long long entries;
+  // The entries copied from the updated archive, rather than compressed.
+  unsigned long long reused_entries;
+  // The bytes read from the source files.
+  unsigned long long bytes_read;
+  // The size of the archive.
+  unsigned long long bytes_written;
+  // Indexed by ZipEntryClass.
+  ZipClassStats classes[kZipEntryClassCount];
+  // The CPU time spent deflating, summed over the threads.
+  double deflate_seconds;
+  // The CPU time deflating the stored incompressible entries would have
+  // taken, estimated from the deflate speed of the other entries.
+  double seconds_saved;
+  // The hexadecimal SHA-256 of the archive, for deterministic archives.
+  std::string content_hash;
+  // The paths, relative to the source directory, of what couldn't be
+  // archived: links to directories, dangling links, pipes, sockets and
+  // devices.
+  std::vector<std::string> skipped;
+};
+
+// The content of an entry of an archive built in memory.
+struct ZipBufferEntry {
+  std::string name;
+  const char* data;
+  size_t size;
+};
+
+int zip(const char* targetFile, const char* sourceDir, int compressionLevel, const char* password, const ZipOptions& options = ZipOptions(), ZipStats* stats = NULL);
+
+// Builds an archive of |entries| in |archive| rather than a file, without
+// any temporary file. The entries' names must be relative paths.
+int zip_buffers(const std::vector<ZipBufferEntry>& entries, int compressionLevel, const char* password, MemoryBuffer* archive, const ZipOptions& options = ZipOptions(), ZipStats* stats = NULL);
 
 }
 
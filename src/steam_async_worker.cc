@@ -27,6 +27,23 @@ void SteamAsyncWorker::HandleErrorCallback() {
   error_callback_->Call(1, argv);
 }
 
+SteamAsyncProgressWorker::SteamAsyncProgressWorker(
+    Nan::Callback* success_callback, Nan::Callback* error_callback)
+        : Nan::AsyncProgressWorker(success_callback),
+          error_callback_(error_callback) {
+}
+
+SteamAsyncProgressWorker::~SteamAsyncProgressWorker() {
+  delete error_callback_;
+}
+
+void SteamAsyncProgressWorker::HandleErrorCallback() {
+  if (!error_callback_) return;
+  Nan::HandleScope scope;
+  v8::Local<v8::Value> argv[] = { Nan::New(ErrorMessage()).ToLocalChecked() };
+  error_callback_->Call(1, argv);
+}
+
 SteamCallbackAsyncWorker::SteamCallbackAsyncWorker(
     Nan::Callback* success_callback, Nan::Callback* error_callback):
         SteamAsyncWorker(success_callback, error_callback),
@@ -24,6 +24,22 @@ class SteamAsyncWorker : public Nan::AsyncWorker {
   Nan::Callback* error_callback_;
 };
 
+// Extend Nan::AsyncProgressWorker with custom error callback supports, like
+// SteamAsyncWorker.
+class SteamAsyncProgressWorker : public Nan::AsyncProgressWorker {
+ public:
+  SteamAsyncProgressWorker(Nan::Callback* success_callback,
+                           Nan::Callback* error_callback);
+
+  ~SteamAsyncProgressWorker();
+
+  // Override Nan::AsyncWorker methods:
+  virtual void HandleErrorCallback();
+
+ protected:
+  Nan::Callback* error_callback_;
+};
+
 // An abstract SteamAsyncWorker for Steam callback API.
 class SteamCallbackAsyncWorker : public SteamAsyncWorker {
  public:
@@ -8,6 +8,8 @@
 
 #include "nan.h"
 
+#include "greenworks_cloud_cache.h"
+
 namespace greenworks {
 
 namespace {
@@ -93,6 +95,10 @@ void SteamClient::OnSteamServerConnectFailure(
 }
 
 void SteamClient::OnSteamShutdown(SteamShutdown_t* callback) {
+  // Steam is going away, write the pending cloud files while we still can.
+  int files_written = 0;
+  CloudFileStats stats;
+  CloudWriteCache::GetInstance()->Flush(true, &files_written, &stats);
   for (size_t i = 0; i < observer_list_.size(); ++i) {
     observer_list_[i]->OnSteamShutdown();
   }
@@ -0,0 +1,110 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+// Benchmarks Utils.createArchive and Utils.extractArchive with one thread
+// against one thread per core, each reading through memory mappings and
+// through fread, on two data sets:
+//   small: 10000 small files.
+//   large: a few multi-GB files (3 x 2048 MB by default).
+//
+// Usage: node test/benchmark/archive.js [small|large] [large_file_size_mb]
+
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var greenworks = require('../../greenworks');
+
+var SMALL_FILE_COUNT = 10000;
+var LARGE_FILE_COUNT = 3;
+
+function makeContent(size, seed) {
+  // Half-compressible content, like most game assets.
+  var buffer = Buffer.alloc(size);
+  var state = seed + 1;
+  for (var i = 0; i < size; i += 2) {
+    state = (state * 1103515245 + 12345) & 0x7fffffff;
+    buffer[i] = state & 0xff;
+    buffer[i + 1] = 0x20;
+  }
+  return buffer;
+}
+
+function createSmallFiles(dir) {
+  for (var i = 0; i < SMALL_FILE_COUNT; ++i) {
+    var sub_dir = path.join(dir, 'dir' + (i % 100));
+    if (!fs.existsSync(sub_dir))
+      fs.mkdirSync(sub_dir);
+    fs.writeFileSync(path.join(sub_dir, 'file' + i + '.txt'),
+                     makeContent(512 + (i % 64) * 64, i));
+  }
+}
+
+function createLargeFiles(dir, size_mb) {
+  // Write in 64 MB blocks to keep the memory flat.
+  var block = makeContent(64 * 1024 * 1024, 0);
+  for (var i = 0; i < LARGE_FILE_COUNT; ++i) {
+    var fd = fs.openSync(path.join(dir, 'large' + i + '.bin'), 'w');
+    for (var written = 0; written < size_mb; written += 64)
+      fs.writeSync(fd, block, 0, Math.min(64, size_mb - written) * 1024 * 1024);
+    fs.closeSync(fd);
+  }
+}
+
+function time(label, run, next) {
+  var start = process.hrtime();
+  run(function() {
+    var elapsed = process.hrtime(start);
+    console.log('  ' + label + ': ' +
+                (elapsed[0] + elapsed[1] / 1e9).toFixed(2) + 's');
+    next();
+  }, function(err) {
+    console.error('  ' + label + ' failed: ' + err);
+    process.exit(1);
+  });
+}
+
+function bench(name, source_dir, work_dir, done) {
+  var thread_counts = [1, os.cpus().length];
+  var runs = [];
+  thread_counts.forEach(function(threads) {
+    runs.push({ threads: threads, mmap: true });
+    runs.push({ threads: threads, mmap: false });
+  });
+  console.log(name + ' (' + thread_counts.join(' vs ') +
+              ' threads, mmap vs fread)');
+  var index = 0;
+  (function next() {
+    if (index >= runs.length)
+      return done();
+    var options = runs[index++];
+    var label = 'x' + options.threads + (options.mmap ? ' mmap' : ' fread');
+    var run_name = name + '-' + options.threads +
+        (options.mmap ? '-mmap' : '-fread');
+    var zip_file = path.join(work_dir, run_name + '.zip');
+    var extract_dir = path.join(work_dir, run_name);
+    fs.mkdirSync(extract_dir);
+    time('createArchive ' + label, function(success, error) {
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6, options,
+                                     success, error);
+    }, function() {
+      time('extractArchive ' + label, function(success, error) {
+        greenworks.Utils.extractArchive(zip_file, extract_dir, '', options,
+                                        success, error);
+      }, next);
+    });
+  })();
+}
+
+var data_set = process.argv[2] || 'small';
+var large_file_size_mb = parseInt(process.argv[3] || '2048', 10);
+var work_dir = fs.mkdtempSync(path.join(os.tmpdir(), 'greenworks-bench-'));
+var source_dir = path.join(work_dir, data_set);
+fs.mkdirSync(source_dir);
+if (data_set == 'large')
+  createLargeFiles(source_dir, large_file_size_mb);
+else
+  createSmallFiles(source_dir);
+bench(data_set, source_dir, work_dir, function() {
+  console.log('Results left in ' + work_dir);
+});
@@ -0,0 +1,44 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+// Benchmarks Utils.crc32, which the archive jobs and the cloud sync use,
+// against zlib's table-driven crc32 (the portable option), in GB/s over
+// buffers from 4 KB to 64 MB.
+//
+// Usage: node test/benchmark/crc32.js [total_mb]
+
+var crypto = require('crypto');
+var greenworks = require('../../greenworks');
+
+var SIZES = [4 * 1024, 64 * 1024, 1024 * 1024, 64 * 1024 * 1024];
+
+// How much each size hashes in total, so that small buffers get enough
+// iterations to time.
+var total_bytes = (parseInt(process.argv[2], 10) || 1024) * 1024 * 1024;
+
+function throughput(buffer, options) {
+  var iterations = Math.max(1, Math.round(total_bytes / buffer.length));
+  var crc = 0;
+  var start = process.hrtime();
+  for (var i = 0; i < iterations; ++i)
+    crc = greenworks.Utils.crc32(buffer, options);
+  var elapsed = process.hrtime(start);
+  var seconds = elapsed[0] + elapsed[1] / 1e9;
+  return { crc: crc, gbps: buffer.length * iterations / seconds / 1e9 };
+}
+
+console.log('Implementation: ' + greenworks.Utils.crc32Implementation());
+SIZES.forEach(function(size) {
+  var buffer = crypto.randomBytes(size);
+  var native = throughput(buffer, {});
+  var portable = throughput(buffer, { portable: true });
+  if (native.crc !== portable.crc) {
+    console.error('CRC mismatch at ' + size + ' bytes');
+    process.exit(1);
+  }
+  console.log('  ' + (size / 1024) + ' KB: ' +
+              native.gbps.toFixed(2) + ' GB/s vs zlib ' +
+              portable.gbps.toFixed(2) + ' GB/s (' +
+              (native.gbps / portable.gbps).toFixed(1) + 'x)');
+});
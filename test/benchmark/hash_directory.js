@@ -0,0 +1,61 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+// Benchmarks Utils.hashDirectory on 1 to 16 threads, in MB/s and speedup
+// over a single thread. A first untimed pass warms the page cache, so this
+// measures the hashing rather than the disk; drop the caches between runs
+// (or pass --cold to skip the warm-up) to measure an SSD.
+//
+// Usage: node test/benchmark/hash_directory.js dir [sha256|crc32] [--cold]
+
+var greenworks = require('../../greenworks');
+
+var THREADS = [1, 2, 4, 8, 16];
+
+var dir = process.argv[2];
+var algorithm = process.argv[3] && process.argv[3] != '--cold' ?
+    process.argv[3] : 'sha256';
+var cold = process.argv.indexOf('--cold') != -1;
+if (!dir) {
+  console.error('Usage: node hash_directory.js dir [sha256|crc32] [--cold]');
+  process.exit(1);
+}
+
+function hash(threads, callback) {
+  var start = process.hrtime();
+  greenworks.Utils.hashDirectory(dir, { algorithm: algorithm,
+                                        threads: threads },
+      function(manifest) {
+    var elapsed = process.hrtime(start);
+    var bytes = manifest.files.reduce(function(total, file) {
+      return total + file.size;
+    }, 0);
+    callback(elapsed[0] + elapsed[1] / 1e9, manifest.files.length, bytes);
+  }, function(err) {
+    console.error(err);
+    process.exit(1);
+  });
+}
+
+function run(index, single_thread_seconds) {
+  if (index == THREADS.length)
+    return;
+  hash(THREADS[index], function(seconds, files, bytes) {
+    if (index == 0) {
+      single_thread_seconds = seconds;
+      console.log(files + ' files, ' + (bytes / 1e6).toFixed(1) + ' MB, ' +
+                  algorithm);
+    }
+    console.log('  ' + THREADS[index] + ' threads: ' +
+                (bytes / 1e6 / seconds).toFixed(1) + ' MB/s, ' +
+                seconds.toFixed(3) + 's (' +
+                (single_thread_seconds / seconds).toFixed(1) + 'x)');
+    run(index + 1, single_thread_seconds);
+  });
+}
+
+if (cold)
+  run(0);
+else
+  hash(0, function() { run(0); });
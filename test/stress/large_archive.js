@@ -0,0 +1,127 @@
+// Copyright (c) 2017 Greenheart Games Pty. Ltd. All rights reserved.
+// Use of this source code is governed by the MIT license that can be
+// found in the LICENSE file.
+
+// Stresses the zip64 limits of the archive utilities: a sparse file past
+// 4 GB, more than 65535 entries, and a path longer than 256 bytes go through
+// createArchive, listArchive, verifyArchive and extractArchive, then the
+// extracted files are checked. Needs twice the file size in free disk space
+// (more when stored), and on Windows paths past MAX_PATH to be enabled.
+//
+// Usage: node test/stress/large_archive.js [size_gb] [compress_level]
+
+var assert = require('assert');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var greenworks = require('../../greenworks');
+
+var SMALL_FILE_COUNT = 70000;
+var DEEP_DIR_COUNT = 12;
+
+var size_gb = parseFloat(process.argv[2] || '5');
+var compress_level = parseInt(process.argv[3] || '1', 10);
+var huge_size = Math.floor(size_gb * 1024 * 1024 * 1024);
+// Data around the 4 GB boundary and at the end, in a file otherwise sparse.
+var markers = [0, 0xfffffff0, 0x100000010, huge_size - 16].filter(
+    function(offset) { return offset >= 0 && offset + 16 <= huge_size; });
+
+function markerAt(offset) {
+  var marker = Buffer.alloc(16, 0x2a);
+  marker.write(offset.toString(16));
+  return marker;
+}
+
+function createSourceFiles(dir) {
+  var fd = fs.openSync(path.join(dir, 'huge.bin'), 'w');
+  fs.ftruncateSync(fd, huge_size);
+  markers.forEach(function(offset) {
+    fs.writeSync(fd, markerAt(offset), 0, 16, offset);
+  });
+  fs.closeSync(fd);
+
+  fs.mkdirSync(path.join(dir, 'many'));
+  for (var i = 0; i < SMALL_FILE_COUNT; ++i) {
+    var sub_dir = path.join(dir, 'many', 'dir' + Math.floor(i / 1000));
+    if (i % 1000 == 0)
+      fs.mkdirSync(sub_dir);
+    fs.writeFileSync(path.join(sub_dir, 'file' + i), String(i));
+  }
+
+  var deep_dir = dir;
+  for (var j = 0; j < DEEP_DIR_COUNT; ++j) {
+    deep_dir = path.join(deep_dir, 'a_rather_long_directory_name_' + j);
+    fs.mkdirSync(deep_dir);
+  }
+  fs.writeFileSync(path.join(deep_dir, 'deep.txt'), 'deep');
+  return path.relative(dir, path.join(deep_dir, 'deep.txt'));
+}
+
+function checkExtracted(dir, deep_path) {
+  var huge_file = path.join(dir, 'huge.bin');
+  assert.equal(huge_size, fs.statSync(huge_file).size);
+  var fd = fs.openSync(huge_file, 'r');
+  var read = Buffer.alloc(16);
+  markers.forEach(function(offset) {
+    fs.readSync(fd, read, 0, 16, offset);
+    assert.ok(read.equals(markerAt(offset)), 'marker at ' + offset);
+  });
+  fs.closeSync(fd);
+  for (var i = 0; i < SMALL_FILE_COUNT; i += 997) {
+    assert.equal(String(i), fs.readFileSync(path.join(
+        dir, 'many', 'dir' + Math.floor(i / 1000), 'file' + i), 'utf8'));
+  }
+  assert.equal('deep', fs.readFileSync(path.join(dir, deep_path), 'utf8'));
+}
+
+function step(label, run, next) {
+  var start = process.hrtime();
+  run(function(result) {
+    var elapsed = process.hrtime(start);
+    console.log('  ' + label + ': ' +
+                (elapsed[0] + elapsed[1] / 1e9).toFixed(2) + 's');
+    next(result);
+  }, function(err) {
+    console.error('  ' + label + ' failed: ' + err);
+    process.exit(1);
+  });
+}
+
+var work_dir = fs.mkdtempSync(path.join(os.tmpdir(), 'greenworks-stress-'));
+var source_dir = path.join(work_dir, 'source');
+fs.mkdirSync(source_dir);
+var deep_path = createSourceFiles(source_dir);
+var entry_count = SMALL_FILE_COUNT + 2;
+var zip_file = path.join(work_dir, 'large.zip');
+var extract_dir = path.join(work_dir, 'extracted');
+fs.mkdirSync(extract_dir);
+
+console.log(size_gb + ' GB sparse file, ' + entry_count + ' entries, ' +
+            'level ' + compress_level);
+step('createArchive', function(success, error) {
+  greenworks.Utils.createArchive(zip_file, source_dir, '', compress_level,
+                                 {}, success, error);
+}, function(stats) {
+  assert.equal(entry_count, stats.entries);
+  step('listArchive', function(success, error) {
+    greenworks.Utils.listArchive(zip_file, success, error);
+  }, function(listing) {
+    assert.equal(entry_count, listing.count);
+    var huge_index = listing.names.indexOf('source/huge.bin');
+    assert.equal(huge_size, listing.uncompressedSizes[huge_index]);
+    assert.notEqual(-1, listing.names.indexOf(
+        'source/' + deep_path.split(path.sep).join('/')));
+    step('verifyArchive', function(success, error) {
+      greenworks.Utils.verifyArchive(zip_file, '', success, error);
+    }, function(corrupt) {
+      assert.deepEqual([], corrupt);
+      step('extractArchive', function(success, error) {
+        greenworks.Utils.extractArchive(zip_file, extract_dir, '', success,
+                                        error);
+      }, function() {
+        checkExtracted(path.join(extract_dir, 'source'), deep_path);
+        console.log('Passed; files left in ' + work_dir);
+      });
+    });
+  });
+});
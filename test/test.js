@@ -3,14 +3,42 @@
 // found in the LICENSE file.
 
 var assert = require("assert");
+var crypto = require('crypto');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
 var greenworks = require('../greenworks');
 
+var temp_dirs = [];
+
+// Returns a new directory, removed after the test.
+function makeTempDir() {
+  var dir = fs.mkdtempSync(path.join(os.tmpdir(), 'greenworks-'));
+  temp_dirs.push(dir);
+  return dir;
+}
+
+function removeTree(file) {
+  if (fs.lstatSync(file).isDirectory()) {
+    fs.readdirSync(file).forEach(function(name) {
+      removeTree(path.join(file, name));
+    });
+    fs.rmdirSync(file);
+  } else {
+    fs.unlinkSync(file);
+  }
+}
+
 describe('greenworks API', function() {
   if (!greenworks.initAPI()) {
     console.log('An error occured initializing Steam API.');
     process.exit(1);
   }
 
+  afterEach(function() {
+    temp_dirs.splice(0).forEach(removeTree);
+  });
+
   describe('saveTextToFile', function() {
     it('Should save successfully.', function(done) {
       greenworks.saveTextToFile('test_file.txt', 'test_content',
@@ -31,6 +59,105 @@ describe('greenworks API', function() {
     })
   });
 
+  describe('enableCloudCompression', function() {
+    it('Should read the compressed file back.', function(done) {
+      var content = new Array(200).join('compressible ');
+      greenworks.enableCloudCompression(true, 0);
+      greenworks.saveTextToFile('test_compressed_file.txt', content,
+          function(stats) {
+        assert(stats.storedBytes < stats.rawBytes);
+        greenworks.enableCloudCompression(false);
+        greenworks.readTextFromFile('test_compressed_file.txt',
+            function(message) {
+          assert.equal(content, message);
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+  });
+
+  describe('saveFilesToCloud', function() {
+    it('Should plan without writing on dry run.', function(done) {
+      // A name which isn't in Steam Cloud yet, so that nothing is released.
+      var file = path.join(makeTempDir(),
+                           'test_dry_run_' + Date.now() + '.txt');
+      fs.writeFileSync(file, 'dry run');
+      greenworks.saveFilesToCloud([file], { dryRun: true },
+          function(stats, plan) {
+        assert.equal(stats.storedBytes, plan.neededBytes);
+        assert(Array.isArray(plan.evictions));
+        done();
+      }, function(err) { throw err; });
+    });
+  });
+
+  describe('syncCloudDirectory', function() {
+    it('Should upload the new files only once.', function(done) {
+      var dir = makeTempDir();
+      fs.writeFileSync(path.join(dir, 'test_synced_file.txt'), 'content');
+      greenworks.syncCloudDirectory(dir, { direction: 'upload' },
+          function(result) {
+        assert.deepEqual(['test_synced_file.txt'], result.uploaded);
+        greenworks.syncCloudDirectory(dir, function(result) {
+          assert.equal(0, result.uploaded.length);
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should delete from the cloud the files deleted locally.',
+        function(done) {
+      var dir = makeTempDir();
+      var file = path.join(dir, 'test_deleted_file.txt');
+      fs.writeFileSync(file, 'content');
+      greenworks.syncCloudDirectory(dir, function() {
+        fs.unlinkSync(file);
+        greenworks.syncCloudDirectory(dir, function(result) {
+          assert.deepEqual(['test_deleted_file.txt'], result.deletedFromCloud);
+          assert.equal(0, result.downloaded.length);
+          assert.ok(!fs.existsSync(file));
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should skip cloud files outside the directory.', function(done) {
+      var dir = makeTempDir();
+      var local_dir = path.join(dir, 'local');
+      fs.mkdirSync(local_dir);
+      var sync = function() {
+        greenworks.syncCloudDirectory(local_dir, { direction: 'download' },
+            function(result) {
+          assert.equal(-1,
+                       result.downloaded.indexOf('../test_escaped_file.txt'));
+          assert.ok(!fs.existsSync(path.join(dir, 'test_escaped_file.txt')));
+          done();
+        }, function(err) { throw err; });
+      };
+      // Steam Cloud may refuse the name itself, which is as good.
+      greenworks.saveTextToFile('../test_escaped_file.txt', 'escaped', sync,
+                                sync);
+    });
+  });
+
+  describe('setCloudWriteDelay&flushCloud', function() {
+    it('Should serve and flush the cached writes.', function(done) {
+      greenworks.setCloudWriteDelay(1000);
+      greenworks.saveTextToFile('test_cached_file.txt', 'first', function() {
+        greenworks.saveTextToFile('test_cached_file.txt', 'last', function() {
+          greenworks.readTextFromFile('test_cached_file.txt', function(message) {
+            assert.equal('last', message);
+            greenworks.flushCloud(function(files_written) {
+              assert.equal(1, files_written);
+              greenworks.setCloudWriteDelay(0);
+              done();
+            }, function(err) { throw err; });
+          }, function(err) { throw err; });
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+  });
+
   describe('enableCloud&isCloudEnabled', function() {
     it('', function() {
        greenworks.enableCloud(false);
@@ -97,4 +224,598 @@ describe('greenworks API', function() {
       done();
     });
   });
+
+  describe('createArchive&extractArchive', function() {
+    it('Should round-trip with parallel compression', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      var content = new Array(300000).join('greenworks ');
+      fs.writeFileSync(path.join(source_dir, 'large.txt'), content);
+      var zip_file = path.join(dir, 'test.zip');
+      fs.mkdirSync(path.join(dir, 'out'));
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6,
+          { threads: 4 }, function() {
+        greenworks.Utils.extractArchive(zip_file, path.join(dir, 'out'), '',
+            function() {
+          assert.equal(content, fs.readFileSync(
+              path.join(dir, 'out', 'source', 'large.txt'), 'utf8'));
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should report the entries it skips', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      fs.writeFileSync(path.join(source_dir, 'file.txt'), 'content');
+      fs.symlinkSync(path.join(dir, 'missing'),
+                     path.join(source_dir, 'dangling'));
+      var zip_file = path.join(dir, 'test.zip');
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6,
+          function(stats) {
+        assert.equal(1, stats.entries);
+        assert.deepEqual(['dangling'], stats.skipped);
+        done();
+      }, function(err) { throw err; });
+    });
+
+    it('Should extract concurrently', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      fs.writeFileSync(path.join(source_dir, 'file.txt'), 'content');
+      var zip_file = path.join(dir, 'test.zip');
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6, function() {
+        var pending = 4;
+        for (var i = 0; i < 4; ++i) {
+          var out_dir = path.join(dir, 'out' + i);
+          fs.mkdirSync(out_dir);
+          greenworks.Utils.extractArchive(zip_file, out_dir, '', function() {
+            if (--pending == 0) {
+              for (var j = 0; j < 4; ++j) {
+                assert.equal('content', fs.readFileSync(path.join(
+                    dir, 'out' + j, 'source', 'file.txt'), 'utf8'));
+              }
+              done();
+            }
+          }, function(err) { throw err; });
+        }
+      }, function(err) { throw err; });
+    });
+
+    it('Should reject entries outside the extract directory', function(done) {
+      // createArchive refuses such names, so the archives are built by hand:
+      // a stored entry, then one escaping the extract directory.
+      var storedZip = function(names) {
+        var locals = [];
+        var centrals = [];
+        var offset = 0;
+        names.forEach(function(name) {
+          var content = Buffer.from('escaped');
+          var file_name = Buffer.from(name);
+          var header = Buffer.alloc(30);
+          header.writeUInt32LE(0x04034b50, 0);
+          header.writeUInt16LE(20, 4);
+          header.writeUInt32LE(greenworks.Utils.crc32(content), 14);
+          header.writeUInt32LE(content.length, 18);
+          header.writeUInt32LE(content.length, 22);
+          header.writeUInt16LE(file_name.length, 26);
+          var central = Buffer.alloc(46);
+          central.writeUInt32LE(0x02014b50, 0);
+          central.writeUInt16LE(20, 4);
+          central.writeUInt16LE(20, 6);
+          header.copy(central, 16, 14, 26);
+          central.writeUInt16LE(file_name.length, 28);
+          central.writeUInt32LE(offset, 42);
+          locals.push(header, file_name, content);
+          centrals.push(central, file_name);
+          offset += header.length + file_name.length + content.length;
+        });
+        var directory = Buffer.concat(centrals);
+        var end = Buffer.alloc(22);
+        end.writeUInt32LE(0x06054b50, 0);
+        end.writeUInt16LE(names.length, 8);
+        end.writeUInt16LE(names.length, 10);
+        end.writeUInt32LE(directory.length, 12);
+        end.writeUInt32LE(offset, 16);
+        return Buffer.concat(locals.concat([directory, end]));
+      };
+      var dir = makeTempDir();
+      var absolute_file = path.join(dir, 'absolute.txt');
+      var names = ['../escape.txt', absolute_file.replace(/\\/g, '/')];
+      var extractNext = function() {
+        if (names.length == 0) {
+          done();
+          return;
+        }
+        var zip_file = path.join(dir, 'test.zip');
+        var out_dir = path.join(dir, 'out');
+        fs.writeFileSync(zip_file, storedZip(['kept.txt', names.shift()]));
+        fs.mkdirSync(out_dir);
+        greenworks.Utils.extractArchive(zip_file, out_dir, '', function() {
+          throw new Error('The archive shouldn\'t be extracted.');
+        }, function(err) {
+          assert.ok(err);
+          assert.deepEqual([], fs.readdirSync(out_dir));
+          assert.ok(!fs.existsSync(path.join(dir, 'escape.txt')));
+          assert.ok(!fs.existsSync(absolute_file));
+          fs.rmdirSync(out_dir);
+          extractNext();
+        });
+      };
+      extractNext();
+    });
+
+    it('Should produce the same archive with and without mmap',
+        function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      var content = new Array(300000).join('mapped ');
+      fs.writeFileSync(path.join(source_dir, 'large.txt'), content);
+      fs.writeFileSync(path.join(source_dir, 'empty.txt'), '');
+      var mapped_zip = path.join(dir, 'mapped.zip');
+      var read_zip = path.join(dir, 'read.zip');
+      fs.mkdirSync(path.join(dir, 'out'));
+      greenworks.Utils.createArchive(mapped_zip, source_dir, '', 6,
+          { mmap: true }, function() {
+        greenworks.Utils.createArchive(read_zip, source_dir, '', 6,
+            { mmap: false }, function() {
+          assert.ok(fs.readFileSync(mapped_zip).equals(
+              fs.readFileSync(read_zip)));
+          greenworks.Utils.extractArchive(mapped_zip, path.join(dir, 'out'),
+              '', { mmap: true }, function() {
+            assert.equal(content, fs.readFileSync(
+                path.join(dir, 'out', 'source', 'large.txt'), 'utf8'));
+            done();
+          }, function(err) { throw err; });
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should report progress and cancel', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      var content = new Array(300000).join('progress ');
+      for (var i = 0; i < 8; ++i)
+        fs.writeFileSync(path.join(source_dir, 'file' + i + '.txt'), content);
+      var zip_file = path.join(dir, 'test.zip');
+      var last_progress = null;
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6,
+          { progress: function(progress) { last_progress = progress; },
+            progressInterval: 0 }, function() {
+        assert.ok(last_progress);
+        assert.equal(8, last_progress.totalEntries);
+        assert.equal(8 * content.length, last_progress.totalBytes);
+        var cancelled_zip = path.join(dir, 'cancelled.zip');
+        var job_id = greenworks.Utils.createArchive(cancelled_zip, source_dir,
+            '', 9, { threads: 1 }, function() {
+          throw new Error('The job should be cancelled.');
+        }, function(err) {
+          assert.equal('Archive job cancelled.', err);
+          assert.ok(!fs.existsSync(cancelled_zip));
+          done();
+        });
+        assert.ok(greenworks.Utils.cancelArchive(job_id));
+      }, function(err) { throw err; });
+    });
+
+    it('Should fail on a missing source directory', function(done) {
+      var dir = makeTempDir();
+      greenworks.Utils.createArchive(path.join(dir, 'test.zip'),
+          path.join(dir, 'missing'), '', 6, function() {
+        throw new Error('The archive shouldn\'t be created.');
+      }, function(err) {
+        assert.ok(err);
+        done();
+      });
+    });
+
+    it('Should store incompressible files', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      var random = crypto.randomBytes(256 * 1024);
+      fs.writeFileSync(path.join(source_dir, 'random.bin'), random);
+      fs.writeFileSync(path.join(source_dir, 'image.png'), 'not a png');
+      fs.writeFileSync(path.join(source_dir, 'text.txt'),
+                       new Array(10000).join('text '));
+      var zip_file = path.join(dir, 'test.zip');
+      fs.mkdirSync(path.join(dir, 'out'));
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6,
+          function(stats) {
+        assert.equal(1, stats.classes.deflated.entries);
+        assert.ok(stats.classes.deflated.ratio < 0.1);
+        assert.equal(1, stats.classes.incompressibleExtension.entries);
+        assert.equal(1, stats.classes.incompressibleEntropy.entries);
+        assert.equal(random.length,
+                     stats.classes.incompressibleEntropy.bytesOut);
+        greenworks.Utils.extractArchive(zip_file, path.join(dir, 'out'), '',
+            function() {
+          assert.ok(random.equals(fs.readFileSync(
+              path.join(dir, 'out', 'source', 'random.bin'))));
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should produce identical deterministic archives', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      fs.writeFileSync(path.join(source_dir, 'b.txt'),
+                       new Array(300000).join('deterministic '));
+      fs.writeFileSync(path.join(source_dir, 'a.txt'), 'a');
+      var first_zip = path.join(dir, 'first.zip');
+      var second_zip = path.join(dir, 'second.zip');
+      greenworks.Utils.createArchive(first_zip, source_dir, '', 6,
+          { deterministic: true, threads: 4 }, function(first_stats) {
+        var date = new Date(2000, 0, 1);
+        fs.utimesSync(path.join(source_dir, 'a.txt'), date, date);
+        greenworks.Utils.createArchive(second_zip, source_dir, '', 6,
+            { deterministic: true, threads: 1 }, function(second_stats) {
+          var archive = fs.readFileSync(first_zip);
+          assert.ok(archive.equals(fs.readFileSync(second_zip)));
+          assert.equal(first_stats.contentHash, second_stats.contentHash);
+          assert.equal(crypto.createHash('sha256').update(archive)
+                           .digest('hex'), first_stats.contentHash);
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should only recompress changed files on update', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      fs.writeFileSync(path.join(source_dir, 'unchanged.txt'), 'unchanged');
+      fs.writeFileSync(path.join(source_dir, 'changed.txt'), 'before');
+      var zip_file = path.join(dir, 'test.zip');
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6, function() {
+        fs.writeFileSync(path.join(source_dir, 'changed.txt'), 'after!');
+        greenworks.Utils.updateArchive(zip_file, source_dir, '', 6,
+            function(stats) {
+          assert.equal(2, stats.entries);
+          assert.equal(1, stats.reusedEntries);
+          assert.equal(1, stats.compressedEntries);
+          var out_dir = path.join(dir, 'out');
+          fs.mkdirSync(out_dir);
+          greenworks.Utils.extractArchive(zip_file, out_dir, '', function() {
+            assert.equal('unchanged', fs.readFileSync(
+                path.join(out_dir, 'source', 'unchanged.txt'), 'utf8'));
+            assert.equal('after!', fs.readFileSync(
+                path.join(out_dir, 'source', 'changed.txt'), 'utf8'));
+            done();
+          }, function(err) { throw err; });
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should list an archive and save its index', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      fs.writeFileSync(path.join(source_dir, 'file.txt'), 'content');
+      var zip_file = path.join(dir, 'test.zip');
+      var index_file = path.join(dir, 'test.zip.index');
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6, function() {
+        greenworks.Utils.listArchive(zip_file, { index: index_file },
+            function(listing) {
+          assert.equal(1, listing.count);
+          assert.equal('source/file.txt', listing.names[0]);
+          assert.equal(7, listing.uncompressedSizes[0]);
+          assert.ok(listing.crcs instanceof Uint32Array);
+          assert.ok(!listing.fromIndex);
+          greenworks.Utils.listArchive(zip_file, { index: index_file },
+              function(indexed) {
+            assert.ok(indexed.fromIndex);
+            assert.deepEqual(listing.names, indexed.names);
+            assert.equal(listing.crcs[0], indexed.crcs[0]);
+            done();
+          }, function(err) { throw err; });
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should write encrypted entries in a single pass', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      // Past 16 MiB, the encrypted data is held in a temporary file.
+      var contents = {
+        'source/small.txt': Buffer.from('content'),
+        'source/large.bin': crypto.randomBytes(17 * 1024 * 1024)
+      };
+      fs.writeFileSync(path.join(source_dir, 'small.txt'),
+                       contents['source/small.txt']);
+      fs.writeFileSync(path.join(source_dir, 'large.bin'),
+                       contents['source/large.bin']);
+      var zip_file = path.join(dir, 'test.zip');
+      greenworks.Utils.createArchive(zip_file, source_dir, 'secret', 6,
+          function() {
+        greenworks.Utils.listArchive(zip_file, function(listing) {
+          assert.equal(2, listing.count);
+          var archive = fs.readFileSync(zip_file);
+          for (var i = 0; i < listing.count; ++i) {
+            var content = contents[listing.names[i]];
+            assert.equal(greenworks.Utils.crc32(content), listing.crcs[i]);
+            assert.equal(content.length, listing.uncompressedSizes[i]);
+            // The local header has the encryption flag, and the CRC and
+            // sizes of the central directory record.
+            var central = listing.offsets[i];
+            var local = archive.readUInt32LE(central + 42);
+            assert.equal(0x04034b50, archive.readUInt32LE(local));
+            assert.equal(1, archive.readUInt16LE(central + 8) & 1);
+            assert.equal(1, archive.readUInt16LE(local + 6) & 1);
+            assert.equal(listing.crcs[i], archive.readUInt32LE(local + 14));
+            assert.equal(listing.compressedSizes[i],
+                         archive.readUInt32LE(local + 18));
+          }
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should extract and read selected entries', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      fs.mkdirSync(path.join(source_dir, 'data'));
+      fs.writeFileSync(path.join(source_dir, 'manifest.json'), '{}');
+      fs.writeFileSync(path.join(source_dir, 'data', 'a.json'), '[]');
+      fs.writeFileSync(path.join(source_dir, 'data', 'b.bin'), 'binary');
+      var zip_file = path.join(dir, 'test.zip');
+      var out_dir = path.join(dir, 'out');
+      fs.mkdirSync(out_dir);
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 6, function() {
+        greenworks.Utils.extractEntries(zip_file, ['source/**/*.json'],
+            out_dir, '', function(count) {
+          assert.equal(2, count);
+          assert.ok(fs.existsSync(
+              path.join(out_dir, 'source', 'data', 'a.json')));
+          assert.ok(!fs.existsSync(
+              path.join(out_dir, 'source', 'data', 'b.bin')));
+          greenworks.Utils.readArchiveEntry(zip_file, 'source/data/b.bin',
+              '', function(content) {
+            assert.equal('binary', content.toString());
+            done();
+          }, function(err) { throw err; });
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should create an archive from Buffers', function(done) {
+      var dir = makeTempDir();
+      var entries = [
+        { name: 'saves/slot1.json', content: Buffer.from('{"level":3}') },
+        { name: 'empty', content: Buffer.alloc(0) }
+      ];
+      greenworks.Utils.createArchiveFromBuffers(entries, '', 6,
+          function(archive, stats) {
+        assert.ok(Buffer.isBuffer(archive));
+        assert.equal(2, stats.entries);
+        assert.equal(archive.length, stats.bytesWritten);
+        var zip_file = path.join(dir, 'test.zip');
+        fs.writeFileSync(zip_file, archive);
+        greenworks.Utils.readArchiveEntry(zip_file, 'saves/slot1.json', '',
+            function(content) {
+          assert.equal('{"level":3}', content.toString());
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should extract an archive from a Buffer', function(done) {
+      var dir = makeTempDir();
+      var content = new Array(300000).join('buffer ');
+      var entries = [
+        { name: 'saves/slot1.json', content: Buffer.from('{"level":3}') },
+        { name: 'large.txt', content: Buffer.from(content) }
+      ];
+      greenworks.Utils.createArchiveFromBuffers(entries, '', 6,
+          function(archive) {
+        greenworks.Utils.readArchiveFromBuffer(archive, '', function(read) {
+          assert.equal(2, read.length);
+          assert.equal('saves/slot1.json', read[0].name);
+          assert.equal('{"level":3}', read[0].content.toString());
+          assert.equal(content, read[1].content.toString());
+          greenworks.Utils.extractArchiveFromBuffer(archive, dir, '',
+              { threads: 2 }, function() {
+            assert.equal(content, fs.readFileSync(path.join(dir, 'large.txt'),
+                                                  'utf8'));
+            done();
+          }, function(err) { throw err; });
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should extract the last of the entries with the same name',
+        function(done) {
+      var dir = makeTempDir();
+      var first = new Array(300000).join('first ');
+      var entries = [
+        { name: 'a.bin', content: Buffer.from(first) },
+        { name: './a.bin', content: Buffer.from('last') }
+      ];
+      greenworks.Utils.createArchiveFromBuffers(entries, '', 6,
+          function(archive) {
+        greenworks.Utils.extractArchiveFromBuffer(archive, dir, '',
+            { threads: 2 }, function() {
+          assert.equal('last', fs.readFileSync(path.join(dir, 'a.bin'),
+                                               'utf8'));
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should report corrupt entries on verify', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      fs.writeFileSync(path.join(source_dir, 'intact.txt'), 'intact');
+      fs.writeFileSync(path.join(source_dir, 'damaged.txt'), 'payload');
+      var zip_file = path.join(dir, 'test.zip');
+      // Stored, so that the content can be found in the archive.
+      greenworks.Utils.createArchive(zip_file, source_dir, '', 0, function() {
+        greenworks.Utils.verifyArchive(zip_file, '', { threads: 2 },
+            function(corrupt) {
+          assert.equal(0, corrupt.length);
+          var archive = fs.readFileSync(zip_file);
+          archive[archive.indexOf('payload', 0, 'utf8')] ^= 0xff;
+          fs.writeFileSync(zip_file, archive);
+          greenworks.Utils.verifyArchive(zip_file, '', function(corrupt) {
+            assert.deepEqual([{ name: 'source/damaged.txt',
+                                error: 'CRC mismatch' }], corrupt);
+            done();
+          }, function(err) { throw err; });
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should copy and move a directory', function(done) {
+      var dir = makeTempDir();
+      var source_dir = path.join(dir, 'source');
+      fs.mkdirSync(source_dir);
+      fs.mkdirSync(path.join(source_dir, 'empty'));
+      fs.mkdirSync(path.join(source_dir, 'data'));
+      var content = new Array(300000).join('copy ');
+      fs.writeFileSync(path.join(source_dir, 'data', 'large.txt'), content);
+      // With milliseconds, which the copy keeps.
+      var time = new Date(2017, 0, 1, 0, 0, 0, 500);
+      fs.utimesSync(path.join(source_dir, 'data', 'large.txt'), time, time);
+      var copy_dir = path.join(dir, 'copy');
+      var moved_dir = path.join(dir, 'moved', 'copy');
+      greenworks.Utils.copyDirectory(source_dir, copy_dir, { threads: 2 },
+          function() {
+        var copied = path.join(copy_dir, 'data', 'large.txt');
+        assert.equal(content, fs.readFileSync(copied, 'utf8'));
+        assert.equal(time.getTime(), fs.statSync(copied).mtime.getTime());
+        assert.ok(fs.statSync(path.join(copy_dir, 'empty')).isDirectory());
+        greenworks.Utils.moveDirectory(copy_dir, moved_dir, function() {
+          assert.ok(!fs.existsSync(copy_dir));
+          assert.equal(content, fs.readFileSync(
+              path.join(moved_dir, 'data', 'large.txt'), 'utf8'));
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should hash a directory and diff manifests', function(done) {
+      var dir = makeTempDir();
+      fs.mkdirSync(path.join(dir, 'data'));
+      fs.writeFileSync(path.join(dir, 'data', 'kept.txt'), 'kept');
+      fs.writeFileSync(path.join(dir, 'changed.txt'), 'before');
+      fs.writeFileSync(path.join(dir, 'removed.txt'), 'removed');
+      greenworks.Utils.hashDirectory(dir, { threads: 2 }, function(before) {
+        assert.equal('sha256', before.algorithm);
+        assert.deepEqual(['changed.txt', 'data/kept.txt', 'removed.txt'],
+                         before.files.map(function(file) {
+                           return file.path;
+                         }));
+        assert.equal(crypto.createHash('sha256').update('kept')
+                         .digest('hex'), before.files[1].hash);
+        fs.writeFileSync(path.join(dir, 'changed.txt'), 'after!');
+        fs.unlinkSync(path.join(dir, 'removed.txt'));
+        fs.writeFileSync(path.join(dir, 'added.txt'), 'added');
+        greenworks.Utils.hashDirectory(dir, function(after) {
+          assert.deepEqual({
+            added: ['added.txt'],
+            removed: ['removed.txt'],
+            modified: ['changed.txt']
+          }, greenworks.Utils.diffManifests(before, after));
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should create and apply patches', function(done) {
+      var dir = makeTempDir();
+      var old_dir = path.join(dir, 'old');
+      var new_dir = path.join(dir, 'new');
+      fs.mkdirSync(old_dir);
+      fs.mkdirSync(new_dir);
+      var content = crypto.randomBytes(1024 * 1024);
+      var changed = Buffer.concat([content.slice(0, 1000),
+                                   Buffer.from('changed'),
+                                   content.slice(2000)]);
+      fs.writeFileSync(path.join(old_dir, 'data.bin'), content);
+      fs.writeFileSync(path.join(new_dir, 'data.bin'), changed);
+      fs.writeFileSync(path.join(old_dir, 'removed.txt'), 'removed');
+      fs.writeFileSync(path.join(new_dir, 'added.txt'), 'added');
+      fs.chmodSync(path.join(new_dir, 'added.txt'), 0o750);
+      var patch_file = path.join(dir, 'data.patch');
+      greenworks.Utils.createPatch(path.join(old_dir, 'data.bin'),
+          path.join(new_dir, 'data.bin'), patch_file, function(stats) {
+        assert.ok(stats.patchSize < 10000);
+        assert.equal(changed.length, stats.copiedBytes + stats.insertedBytes);
+        var patched = path.join(dir, 'patched.bin');
+        greenworks.Utils.applyPatch(path.join(old_dir, 'data.bin'),
+            patch_file, patched, function() {
+          assert.ok(changed.equals(fs.readFileSync(patched)));
+          var dir_patch = path.join(dir, 'dir.patch');
+          greenworks.Utils.createDirectoryPatch(old_dir, new_dir, dir_patch,
+              function(dir_stats) {
+            assert.equal(3, dir_stats.files);
+            greenworks.Utils.applyDirectoryPatch(old_dir, dir_patch,
+                function() {
+              assert.ok(changed.equals(
+                  fs.readFileSync(path.join(old_dir, 'data.bin'))));
+              assert.equal('added', fs.readFileSync(
+                  path.join(old_dir, 'added.txt'), 'utf8'));
+              if (process.platform != 'win32') {
+                assert.equal(0o750, fs.statSync(
+                    path.join(old_dir, 'added.txt')).mode & 0o777);
+              }
+              assert.ok(!fs.existsSync(path.join(old_dir, 'removed.txt')));
+              done();
+            }, function(err) { throw err; });
+          }, function(err) { throw err; });
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should patch files into directories and back', function(done) {
+      var dir = makeTempDir();
+      var old_dir = path.join(dir, 'old');
+      var new_dir = path.join(dir, 'new');
+      fs.mkdirSync(old_dir);
+      fs.mkdirSync(path.join(old_dir, 'dir'));
+      fs.mkdirSync(new_dir);
+      fs.mkdirSync(path.join(new_dir, 'file'));
+      fs.writeFileSync(path.join(old_dir, 'file'), 'file');
+      fs.writeFileSync(path.join(old_dir, 'dir', 'inner'), 'inner');
+      fs.writeFileSync(path.join(new_dir, 'file', 'inner'), 'new inner');
+      fs.writeFileSync(path.join(new_dir, 'dir'), 'new file');
+      var dir_patch = path.join(dir, 'dir.patch');
+      greenworks.Utils.createDirectoryPatch(old_dir, new_dir, dir_patch,
+          function() {
+        greenworks.Utils.applyDirectoryPatch(old_dir, dir_patch, function() {
+          assert.equal('new inner', fs.readFileSync(
+              path.join(old_dir, 'file', 'inner'), 'utf8'));
+          assert.equal('new file', fs.readFileSync(
+              path.join(old_dir, 'dir'), 'utf8'));
+          assert.deepEqual(['dir', 'file'], fs.readdirSync(old_dir).sort());
+          done();
+        }, function(err) { throw err; });
+      }, function(err) { throw err; });
+    });
+
+    it('Should compute CRC-32 like zlib', function() {
+      var text = Buffer.from('The quick brown fox jumps over the lazy dog');
+      assert.equal(0x414fa339, greenworks.Utils.crc32(text));
+      assert.equal(0x414fa339, greenworks.Utils.crc32(text.slice(20),
+          { crc: greenworks.Utils.crc32(text.slice(0, 20)) }));
+      assert.equal(0, greenworks.Utils.crc32(Buffer.alloc(0)));
+      // Odd sizes and offsets go through both the SIMD loop and the tail.
+      var random = crypto.randomBytes(70000);
+      [1, 63, 64, 65, 1023, 4097, 69999].forEach(function(size) {
+        var slice = random.slice(1, size + 1);
+        assert.equal(greenworks.Utils.crc32(slice, { portable: true }),
+                     greenworks.Utils.crc32(slice));
+      });
+    });
+  });
 });